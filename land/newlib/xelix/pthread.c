@@ -0,0 +1,994 @@
+/* Copyright © 2026 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* POSIX threads on top of the kernel's clone, futex and TLS syscalls.
+ *
+ * Every thread is a kernel task sharing the address space, file descriptors
+ * and signal handlers of the process. %gs points to the struct __pthread of
+ * the current thread, with a pointer to itself as first member. Until the
+ * first thread is created, there is no TLS and pthread_self returns the
+ * static main thread.
+ *
+ * Locks are futexes with the states 0 (unlocked), 1 (locked) and 2 (locked
+ * with waiters), so they only enter the kernel when contended.
+ *
+ * errno and the newlib reentrancy structure are still shared by all threads.
+ */
+
+#include <pthread.h>
+#include <sys/lock.h>
+#include <sys/xelix.h>
+#include <sys/time.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+
+#define DEFAULT_STACK_SIZE 0x40000
+
+enum {
+	JOINABLE,
+	DETACHED,
+	EXITED,
+};
+
+struct __pthread {
+	// Needs to stay first, pthread_self reads it through %gs
+	struct __pthread* self;
+
+	// Set to 0 and woken by the kernel once the thread is gone
+	volatile int running;
+
+	// Kernel task ID, 0 until clone has returned
+	volatile int tid;
+	volatile int state;
+
+	void* (*start)(void*);
+	void* arg;
+	void* result;
+
+	// Allocated stack, NULL if the stack is provided by the caller
+	void* stack;
+
+	struct _pthread_cleanup* cleanup;
+	const void* specific[PTHREAD_KEYS_MAX];
+
+	// Detached threads that exited, freed once the kernel is done with them
+	struct __pthread* reap_next;
+};
+
+static struct __pthread main_thread = {
+	.self = &main_thread,
+	.running = 1,
+};
+
+static bool threaded = false;
+
+// Threads other than the main thread, pthread_exit in main waits for them
+static volatile int live_threads = 0;
+
+__LOCK_INIT(static, reap_lock);
+static struct __pthread* reap_list = NULL;
+
+__LOCK_INIT(static, key_lock);
+static bool key_used[PTHREAD_KEYS_MAX];
+static void (*key_destructors[PTHREAD_KEYS_MAX])(void*);
+
+static void lock_wait(volatile int* lock) {
+	// Mark the lock as contended so the unlock knows it has to wake us
+	while(__sync_lock_test_and_set(lock, 2)) {
+		__xelix_futex_wait(lock, 2, -1);
+	}
+}
+
+static inline void futex_lock(volatile int* lock) {
+	if(__sync_val_compare_and_swap(lock, 0, 1)) {
+		lock_wait(lock);
+	}
+}
+
+static inline void futex_unlock(volatile int* lock) {
+	if(__sync_lock_test_and_set(lock, 0) == 2) {
+		__xelix_futex_wake(lock, 1);
+	}
+}
+
+// Milliseconds left until abstime. There is no monotonic clock, so always realtime.
+static int timeout_ms(const struct timespec* abstime) {
+	struct timeval now;
+	gettimeofday(&now, NULL);
+
+	long long ms = (abstime->tv_sec - now.tv_sec) * 1000LL
+		+ abstime->tv_nsec / 1000000 - now.tv_usec / 1000;
+	if(ms < 0) {
+		return 0;
+	}
+	return ms > INT_MAX ? INT_MAX : ms;
+}
+
+// Locks used by newlib internally, see sys/lock.h
+void __xelix_lock_acquire(struct __xelix_lock* lock) {
+	futex_lock(&lock->lock);
+}
+
+int __xelix_lock_try_acquire(struct __xelix_lock* lock) {
+	return __sync_val_compare_and_swap(&lock->lock, 0, 1) ? -1 : 0;
+}
+
+void __xelix_lock_release(struct __xelix_lock* lock) {
+	futex_unlock(&lock->lock);
+}
+
+void __xelix_lock_acquire_recursive(struct __xelix_lock* lock) {
+	pthread_t self = pthread_self();
+	if(lock->owner != self) {
+		futex_lock(&lock->lock);
+		lock->owner = self;
+	}
+	lock->count++;
+}
+
+int __xelix_lock_try_acquire_recursive(struct __xelix_lock* lock) {
+	pthread_t self = pthread_self();
+	if(lock->owner != self) {
+		if(__xelix_lock_try_acquire(lock)) {
+			return -1;
+		}
+		lock->owner = self;
+	}
+	lock->count++;
+	return 0;
+}
+
+void __xelix_lock_release_recursive(struct __xelix_lock* lock) {
+	if(lock->owner != pthread_self() || --lock->count) {
+		return;
+	}
+
+	lock->owner = NULL;
+	futex_unlock(&lock->lock);
+}
+
+pthread_t pthread_self(void) {
+	if(!threaded) {
+		return &main_thread;
+	}
+
+	pthread_t self;
+	asm volatile("mov %%gs:0, %0" : "=r"(self));
+	return self;
+}
+
+int pthread_equal(pthread_t t1, pthread_t t2) {
+	return t1 == t2;
+}
+
+static void free_thread(struct __pthread* thread) {
+	free(thread->stack);
+	free(thread);
+}
+
+static void reap_add(struct __pthread* thread) {
+	__lock_acquire(reap_lock);
+	thread->reap_next = reap_list;
+	reap_list = thread;
+	__lock_release(reap_lock);
+}
+
+// Free detached threads that have fully exited
+static void reap(void) {
+	if(!reap_list) {
+		return;
+	}
+
+	__lock_acquire(reap_lock);
+	struct __pthread** pos = &reap_list;
+	while(*pos) {
+		struct __pthread* thread = *pos;
+		if(thread->running || !thread->tid) {
+			pos = &thread->reap_next;
+			continue;
+		}
+
+		*pos = thread->reap_next;
+		free_thread(thread);
+	}
+	__lock_release(reap_lock);
+}
+
+static void run_destructors(struct __pthread* self) {
+	for(int i = 0; i < PTHREAD_DESTRUCTOR_ITERATIONS; i++) {
+		bool called = false;
+		for(int key = 0; key < PTHREAD_KEYS_MAX; key++) {
+			void* value = (void*)self->specific[key];
+			if(!value || !key_used[key] || !key_destructors[key]) {
+				continue;
+			}
+
+			self->specific[key] = NULL;
+			key_destructors[key](value);
+			called = true;
+		}
+
+		if(!called) {
+			break;
+		}
+	}
+}
+
+void pthread_exit(void* value_ptr) {
+	struct __pthread* self = pthread_self();
+	while(self->cleanup) {
+		struct _pthread_cleanup* cleanup = self->cleanup;
+		self->cleanup = cleanup->next;
+		cleanup->routine(cleanup->arg);
+	}
+	run_destructors(self);
+
+	// The process lives on until the other threads are done
+	if(self == &main_thread) {
+		int live;
+		while((live = live_threads)) {
+			__xelix_futex_wait(&live_threads, live, -1);
+		}
+		exit(EXIT_SUCCESS);
+	}
+
+	self->result = value_ptr;
+	if(__sync_val_compare_and_swap(&self->state, JOINABLE, EXITED) == DETACHED) {
+		reap_add(self);
+	}
+
+	__sync_sub_and_fetch(&live_threads, 1);
+	__xelix_futex_wake(&live_threads, 1);
+	__xelix_thread_exit(0);
+}
+
+// Called on the new stack by clone_thread, with the thread as argument
+static void __attribute__((used, noreturn)) thread_entry(struct __pthread* thread) {
+	pthread_exit(thread->start(thread->arg));
+}
+
+/* The new thread returns from the syscall on its own stack, so it can't
+ * return from this function. Instead, it calls thread_entry, with the thread
+ * already stored at the top of the stack as argument.
+ */
+static int clone_thread(void* stack, struct __pthread* thread) {
+	register uint32_t result asm("eax") = 66;
+	register uint32_t sce asm("ebx") = (uint32_t)stack;
+
+	asm volatile(
+		"int $0x80;"
+		"test %%eax, %%eax;"
+		"jnz 1f;"
+		"call thread_entry;"
+		"1:"
+
+		: "+r" (result), "+r" (sce)
+		: "c" (thread), "d" (&thread->running)
+		: "memory");
+
+	if((int)result < 0) {
+		errno = sce;
+	}
+	return result;
+}
+
+int pthread_create(pthread_t* thread, const pthread_attr_t* attr,
+	void* (*start_routine)(void*), void* arg) {
+
+	reap();
+
+	struct __pthread* new = calloc(1, sizeof(struct __pthread));
+	if(!new) {
+		return EAGAIN;
+	}
+
+	size_t stack_size = attr && attr->stacksize ? attr->stacksize : DEFAULT_STACK_SIZE;
+	void* stack = attr ? attr->stackaddr : NULL;
+	if(!stack) {
+		new->stack = malloc(stack_size);
+		if(!new->stack) {
+			free(new);
+			return EAGAIN;
+		}
+		stack = new->stack;
+	}
+
+	new->self = new;
+	new->running = 1;
+	new->start = start_routine;
+	new->arg = arg;
+	new->state = attr && attr->detachstate == PTHREAD_CREATE_DETACHED ? DETACHED : JOINABLE;
+
+	// The main thread needs TLS too once there are others
+	if(!threaded) {
+		__xelix_set_tls(&main_thread);
+		threaded = true;
+	}
+
+	uintptr_t top = ((uintptr_t)stack + stack_size - sizeof(void*)) & ~0xf;
+	*(struct __pthread**)top = new;
+
+	__sync_add_and_fetch(&live_threads, 1);
+	int tid = clone_thread((void*)top, new);
+	if(tid < 0) {
+		__sync_sub_and_fetch(&live_threads, 1);
+		free_thread(new);
+		return EAGAIN;
+	}
+
+	new->tid = tid;
+	*thread = new;
+	return 0;
+}
+
+int pthread_join(pthread_t thread, void** value_ptr) {
+	if(thread == pthread_self()) {
+		return EDEADLK;
+	}
+
+	if(thread == &main_thread || thread->state == DETACHED) {
+		return EINVAL;
+	}
+
+	int running;
+	while((running = thread->running)) {
+		__xelix_futex_wait(&thread->running, running, -1);
+	}
+
+	if(value_ptr) {
+		*value_ptr = thread->result;
+	}
+	free_thread(thread);
+	return 0;
+}
+
+int pthread_detach(pthread_t thread) {
+	if(thread == &main_thread) {
+		return 0;
+	}
+
+	int old = __sync_val_compare_and_swap(&thread->state, JOINABLE, DETACHED);
+	if(old == DETACHED) {
+		return EINVAL;
+	}
+
+	// Already exited, so nobody else is going to free it
+	if(old == EXITED) {
+		reap_add(thread);
+	}
+	return 0;
+}
+
+int pthread_once(pthread_once_t* once_control, void (*init_routine)(void)) {
+	if(once_control->state == 2) {
+		return 0;
+	}
+
+	if(!__sync_val_compare_and_swap(&once_control->state, 0, 1)) {
+		init_routine();
+		__sync_lock_test_and_set(&once_control->state, 2);
+		__xelix_futex_wake(&once_control->state, INT_MAX);
+		return 0;
+	}
+
+	while(once_control->state == 1) {
+		__xelix_futex_wait(&once_control->state, 1, -1);
+	}
+	return 0;
+}
+
+int pthread_yield(void) {
+	return sched_yield();
+}
+
+int pthread_kill(pthread_t thread, int sig) {
+	pid_t tid = thread == &main_thread ? getpid() : thread->tid;
+	return kill(tid, sig) < 0 ? errno : 0;
+}
+
+int pthread_sigmask(int how, const sigset_t* set, sigset_t* oset) {
+	return sigprocmask(how, set, oset) < 0 ? errno : 0;
+}
+
+void _pthread_cleanup_push(struct _pthread_cleanup* cleanup, void (*routine)(void*), void* arg) {
+	struct __pthread* self = pthread_self();
+	cleanup->routine = routine;
+	cleanup->arg = arg;
+	cleanup->next = self->cleanup;
+	self->cleanup = cleanup;
+}
+
+void _pthread_cleanup_pop(struct _pthread_cleanup* cleanup, int execute) {
+	pthread_self()->cleanup = cleanup->next;
+	if(execute) {
+		cleanup->routine(cleanup->arg);
+	}
+}
+
+// Cancellation is not supported
+int pthread_cancel(pthread_t thread) {
+	return ENOSYS;
+}
+
+int pthread_setcancelstate(int state, int* oldstate) {
+	if(oldstate) {
+		*oldstate = PTHREAD_CANCEL_ENABLE;
+	}
+	return 0;
+}
+
+int pthread_setcanceltype(int type, int* oldtype) {
+	if(oldtype) {
+		*oldtype = PTHREAD_CANCEL_DEFERRED;
+	}
+	return 0;
+}
+
+void pthread_testcancel(void) {
+}
+
+// All threads are scheduled the same way
+int pthread_getschedparam(pthread_t thread, int* policy, struct sched_param* param) {
+	*policy = SCHED_OTHER;
+	param->sched_priority = 0;
+	return 0;
+}
+
+int pthread_setschedparam(pthread_t thread, int policy, const struct sched_param* param) {
+	return policy == SCHED_OTHER ? 0 : ENOTSUP;
+}
+
+int pthread_getconcurrency(void) {
+	return 0;
+}
+
+int pthread_setconcurrency(int new_level) {
+	return new_level < 0 ? EINVAL : 0;
+}
+
+int pthread_attr_init(pthread_attr_t* attr) {
+	memset(attr, 0, sizeof(pthread_attr_t));
+	attr->is_initialized = 1;
+	attr->stacksize = DEFAULT_STACK_SIZE;
+	attr->detachstate = PTHREAD_CREATE_JOINABLE;
+	attr->inheritsched = PTHREAD_INHERIT_SCHED;
+	attr->schedpolicy = SCHED_OTHER;
+	return 0;
+}
+
+int pthread_attr_destroy(pthread_attr_t* attr) {
+	attr->is_initialized = 0;
+	return 0;
+}
+
+int pthread_attr_getdetachstate(const pthread_attr_t* attr, int* detachstate) {
+	*detachstate = attr->detachstate;
+	return 0;
+}
+
+int pthread_attr_setdetachstate(pthread_attr_t* attr, int detachstate) {
+	if(detachstate != PTHREAD_CREATE_JOINABLE && detachstate != PTHREAD_CREATE_DETACHED) {
+		return EINVAL;
+	}
+	attr->detachstate = detachstate;
+	return 0;
+}
+
+int pthread_attr_getstacksize(const pthread_attr_t* attr, size_t* stacksize) {
+	*stacksize = attr->stacksize;
+	return 0;
+}
+
+int pthread_attr_setstacksize(pthread_attr_t* attr, size_t stacksize) {
+	if(stacksize < PTHREAD_STACK_MIN) {
+		return EINVAL;
+	}
+	attr->stacksize = stacksize;
+	return 0;
+}
+
+int pthread_attr_getstack(const pthread_attr_t* attr, void** stackaddr, size_t* stacksize) {
+	*stackaddr = attr->stackaddr;
+	*stacksize = attr->stacksize;
+	return 0;
+}
+
+int pthread_attr_setstack(pthread_attr_t* attr, void* stackaddr, size_t stacksize) {
+	if(stacksize < PTHREAD_STACK_MIN) {
+		return EINVAL;
+	}
+	attr->stackaddr = stackaddr;
+	attr->stacksize = stacksize;
+	return 0;
+}
+
+// There are no guard pages, the size is only stored
+int pthread_attr_getguardsize(const pthread_attr_t* attr, size_t* guardsize) {
+	*guardsize = attr->guardsize;
+	return 0;
+}
+
+int pthread_attr_setguardsize(pthread_attr_t* attr, size_t guardsize) {
+	attr->guardsize = guardsize;
+	return 0;
+}
+
+int pthread_attr_getscope(const pthread_attr_t* attr, int* scope) {
+	*scope = PTHREAD_SCOPE_SYSTEM;
+	return 0;
+}
+
+int pthread_attr_setscope(pthread_attr_t* attr, int scope) {
+	return scope == PTHREAD_SCOPE_SYSTEM ? 0 : ENOTSUP;
+}
+
+int pthread_attr_getinheritsched(const pthread_attr_t* attr, int* inheritsched) {
+	*inheritsched = attr->inheritsched;
+	return 0;
+}
+
+int pthread_attr_setinheritsched(pthread_attr_t* attr, int inheritsched) {
+	attr->inheritsched = inheritsched;
+	return 0;
+}
+
+int pthread_attr_getschedpolicy(const pthread_attr_t* attr, int* policy) {
+	*policy = attr->schedpolicy;
+	return 0;
+}
+
+int pthread_attr_setschedpolicy(pthread_attr_t* attr, int policy) {
+	if(policy != SCHED_OTHER) {
+		return ENOTSUP;
+	}
+	attr->schedpolicy = policy;
+	return 0;
+}
+
+int pthread_attr_getschedparam(const pthread_attr_t* attr, struct sched_param* param) {
+	param->sched_priority = attr->schedpriority;
+	return 0;
+}
+
+int pthread_attr_setschedparam(pthread_attr_t* attr, const struct sched_param* param) {
+	attr->schedpriority = param->sched_priority;
+	return 0;
+}
+
+int pthread_mutex_init(pthread_mutex_t* mutex, const pthread_mutexattr_t* attr) {
+	memset(mutex, 0, sizeof(pthread_mutex_t));
+	mutex->type = attr ? attr->type : PTHREAD_MUTEX_DEFAULT;
+	return 0;
+}
+
+int pthread_mutex_destroy(pthread_mutex_t* mutex) {
+	return mutex->lock ? EBUSY : 0;
+}
+
+static int mutex_lock(pthread_mutex_t* mutex, const struct timespec* abstime) {
+	pthread_t self = pthread_self();
+	if(mutex->type != PTHREAD_MUTEX_NORMAL && mutex->owner == self) {
+		if(mutex->type == PTHREAD_MUTEX_ERRORCHECK) {
+			return EDEADLK;
+		}
+
+		mutex->count++;
+		return 0;
+	}
+
+	if(__sync_val_compare_and_swap(&mutex->lock, 0, 1)) {
+		while(__sync_lock_test_and_set(&mutex->lock, 2)) {
+			int timeout = -1;
+			if(abstime && !(timeout = timeout_ms(abstime))) {
+				return ETIMEDOUT;
+			}
+			__xelix_futex_wait(&mutex->lock, 2, timeout);
+		}
+	}
+
+	mutex->owner = self;
+	mutex->count = 1;
+	return 0;
+}
+
+int pthread_mutex_lock(pthread_mutex_t* mutex) {
+	return mutex_lock(mutex, NULL);
+}
+
+int pthread_mutex_timedlock(pthread_mutex_t* mutex, const struct timespec* abstime) {
+	return mutex_lock(mutex, abstime);
+}
+
+int pthread_mutex_trylock(pthread_mutex_t* mutex) {
+	pthread_t self = pthread_self();
+	if(mutex->type == PTHREAD_MUTEX_RECURSIVE && mutex->owner == self) {
+		mutex->count++;
+		return 0;
+	}
+
+	if(__sync_val_compare_and_swap(&mutex->lock, 0, 1)) {
+		return EBUSY;
+	}
+
+	mutex->owner = self;
+	mutex->count = 1;
+	return 0;
+}
+
+int pthread_mutex_unlock(pthread_mutex_t* mutex) {
+	if(mutex->type != PTHREAD_MUTEX_NORMAL) {
+		if(mutex->owner != pthread_self()) {
+			return EPERM;
+		}
+
+		if(--mutex->count) {
+			return 0;
+		}
+	}
+
+	mutex->owner = NULL;
+	mutex->count = 0;
+	futex_unlock(&mutex->lock);
+	return 0;
+}
+
+int pthread_mutexattr_init(pthread_mutexattr_t* attr) {
+	attr->is_initialized = 1;
+	attr->type = PTHREAD_MUTEX_DEFAULT;
+	attr->pshared = PTHREAD_PROCESS_PRIVATE;
+	return 0;
+}
+
+int pthread_mutexattr_destroy(pthread_mutexattr_t* attr) {
+	attr->is_initialized = 0;
+	return 0;
+}
+
+int pthread_mutexattr_gettype(const pthread_mutexattr_t* attr, int* type) {
+	*type = attr->type;
+	return 0;
+}
+
+int pthread_mutexattr_settype(pthread_mutexattr_t* attr, int type) {
+	if(type < PTHREAD_MUTEX_NORMAL || type > PTHREAD_MUTEX_ERRORCHECK) {
+		return EINVAL;
+	}
+	attr->type = type;
+	return 0;
+}
+
+// Futexes are keyed by address space, so only process-private objects work
+int pthread_mutexattr_getpshared(const pthread_mutexattr_t* attr, int* pshared) {
+	*pshared = attr->pshared;
+	return 0;
+}
+
+int pthread_mutexattr_setpshared(pthread_mutexattr_t* attr, int pshared) {
+	return pshared == PTHREAD_PROCESS_PRIVATE ? 0 : ENOTSUP;
+}
+
+int pthread_cond_init(pthread_cond_t* cond, const pthread_condattr_t* attr) {
+	memset(cond, 0, sizeof(pthread_cond_t));
+	cond->clock = attr ? attr->clock : 0;
+	return 0;
+}
+
+int pthread_cond_destroy(pthread_cond_t* cond) {
+	return cond->waiters ? EBUSY : 0;
+}
+
+static int cond_wait(pthread_cond_t* cond, pthread_mutex_t* mutex,
+	const struct timespec* abstime) {
+
+	__sync_add_and_fetch(&cond->waiters, 1);
+	int seq = cond->seq;
+
+	// Release the mutex completely, even if it is recursive
+	pthread_t owner = mutex->owner;
+	int count = mutex->count;
+	mutex->owner = NULL;
+	mutex->count = 0;
+	futex_unlock(&mutex->lock);
+
+	int timeout = abstime ? timeout_ms(abstime) : -1;
+	if(timeout) {
+		__xelix_futex_wait(&cond->seq, seq, timeout);
+	}
+	__sync_sub_and_fetch(&cond->waiters, 1);
+
+	/* Other waiters may have been woken together with this one, so lock as
+	 * contended to make sure the unlock wakes them too.
+	 */
+	lock_wait(&mutex->lock);
+	mutex->owner = owner;
+	mutex->count = count;
+
+	if(abstime && cond->seq == seq && !timeout_ms(abstime)) {
+		return ETIMEDOUT;
+	}
+	return 0;
+}
+
+int pthread_cond_wait(pthread_cond_t* cond, pthread_mutex_t* mutex) {
+	return cond_wait(cond, mutex, NULL);
+}
+
+int pthread_cond_timedwait(pthread_cond_t* cond, pthread_mutex_t* mutex,
+	const struct timespec* abstime) {
+	return cond_wait(cond, mutex, abstime);
+}
+
+int pthread_cond_signal(pthread_cond_t* cond) {
+	__sync_add_and_fetch(&cond->seq, 1);
+	if(cond->waiters) {
+		__xelix_futex_wake(&cond->seq, 1);
+	}
+	return 0;
+}
+
+int pthread_cond_broadcast(pthread_cond_t* cond) {
+	__sync_add_and_fetch(&cond->seq, 1);
+	if(cond->waiters) {
+		__xelix_futex_wake(&cond->seq, INT_MAX);
+	}
+	return 0;
+}
+
+int pthread_condattr_init(pthread_condattr_t* attr) {
+	attr->is_initialized = 1;
+	attr->clock = 0;
+	attr->pshared = PTHREAD_PROCESS_PRIVATE;
+	return 0;
+}
+
+int pthread_condattr_destroy(pthread_condattr_t* attr) {
+	attr->is_initialized = 0;
+	return 0;
+}
+
+int pthread_condattr_getclock(const pthread_condattr_t* attr, clockid_t* clock_id) {
+	*clock_id = attr->clock ? attr->clock : CLOCK_REALTIME;
+	return 0;
+}
+
+int pthread_condattr_setclock(pthread_condattr_t* attr, clockid_t clock_id) {
+	attr->clock = clock_id;
+	return 0;
+}
+
+int pthread_condattr_getpshared(const pthread_condattr_t* attr, int* pshared) {
+	*pshared = attr->pshared;
+	return 0;
+}
+
+int pthread_condattr_setpshared(pthread_condattr_t* attr, int pshared) {
+	return pshared == PTHREAD_PROCESS_PRIVATE ? 0 : ENOTSUP;
+}
+
+/* Readers are preferred, so a thread can take a read lock it already holds
+ * without deadlocking against a waiting writer.
+ */
+int pthread_rwlock_init(pthread_rwlock_t* rwlock, const pthread_rwlockattr_t* attr) {
+	memset(rwlock, 0, sizeof(pthread_rwlock_t));
+	return 0;
+}
+
+int pthread_rwlock_destroy(pthread_rwlock_t* rwlock) {
+	return rwlock->active_readers || rwlock->active_writer ? EBUSY : 0;
+}
+
+int pthread_rwlock_rdlock(pthread_rwlock_t* rwlock) {
+	pthread_mutex_lock(&rwlock->lock);
+	while(rwlock->active_writer) {
+		pthread_cond_wait(&rwlock->readers, &rwlock->lock);
+	}
+	rwlock->active_readers++;
+	pthread_mutex_unlock(&rwlock->lock);
+	return 0;
+}
+
+int pthread_rwlock_tryrdlock(pthread_rwlock_t* rwlock) {
+	int ret = EBUSY;
+	pthread_mutex_lock(&rwlock->lock);
+	if(!rwlock->active_writer) {
+		rwlock->active_readers++;
+		ret = 0;
+	}
+	pthread_mutex_unlock(&rwlock->lock);
+	return ret;
+}
+
+int pthread_rwlock_wrlock(pthread_rwlock_t* rwlock) {
+	pthread_mutex_lock(&rwlock->lock);
+	rwlock->waiting_writers++;
+	while(rwlock->active_writer || rwlock->active_readers) {
+		pthread_cond_wait(&rwlock->writers, &rwlock->lock);
+	}
+	rwlock->waiting_writers--;
+	rwlock->active_writer = 1;
+	pthread_mutex_unlock(&rwlock->lock);
+	return 0;
+}
+
+int pthread_rwlock_trywrlock(pthread_rwlock_t* rwlock) {
+	int ret = EBUSY;
+	pthread_mutex_lock(&rwlock->lock);
+	if(!rwlock->active_writer && !rwlock->active_readers) {
+		rwlock->active_writer = 1;
+		ret = 0;
+	}
+	pthread_mutex_unlock(&rwlock->lock);
+	return ret;
+}
+
+int pthread_rwlock_unlock(pthread_rwlock_t* rwlock) {
+	pthread_mutex_lock(&rwlock->lock);
+	if(rwlock->active_writer) {
+		rwlock->active_writer = 0;
+		pthread_cond_broadcast(&rwlock->readers);
+	} else if(rwlock->active_readers) {
+		rwlock->active_readers--;
+	}
+
+	if(!rwlock->active_readers && rwlock->waiting_writers) {
+		pthread_cond_signal(&rwlock->writers);
+	}
+	pthread_mutex_unlock(&rwlock->lock);
+	return 0;
+}
+
+int pthread_rwlockattr_init(pthread_rwlockattr_t* attr) {
+	attr->is_initialized = 1;
+	attr->pshared = PTHREAD_PROCESS_PRIVATE;
+	return 0;
+}
+
+int pthread_rwlockattr_destroy(pthread_rwlockattr_t* attr) {
+	attr->is_initialized = 0;
+	return 0;
+}
+
+int pthread_rwlockattr_getpshared(const pthread_rwlockattr_t* attr, int* pshared) {
+	*pshared = attr->pshared;
+	return 0;
+}
+
+int pthread_rwlockattr_setpshared(pthread_rwlockattr_t* attr, int pshared) {
+	return pshared == PTHREAD_PROCESS_PRIVATE ? 0 : ENOTSUP;
+}
+
+// There is only one CPU, so yield instead of spinning
+int pthread_spin_init(pthread_spinlock_t* lock, int pshared) {
+	*lock = 0;
+	return 0;
+}
+
+int pthread_spin_destroy(pthread_spinlock_t* lock) {
+	return 0;
+}
+
+int pthread_spin_lock(pthread_spinlock_t* lock) {
+	while(__sync_lock_test_and_set(lock, 1)) {
+		sched_yield();
+	}
+	return 0;
+}
+
+int pthread_spin_trylock(pthread_spinlock_t* lock) {
+	return __sync_lock_test_and_set(lock, 1) ? EBUSY : 0;
+}
+
+int pthread_spin_unlock(pthread_spinlock_t* lock) {
+	__sync_lock_release(lock);
+	return 0;
+}
+
+int pthread_barrier_init(pthread_barrier_t* barrier, const pthread_barrierattr_t* attr,
+	unsigned int count) {
+
+	if(!count) {
+		return EINVAL;
+	}
+
+	memset(barrier, 0, sizeof(pthread_barrier_t));
+	barrier->count = count;
+	return 0;
+}
+
+int pthread_barrier_destroy(pthread_barrier_t* barrier) {
+	return barrier->waiting ? EBUSY : 0;
+}
+
+int pthread_barrier_wait(pthread_barrier_t* barrier) {
+	pthread_mutex_lock(&barrier->lock);
+	unsigned int cycle = barrier->cycle;
+
+	if(++barrier->waiting == barrier->count) {
+		barrier->waiting = 0;
+		barrier->cycle++;
+		pthread_cond_broadcast(&barrier->cond);
+		pthread_mutex_unlock(&barrier->lock);
+		return PTHREAD_BARRIER_SERIAL_THREAD;
+	}
+
+	while(cycle == barrier->cycle) {
+		pthread_cond_wait(&barrier->cond, &barrier->lock);
+	}
+	pthread_mutex_unlock(&barrier->lock);
+	return 0;
+}
+
+int pthread_barrierattr_init(pthread_barrierattr_t* attr) {
+	attr->is_initialized = 1;
+	attr->pshared = PTHREAD_PROCESS_PRIVATE;
+	return 0;
+}
+
+int pthread_barrierattr_destroy(pthread_barrierattr_t* attr) {
+	attr->is_initialized = 0;
+	return 0;
+}
+
+int pthread_key_create(pthread_key_t* key, void (*destructor)(void*)) {
+	__lock_acquire(key_lock);
+	for(pthread_key_t i = 0; i < PTHREAD_KEYS_MAX; i++) {
+		if(!key_used[i]) {
+			key_used[i] = true;
+			key_destructors[i] = destructor;
+			__lock_release(key_lock);
+			*key = i;
+			return 0;
+		}
+	}
+
+	__lock_release(key_lock);
+	return EAGAIN;
+}
+
+int pthread_key_delete(pthread_key_t key) {
+	if(key >= PTHREAD_KEYS_MAX || !key_used[key]) {
+		return EINVAL;
+	}
+
+	key_used[key] = false;
+	key_destructors[key] = NULL;
+	return 0;
+}
+
+void* pthread_getspecific(pthread_key_t key) {
+	if(key >= PTHREAD_KEYS_MAX) {
+		return NULL;
+	}
+	return (void*)pthread_self()->specific[key];
+}
+
+int pthread_setspecific(pthread_key_t key, const void* value) {
+	if(key >= PTHREAD_KEYS_MAX || !key_used[key]) {
+		return EINVAL;
+	}
+
+	pthread_self()->specific[key] = value;
+	return 0;
+}
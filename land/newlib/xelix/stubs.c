@@ -39,7 +39,6 @@
 #include <limits.h>
 #include <poll.h>
 #include <mntent.h>
-#include <pthread.h>
 #include <syslog.h>
 #include <sched.h>
 
@@ -96,14 +95,12 @@ STUB(int, lchmod, (const char *path, mode_t mode), -1);
 STUB(int, lchown, (const char *path, uid_t owner, gid_t group), -1);
 STUB(int, mknod, (const char *path, mode_t mode, dev_t dev), -1);
 STUB(int, lutimes, (const char *path, const struct timeval times[2]), -1);
-STUB(int, fsync, (int fildes), -1);
 STUB(int, getgrouplist, (const char *user, gid_t group, gid_t *groups, int *ngroups), -1);
 STUB(int, mkfifo, (const char *path, mode_t mode), -1);
 STUB(unsigned, alarm, (unsigned seconds), -1);
 STUB(void, flockfile, (FILE *file));
 STUB(int, ftrylockfile, (FILE *file), -1);
 STUB(void, funlockfile, (FILE *file));
-STUB(int, fdatasync, (int fildes), -1);
 STUB(void, err, (int eval, const char *fmt, ...));
 STUB(int, nanosleep, (const struct timespec *rqtp, struct timespec *rmtp), -1);
 STUB(struct servent*, getservbyname, (const char *name, const char *proto), NULL);
@@ -112,27 +109,12 @@ STUB(struct hostent*, gethostbyaddr, (const void *addr, socklen_t len, int type)
 STUB(struct servent*, getservbyport, (int port, const char *proto), NULL);
 STUB(int, shutdown, (int socket, int how), -1);
 STUB(void, freeaddrinfo, (struct addrinfo *ai));
-STUB(int, pthread_mutex_destroy, (pthread_mutex_t *mutex), -1);
-STUB(int, pthread_mutex_init, (pthread_mutex_t *restrict mutex, const pthread_mutexattr_t *restrict attr), -1);
-STUB(int, pthread_sigmask, (int how, const sigset_t *restrict set, sigset_t *restrict oset), -1);
-STUB(int, pthread_mutex_lock, (pthread_mutex_t *mutex), -1);
-STUB(int, pthread_mutex_trylock, (pthread_mutex_t *mutex), -1);
-STUB(int, pthread_mutex_unlock, (pthread_mutex_t *mutex), -1);
-STUB(int, pthread_cond_init, (pthread_cond_t *cond, const pthread_condattr_t *attr), -1);
-STUB(int, pthread_cond_destroy, (pthread_cond_t *cond), -1);
-STUB(int, pthread_cond_signal, (pthread_cond_t *cond), -1);
-STUB(int, pthread_cond_broadcast, (pthread_cond_t *cond), -1);
-STUB(int, pthread_cond_wait, (pthread_cond_t *cond, pthread_mutex_t *mutex), -1);
-STUB(int, pthread_cond_timedwait, (pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *abstime), -1);
-STUB(int, pthread_join, (pthread_t thread, void **value_ptr), -1);
-STUB(int, pthread_create, (pthread_t *thread, const pthread_attr_t *attr, void *(*start_routine) (void *), void *arg), -1);
 STUB(int, killpg, (pid_t pid, int sig), -1);
 STUB(void, closelog, (void));
 STUB(void, openlog, (const char* ident, int logopt, int facility));
 STUB(int, setlogmask, (int maskpri), -1);
 STUB(void, syslog, (int prio, const char* fmt, ...));
 STUB(int, initgroups, (const char *user, gid_t group), -1);
-STUB(void, sync, (void));
 STUB(int, getsockopt, (int sockfd, int level, int optname, void* optval, socklen_t* optlen), -1);
 STUB(ssize_t, recvmsg, (int sockfd, struct msghdr *msg, int flags), -1);
 STUB(dev_t, makedev, (unsigned int maj, unsigned int min), NULL);
@@ -144,7 +126,6 @@ STUB(int, sigmask, (int signum), -1);
 STUB(int, sigblock, (int mask), -1);
 STUB(int, sigsetmask, (int mask), -1);
 STUB(int, siggetmask, (void), -1);
-STUB(int, symlink, (const char *path1, const char *path2), -1);
 STUB(int, sched_setscheduler, (pid_t pid, int policy, const struct sched_param *param), -1);
 STUB(int, sched_setparam, (pid_t pid, const struct sched_param *param), -1);
 STUB(int, posix_memalign, (void **memptr, size_t alignment, size_t size), EINVAL);
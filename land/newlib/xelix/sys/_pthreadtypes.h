@@ -0,0 +1,107 @@
+/* Copyright © 2026 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SYS__PTHREADTYPES_H_
+#define _SYS__PTHREADTYPES_H_
+
+#define __need_size_t
+#include <stddef.h>
+
+/* Replaces the newlib version, which uses object IDs for everything. The
+ * synchronization objects here are futexes with some state around them, so
+ * they can be locked without entering the kernel.
+ */
+
+typedef struct __pthread* pthread_t;
+
+typedef struct {
+	int is_initialized;
+	void* stackaddr;
+	size_t stacksize;
+	size_t guardsize;
+	int detachstate;
+	int inheritsched;
+	int schedpolicy;
+	int schedpriority;
+} pthread_attr_t;
+
+typedef struct {
+	// 0 unlocked, 1 locked, 2 locked with waiters
+	volatile int lock;
+	int type;
+	pthread_t owner;
+	int count;
+} pthread_mutex_t;
+
+typedef struct {
+	int is_initialized;
+	int type;
+	int pshared;
+} pthread_mutexattr_t;
+
+typedef struct {
+	// Incremented on every signal, waiters sleep on it
+	volatile int seq;
+
+	// Signals only need to enter the kernel if there are waiters
+	volatile int waiters;
+	int clock;
+} pthread_cond_t;
+
+typedef struct {
+	int is_initialized;
+	int clock;
+	int pshared;
+} pthread_condattr_t;
+
+typedef unsigned int pthread_key_t;
+
+typedef struct {
+	volatile int state;
+} pthread_once_t;
+
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t readers;
+	pthread_cond_t writers;
+	int active_readers;
+	int active_writer;
+	int waiting_writers;
+} pthread_rwlock_t;
+
+typedef struct {
+	int is_initialized;
+	int pshared;
+} pthread_rwlockattr_t;
+
+typedef volatile int pthread_spinlock_t;
+
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	unsigned int count;
+	unsigned int waiting;
+	unsigned int cycle;
+} pthread_barrier_t;
+
+typedef struct {
+	int is_initialized;
+	int pshared;
+} pthread_barrierattr_t;
+
+#endif /* _SYS__PTHREADTYPES_H_ */
@@ -3,4 +3,12 @@
 #include <sys/_default_fcntl.h>
 
 #define	F_GETPATH	15
+
+#define SPLICE_F_MOVE		1
+#define SPLICE_F_NONBLOCK	2
+#define SPLICE_F_MORE		4
+#define SPLICE_F_GIFT		8
+
+ssize_t splice(int fd_in, off_t *off_in, int fd_out, off_t *off_out,
+	size_t len, unsigned int flags);
 #endif
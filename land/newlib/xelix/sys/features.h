@@ -334,6 +334,10 @@ extern "C" {
 /*# define _POSIX_JOB_CONTROL     1*/
 /*# define _POSIX_SAVED_IDS       1*/
 # define _POSIX_VERSION 199309L
+# define _POSIX_THREADS 1
+# define _POSIX_READER_WRITER_LOCKS 1
+# define _POSIX_SPIN_LOCKS 1
+# define _POSIX_BARRIERS 1
 
 #ifdef __cplusplus
 }
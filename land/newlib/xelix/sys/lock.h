@@ -0,0 +1,57 @@
+/* Copyright © 2026 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SYS_LOCK_H__
+#define __SYS_LOCK_H__
+
+/* Locks used inside newlib, for example by malloc and stdio. The newlib
+ * default are no-ops, which is not enough once there are threads. These are
+ * futex-based and only enter the kernel when contended. Implemented in
+ * pthread.c.
+ */
+
+struct __xelix_lock {
+	volatile int lock;
+	void* owner;
+	int count;
+};
+
+typedef struct __xelix_lock _LOCK_T;
+typedef struct __xelix_lock _LOCK_RECURSIVE_T;
+
+void __xelix_lock_acquire(struct __xelix_lock* lock);
+int __xelix_lock_try_acquire(struct __xelix_lock* lock);
+void __xelix_lock_release(struct __xelix_lock* lock);
+void __xelix_lock_acquire_recursive(struct __xelix_lock* lock);
+int __xelix_lock_try_acquire_recursive(struct __xelix_lock* lock);
+void __xelix_lock_release_recursive(struct __xelix_lock* lock);
+
+#define __LOCK_INIT(class, lock) class _LOCK_T lock = {0, 0, 0};
+#define __LOCK_INIT_RECURSIVE(class, lock) class _LOCK_RECURSIVE_T lock = {0, 0, 0};
+#define __lock_init(lock) ((lock) = (_LOCK_T){0, 0, 0})
+#define __lock_init_recursive(lock) ((lock) = (_LOCK_RECURSIVE_T){0, 0, 0})
+#define __lock_close(lock) ((void)0)
+#define __lock_close_recursive(lock) ((void)0)
+#define __lock_acquire(lock) __xelix_lock_acquire(&(lock))
+#define __lock_acquire_recursive(lock) __xelix_lock_acquire_recursive(&(lock))
+#define __lock_try_acquire(lock) __xelix_lock_try_acquire(&(lock))
+#define __lock_try_acquire_recursive(lock) __xelix_lock_try_acquire_recursive(&(lock))
+#define __lock_release(lock) __xelix_lock_release(&(lock))
+#define __lock_release_recursive(lock) __xelix_lock_release_recursive(&(lock))
+
+#endif /* __SYS_LOCK_H__ */
@@ -51,6 +51,11 @@ extern FILE* _xelix_serial;
 int _strace(void);
 void _serial_printf(const char* format, ...);
 
+int __xelix_futex_wait(volatile int* addr, int val, int timeout);
+int __xelix_futex_wake(volatile int* addr, int num);
+void __xelix_thread_exit(int code) __attribute__((noreturn));
+int __xelix_set_tls(void* tls);
+
 #define syscall(call, a1, a2, a3) __syscall(__errno(), call, (uint32_t)a1, (uint32_t)a2, (uint32_t)a3)
 static inline uint32_t __syscall(int* errp, uint32_t call, uint32_t arg1, uint32_t arg2, uint32_t arg3) {
 	register uint32_t _call asm("eax") = call;
@@ -25,6 +25,9 @@
 #include <sys/time.h>
 #include <sys/dirent.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <sys/epoll.h>
 #include <sys/select.h>
 #include <sys/errno.h>
 #include <sys/xelix.h>
@@ -139,6 +142,147 @@ int _write(int file, char *buf, int len) {
 	return syscall_pf(3, file, buf, len);
 }
 
+ssize_t readv(int fd, const struct iovec* iov, int iovcnt) {
+	return syscall(54, fd, iov, iovcnt);
+}
+
+ssize_t writev(int fd, const struct iovec* iov, int iovcnt) {
+	return syscall(55, fd, iov, iovcnt);
+}
+
+// Keep in sync with kernel
+struct _prw_data {
+	int fd;
+	const struct iovec* iov;
+	int iovcnt;
+	uint64_t offset;
+};
+
+ssize_t preadv(int fd, const struct iovec* iov, int iovcnt, off_t offset) {
+	struct _prw_data data = {
+		.fd = fd,
+		.iov = iov,
+		.iovcnt = iovcnt,
+		.offset = offset,
+	};
+
+	return syscall(56, &data, 0, 0);
+}
+
+ssize_t pwritev(int fd, const struct iovec* iov, int iovcnt, off_t offset) {
+	struct _prw_data data = {
+		.fd = fd,
+		.iov = iov,
+		.iovcnt = iovcnt,
+		.offset = offset,
+	};
+
+	return syscall(57, &data, 0, 0);
+}
+
+// Keep in sync with kernel
+#define _SPLICE_OFF_IN	0x100
+#define _SPLICE_OFF_OUT	0x200
+
+struct _splice_data {
+	int fd_in;
+	int fd_out;
+	uint64_t off_in;
+	uint64_t off_out;
+	size_t len;
+	uint32_t flags;
+};
+
+ssize_t splice(int fd_in, off_t* off_in, int fd_out, off_t* off_out,
+	size_t len, unsigned int flags) {
+
+	struct _splice_data data = {
+		.fd_in = fd_in,
+		.fd_out = fd_out,
+		.off_in = off_in ? *off_in : 0,
+		.off_out = off_out ? *off_out : 0,
+		.len = len,
+		.flags = (flags & 0xff) | (off_in ? _SPLICE_OFF_IN : 0)
+			| (off_out ? _SPLICE_OFF_OUT : 0),
+	};
+
+	ssize_t r = syscall(58, &data, 0, 0);
+	if(r >= 0) {
+		if(off_in) {
+			*off_in = data.off_in;
+		}
+		if(off_out) {
+			*off_out = data.off_out;
+		}
+	}
+	return r;
+}
+
+ssize_t sendfile(int out_fd, int in_fd, off_t* offset, size_t count) {
+	return splice(in_fd, offset, out_fd, NULL, count, 0);
+}
+
+int epoll_create1(int flags) {
+	return syscall(59, flags, 0, 0);
+}
+
+int epoll_create(int size) {
+	if(size <= 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	return epoll_create1(0);
+}
+
+// Keep in sync with kernel
+struct _epoll_ctl_data {
+	int epfd;
+	int op;
+	int fd;
+	struct epoll_event event;
+};
+
+struct _epoll_wait_data {
+	int epfd;
+	struct epoll_event* events;
+	int maxevents;
+	int timeout;
+};
+
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event* event) {
+	struct _epoll_ctl_data data = {
+		.epfd = epfd,
+		.op = op,
+		.fd = fd,
+	};
+
+	if(event) {
+		data.event = *event;
+	}
+	return syscall(60, &data, 0, 0);
+}
+
+int epoll_wait(int epfd, struct epoll_event* events, int maxevents, int timeout) {
+	struct _epoll_wait_data data = {
+		.epfd = epfd,
+		.events = events,
+		.maxevents = maxevents,
+		.timeout = timeout,
+	};
+
+	return syscall(61, &data, 0, 0);
+}
+
+ssize_t pread(int fd, void* buf, size_t nbytes, off_t offset) {
+	struct iovec iov = {buf, nbytes};
+	return preadv(fd, &iov, 1, offset);
+}
+
+ssize_t pwrite(int fd, const void* buf, size_t nbytes, off_t offset) {
+	struct iovec iov = {(void*)buf, nbytes};
+	return pwritev(fd, &iov, 1, offset);
+}
+
 int chdir(const char *path) {
 	return syscall(20, path, 0, 0);
 }
@@ -348,6 +492,44 @@ int readlink(const char *path, char *buf, size_t bufsize) {
 	return syscall(31, path, buf, bufsize);
 }
 
+int _rename(const char *old, const char *new) {
+	return syscall(62, old, new, 0);
+}
+
+int symlink(const char *path1, const char *path2) {
+	return syscall(63, path1, path2, 0);
+}
+
+int fsync(int fildes) {
+	return syscall(64, fildes, 0, 0);
+}
+
+int fdatasync(int fildes) {
+	return syscall(64, fildes, 1, 0);
+}
+
+void sync(void) {
+	syscall(65, 0, 0, 0);
+}
+
+// Thread primitives used by pthread.c. clone has to switch stacks and lives there.
+int __xelix_futex_wait(volatile int* addr, int val, int timeout) {
+	return syscall(67, addr, val, timeout);
+}
+
+int __xelix_futex_wake(volatile int* addr, int num) {
+	return syscall(68, addr, num, 0);
+}
+
+void __xelix_thread_exit(int code) {
+	syscall(69, code, 0, 0);
+	__builtin_unreachable();
+}
+
+int __xelix_set_tls(void* tls) {
+	return syscall(70, tls, 0, 0);
+}
+
 int sigaction(int sig, const struct sigaction* act, struct sigaction* oact) {
 	return syscall(33, sig, act, oact);
 }
@@ -28,6 +28,16 @@ static const char *const usage[] = {
     NULL,
 };
 
+static void print_usage(const char* name, uint32_t value, bool human) {
+	if(human) {
+		char* rfs = readable_fs(value);
+		printf("  %-12s%13s\n", name, rfs);
+		free(rfs);
+	} else {
+		printf("  %-12s%13u\n", name, value / 1024);
+	}
+}
+
 int main(int argc, const char** argv) {
 	int human;
 	const char* path = "/sys/mem_info";
@@ -43,7 +53,8 @@ int main(int argc, const char** argv) {
     argparse_describe(&argparse, "\nDisplay amount of free and used memory in the system.",
     	"\nfree displays the total amount of free and used physical and swap "
     	"memory in the system, as well as the buffers and caches used by the "
-    	"kernel. The information is gathered by parsing /sys/mem_info.\nfree is "
+    	"kernel, followed by a breakdown of where physical memory is used. "
+    	"The information is gathered by parsing /sys/mem_info.\nfree is "
     	"part of xelix-utils. Please report bugs to <hello@lutoma.org>.");
     argc = argparse_parse(&argparse, argc, argv);
 
@@ -57,6 +68,7 @@ int main(int argc, const char** argv) {
 	uint32_t mem_shared = 0, mem_cache = 0;
 	uint32_t palloc_total = 0, palloc_used = 0;
 	uint32_t kmalloc_total = 0, kmalloc_used = 0;
+	uint32_t page_tables = 0, user_anon = 0;
 
 	while(!feof(fp)) {
 		char name[100];
@@ -83,8 +95,13 @@ int main(int argc, const char** argv) {
 			kmalloc_total = value;
 		} else if(!strcmp(name, "kmalloc_used")) {
 			kmalloc_used = value;
+		} else if(!strcmp(name, "page_tables")) {
+			page_tables = value;
+		} else if(!strcmp(name, "user_anon")) {
+			user_anon = value;
 		}
 	}
+	fclose(fp);
 
 	uint32_t mem_free = mem_total - mem_used;
 	uint32_t palloc_free = palloc_total - palloc_used;
@@ -113,5 +130,12 @@ int main(int argc, const char** argv) {
 		printf("kmalloc:    %13s%13s%13s\n", readable_fs(kmalloc_total),
 			readable_fs(kmalloc_used), readable_fs(kmalloc_free));
 	}
+
+	printf("\nUsage:\n");
+	print_usage("kernel heap", kmalloc_used, human);
+	print_usage("page tables", page_tables, human);
+	print_usage("block cache", mem_cache, human);
+	print_usage("tmpfs", mem_shared, human);
+	print_usage("user anon", user_anon, human);
 	exit(EXIT_SUCCESS);
 }
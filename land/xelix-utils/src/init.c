@@ -24,6 +24,7 @@
 #include <fcntl.h>
 #include <dirent.h>
 #include <string.h>
+#include <errno.h>
 #include <strings.h>
 #include <limits.h>
 #include <termios.h>
@@ -122,18 +123,19 @@ static int handler(void* user, const char* section, const char* name,
 }
 
 
-static char* get_target() {
+static char* get_cmdline_option(const char* key) {
 	int fd = open("/sys/cmdline", O_RDONLY);
 	if(fd < 1) {
 		return NULL;
 	}
 
 	char buf[500];
-	int nread = read(fd, buf, 500);
+	int nread = read(fd, buf, 499);
 	close(fd);
 	if(nread < 1) {
 		return NULL;
 	}
+	buf[nread] = 0;
 
 	char* pch;
 	char* strtok_state;
@@ -141,7 +143,7 @@ static char* get_target() {
 	pch = strtok_r(buf, " =\n", &strtok_state);
 	while(pch != NULL) {
 		if(state == 0) {
-			if(strcmp(pch, "init_target") == 0) {
+			if(strcmp(pch, key) == 0) {
 				state = 2;
 			} else {
 				state = 1;
@@ -174,11 +176,28 @@ int main() {
 	sigfillset(&set);
 	sigprocmask(SIG_SETMASK, &set, NULL);
 
+	/* When booting from an initramfs, the kernel leaves mounting the disk
+	 * root to us. Otherwise it is already mounted and this fails with EBUSY.
+	 */
+	char* root = get_cmdline_option("root");
+	if(root) {
+		if(mount(root, "/", "ext2", 0, NULL) == 0) {
+			printf("init: Switched root to %s\n", root);
+		} else if(errno != EBUSY) {
+			perror("Could not mount root file system");
+		}
+		free(root);
+	}
+
 	if(mount("/dev/ide1p1", "/boot", "ext2", 0, NULL) < 0) {
 		perror("Could not mount /boot");
 	}
 
-	char* target = get_target();
+	if(mount("tmpfs", "/tmp", "tmpfs", 0, NULL) < 0) {
+		perror("Could not mount /tmp");
+	}
+
+	char* target = get_cmdline_option("init_target");
 	if(!target) {
 		target = "default";
 	}
@@ -0,0 +1,277 @@
+/* Copyright © 2026 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "argparse.h"
+#include "util.h"
+
+// Needs to match the kernel's BLOCK_STATS_BUCKETS
+#define BUCKETS 40
+#define MAX_DEVS 32
+
+static const char *const usage[] = {
+    "iostat [options] [interval [count]]",
+    NULL,
+};
+
+struct dir_stats {
+	uint64_t ios;
+	uint64_t merges;
+	uint64_t blocks;
+	uint64_t errors;
+	uint64_t cycles;
+	uint64_t latency[BUCKETS];
+};
+
+struct dev_stats {
+	char name[50];
+	int block_size;
+	uint64_t flushes;
+	uint64_t flush_cycles;
+	uint32_t inflight;
+	uint32_t inflight_max;
+	struct dir_stats read;
+	struct dir_stats write;
+};
+
+struct sample {
+	uint64_t tsc_khz;
+	uint32_t tick;
+	uint32_t rate;
+	int num_devs;
+	struct dev_stats devs[MAX_DEVS];
+};
+
+static const char* path = "/sys/block_stats";
+
+// sysfs files have to be read in one go
+static char* read_file(const char* file, char* buf, size_t size) {
+	int fd = open(file, O_RDONLY);
+	if(fd < 0) {
+		perror(file);
+		exit(EXIT_FAILURE);
+	}
+
+	ssize_t len = read(fd, buf, size - 1);
+	close(fd);
+	if(len < 0) {
+		perror(file);
+		exit(EXIT_FAILURE);
+	}
+	buf[len] = 0;
+	return buf;
+}
+
+static void parse_dir(char* line, struct dir_stats* dir) {
+	char* pos = strchr(line, ' ');
+	uint64_t* fields[] = {&dir->ios, &dir->merges, &dir->blocks, &dir->errors, &dir->cycles};
+	for(int i = 0; i < 5 + BUCKETS && pos; i++) {
+		uint64_t value = strtoull(pos, &pos, 10);
+		if(i < 5) {
+			*fields[i] = value;
+		} else {
+			dir->latency[i - 5] = value;
+		}
+	}
+}
+
+static void take_sample(struct sample* sample) {
+	static char buf[0x4000];
+	bzero(sample, sizeof(struct sample));
+
+	read_file("/sys/tick", buf, sizeof(buf));
+	sscanf(buf, "%*d %u %u", &sample->tick, &sample->rate);
+
+	struct dev_stats* dev = NULL;
+	char* state;
+	char* line = strtok_r(read_file(path, buf, sizeof(buf)), "\n", &state);
+	for(; line; line = strtok_r(NULL, "\n", &state)) {
+		if(!strncmp(line, "tsc_khz ", 8)) {
+			sample->tsc_khz = strtoull(line + 8, NULL, 10);
+		} else if(!strncmp(line, "dev ", 4) && sample->num_devs < MAX_DEVS) {
+			dev = &sample->devs[sample->num_devs++];
+			sscanf(line, "dev %49s %d %llu %llu %u %u", dev->name, &dev->block_size,
+				&dev->flushes, &dev->flush_cycles, &dev->inflight, &dev->inflight_max);
+		} else if(dev && !strncmp(line, "read ", 5)) {
+			parse_dir(line, &dev->read);
+		} else if(dev && !strncmp(line, "write ", 6)) {
+			parse_dir(line, &dev->write);
+		}
+	}
+}
+
+static struct dev_stats* find_dev(struct sample* sample, const char* name) {
+	for(int i = 0; i < sample->num_devs; i++) {
+		if(!strcmp(sample->devs[i].name, name)) {
+			return &sample->devs[i];
+		}
+	}
+	return NULL;
+}
+
+static void dir_delta(struct dir_stats* cur, struct dir_stats* prev, struct dir_stats* delta) {
+	*delta = *cur;
+	if(!prev) {
+		return;
+	}
+
+	delta->ios -= prev->ios;
+	delta->merges -= prev->merges;
+	delta->blocks -= prev->blocks;
+	delta->errors -= prev->errors;
+	delta->cycles -= prev->cycles;
+	for(int i = 0; i < BUCKETS; i++) {
+		delta->latency[i] -= prev->latency[i];
+	}
+}
+
+// Average latency in microseconds
+static uint64_t await_us(struct dir_stats* dir, uint64_t tsc_khz) {
+	if(!dir->ios || !tsc_khz) {
+		return 0;
+	}
+	return dir->cycles * 1000 / tsc_khz / dir->ios;
+}
+
+static void print_histogram(const char* name, struct dir_stats* dir, uint64_t tsc_khz) {
+	if(!dir->ios || !tsc_khz) {
+		return;
+	}
+
+	uint64_t max = 1;
+	for(int i = 0; i < BUCKETS; i++) {
+		max = dir->latency[i] > max ? dir->latency[i] : max;
+	}
+
+	printf("  %s latency:\n", name);
+	for(int i = 0; i < BUCKETS; i++) {
+		if(!dir->latency[i]) {
+			continue;
+		}
+
+		uint64_t lo = (1ULL << i) * 1000 / tsc_khz;
+		uint64_t hi = (1ULL << (i + 1)) * 1000 / tsc_khz;
+		char bar[41];
+		int len = dir->latency[i] * 40 / max;
+		memset(bar, '#', len);
+		bar[len] = 0;
+		printf("  %10llu - %-10llu us %10llu %s\n", lo, hi, dir->latency[i], bar);
+	}
+}
+
+/* Rates are per second over the interval, or since boot for the first
+ * report. Latencies are averages over the same period.
+ */
+static void report(struct sample* cur, struct sample* prev, int latency) {
+	uint32_t ticks = cur->tick - (prev ? prev->tick : 0);
+	uint64_t hz = cur->rate ? cur->rate : 1;
+	if(!ticks) {
+		ticks = 1;
+	}
+
+	printf("%-10s %8s %8s %9s %9s %7s %7s %10s %10s %6s %5s %5s %5s\n", "Device",
+		"r/s", "w/s", "rkB/s", "wkB/s", "rrqm/s", "wrqm/s", "r_await", "w_await",
+		"f/s", "err", "infl", "max");
+
+	for(int i = 0; i < cur->num_devs; i++) {
+		struct dev_stats* dev = &cur->devs[i];
+		struct dev_stats* pdev = prev ? find_dev(prev, dev->name) : NULL;
+		struct dir_stats rd, wr;
+		dir_delta(&dev->read, pdev ? &pdev->read : NULL, &rd);
+		dir_delta(&dev->write, pdev ? &pdev->write : NULL, &wr);
+		uint64_t flushes = dev->flushes - (pdev ? pdev->flushes : 0);
+
+		// Skip devices that have never been used, such as /dev/null
+		if(!dev->read.ios && !dev->write.ios && !dev->flushes) {
+			continue;
+		}
+
+		printf("%-10s %8llu %8llu %9llu %9llu %7llu %7llu %7llu us %7llu us %6llu %5llu %5u %5u\n",
+			dev->name,
+			rd.ios * hz / ticks,
+			wr.ios * hz / ticks,
+			rd.blocks * dev->block_size / 1024 * hz / ticks,
+			wr.blocks * dev->block_size / 1024 * hz / ticks,
+			rd.merges * hz / ticks,
+			wr.merges * hz / ticks,
+			await_us(&rd, cur->tsc_khz),
+			await_us(&wr, cur->tsc_khz),
+			flushes * hz / ticks,
+			rd.errors + wr.errors,
+			dev->inflight,
+			dev->inflight_max);
+
+		if(latency) {
+			print_histogram("read", &rd, cur->tsc_khz);
+			print_histogram("write", &wr, cur->tsc_khz);
+		}
+	}
+}
+
+int main(int argc, const char** argv) {
+	int latency = 0;
+	struct argparse_option options[] = {
+		OPT_HELP(),
+		OPT_BOOLEAN('l', "latency", &latency, "show latency histograms"),
+		OPT_STRING('f', "file", &path, "file to read statistics from"),
+        OPT_END(),
+	};
+
+    struct argparse argparse;
+    argparse_init(&argparse, options, usage, 0);
+    argparse_describe(&argparse, "Report block device I/O statistics.",
+    	"\niostat shows requests, throughput, merged requests and average "
+    	"latency for each block device. The first report covers the time since "
+    	"boot, following reports the time since the previous one. With an "
+    	"interval, iostat keeps reporting until count reports have been shown. "
+    	"The information is gathered by parsing /sys/block_stats.\niostat is "
+    	"part of xelix-utils. Please report bugs to <hello@lutoma.org>.");
+    argc = argparse_parse(&argparse, argc, argv);
+
+	int interval = argc > 0 ? atoi(argv[0]) : 0;
+	int count = argc > 1 ? atoi(argv[1]) : (interval ? -1 : 1);
+
+	struct sample* samples = malloc(sizeof(struct sample) * 2);
+	if(!samples) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+
+	struct sample* prev = NULL;
+	for(int i = 0; count < 0 || i < count; i++) {
+		struct sample* cur = &samples[i % 2];
+		take_sample(cur);
+		if(i) {
+			printf("\n");
+		}
+		report(cur, prev, latency);
+		prev = cur;
+
+		if(interval && (count < 0 || i + 1 < count)) {
+			sleep(interval);
+		}
+	}
+
+	free(samples);
+	exit(EXIT_SUCCESS);
+}
@@ -22,8 +22,42 @@
 #include <stdbool.h>
 #include <string.h>
 #include <pwd.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include "util.h"
 
+/* Add up the resident pages of shared mappings in /sys/maps/<pid>. sysfs
+ * files have to be read in one go, so don't use stdio here.
+ */
+static uint32_t get_shared(uint32_t pid) {
+	static char buf[0x4000];
+	char path[30];
+	snprintf(path, sizeof(path), "/sys/maps/%u", pid);
+
+	int fd = open(path, O_RDONLY);
+	if(fd < 0) {
+		return 0;
+	}
+
+	ssize_t len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if(len <= 0) {
+		return 0;
+	}
+	buf[len] = 0;
+
+	uint32_t shared = 0;
+	char* state;
+	for(char* line = strtok_r(buf, "\n", &state); line; line = strtok_r(NULL, "\n", &state)) {
+		char perms[5];
+		uint32_t pages;
+		if(sscanf(line, "%*x-%*x %4s %u", perms, &pages) == 2 && perms[3] == 's') {
+			shared += pages;
+		}
+	}
+	return shared * 4096;
+}
+
 int main(int argc, char* argv[]) {
 	FILE* fp = fopen("/sys/tasks", "r");
 	if(!fp) {
@@ -36,7 +70,7 @@ int main(int argc, char* argv[]) {
 	fgets(data, 1024, fp);
 	free(data);
 
-	printf("  PID User     State     PPID TTY      Mem\n");
+	printf("  PID User     State     PPID TTY      RSS        SHR\n");
 
 	while(true) {
 		if(feof(fp)) {
@@ -80,12 +114,14 @@ int main(int argc, char* argv[]) {
 		}
 
 		char* rfs = readable_fs(mem);
+		char* sfs = readable_fs(pid != -1 ? get_shared(pid) : 0);
 		if(*tty == '/') {
 			tty = basename(tty);
 		}
 
-		printf("%5d %-8s \033[%-11s\033[m %5d %-8s %-10s %-15s\n", pid, user, state, ppid, tty, rfs, name);
+		printf("%5d %-8s \033[%-11s\033[m %5d %-8s %-10s %-10s %-15s\n", pid, user, state, ppid, tty, rfs, sfs, name);
 		free(rfs);
+		free(sfs);
 	}
 
 	exit(EXIT_SUCCESS);
@@ -0,0 +1,457 @@
+/* Copyright © 2026 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include "argparse.h"
+#include "util.h"
+
+static const char *const usage[] = {
+    "scbench [options]",
+    NULL,
+};
+
+static uint64_t now_us() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void report(const char* name, int iterations, uint64_t start) {
+	uint64_t elapsed = now_us() - start;
+	if(!elapsed) {
+		elapsed = 1;
+	}
+
+	printf("%-24s %8d calls %10llu us %8llu ns/call %10llu calls/s\n", name,
+		iterations, elapsed, elapsed * 1000 / iterations,
+		(uint64_t)iterations * 1000000 / elapsed);
+}
+
+static void bench_pipe(int iterations) {
+	int fds[2];
+	if(pipe(fds) < 0) {
+		perror("Could not create pipe");
+		exit(EXIT_FAILURE);
+	}
+
+	// Write/read pairs so the pipe never fills up or blocks
+	char c = 'x';
+	uint64_t start = now_us();
+	for(int i = 0; i < iterations; i++) {
+		if(write(fds[1], &c, 1) != 1 || read(fds[0], &c, 1) != 1) {
+			perror("pipe");
+			exit(EXIT_FAILURE);
+		}
+	}
+	report("pipe write+read 1B", iterations, start);
+
+	close(fds[0]);
+	close(fds[1]);
+}
+
+/* Measure system call entry and exit. getpid() is answered from the exec data
+ * without entering the kernel, so use the cheapest call that does.
+ */
+static void bench_syscall(int iterations) {
+	struct timeval tv;
+	uint64_t start = now_us();
+	for(int i = 0; i < iterations; i++) {
+		gettimeofday(&tv, NULL);
+	}
+	report("gettimeofday", iterations, start);
+}
+
+/* Bounce a byte between two processes over a pair of pipes. Each round trip
+ * takes two context switches, so this mostly measures their cost.
+ */
+static void bench_pingpong(int iterations) {
+	int ping[2];
+	int pong[2];
+	if(pipe(ping) < 0 || pipe(pong) < 0) {
+		perror("Could not create pipe");
+		exit(EXIT_FAILURE);
+	}
+
+	pid_t pid = fork();
+	if(pid < 0) {
+		perror("fork");
+		exit(EXIT_FAILURE);
+	}
+
+	char c = 'x';
+	if(!pid) {
+		close(ping[1]);
+		close(pong[0]);
+		while(read(ping[0], &c, 1) == 1) {
+			if(write(pong[1], &c, 1) != 1) {
+				_exit(EXIT_FAILURE);
+			}
+		}
+		_exit(EXIT_SUCCESS);
+	}
+
+	close(ping[0]);
+	close(pong[1]);
+
+	uint64_t start = now_us();
+	for(int i = 0; i < iterations; i++) {
+		if(write(ping[1], &c, 1) != 1 || read(pong[0], &c, 1) != 1) {
+			perror("pipe");
+			exit(EXIT_FAILURE);
+		}
+	}
+	report("pipe ping-pong", iterations, start);
+
+	close(ping[1]);
+	waitpid(pid, NULL, 0);
+	close(pong[0]);
+}
+
+// Push data through a pipe between two processes, like cat big | gzip
+static void bench_pipe_bandwidth(int megabytes) {
+	int fds[2];
+	if(pipe(fds) < 0) {
+		perror("Could not create pipe");
+		exit(EXIT_FAILURE);
+	}
+
+	static char buf[0x10000];
+	size_t total = (size_t)megabytes * 1024 * 1024;
+	uint64_t start = now_us();
+
+	pid_t pid = fork();
+	if(pid < 0) {
+		perror("fork");
+		exit(EXIT_FAILURE);
+	}
+
+	if(!pid) {
+		close(fds[0]);
+		for(size_t done = 0; done < total;) {
+			ssize_t r = write(fds[1], buf, sizeof(buf));
+			if(r <= 0) {
+				perror("write");
+				_exit(EXIT_FAILURE);
+			}
+			done += r;
+		}
+		_exit(EXIT_SUCCESS);
+	}
+
+	close(fds[1]);
+	size_t done = 0;
+	while(done < total) {
+		ssize_t r = read(fds[0], buf, sizeof(buf));
+		if(r <= 0) {
+			break;
+		}
+		done += r;
+	}
+
+	waitpid(pid, NULL, 0);
+	close(fds[0]);
+
+	uint64_t elapsed = now_us() - start;
+	if(!elapsed) {
+		elapsed = 1;
+	}
+
+	printf("%-24s %8zu KiB %10llu us %8llu KiB/s\n", "pipe bandwidth",
+		done / 1024, elapsed, (uint64_t)done * 1000000 / 1024 / elapsed);
+}
+
+static void bench_devnull(int iterations) {
+	int fd = open("/dev/null", O_RDWR);
+	if(fd < 0) {
+		perror("Could not open /dev/null");
+		exit(EXIT_FAILURE);
+	}
+
+	char c = 'x';
+	uint64_t start = now_us();
+	for(int i = 0; i < iterations; i++) {
+		write(fd, &c, 1);
+	}
+	report("/dev/null write 1B", iterations, start);
+
+	start = now_us();
+	for(int i = 0; i < iterations; i++) {
+		read(fd, &c, 1);
+	}
+	report("/dev/null read 1B", iterations, start);
+
+	// Same again through a dup to cover fd resolution
+	int dfd = dup(fd);
+	start = now_us();
+	for(int i = 0; i < iterations; i++) {
+		write(dfd, &c, 1);
+	}
+	report("/dev/null dup write 1B", iterations, start);
+
+	start = now_us();
+	for(int i = 0; i < iterations; i++) {
+		lseek(fd, 0, SEEK_SET);
+	}
+	report("/dev/null lseek", iterations, start);
+
+	close(dfd);
+	close(fd);
+}
+
+/* Wait for one active pipe among many idle ones, the case epoll is made for.
+ * poll() has to check every descriptor on each call, epoll_wait only the ones
+ * that changed.
+ */
+static void bench_poll_idle(int iterations, int idle) {
+	int nfds = idle + 1;
+	int* fds = malloc(sizeof(int) * nfds * 2);
+	struct pollfd* pfds = malloc(sizeof(struct pollfd) * nfds);
+	if(!fds || !pfds) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+
+	for(int i = 0; i < nfds; i++) {
+		if(pipe(fds + i * 2) < 0) {
+			perror("Could not create pipe");
+			exit(EXIT_FAILURE);
+		}
+
+		pfds[i].fd = fds[i * 2];
+		pfds[i].events = POLLIN;
+	}
+
+	// The active pipe is the last one
+	int rfd = fds[idle * 2];
+	int wfd = fds[idle * 2 + 1];
+	char c = 'x';
+	char name[50];
+
+	uint64_t start = now_us();
+	for(int i = 0; i < iterations; i++) {
+		write(wfd, &c, 1);
+		if(poll(pfds, nfds, -1) != 1 || read(rfd, &c, 1) != 1) {
+			perror("poll");
+			exit(EXIT_FAILURE);
+		}
+	}
+	snprintf(name, sizeof(name), "poll %d idle", idle);
+	report(name, iterations, start);
+
+	int epfd = epoll_create1(0);
+	if(epfd < 0) {
+		perror("epoll_create1");
+		exit(EXIT_FAILURE);
+	}
+
+	for(int i = 0; i < nfds; i++) {
+		struct epoll_event ev = {.events = EPOLLIN, .data.fd = fds[i * 2]};
+		if(epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i * 2], &ev) < 0) {
+			perror("epoll_ctl");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	struct epoll_event events[8];
+	start = now_us();
+	for(int i = 0; i < iterations; i++) {
+		write(wfd, &c, 1);
+		if(epoll_wait(epfd, events, 8, -1) != 1 || read(events[0].data.fd, &c, 1) != 1) {
+			perror("epoll_wait");
+			exit(EXIT_FAILURE);
+		}
+	}
+	snprintf(name, sizeof(name), "epoll_wait %d idle", idle);
+	report(name, iterations, start);
+
+	close(epfd);
+	for(int i = 0; i < nfds * 2; i++) {
+		close(fds[i]);
+	}
+	free(fds);
+	free(pfds);
+}
+
+/* Create, write, read back and delete small files, like compilers do with
+ * their temporary files. Run once with a directory on tmpfs and once with
+ * one on disk to compare the two.
+ */
+static void bench_files(int iterations, const char* dir) {
+	static char buf[4096];
+	char path[256];
+	snprintf(path, sizeof(path), "%s/scbench.%d", dir, getpid());
+
+	uint64_t start = now_us();
+	for(int i = 0; i < iterations; i++) {
+		int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+		if(fd < 0 || write(fd, buf, sizeof(buf)) != sizeof(buf)) {
+			perror(path);
+			exit(EXIT_FAILURE);
+		}
+		close(fd);
+
+		fd = open(path, O_RDONLY);
+		if(fd < 0 || read(fd, buf, sizeof(buf)) != sizeof(buf)) {
+			perror(path);
+			exit(EXIT_FAILURE);
+		}
+		close(fd);
+		unlink(path);
+	}
+
+	char name[50];
+	snprintf(name, sizeof(name), "4K file in %s", dir);
+	report(name, iterations, start);
+}
+
+static void fill_pattern(uint32_t* buf, size_t words, uint32_t offset) {
+	for(size_t i = 0; i < words; i++) {
+		buf[i] = (offset + i) * 2654435761u;
+	}
+}
+
+/* Write a large file and verify it on read back. Past the first 12 blocks,
+ * ext2 files use indirect blocks, then double and triple indirect ones (the
+ * latter from 64 MiB on with 1 KiB blocks), so this covers all of them.
+ */
+static void bench_large_file(int megabytes, const char* dir) {
+	static uint32_t buf[0x10000 / sizeof(uint32_t)];
+	static uint32_t expect[0x10000 / sizeof(uint32_t)];
+	const size_t words = sizeof(buf) / sizeof(uint32_t);
+	size_t total = (size_t)megabytes * 1024 * 1024;
+	char path[256];
+	snprintf(path, sizeof(path), "%s/scbench-large.%d", dir, getpid());
+
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if(fd < 0) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+
+	uint64_t start = now_us();
+	for(size_t done = 0; done < total; done += sizeof(buf)) {
+		fill_pattern(buf, words, done / sizeof(uint32_t));
+		if(write(fd, buf, sizeof(buf)) != sizeof(buf)) {
+			perror(path);
+			unlink(path);
+			exit(EXIT_FAILURE);
+		}
+	}
+	close(fd);
+	uint64_t write_elapsed = now_us() - start;
+
+	fd = open(path, O_RDONLY);
+	if(fd < 0) {
+		perror(path);
+		unlink(path);
+		exit(EXIT_FAILURE);
+	}
+
+	start = now_us();
+	size_t done = 0;
+	while(done < total) {
+		ssize_t r = read(fd, buf, sizeof(buf));
+		if(r != sizeof(buf)) {
+			break;
+		}
+
+		fill_pattern(expect, words, done / sizeof(uint32_t));
+		if(memcmp(buf, expect, sizeof(buf))) {
+			break;
+		}
+		done += r;
+	}
+	uint64_t read_elapsed = now_us() - start;
+	close(fd);
+	unlink(path);
+
+	if(done != total) {
+		fprintf(stderr, "%s: data mismatch or short read at offset %zu\n", path, done);
+		exit(EXIT_FAILURE);
+	}
+
+	write_elapsed = write_elapsed ? write_elapsed : 1;
+	read_elapsed = read_elapsed ? read_elapsed : 1;
+	printf("%-24s %8zu KiB %10llu us %8llu KiB/s\n", "large file write",
+		total / 1024, write_elapsed, (uint64_t)total * 1000000 / 1024 / write_elapsed);
+	printf("%-24s %8zu KiB %10llu us %8llu KiB/s\n", "large file read+verify",
+		total / 1024, read_elapsed, (uint64_t)total * 1000000 / 1024 / read_elapsed);
+}
+
+int main(int argc, const char** argv) {
+	int iterations = 100000;
+	int megabytes = 64;
+	int idle = 200;
+	int large = 256;
+	const char* dir = NULL;
+	struct argparse_option options[] = {
+		OPT_HELP(),
+		OPT_INTEGER('n', "iterations", &iterations, "number of calls per test"),
+		OPT_INTEGER('m', "megabytes", &megabytes, "amount of data for the pipe bandwidth test"),
+		OPT_INTEGER('p', "idle-pipes", &idle, "number of idle pipes for the poll test"),
+		OPT_STRING('d', "dir", &dir, "directory for the file tests"),
+		OPT_INTEGER('l', "large-file", &large, "size of the large file test in MiB"),
+        OPT_END(),
+	};
+
+    struct argparse argparse;
+    argparse_init(&argparse, options, usage, 0);
+    argparse_describe(&argparse, "Measure system call overhead.",
+    	"\nscbench times gettimeofday() and small read, write and lseek calls on a "
+    	"pipe and on /dev/null to track the cost of system calls and the VFS fd "
+    	"path, the round trip time of a pipe between two processes to track "
+    	"the cost of context switches, and measures pipe bandwidth between two "
+    	"processes and poll()/epoll_wait() latency with "
+    	"many idle descriptors. With -d, it also times creating and deleting "
+    	"small files in a directory, and writes a large file there and verifies "
+    	"it on read back.\nscbench is part "
+    	"of xelix-utils. Please report bugs to <hello@lutoma.org>.");
+    argc = argparse_parse(&argparse, argc, argv);
+
+	if(iterations < 1) {
+		fprintf(stderr, "Invalid number of iterations.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	bench_syscall(iterations);
+	bench_pipe(iterations);
+	bench_pingpong(iterations / 10 ? iterations / 10 : 1);
+	bench_devnull(iterations);
+	if(megabytes > 0) {
+		bench_pipe_bandwidth(megabytes);
+	}
+	if(idle >= 0) {
+		bench_poll_idle(iterations / 10 ? iterations / 10 : 1, idle);
+	}
+	if(dir) {
+		bench_files(iterations / 100 ? iterations / 100 : 1, dir);
+		if(large > 0) {
+			bench_large_file(large, dir);
+		}
+	}
+	exit(EXIT_SUCCESS);
+}
@@ -25,87 +25,705 @@
 #include <block/part.h>
 #include <block/null.h>
 #include <block/random.h>
+#include <block/cache.h>
 #include <fs/sysfs.h>
 #include <fs/mount.h>
-#include <mem/vm.h>
+#include <tasks/scheduler.h>
+#include <tasks/worker.h>
+#include <bsp/timer.h>
+#include <prof.h>
 #include <panic.h>
 
+// Pool of temporary buffers for partial block I/O
+#define BOUNCE_SIZE 512
+#define BOUNCE_POOL_SIZE 32
+
+// Upper bound for the length of the statistics of one device in /sys/block_stats
+#define STATS_DEV_MAX (200 + 2 * (128 + BLOCK_STATS_BUCKETS * 11))
+
 static int num_devs = 0;
 static struct vfs_block_dev* block_devs = NULL;
+static uint8_t* bounce_pool = NULL;
+static uint32_t bounce_free = 0xffffffff;
+
+// Used to determine the TSC rate for block_stats
+static uint64_t boot_tsc;
+static uint32_t boot_tick;
+
+static size_t sfs_block_read(struct vfs_callback_ctx* ctx, void* dest, size_t size);
 
 struct vfs_block_dev* vfs_block_get_dev(const char* path) {
 	if(strlen(path) < 6 || strncmp(path, "/dev/", 5)) {
 		return NULL;
 	}
 
-	struct vfs_block_dev* dev = block_devs;
-	while(dev) {
-		if(!strcmp(dev->name, path + 5)) {
-			return dev;
+	// Use the /dev index rather than walking all devices
+	struct sysfs_file* sfp = sysfs_get_dev(path + 5);
+	if(!sfp || sfp->cb.read != sfs_block_read) {
+		return NULL;
+	}
+	return (struct vfs_block_dev*)sfp->meta;
+}
+
+static inline struct vfs_block_dev* queue_dev(struct vfs_block_dev* dev) {
+	return dev->parent ? dev->parent : dev;
+}
+
+static inline bool overlaps(struct block_request* a, struct block_request* b) {
+	return a->lba < b->lba + b->num_blocks && b->lba < a->lba + a->num_blocks;
+}
+
+static inline bool conflicts(struct block_request* a, struct block_request* b) {
+	if(a->flush || b->flush) {
+		return true;
+	}
+	return (a->write || b->write) && overlaps(a, b);
+}
+
+/* Returns a request that has to be completed before req can be dispatched,
+ * as they access the same blocks and at least one of them is a write (or a
+ * flush). This is either an older pending request or one that is already
+ * in flight.
+ */
+static struct block_request* find_conflict(struct block_queue* queue, struct block_request* req) {
+	for(struct block_request* other = queue->active; other; other = other->next) {
+		if(conflicts(other, req)) {
+			return other;
+		}
+	}
+
+	for(struct block_request* other = queue->pending; other; other = other->next) {
+		if(other != req && (int32_t)(other->seq - req->seq) < 0 && conflicts(other, req)) {
+			return other;
 		}
-		dev = dev->next;
 	}
 	return NULL;
 }
 
+static inline uint64_t max_request_blocks(struct vfs_block_dev* dev) {
+	return dev->max_blocks ? MIN(dev->max_blocks, BLOCK_MERGE_MAX) : BLOCK_MERGE_MAX;
+}
+
+static void stats_submit(struct vfs_block_dev* dev) {
+	uint32_t inflight = __sync_add_and_fetch(&dev->stats.inflight, 1);
+	if(inflight > dev->stats.inflight_max) {
+		dev->stats.inflight_max = inflight;
+	}
+}
+
+static void stats_complete(struct vfs_block_dev* dev, struct block_request* req,
+	uint64_t result, uint64_t cycles) {
+
+	struct block_stats* stats = &dev->stats;
+	__sync_sub_and_fetch(&stats->inflight, 1);
+
+	if(req->flush) {
+		stats->flushes++;
+		stats->flush_cycles += cycles;
+		return;
+	}
+
+	struct block_stats_dir* dir = req->write ? &stats->write : &stats->read;
+	dir->ios++;
+	dir->cycles += cycles;
+	if(result == -1 || result != req->num_blocks) {
+		dir->errors++;
+	}
+	if(result != -1) {
+		dir->blocks += result;
+	}
+
+	int bucket = cycles ? 63 - __builtin_clzll(cycles) : 0;
+	dir->latency[MIN(bucket, BLOCK_STATS_BUCKETS - 1)]++;
+}
+
+static void finish_request(struct block_request* req, uint64_t result) {
+	#ifdef CONFIG_BLOCK_WRITEBACK
+	// Data in the write-back cache is newer than what is on the device
+	if(req->cache_overlay && result == req->num_blocks) {
+		block_cache_read(queue_dev(req->dev), req->lba, req->num_blocks, req->buf, true);
+	}
+	#endif
+
+	if(req->submit_tsc) {
+		uint64_t cycles = profile_stop(req->submit_tsc);
+		stats_complete(req->dev, req, result, cycles);
+		if(req->dev->parent) {
+			stats_complete(req->dev->parent, req, result, cycles);
+		}
+	}
+
+	req->result = result;
+	req->done = true;
+	if(req->callback) {
+		req->callback(req);
+	}
+}
+
+// Completion callback for requests that have been merged at dispatch time
+static void merged_complete(struct block_request* batch) {
+	int block_size = batch->dev->block_size;
+	uint64_t offset = 0;
+
+	struct block_request* req = batch->merged;
+	while(req) {
+		struct block_request* next = req->next;
+		uint64_t result = req->num_blocks;
+		if(batch->result == -1 || batch->result <= offset) {
+			result = -1;
+		} else if(batch->result < offset + req->num_blocks) {
+			result = batch->result - offset;
+		}
+
+		if(batch->bounce && !batch->write && result != -1) {
+			memcpy(req->buf, batch->bounce + offset * block_size, result * block_size);
+		}
+
+		offset += req->num_blocks;
+		finish_request(req, result);
+		req = next;
+	}
+
+	kfree(batch->bounce);
+	kfree(batch);
+}
+
+/* Takes the next request off the pending list. Requests are served in
+ * ascending LBA order starting from the current head position, wrapping
+ * around at the end (C-LOOK). Adjacent requests following it are merged
+ * into one larger request. Returns NULL if all pending requests have to
+ * wait for older conflicting ones.
+ */
+static struct block_request* queue_next(struct vfs_block_dev* dev) {
+	struct block_queue* queue = &dev->queue;
+	struct block_request* first = queue->pending;
+	while(first && first->lba < queue->head) {
+		first = first->next;
+	}
+	if(!first) {
+		first = queue->pending;
+	}
+
+	// Keep the order of overlapping requests intact
+	struct block_request* conflict;
+	while(!first->dispatched && (conflict = find_conflict(queue, first))) {
+		first = conflict;
+	}
+
+	// Conflicts with a request that is still in flight, try again later
+	if(first->dispatched) {
+		return NULL;
+	}
+
+	struct block_request* last = first;
+	uint64_t num_blocks = first->num_blocks;
+	bool contiguous = true;
+
+	while(!first->flush && last->next && !last->next->flush
+		&& last->next->write == first->write
+		&& last->next->lba == last->lba + last->num_blocks
+		&& num_blocks + last->next->num_blocks <= max_request_blocks(dev)
+		&& !find_conflict(queue, last->next)) {
+
+		if(last->next->buf != last->buf + last->num_blocks * dev->block_size) {
+			contiguous = false;
+		}
+
+		num_blocks += last->next->num_blocks;
+		last = last->next;
+		if(last->write) {
+			dev->stats.write.merges++;
+		} else {
+			dev->stats.read.merges++;
+		}
+	}
+
+	// Unlink first to last from pending list
+	struct block_request** pos = &queue->pending;
+	while(*pos != first) {
+		pos = &(*pos)->next;
+	}
+	*pos = last->next;
+	last->next = NULL;
+	queue->head = last->lba + last->num_blocks;
+
+	if(first == last) {
+		return first;
+	}
+
+	struct block_request* batch = zmalloc(sizeof(struct block_request));
+	batch->dev = dev;
+	batch->write = first->write;
+	batch->lba = first->lba;
+	batch->num_blocks = num_blocks;
+	batch->seq = first->seq;
+	batch->merged = first;
+	batch->callback = merged_complete;
+
+	if(contiguous) {
+		batch->buf = first->buf;
+		return batch;
+	}
+
+	batch->bounce = kmalloc(num_blocks * dev->block_size);
+	batch->buf = batch->bounce;
+	if(batch->write) {
+		for(struct block_request* req = first; req; req = req->next) {
+			memcpy(batch->bounce + (req->lba - first->lba) * dev->block_size,
+				req->buf, req->num_blocks * dev->block_size);
+		}
+	}
+	return batch;
+}
+
+static void dispatch(struct vfs_block_dev* dev, struct block_request* req) {
+	if(dev->submit_cb) {
+		if(dev->submit_cb(dev, req) < 0) {
+			vfs_block_complete(req, -1);
+		}
+		return;
+	}
+
+	if(req->flush) {
+		int r = dev->flush_cb ? dev->flush_cb(dev) : 0;
+		vfs_block_complete(req, r < 0 ? -1 : 0);
+		return;
+	}
+
+	vfs_block_read_cb callback = req->write ? dev->write_cb : dev->read_cb;
+	vfs_block_complete(req, callback(dev, req->lba, req->num_blocks, req->buf));
+}
+
+/* Finishes requests completed by the driver and dispatches pending ones
+ * until the queue depth of the device is reached. Called by waiting tasks
+ * and kblockd, so this never runs in interrupt context.
+ */
+static void queue_run(struct vfs_block_dev* dev) {
+	struct block_queue* queue = &dev->queue;
+	uint32_t depth = dev->submit_cb ? MAX(dev->queue_depth, 1) : 1;
+
+	while(true) {
+		if(dev->poll_cb) {
+			dev->poll_cb(dev);
+		}
+
+		if(!spinlock_get(&queue->lock, -1)) {
+			return;
+		}
+
+		struct block_request* completed = __sync_lock_test_and_set(&queue->completed, NULL);
+		for(struct block_request* req = completed; req; req = req->completed_next) {
+			struct block_request** pos = &queue->active;
+			while(*pos != req) {
+				pos = &(*pos)->next;
+			}
+			*pos = req->next;
+			queue->inflight--;
+		}
+
+		struct block_request* req = NULL;
+		if(queue->pending && queue->inflight < depth) {
+			req = queue_next(dev);
+		}
+
+		if(req) {
+			req->dispatched = true;
+			req->next = queue->active;
+			queue->active = req;
+			queue->inflight++;
+		}
+		spinlock_release(&queue->lock);
+
+		// Callbacks may submit new requests, so run them without the lock
+		while(completed) {
+			struct block_request* next = completed->completed_next;
+			finish_request(completed, completed->driver_result);
+			completed = next;
+		}
+
+		if(!req) {
+			return;
+		}
+		dispatch(dev, req);
+	}
+}
+
+// Completion callback for the parts of a request that has been split up
+static void split_complete(struct block_request* part) {
+	struct block_request* req = part->meta;
+
+	// Keep track of how many blocks from the start were transferred successfully
+	if(part->result != part->num_blocks) {
+		uint64_t good = part->lba - req->lba + (part->result == -1 ? 0 : part->result);
+		req->driver_result = MIN(req->driver_result, good);
+	}
+
+	if(!__sync_sub_and_fetch(&req->parts_pending, 1)) {
+		kfree(req->parts);
+		finish_request(req, req->driver_result ? req->driver_result : -1);
+	}
+}
+
+// Split up a request that is larger than what the device can handle at once
+static int submit_split(struct vfs_block_dev* dev, struct block_request* req) {
+	uint64_t max = dev->max_blocks;
+	uint32_t num_parts = RDIV(req->num_blocks, max);
+
+	req->parts = zmalloc(sizeof(struct block_request) * num_parts);
+	req->parts_pending = num_parts;
+	req->driver_result = req->num_blocks;
+	req->done = false;
+
+	for(uint32_t i = 0; i < num_parts; i++) {
+		struct block_request* part = &req->parts[i];
+		part->dev = req->dev;
+		part->write = req->write;
+		part->lba = req->lba + i * max;
+		part->num_blocks = MIN(max, req->num_blocks - i * max);
+		part->buf = req->buf + i * max * dev->block_size;
+		part->callback = split_complete;
+		part->meta = req;
+	}
+
+	/* Convert lba so it matches the parts once they are submitted. Submitting
+	 * the last part may complete the request, so req can't be touched after.
+	 */
+	req->lba += req->dev->start_offset;
+	for(uint32_t i = 0; i < num_parts; i++) {
+		// Fail the part right away so the request still completes
+		if(vfs_block_submit(&req->parts[i]) < 0) {
+			finish_request(&req->parts[i], -1);
+		}
+	}
+	return 0;
+}
+
+/* Queue a request. req->lba is relative to the device, and req->callback is
+ * invoked once the request is done. The request memory has to stay valid
+ * until then.
+ */
+int vfs_block_submit(struct block_request* req) {
+	struct vfs_block_dev* dev = queue_dev(req->dev);
+	struct block_queue* queue = &dev->queue;
+	req->submit_tsc = 0;
+	req->cache_overlay = false;
+	if(!req->num_blocks && !req->flush) {
+		finish_request(req, 0);
+		return 0;
+	}
+
+	#ifdef CONFIG_BLOCK_WRITEBACK
+	/* Writes go to the write-back cache. Reads are served from it if it has
+	 * all of the blocks, and otherwise get its contents applied on completion.
+	 * Parts of split requests are covered by their parent.
+	 */
+	if(!req->flush && !req->nocache && req->callback != split_complete) {
+		uint64_t lba = req->lba + req->dev->start_offset;
+		if(req->write ? block_cache_write(dev, lba, req->num_blocks, req->buf)
+			: block_cache_read(dev, lba, req->num_blocks, req->buf, false)) {
+			finish_request(req, req->num_blocks);
+			return 0;
+		}
+		req->cache_overlay = !req->write && block_cache_has_data();
+	}
+	#endif
+
+	// The parts of a split request are accounted for as one
+	if(req->callback != split_complete) {
+		req->submit_tsc = profile_start();
+		stats_submit(req->dev);
+		if(req->dev->parent) {
+			stats_submit(req->dev->parent);
+		}
+	}
+
+	if(dev->max_blocks && req->num_blocks > dev->max_blocks) {
+		return submit_split(dev, req);
+	}
+
+	req->lba += req->dev->start_offset;
+	req->done = false;
+	req->dispatched = false;
+	req->merged = NULL;
+	req->bounce = NULL;
+
+	if(!spinlock_get(&queue->lock, -1)) {
+		return -1;
+	}
+
+	req->seq = queue->seq++;
+
+	// Keep pending list sorted by LBA, FIFO for identical ones
+	struct block_request** pos = &queue->pending;
+	while(*pos && (*pos)->lba <= req->lba) {
+		pos = &(*pos)->next;
+	}
+	req->next = *pos;
+	*pos = req;
+	spinlock_release(&queue->lock);
+
+	queue_run(dev);
+	return 0;
+}
+
+// Wait for a submitted request to complete and return its result
+uint64_t vfs_block_wait(struct block_request* req) {
+	struct vfs_block_dev* dev = queue_dev(req->dev);
+	while(true) {
+		queue_run(dev);
+		if(req->done) {
+			return req->result;
+		}
+		scheduler_yield();
+	}
+}
+
+/* Called by drivers once a request has finished, possibly from interrupt
+ * context. The request is finished later on by queue_run.
+ */
+void vfs_block_complete(struct block_request* req, uint64_t result) {
+	struct block_queue* queue = &queue_dev(req->dev)->queue;
+	req->driver_result = result;
+
+	struct block_request* head;
+	do {
+		head = queue->completed;
+		req->completed_next = head;
+	} while(!__sync_bool_compare_and_swap(&queue->completed, head, req));
+}
+
+static uint64_t block_rw(struct vfs_block_dev* dev, bool write, uint64_t start_block,
+	uint64_t num_blocks, uint8_t* buf) {
+
+	struct block_request req = {
+		.dev = dev,
+		.write = write,
+		.lba = start_block,
+		.num_blocks = num_blocks,
+		.buf = buf,
+	};
+
+	if(vfs_block_submit(&req) < 0) {
+		return -1;
+	}
+	return vfs_block_wait(&req);
+}
+
+// Wait until all previously written data has reached the disk
+int vfs_block_flush(struct vfs_block_dev* dev) {
+	int result = 0;
+	#ifdef CONFIG_BLOCK_WRITEBACK
+	result = block_cache_sync(queue_dev(dev));
+	#endif
+
+	struct block_request req = {
+		.dev = dev,
+		.flush = true,
+	};
+
+	if(vfs_block_submit(&req) < 0 || vfs_block_wait(&req) == -1) {
+		return -1;
+	}
+	return result;
+}
+
+// Flush all devices
+int vfs_block_sync(void) {
+	int result = 0;
+	for(struct vfs_block_dev* dev = block_devs; dev; dev = dev->next) {
+		if(!dev->parent && vfs_block_flush(dev) < 0) {
+			result = -1;
+		}
+	}
+	return result;
+}
+
 uint64_t vfs_block_read(struct vfs_block_dev* dev, uint64_t start_block, uint64_t num_blocks, uint8_t* buf) {
-	return dev->read_cb(dev, start_block + dev->start_offset, num_blocks, buf);
+	return block_rw(dev, false, start_block, num_blocks, buf);
 }
 
 uint64_t vfs_block_write(struct vfs_block_dev* dev, uint64_t start_block, uint64_t num_blocks, uint8_t* buf) {
-	return dev->write_cb(dev, start_block + dev->start_offset, num_blocks, buf);
+	return block_rw(dev, true, start_block, num_blocks, buf);
 }
 
-uint64_t vfs_block_sread(struct vfs_block_dev* dev, uint64_t position, uint64_t size, uint8_t* buf) {
-	int start_block = position / dev->block_size;
-	uint64_t offset = (position % dev->block_size);
-	int num_blocks = (size + offset + dev->block_size - 1) / dev->block_size;
+// Get a temporary buffer for one block, from the pool if possible
+static uint8_t* bounce_get(struct vfs_block_dev* dev) {
+	if(bounce_pool && dev->block_size <= BOUNCE_SIZE) {
+		uint32_t free;
+		while((free = bounce_free)) {
+			int i = __builtin_ctz(free);
+			if(__sync_bool_compare_and_swap(&bounce_free, free, free & ~(1U << i))) {
+				return bounce_pool + i * BOUNCE_SIZE;
+			}
+		}
+	}
+	return kmalloc(dev->block_size);
+}
 
-	if(!offset && !(size % dev->block_size)) {
-		return vfs_block_read(dev, start_block, num_blocks, buf) * dev->block_size;
+static void bounce_put(uint8_t* buf) {
+	if(buf >= bounce_pool && buf < bounce_pool + BOUNCE_POOL_SIZE * BOUNCE_SIZE) {
+		__sync_fetch_and_or(&bounce_free, 1U << ((buf - bounce_pool) / BOUNCE_SIZE));
+		return;
 	}
+	kfree(buf);
+}
+
+/* Byte-granular I/O is split into a partial block at the start, whole
+ * blocks in the middle that are transferred directly, and a partial block
+ * at the end. Only the partial blocks go through bounce buffers.
+ */
+struct byte_range {
+	uint64_t head_block;
+	uint64_t head_offset;
+	uint64_t head_bytes;
+	uint64_t mid_blocks;
+	uint64_t tail_bytes;
+};
+
+static inline void split_range(struct vfs_block_dev* dev, uint64_t position,
+	uint64_t size, struct byte_range* range) {
 
-	vm_alloc_t alloc;
-	uint64_t buffer_size = num_blocks * dev->block_size;
-	assert(buffer_size >= size);
+	range->head_block = position / dev->block_size;
+	range->head_offset = position % dev->block_size;
+	range->head_bytes = range->head_offset ? MIN(size, dev->block_size - range->head_offset) : 0;
+	range->mid_blocks = (size - range->head_bytes) / dev->block_size;
+	range->tail_bytes = (size - range->head_bytes) % dev->block_size;
+}
+
+/* Queue a request in the next free slot of reqs. Requests that could not be
+ * submitted don't take up a slot, so they are never waited for.
+ */
+static inline int submit_rw(struct block_request* reqs, int* num_reqs,
+	struct vfs_block_dev* dev, bool write, uint64_t lba, uint64_t num_blocks,
+	uint8_t* buf) {
 
-	uint8_t* int_buf = vm_alloc(VM_KERNEL, &alloc, RDIV(buffer_size, PAGE_SIZE), NULL, 0);
+	struct block_request* req = &reqs[*num_reqs];
+	bzero(req, sizeof(struct block_request));
+	req->dev = dev;
+	req->write = write;
+	req->lba = lba;
+	req->num_blocks = num_blocks;
+	req->buf = buf;
 
-	if(vfs_block_read(dev, start_block, num_blocks, int_buf) < num_blocks) {
-		kfree(int_buf);
+	if(vfs_block_submit(req) < 0) {
 		return -1;
 	}
+	(*num_reqs)++;
+	return 0;
+}
 
-	memcpy(buf, int_buf + offset, size);
-	vm_free(&alloc);
-	return size;
+uint64_t vfs_block_sread(struct vfs_block_dev* dev, uint64_t position, uint64_t size, uint8_t* buf) {
+	struct byte_range range;
+	split_range(dev, position, size, &range);
+
+	if(!range.head_bytes && !range.tail_bytes) {
+		uint64_t read = vfs_block_read(dev, range.head_block, range.mid_blocks, buf);
+		return read == -1 ? -1 : read * dev->block_size;
+	}
+
+	uint64_t mid_block = range.head_block + (range.head_bytes ? 1 : 0);
+	uint8_t* head = range.head_bytes ? bounce_get(dev) : NULL;
+	uint8_t* tail = range.tail_bytes ? bounce_get(dev) : NULL;
+	struct block_request reqs[3];
+	int num_reqs = 0;
+	bool failed = false;
+
+	if(head && submit_rw(reqs, &num_reqs, dev, false, range.head_block, 1, head) < 0) {
+		failed = true;
+	}
+	if(range.mid_blocks && submit_rw(reqs, &num_reqs, dev, false, mid_block,
+		range.mid_blocks, buf + range.head_bytes) < 0) {
+		failed = true;
+	}
+	if(tail && submit_rw(reqs, &num_reqs, dev, false, mid_block + range.mid_blocks, 1, tail) < 0) {
+		failed = true;
+	}
+
+	for(int i = 0; i < num_reqs; i++) {
+		if(vfs_block_wait(&reqs[i]) != reqs[i].num_blocks) {
+			failed = true;
+		}
+	}
+
+	if(!failed && head) {
+		memcpy(buf, head + range.head_offset, range.head_bytes);
+	}
+	if(!failed && tail) {
+		memcpy(buf + size - range.tail_bytes, tail, range.tail_bytes);
+	}
+
+	if(head) {
+		bounce_put(head);
+	}
+	if(tail) {
+		bounce_put(tail);
+	}
+	return failed ? -1 : size;
 }
 
 uint64_t vfs_block_swrite(struct vfs_block_dev* dev, uint64_t position, uint64_t size, uint8_t* buf) {
-	int start_block = position / dev->block_size;
-	uint64_t offset = (position % dev->block_size);
-	int num_blocks = (size + offset + dev->block_size - 1) / dev->block_size;
+	struct byte_range range;
+	split_range(dev, position, size, &range);
 
-	if(!offset && !(size % dev->block_size)) {
-		return vfs_block_write(dev, start_block, num_blocks, buf) * dev->block_size;
+	if(!range.head_bytes && !range.tail_bytes) {
+		uint64_t written = vfs_block_write(dev, range.head_block, range.mid_blocks, buf);
+		return written == -1 ? -1 : written * dev->block_size;
 	}
 
-	// FIXME Should only read the required parts at the beginning and end
-	uint8_t* int_buf = kmalloc(num_blocks * dev->block_size);
-	if(vfs_block_read(dev, start_block, num_blocks, int_buf) < num_blocks) {
-		kfree(int_buf);
-		return -1;
+	uint64_t mid_block = range.head_block + (range.head_bytes ? 1 : 0);
+	uint64_t tail_block = mid_block + range.mid_blocks;
+	uint8_t* head = range.head_bytes ? bounce_get(dev) : NULL;
+	uint8_t* tail = range.tail_bytes ? bounce_get(dev) : NULL;
+	struct block_request reqs[3];
+	int num_reqs = 0;
+	bool failed = false;
+
+	// Read the partial blocks at the edges, the rest is overwritten anyway
+	if(head && submit_rw(reqs, &num_reqs, dev, false, range.head_block, 1, head) < 0) {
+		failed = true;
+	}
+	if(tail && submit_rw(reqs, &num_reqs, dev, false, tail_block, 1, tail) < 0) {
+		failed = true;
+	}
+	for(int i = 0; i < num_reqs; i++) {
+		if(vfs_block_wait(&reqs[i]) != 1) {
+			failed = true;
+		}
 	}
 
-	memcpy(int_buf + offset, buf, size);
+	if(!failed) {
+		num_reqs = 0;
+		if(head) {
+			memcpy(head + range.head_offset, buf, range.head_bytes);
+			if(submit_rw(reqs, &num_reqs, dev, true, range.head_block, 1, head) < 0) {
+				failed = true;
+			}
+		}
+		if(range.mid_blocks && submit_rw(reqs, &num_reqs, dev, true, mid_block,
+			range.mid_blocks, buf + range.head_bytes) < 0) {
+			failed = true;
+		}
+		if(tail) {
+			memcpy(tail, buf + size - range.tail_bytes, range.tail_bytes);
+			if(submit_rw(reqs, &num_reqs, dev, true, tail_block, 1, tail) < 0) {
+				failed = true;
+			}
+		}
 
-	if(vfs_block_write(dev, start_block, num_blocks, int_buf) < num_blocks) {
-		kfree(int_buf);
-		return -1;
+		for(int i = 0; i < num_reqs; i++) {
+			if(vfs_block_wait(&reqs[i]) != reqs[i].num_blocks) {
+				failed = true;
+			}
+		}
 	}
 
-	kfree(int_buf);
-	return size;
+	if(head) {
+		bounce_put(head);
+	}
+	if(tail) {
+		bounce_put(tail);
+	}
+	return failed ? -1 : size;
 }
 
 static size_t sfs_block_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
@@ -114,7 +732,7 @@ static size_t sfs_block_read(struct vfs_callback_ctx* ctx, void* dest, size_t si
 		return -1;
 	}
 
-	if(!vfs_block_sread(dev, ctx->fp->offset, size, dest)) {
+	if(vfs_block_sread(dev, ctx->offset, size, dest) == -1) {
 		return -1;
 	}
 	return size;
@@ -126,7 +744,7 @@ static size_t sfs_block_write(struct vfs_callback_ctx* ctx, void* src, size_t si
 		return -1;
 	}
 
-	if(!vfs_block_swrite(dev, ctx->fp->offset, size, src)) {
+	if(vfs_block_swrite(dev, ctx->offset, size, src) == -1) {
 		return -1;
 	}
 	return size;
@@ -157,7 +775,65 @@ static int sfs_block_stat(struct vfs_callback_ctx* ctx, vfs_stat_t* dest) {
 	return 0;
 }
 
-void vfs_block_register_dev(char* name, uint64_t start_offset,
+static size_t sfs_stats_print_dir(struct block_stats_dir* dir, char* name,
+	void* dest, size_t size) {
+
+	size_t rsize = 0;
+	sysfs_printf("%s %llu %llu %llu %llu %llu", name, dir->ios, dir->merges,
+		dir->blocks, dir->errors, dir->cycles);
+	for(int i = 0; i < BLOCK_STATS_BUCKETS; i++) {
+		sysfs_printf(" %u", dir->latency[i]);
+	}
+	sysfs_printf("\n");
+	return rsize;
+}
+
+/* Statistics for all devices. Latencies are in TSC cycles, the first line has
+ * the TSC rate to convert them. Each device has a line with its block size,
+ * flush and in-flight counters, followed by one line each for reads and
+ * writes: requests, merges, blocks, errors, total latency and the latency
+ * histogram.
+ */
+static size_t sfs_stats_render(void* dest, size_t size) {
+	uint64_t tsc_khz = 0;
+	uint32_t ticks = timer_tick - boot_tick;
+	if(ticks) {
+		// Divide first, the product overflows after a few months of uptime
+		tsc_khz = (profile_read_rdtsc() - boot_tsc) / ticks * timer_rate / 1000;
+	}
+
+	size_t rsize = 0;
+	sysfs_printf("tsc_khz %llu\n", tsc_khz);
+	for(struct vfs_block_dev* dev = block_devs; dev && rsize < size; dev = dev->next) {
+		struct block_stats* stats = &dev->stats;
+		sysfs_printf("dev %s %d %llu %llu %u %u\n", dev->name, dev->block_size,
+			stats->flushes, stats->flush_cycles, stats->inflight, stats->inflight_max);
+		rsize += sfs_stats_print_dir(&stats->read, "read", dest + rsize, size - rsize);
+		rsize += sfs_stats_print_dir(&stats->write, "write", dest + rsize, size - rsize);
+	}
+	return MIN(rsize, size - 1);
+}
+
+/* The output can be larger than the buffer of the reader, so render all of it
+ * into a kernel buffer and hand out the part at the current offset.
+ */
+static size_t sfs_stats_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
+	size_t buf_size = 64 + num_devs * STATS_DEV_MAX;
+	char* buf = kmalloc(buf_size);
+	size_t len = sfs_stats_render(buf, buf_size);
+
+	if(ctx->offset >= len) {
+		kfree(buf);
+		return 0;
+	}
+
+	size = MIN(size, len - ctx->offset);
+	memcpy(dest, buf + ctx->offset, size);
+	kfree(buf);
+	return size;
+}
+
+struct vfs_block_dev* vfs_block_register_dev(char* name, uint64_t start_offset,
 	vfs_block_read_cb read_cb, vfs_block_write_cb write_cb, void* meta) {
 
 	struct vfs_block_dev* dev = zmalloc(sizeof(struct vfs_block_dev));
@@ -178,15 +854,37 @@ void vfs_block_register_dev(char* name, uint64_t start_offset,
 		.stat = sfs_block_stat,
 	};
 	struct sysfs_file* sfp = sysfs_add_dev(name, &sfs_block_cb);
-	sfp->meta = (void*)dev;
+	if(sfp) {
+		sfp->meta = (void*)dev;
+	}
 
 	// Probe for partitions unless this is a partition
 	if(!dev->start_offset) {
 		vfs_part_probe(dev);
 	}
+	return dev;
+}
+
+// Runs requests that were submitted without anyone waiting for them, and writes back cached data
+static void __attribute__((fastcall, noreturn)) block_worker_entry(worker_t* worker) {
+	while(1) {
+		#ifdef CONFIG_BLOCK_WRITEBACK
+		block_cache_run();
+		#endif
+
+		for(struct vfs_block_dev* dev = block_devs; dev; dev = dev->next) {
+			if(!dev->parent && (dev->queue.pending || dev->queue.completed)) {
+				queue_run(dev);
+			}
+		}
+		scheduler_yield();
+	}
 }
 
 void block_init(void) {
+	boot_tsc = profile_read_rdtsc();
+	boot_tick = timer_tick;
+	bounce_pool = zmalloc_a(BOUNCE_POOL_SIZE * BOUNCE_SIZE);
 	ide_init();
 
 	#ifdef CONFIG_ENABLE_VIRTIO_BLOCK
@@ -195,4 +893,12 @@ void block_init(void) {
 
 	block_null_init();
 	block_random_init();
+
+	worker_t* block_worker = worker_new("kblockd", block_worker_entry);
+	scheduler_add_worker(block_worker);
+
+	struct vfs_callbacks sfs_cb = {
+		.read = sfs_stats_read,
+	};
+	sysfs_add_file("block_stats", &sfs_cb);
 }
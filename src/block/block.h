@@ -19,11 +19,118 @@
  */
 
 #include <stdbool.h>
+#include <spinlock.h>
+
+// Maximum number of blocks adjacent requests get merged into
+#define BLOCK_MERGE_MAX 128
+
+// Latency histogram buckets, bucket n counts requests taking 2^n to 2^(n+1) TSC cycles
+#define BLOCK_STATS_BUCKETS 40
 
 struct vfs_block_dev;
+struct block_request;
 typedef uint64_t (*vfs_block_read_cb)(struct vfs_block_dev* dev, uint64_t lba, uint64_t num_blocks, void* buf);
 typedef uint64_t (*vfs_block_write_cb)(struct vfs_block_dev* dev, uint64_t lba, uint64_t num_blocks, void* buf);
 
+/* Optional driver callback to start a request without waiting for it. The
+ * driver calls vfs_block_complete once the request is done. Returns -1 if
+ * the request could not be started.
+ */
+typedef int (*vfs_block_submit_cb)(struct vfs_block_dev* dev, struct block_request* req);
+
+// Optional driver callback to check for completed requests without interrupts
+typedef void (*vfs_block_poll_cb)(struct vfs_block_dev* dev);
+
+// Optional callback for synchronous drivers to flush the device write cache
+typedef int (*vfs_block_flush_cb)(struct vfs_block_dev* dev);
+typedef void (*block_request_cb)(struct block_request* req);
+
+struct block_request {
+	struct block_request* next;
+	struct vfs_block_dev* dev;
+	bool write;
+
+	/* Flush the write cache of the device. Flush requests wait for all
+	 * requests submitted before them, and have no blocks.
+	 */
+	bool flush;
+
+	// Bypass the write-back cache, used for writing it back
+	bool nocache;
+	uint64_t lba;
+	uint64_t num_blocks;
+	uint8_t* buf;
+
+	/* Called once the request has completed. This may happen in interrupt
+	 * context, depending on the driver.
+	 */
+	block_request_cb callback;
+	void* meta;
+
+	// Number of transferred blocks or -1, valid once done is set
+	uint64_t result;
+	volatile bool done;
+
+	// Internal state of the request queue
+	uint32_t seq;
+	bool dispatched;
+	uint64_t driver_result;
+	struct block_request* completed_next;
+	struct block_request* merged;
+	uint8_t* bounce;
+	struct block_request* parts;
+	uint32_t parts_pending;
+	bool cache_overlay;
+
+	// For use by the driver while the request is in flight
+	void* driver_meta;
+
+	// TSC at submission for statistics, 0 for internal requests
+	uint64_t submit_tsc;
+};
+
+struct block_stats_dir {
+	uint64_t ios;
+	uint64_t merges;
+	uint64_t blocks;
+	uint64_t errors;
+
+	// Sum of request latencies in TSC cycles
+	uint64_t cycles;
+	uint32_t latency[BLOCK_STATS_BUCKETS];
+};
+
+/* Counted per request as submitted, so merges and splits in the queue don't
+ * change the number of requests. Requests to partitions count for both the
+ * partition and the device it is on.
+ */
+struct block_stats {
+	struct block_stats_dir read;
+	struct block_stats_dir write;
+	uint64_t flushes;
+	uint64_t flush_cycles;
+
+	// Submitted requests that have not completed yet
+	uint32_t inflight;
+	uint32_t inflight_max;
+};
+
+struct block_queue {
+	spinlock_t lock;
+
+	// Pending requests, sorted by LBA
+	struct block_request* pending;
+
+	// Requests passed on to the driver, and the ones it has completed
+	struct block_request* active;
+	struct block_request* volatile completed;
+	uint32_t inflight;
+	uint32_t seq;
+
+	// LBA after the last dispatched request, used for the elevator
+	uint64_t head;
+};
+
 struct vfs_block_dev {
 	struct vfs_block_dev* next;
 	char name[50];
@@ -38,11 +145,34 @@ struct vfs_block_dev {
 
 	vfs_block_read_cb read_cb;
 	vfs_block_read_cb write_cb;
+	vfs_block_flush_cb flush_cb;
+
+	// Asynchronous drivers set these after registering
+	vfs_block_submit_cb submit_cb;
+	vfs_block_poll_cb poll_cb;
+	uint32_t queue_depth;
+
+	// Maximum number of blocks per request, larger ones get split up
+	uint64_t max_blocks;
+
+	// Partitions share the queue of the device they are on
+	struct vfs_block_dev* parent;
+	struct block_queue queue;
+	struct block_stats stats;
+
+	// Write-back cache pages of this device that are being written
+	uint32_t writeback;
 
 	// For use by device driver
 	void* meta;
 };
 
+int vfs_block_submit(struct block_request* req);
+uint64_t vfs_block_wait(struct block_request* req);
+void vfs_block_complete(struct block_request* req, uint64_t result);
+int vfs_block_flush(struct vfs_block_dev* dev);
+int vfs_block_sync(void);
+
 uint64_t vfs_block_read(struct vfs_block_dev* dev, uint64_t start_block, uint64_t num_blocks, uint8_t* buf);
 uint64_t vfs_block_write(struct vfs_block_dev* dev, uint64_t start_block, uint64_t num_blocks, uint8_t* buf);
 
@@ -50,7 +180,7 @@ uint64_t vfs_block_sread(struct vfs_block_dev* dev, uint64_t offset, uint64_t si
 uint64_t vfs_block_swrite(struct vfs_block_dev* dev, uint64_t offset, uint64_t size, uint8_t* buf);
 
 struct vfs_block_dev* vfs_block_get_dev(const char* path);
-void vfs_block_register_dev(char* name, uint64_t start_offset,
+struct vfs_block_dev* vfs_block_register_dev(char* name, uint64_t start_offset,
 	vfs_block_read_cb read_cb, vfs_block_write_cb write_cb, void* meta);
 
 void block_init(void);
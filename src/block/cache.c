@@ -0,0 +1,429 @@
+/* cache.c: Write-back caching for block devices
+ * Copyright © 2026 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Writes are copied into page-sized cache entries and complete right away.
+ * kblockd writes them back once they are older than
+ * CONFIG_BLOCK_WRITEBACK_DELAY seconds, or early if more than half of
+ * CONFIG_BLOCK_WRITEBACK_MAX is dirty. Writers that push the amount of dirty
+ * data past the maximum have to write back the oldest data themselves.
+ *
+ * Only written data is cached, and pages are dropped once they are clean.
+ * Reads still go to the device, but get cached sectors copied over the
+ * result, or are served from the cache if it has all of the sectors.
+ */
+
+#ifdef CONFIG_BLOCK_WRITEBACK
+
+#include <block/cache.h>
+#include <bsp/timer.h>
+#include <mem/kmalloc.h>
+#include <tasks/scheduler.h>
+#include <spinlock.h>
+#include <string.h>
+#include <log.h>
+
+#define HASH_SIZE 1024
+
+// Pages written back at once, submitted together so the queue can merge them
+#define BATCH_SIZE 32
+#define MAX_DIRTY (CONFIG_BLOCK_WRITEBACK_MAX * 1024 / PAGE_SIZE)
+
+struct cache_page {
+	struct cache_page* hash_next;
+	struct cache_page* dirty_next;
+	struct cache_page* dirty_prev;
+	struct vfs_block_dev* dev;
+	uint64_t page;
+
+	// Bitmaps of sectors that have data in the cache / still need writing
+	uint32_t valid;
+	uint32_t dirty;
+
+	// Tick at which the page became dirty, the dirty list is sorted by it
+	uint32_t dirtied;
+
+	// Number of writebacks of this page in flight
+	uint32_t busy;
+	uint8_t* data;
+};
+
+struct wb_page {
+	struct cache_page* cp;
+	uint32_t mask;
+	bool failed;
+};
+
+static spinlock_t lock;
+static struct cache_page* hash[HASH_SIZE];
+static struct cache_page* dirty_head;
+static struct cache_page* dirty_tail;
+static uint32_t num_pages;
+static uint32_t num_dirty;
+
+static inline bool cacheable(struct vfs_block_dev* dev) {
+	return dev->block_size <= PAGE_SIZE && !(PAGE_SIZE % dev->block_size)
+		&& PAGE_SIZE / dev->block_size <= 32;
+}
+
+static inline uint32_t sector_mask(uint32_t first, uint32_t count) {
+	return (count >= 32 ? 0xffffffff : (1U << count) - 1) << first;
+}
+
+static inline struct cache_page** hash_slot(struct vfs_block_dev* dev, uint64_t page) {
+	return &hash[(page ^ ((uint64_t)dev->number << 20)) % HASH_SIZE];
+}
+
+static struct cache_page* get_page(struct vfs_block_dev* dev, uint64_t page, bool create) {
+	struct cache_page** slot = hash_slot(dev, page);
+	for(struct cache_page* cp = *slot; cp; cp = cp->hash_next) {
+		if(cp->dev == dev && cp->page == page) {
+			return cp;
+		}
+	}
+
+	if(!create) {
+		return NULL;
+	}
+
+	struct cache_page* cp = zmalloc(sizeof(struct cache_page));
+	cp->data = kmalloc(PAGE_SIZE);
+	cp->dev = dev;
+	cp->page = page;
+	cp->hash_next = *slot;
+	*slot = cp;
+	num_pages++;
+	return cp;
+}
+
+static void drop_page(struct cache_page* cp) {
+	struct cache_page** pos = hash_slot(cp->dev, cp->page);
+	while(*pos != cp) {
+		pos = &(*pos)->hash_next;
+	}
+	*pos = cp->hash_next;
+	num_pages--;
+
+	kfree(cp->data);
+	kfree(cp);
+}
+
+static void dirty_add(struct cache_page* cp) {
+	cp->dirtied = timer_tick;
+	cp->dirty_next = NULL;
+	cp->dirty_prev = dirty_tail;
+	if(dirty_tail) {
+		dirty_tail->dirty_next = cp;
+	} else {
+		dirty_head = cp;
+	}
+	dirty_tail = cp;
+	num_dirty++;
+}
+
+static void dirty_remove(struct cache_page* cp) {
+	if(cp->dirty_prev) {
+		cp->dirty_prev->dirty_next = cp->dirty_next;
+	} else {
+		dirty_head = cp->dirty_next;
+	}
+
+	if(cp->dirty_next) {
+		cp->dirty_next->dirty_prev = cp->dirty_prev;
+	} else {
+		dirty_tail = cp->dirty_prev;
+	}
+	num_dirty--;
+}
+
+/* Write back up to BATCH_SIZE dirty pages that became dirty before tick
+ * before, oldest first. With dev set, only pages of that device are written.
+ * Returns the number of pages or -1 if any of the writes failed.
+ *
+ * Pages that are still being written by another writeback are skipped, as
+ * their older copy could otherwise land on the disk after the newer one. If
+ * busy is set, it reports whether any were.
+ */
+static int writeback(struct vfs_block_dev* dev, uint32_t before, bool* busy) {
+	struct wb_page pages[BATCH_SIZE];
+	int num = 0;
+
+	if(busy) {
+		*busy = false;
+	}
+
+	if(!spinlock_get(&lock, -1)) {
+		return -1;
+	}
+
+	struct cache_page* next;
+	for(struct cache_page* cp = dirty_head; cp && num < BATCH_SIZE; cp = next) {
+		next = cp->dirty_next;
+		if((int32_t)(cp->dirtied - before) >= 0) {
+			break;
+		}
+
+		if(dev && cp->dev != dev) {
+			continue;
+		}
+
+		if(cp->busy) {
+			if(busy) {
+				*busy = true;
+			}
+			continue;
+		}
+
+		dirty_remove(cp);
+		pages[num].cp = cp;
+		pages[num].mask = cp->dirty;
+		pages[num].failed = false;
+		cp->dirty = 0;
+		cp->busy++;
+		__sync_add_and_fetch(&cp->dev->writeback, 1);
+		num++;
+	}
+
+	if(!num) {
+		spinlock_release(&lock);
+		return 0;
+	}
+
+	// Writers can modify the pages while they are written, so write a copy
+	uint8_t* buf = kmalloc(num * PAGE_SIZE);
+	int num_reqs = 0;
+	for(int i = 0; i < num; i++) {
+		memcpy(buf + i * PAGE_SIZE, pages[i].cp->data, PAGE_SIZE);
+		num_reqs += __builtin_popcount(pages[i].mask);
+	}
+	spinlock_release(&lock);
+
+	// One request for each run of dirty sectors
+	struct block_request* reqs = zmalloc(sizeof(struct block_request) * num_reqs);
+	struct block_request* req = reqs;
+	for(int i = 0; i < num; i++) {
+		struct cache_page* cp = pages[i].cp;
+		uint32_t spp = PAGE_SIZE / cp->dev->block_size;
+		uint32_t mask = pages[i].mask;
+
+		while(mask) {
+			uint32_t first = __builtin_ctz(mask);
+			uint32_t rest = ~(mask >> first);
+			uint32_t count = rest ? MIN(__builtin_ctz(rest), spp - first) : spp - first;
+			mask &= ~sector_mask(first, count);
+
+			req->dev = cp->dev;
+			req->write = true;
+			req->nocache = true;
+			req->lba = cp->page * spp + first;
+			req->num_blocks = count;
+			req->buf = buf + i * PAGE_SIZE + first * cp->dev->block_size;
+			req->meta = &pages[i];
+			vfs_block_submit(req++);
+		}
+	}
+
+	bool failed = false;
+	for(struct block_request* r = reqs; r < req; r++) {
+		if(vfs_block_wait(r) != r->num_blocks) {
+			((struct wb_page*)r->meta)->failed = true;
+			failed = true;
+		}
+	}
+
+	kfree(reqs);
+	kfree(buf);
+
+	spinlock_get(&lock, -1);
+	for(int i = 0; i < num; i++) {
+		struct cache_page* cp = pages[i].cp;
+		cp->busy--;
+		__sync_sub_and_fetch(&cp->dev->writeback, 1);
+
+		// Keep the data around and try again later
+		if(pages[i].failed) {
+			log(LOG_ERR, "block: Write-back of %s block %llu failed\n", cp->dev->name,
+				cp->page * (PAGE_SIZE / cp->dev->block_size));
+
+			if(!cp->dirty) {
+				dirty_add(cp);
+			}
+			cp->dirty |= pages[i].mask;
+		}
+
+		if(!cp->dirty && !cp->busy) {
+			drop_page(cp);
+		}
+	}
+	spinlock_release(&lock);
+	return failed ? -1 : num;
+}
+
+/* Copy a write into the cache. Returns false if the device can't be cached,
+ * in which case the write has to go to the device directly.
+ */
+bool block_cache_write(struct vfs_block_dev* dev, uint64_t lba, uint64_t num_blocks, uint8_t* buf) {
+	if(!cacheable(dev)) {
+		return false;
+	}
+
+	uint32_t spp = PAGE_SIZE / dev->block_size;
+	if(!spinlock_get(&lock, -1)) {
+		return false;
+	}
+
+	while(num_blocks) {
+		uint32_t first = lba % spp;
+		uint32_t count = MIN(num_blocks, spp - first);
+		struct cache_page* cp = get_page(dev, lba / spp, true);
+
+		memcpy(cp->data + first * dev->block_size, buf, count * dev->block_size);
+		if(!cp->dirty) {
+			dirty_add(cp);
+		}
+
+		uint32_t mask = sector_mask(first, count);
+		cp->valid |= mask;
+		cp->dirty |= mask;
+
+		lba += count;
+		num_blocks -= count;
+		buf += count * dev->block_size;
+	}
+	spinlock_release(&lock);
+
+	// Throttle writers that produce dirty data faster than the disk takes it
+	while(num_dirty > MAX_DIRTY && writeback(NULL, timer_tick + 1, NULL) > 0);
+	return true;
+}
+
+/* Copy cached sectors over a buffer read from the device. If partial is not
+ * set, only copies anything if all of the sectors are cached. Returns true if
+ * they were.
+ */
+bool block_cache_read(struct vfs_block_dev* dev, uint64_t lba, uint64_t num_blocks,
+	uint8_t* buf, bool partial) {
+
+	if(!num_pages || !cacheable(dev)) {
+		return false;
+	}
+
+	uint32_t spp = PAGE_SIZE / dev->block_size;
+	if(!spinlock_get(&lock, -1)) {
+		return false;
+	}
+
+	if(!partial) {
+		for(uint64_t pos = lba; pos < lba + num_blocks;) {
+			uint32_t first = pos % spp;
+			uint32_t count = MIN(lba + num_blocks - pos, spp - first);
+			uint32_t mask = sector_mask(first, count);
+			struct cache_page* cp = get_page(dev, pos / spp, false);
+
+			if(!cp || (cp->valid & mask) != mask) {
+				spinlock_release(&lock);
+				return false;
+			}
+			pos += count;
+		}
+	}
+
+	bool all = true;
+	while(num_blocks) {
+		uint32_t first = lba % spp;
+		uint32_t count = MIN(num_blocks, spp - first);
+		uint32_t mask = sector_mask(first, count);
+		struct cache_page* cp = get_page(dev, lba / spp, false);
+
+		if(!cp || (cp->valid & mask) != mask) {
+			all = false;
+		}
+
+		if(cp) {
+			for(uint32_t i = first; i < first + count; i++) {
+				if(cp->valid & (1U << i)) {
+					memcpy(buf + (i - first) * dev->block_size,
+						cp->data + i * dev->block_size, dev->block_size);
+				}
+			}
+		}
+
+		lba += count;
+		num_blocks -= count;
+		buf += count * dev->block_size;
+	}
+
+	spinlock_release(&lock);
+	return all;
+}
+
+bool block_cache_has_data(void) {
+	return num_pages;
+}
+
+size_t block_cache_size(void) {
+	return num_pages * PAGE_SIZE;
+}
+
+/* Write back everything that was written to dev before this call, and wait
+ * for writebacks that are already in flight.
+ */
+int block_cache_sync(struct vfs_block_dev* dev) {
+	uint32_t before = timer_tick + 1;
+	int result = 0;
+	int r;
+
+	/* Pages that fail get dirtied again with a later tick, so this terminates.
+	 * Pages skipped because another writeback had them in flight are retried
+	 * once that is done.
+	 */
+	bool busy;
+	do {
+		while((r = writeback(dev, before, &busy))) {
+			if(r < 0) {
+				result = -1;
+			}
+		}
+
+		if(busy) {
+			scheduler_yield();
+		}
+	} while(busy);
+
+	while(dev->writeback) {
+		scheduler_yield();
+	}
+	return result;
+}
+
+// Called by kblockd
+void block_cache_run(void) {
+	if(!dirty_head) {
+		return;
+	}
+
+	if(num_dirty > MAX_DIRTY / 2) {
+		writeback(NULL, timer_tick + 1, NULL);
+		return;
+	}
+
+	uint32_t delay = CONFIG_BLOCK_WRITEBACK_DELAY * timer_rate;
+	writeback(NULL, timer_tick - delay, NULL);
+}
+
+#endif /* CONFIG_BLOCK_WRITEBACK */
@@ -0,0 +1,32 @@
+#pragma once
+
+/* Copyright © 2026 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <block/block.h>
+
+/* All of these take the device that owns the request queue and absolute
+ * LBAs, so partitions share the cache of their device.
+ */
+bool block_cache_write(struct vfs_block_dev* dev, uint64_t lba, uint64_t num_blocks, uint8_t* buf);
+bool block_cache_read(struct vfs_block_dev* dev, uint64_t lba, uint64_t num_blocks, uint8_t* buf, bool partial);
+bool block_cache_has_data(void);
+size_t block_cache_size(void);
+int block_cache_sync(struct vfs_block_dev* dev);
+void block_cache_run(void);
@@ -23,10 +23,17 @@
 
 #include <log.h>
 #include <mem/kmalloc.h>
+#include <mem/vm.h>
 #include <int/int.h>
 #include <portio.h>
 #include <block/i386-ide.h>
 #include <block/block.h>
+#include <bsp/i386-pci.h>
+#include <tasks/task.h>
+
+// Maximum number of sectors per command, for both PIO and DMA
+#define MAX_SECTORS 256
+#define PRDT_ENTRIES 64
 
 struct ata_identify {
 	uint16_t flags;
@@ -43,16 +50,38 @@ struct ata_identify {
 	uint16_t unused5[5];
 	uint16_t size_of_rw_mult;
 	uint32_t sectors_28;
-	uint16_t unused6[38];
+	uint16_t unused6[20];
+	uint16_t command_sets[6];
+	uint16_t unused7[12];
 	uint64_t sectors_48;
-	uint16_t unused7[152];
+	uint16_t unused8[152];
 };
 
+// Physical region descriptor, describes one buffer of a DMA transfer
+struct prd {
+	uint32_t addr;
+	// 0 means 64 KiB
+	uint16_t size;
+	uint16_t flags;
+} __attribute__((packed));
+
 struct ide_dev {
 	uint16_t bus;
+	uint16_t ctrl;
 	uint8_t slave;
+	bool lba48;
+
+	// Bus master IDE registers, 0 if DMA is unavailable
+	uint16_t bmide;
+	struct prd* prdt;
+	uint32_t prdt_phys;
+
+	// Request the current DMA or flush command belongs to
+	struct block_request* current;
 };
 
+static struct ide_dev* primary = NULL;
+
 static void inportsm(unsigned short port, unsigned char * data, unsigned long size) {
 	asm volatile ("rep insw" : "+D" (data), "+c" (size) : "d" (port) : "memory");
 }
@@ -62,10 +91,10 @@ static void outportsm(unsigned short port, unsigned char * data, unsigned long s
 }
 
 static void ata_io_wait(struct ide_dev* dev) {
-	inb(dev->bus + ATA_REG_ALTSTATUS);
-	inb(dev->bus + ATA_REG_ALTSTATUS);
-	inb(dev->bus + ATA_REG_ALTSTATUS);
-	inb(dev->bus + ATA_REG_ALTSTATUS);
+	inb(dev->ctrl);
+	inb(dev->ctrl);
+	inb(dev->ctrl);
+	inb(dev->ctrl);
 }
 
 static int ata_wait(struct ide_dev* dev, int advanced) {
@@ -93,14 +122,37 @@ static void ata_wait_ready(struct ide_dev* dev) {
 	while (inb(dev->bus + ATA_REG_STATUS) & ATA_SR_BSY);
 }
 
-static struct ide_dev* ide_init_device(uint16_t bus) {
+/* Set up the task file for a command on num sectors starting at lba. Returns
+ * the 48-bit variant of the command when it has to be used.
+ */
+static uint8_t ata_setup_lba(struct ide_dev* dev, uint64_t lba, uint32_t num, uint8_t cmd, uint8_t cmd_ext) {
+	if(dev->lba48) {
+		outb(dev->bus + ATA_REG_HDDEVSEL, 0x40 | dev->slave << 4);
+		outb(dev->bus + ATA_REG_SECCOUNT0, (num >> 8) & 0xff);
+		outb(dev->bus + ATA_REG_LBA0, (lba >> 24) & 0xff);
+		outb(dev->bus + ATA_REG_LBA1, (lba >> 32) & 0xff);
+		outb(dev->bus + ATA_REG_LBA2, (lba >> 40) & 0xff);
+	} else {
+		outb(dev->bus + ATA_REG_HDDEVSEL, 0xe0 | dev->slave << 4 | ((lba >> 24) & 0x0f));
+	}
+
+	outb(dev->bus + ATA_REG_FEATURES, 0x00);
+	outb(dev->bus + ATA_REG_SECCOUNT0, num & 0xff);
+	outb(dev->bus + ATA_REG_LBA0, lba & 0xff);
+	outb(dev->bus + ATA_REG_LBA1, (lba >> 8) & 0xff);
+	outb(dev->bus + ATA_REG_LBA2, (lba >> 16) & 0xff);
+	return dev->lba48 ? cmd_ext : cmd;
+}
+
+static struct ide_dev* ide_init_device(uint16_t bus, uint16_t ctrl) {
 	struct ide_dev* dev = zmalloc(sizeof(struct ide_dev));
 	dev->bus = bus;
+	dev->ctrl = ctrl;
 	dev->slave = 0;
 
 	log(LOG_INFO, "ide: Initializing IDE device on bus %#x\n", dev->bus);
 	outb(dev->bus + 1, 1);
-	outb(dev->bus + 0x306, 0);
+	outb(dev->ctrl, 0);
 
 	ata_select(dev);
 	ata_io_wait(dev);
@@ -123,88 +175,238 @@ static struct ide_dev* ide_init_device(uint16_t bus) {
 		ptr[i] = tmp;
 	}
 
-	outb(dev->bus + ATA_REG_CONTROL, 0x02);
+	dev->lba48 = device.command_sets[1] & (1 << 10);
 	return dev;
 }
-static inline int do_read(struct ide_dev* dev, uint64_t lba, void* buf) {
+
+static inline int do_read(struct ide_dev* dev, uint64_t lba, uint32_t num, void* buf) {
 	int errors = 0;
 try_again:
-	outb(dev->bus + ATA_REG_CONTROL, 0x02);
+	ata_wait_ready(dev);
+	uint8_t cmd = ata_setup_lba(dev, lba, num, ATA_CMD_READ_PIO, ATA_CMD_READ_PIO_EXT);
+	outb(dev->bus + ATA_REG_COMMAND, cmd);
+
+	for(uint32_t i = 0; i < num; i++) {
+		if (ata_wait(dev, 1)) {
+			errors++;
+			if (errors > 4) {
+				log(LOG_WARN, "ide: Too many errors during read of lba block %u. Bailing.\n", lba);
+				return -1;
+			}
+			goto try_again;
+		}
+
+		inportsm(dev->bus, buf + i * 512, 256);
+	}
+
+	ata_wait(dev, 0);
+	return 0;
+}
 
+static inline int do_write(struct ide_dev* dev, uint64_t lba, uint32_t num, void* buf) {
 	ata_wait_ready(dev);
+	uint8_t cmd = ata_setup_lba(dev, lba, num, ATA_CMD_WRITE_PIO, ATA_CMD_WRITE_PIO_EXT);
+	outb(dev->bus + ATA_REG_COMMAND, cmd);
 
-	outb(dev->bus + ATA_REG_HDDEVSEL,  0xe0 | dev->slave << 4 |
-								 (lba & 0x0f000000) >> 24);
-	outb(dev->bus + ATA_REG_FEATURES, 0x00);
-	outb(dev->bus + ATA_REG_SECCOUNT0, 1);
-	outb(dev->bus + ATA_REG_LBA0, (lba & 0x000000ff) >>  0);
-	outb(dev->bus + ATA_REG_LBA1, (lba & 0x0000ff00) >>  8);
-	outb(dev->bus + ATA_REG_LBA2, (lba & 0x00ff0000) >> 16);
-	outb(dev->bus + ATA_REG_COMMAND, ATA_CMD_READ_PIO);
-
-	if (ata_wait(dev, 1)) {
-		errors++;
-		if (errors > 4) {
-			log(LOG_WARN, "ide: Too many errors during read of lba block %u. Bailing.\n", lba);
+	for(uint32_t i = 0; i < num; i++) {
+		if(ata_wait(dev, 1)) {
+			log(LOG_WARN, "ide: Error during write of lba block %u.\n", lba + i);
 			return -1;
 		}
-		goto try_again;
+		outportsm(dev->bus, buf + i * 512, 256);
 	}
 
-	int size = 256;
-	inportsm(dev->bus, buf, size);
 	ata_wait(dev, 0);
 	return 0;
+}
 
+static uint64_t pio_rw(struct ide_dev* dev, bool write, uint64_t lba, uint64_t num_blocks, void* buf) {
+	for(uint64_t done = 0; done < num_blocks; done += MAX_SECTORS) {
+		uint32_t num = MIN(MAX_SECTORS, num_blocks - done);
+		void* nbuf = buf + done * 512;
+		int ret = write ? do_write(dev, lba + done, num, nbuf) : do_read(dev, lba + done, num, nbuf);
+		if(ret < 0) {
+			return done ? done : -1;
+		}
+	}
+	return num_blocks;
 }
 
 static uint64_t ide_read_cb(struct vfs_block_dev* block_dev, uint64_t lba, uint64_t num_blocks, void* buf) {
+	return pio_rw((struct ide_dev*)block_dev->meta, false, lba, num_blocks, buf);
+}
+
+static uint64_t ide_write_cb(struct vfs_block_dev* block_dev, uint64_t lba, uint64_t num_blocks, void* buf) {
+	return pio_rw((struct ide_dev*)block_dev->meta, true, lba, num_blocks, buf);
+}
+
+// Only used with PIO, the write cache is flushed through ide_submit_cb with DMA
+static int ide_flush_cb(struct vfs_block_dev* block_dev) {
 	struct ide_dev* dev = (struct ide_dev*)block_dev->meta;
+	ata_wait_ready(dev);
+	outb(dev->bus + ATA_REG_HDDEVSEL, 0xe0 | dev->slave << 4);
+	outb(dev->bus + ATA_REG_COMMAND, dev->lba48 ? ATA_CMD_CACHE_FLUSH_EXT : ATA_CMD_CACHE_FLUSH);
+	ata_wait(dev, 0);
+	return inb(dev->bus + ATA_REG_STATUS) & (ATA_SR_ERR | ATA_SR_DF) ? -1 : 0;
+}
+
+/* Fill the PRD table for a buffer. Regions must not cross a 64 KiB
+ * boundary. Returns the number of entries or -1.
+ */
+static int build_prdt(struct ide_dev* dev, uint8_t* buf, size_t size) {
+	if((uintptr_t)buf & 1) {
+		return -1;
+	}
+
+	int num = 0;
+	while(size) {
+		size_t chunk = MIN(size, PAGE_SIZE - ((uintptr_t)buf % PAGE_SIZE));
+		uint32_t phys = (uint32_t)valloc_translate(VM_KERNEL, buf, false);
+		if(!phys) {
+			return -1;
+		}
 
-	for(int i = 0; i < num_blocks; i++) {
-		if(do_read(dev, lba + i, buf + i * 512) < 0) {
-			return i;
+		struct prd* prev = num ? &dev->prdt[num - 1] : NULL;
+		uint32_t prev_size = prev ? (prev->size ? prev->size : 0x10000) : 0;
+		if(prev && prev->addr + prev_size == phys
+			&& (prev->addr >> 16) == ((phys + chunk - 1) >> 16)) {
+			prev->size = prev_size + chunk;
+		} else {
+			if(num == PRDT_ENTRIES) {
+				return -1;
+			}
+
+			dev->prdt[num].addr = phys;
+			dev->prdt[num].size = chunk;
+			dev->prdt[num].flags = 0;
+			num++;
 		}
+
+		buf += chunk;
+		size -= chunk;
 	}
 
-	return num_blocks;
+	dev->prdt[num - 1].flags = PRD_FLAG_EOT;
+	return num;
 }
 
-static inline int do_write(struct ide_dev* dev, uint64_t lba, void* buf) {
-	outb(dev->bus + ATA_REG_CONTROL, 0x02);
+// Finish the current command. Needs interrupts disabled.
+static void complete_current(struct ide_dev* dev) {
+	uint8_t bm_status = inb(dev->bmide + BMIDE_REG_STATUS);
+	outb(dev->bmide + BMIDE_REG_COMMAND, 0);
 
-	ata_wait_ready(dev);
+	// Reading the status register also acknowledges the interrupt
+	uint8_t status = inb(dev->bus + ATA_REG_STATUS);
+	outb(dev->bmide + BMIDE_REG_STATUS, BMIDE_STATUS_IRQ | BMIDE_STATUS_ERR);
 
-	outb(dev->bus + ATA_REG_HDDEVSEL,  0xe0 | dev->slave << 4 |
-								 (lba & 0x0f000000) >> 24);
-	ata_wait(dev, 0);
-	outb(dev->bus + ATA_REG_FEATURES, 0x00);
-	outb(dev->bus + ATA_REG_SECCOUNT0, 0x01);
-	outb(dev->bus + ATA_REG_LBA0, (lba & 0x000000ff) >>  0);
-	outb(dev->bus + ATA_REG_LBA1, (lba & 0x0000ff00) >>  8);
-	outb(dev->bus + ATA_REG_LBA2, (lba & 0x00ff0000) >> 16);
-	outb(dev->bus + ATA_REG_COMMAND, ATA_CMD_WRITE_PIO);
-	ata_wait(dev, 0);
-	int size = 256;
-	outportsm(dev->bus, buf, size);
-	outb(dev->bus + 0x07, ATA_CMD_CACHE_FLUSH);
-	ata_wait(dev, 0);
-	return 0;
+	struct block_request* req = dev->current;
+	dev->current = NULL;
+	if(!req) {
+		return;
+	}
+
+	uint64_t result = req->flush ? 0 : req->num_blocks;
+	if((status & (ATA_SR_ERR | ATA_SR_DF)) || (bm_status & BMIDE_STATUS_ERR)) {
+		log(LOG_WARN, "ide: DMA command for lba %u failed, status %#x bus master status %#x\n",
+			req->lba, status, bm_status);
+		result = -1;
+	}
+	vfs_block_complete(req, result);
 }
 
-static uint64_t ide_write_cb(struct vfs_block_dev* block_dev, uint64_t lba, uint64_t num_blocks, void* buf) {
+static void int_handler(task_t* task, isf_t* state, int num) {
+	if(!primary->bmide) {
+		inb(primary->bus + ATA_REG_STATUS);
+		return;
+	}
+
+	if(inb(primary->bmide + BMIDE_REG_STATUS) & BMIDE_STATUS_IRQ) {
+		complete_current(primary);
+	}
+}
+
+static void ide_poll_cb(struct vfs_block_dev* block_dev) {
 	struct ide_dev* dev = (struct ide_dev*)block_dev->meta;
 
-	for(int i = 0; i < num_blocks; i++) {
-		if(do_write(dev, lba + i, buf + i * 512) < 0) {
-			return i;
-		}
+	int_disable();
+	if(dev->current && (inb(dev->bmide + BMIDE_REG_STATUS) & BMIDE_STATUS_IRQ)) {
+		complete_current(dev);
 	}
+	int_enable();
+}
 
-	return num_blocks;
+static int ide_submit_cb(struct vfs_block_dev* block_dev, struct block_request* req) {
+	struct ide_dev* dev = (struct ide_dev*)block_dev->meta;
+
+	int_disable();
+	if(req->flush) {
+		dev->current = req;
+		ata_wait_ready(dev);
+		outb(dev->bus + ATA_REG_HDDEVSEL, 0xe0 | dev->slave << 4);
+		outb(dev->bus + ATA_REG_COMMAND, dev->lba48 ? ATA_CMD_CACHE_FLUSH_EXT : ATA_CMD_CACHE_FLUSH);
+		int_enable();
+		return 0;
+	}
+
+	// Buffers DMA can't handle go through PIO
+	if(build_prdt(dev, req->buf, req->num_blocks * 512) < 0) {
+		int_enable();
+		vfs_block_complete(req, pio_rw(dev, req->write, req->lba, req->num_blocks, req->buf));
+		return 0;
+	}
+
+	dev->current = req;
+	uint8_t bm_cmd = req->write ? 0 : BMIDE_CMD_READ;
+	outl(dev->bmide + BMIDE_REG_PRDT, dev->prdt_phys);
+	outb(dev->bmide + BMIDE_REG_COMMAND, bm_cmd);
+	outb(dev->bmide + BMIDE_REG_STATUS, BMIDE_STATUS_IRQ | BMIDE_STATUS_ERR);
+
+	ata_wait_ready(dev);
+	uint8_t cmd = req->write ?
+		ata_setup_lba(dev, req->lba, req->num_blocks, ATA_CMD_WRITE_DMA, ATA_CMD_WRITE_DMA_EXT) :
+		ata_setup_lba(dev, req->lba, req->num_blocks, ATA_CMD_READ_DMA, ATA_CMD_READ_DMA_EXT);
+	outb(dev->bus + ATA_REG_COMMAND, cmd);
+	outb(dev->bmide + BMIDE_REG_COMMAND, bm_cmd | BMIDE_CMD_START);
+	int_enable();
+	return 0;
+}
+
+static int pci_cb(pci_device_t* pci_dev) {
+	if(pci_dev->class != PCI_CLASS_STORAGE || pci_dev->subclass != 0x01) {
+		return 1;
+	}
+
+	uint32_t bar = pci_get_bar(pci_dev, 4);
+	if(!(bar & 0x1)) {
+		return 1;
+	}
+
+	primary->bmide = bar & 0xfffc;
+
+	// Enable bus mastering
+	uint32_t command = pci_config_read(pci_dev, 0x04, 4);
+	pci_config_write(pci_dev, 0x04, command | 0x4);
+	return 0;
 }
 
 void ide_init(void) {
-	struct ide_dev* dev = ide_init_device(0x1F0);
-	vfs_block_register_dev("ide1", 0, ide_read_cb, ide_write_cb, (void*)dev);
+	primary = ide_init_device(0x1F0, 0x3F6);
+	int_register(IRQ(14), int_handler, false);
+
+	struct vfs_block_dev* block_dev = vfs_block_register_dev("ide1", 0, ide_read_cb, ide_write_cb, (void*)primary);
+	block_dev->flush_cb = ide_flush_cb;
+	pci_walk(pci_cb);
+	if(!primary->bmide) {
+		log(LOG_INFO, "ide: No bus master IDE controller found, using PIO\n");
+		return;
+	}
+
+	primary->prdt = zmalloc_a(sizeof(struct prd) * PRDT_ENTRIES);
+	primary->prdt_phys = (uint32_t)valloc_translate(VM_KERNEL, primary->prdt, false);
+	log(LOG_INFO, "ide: Using bus master DMA at %#x%s\n", primary->bmide, primary->lba48 ? ", LBA48" : "");
+
+	block_dev->max_blocks = MAX_SECTORS;
+	block_dev->queue_depth = 1;
+	block_dev->poll_cb = ide_poll_cb;
+	block_dev->submit_cb = ide_submit_cb;
 }
@@ -95,6 +95,22 @@
 #define ATA_REG_ALTSTATUS  0x0C
 #define ATA_REG_DEVADDRESS 0x0D
 
+// Bus master IDE registers, relative to BAR4
+#define BMIDE_REG_COMMAND  0x00
+#define BMIDE_REG_STATUS   0x02
+#define BMIDE_REG_PRDT     0x04
+
+#define BMIDE_CMD_START    0x01
+// Bus master writes to memory, i.e. the disk is read
+#define BMIDE_CMD_READ     0x08
+
+#define BMIDE_STATUS_ACTIVE 0x01
+#define BMIDE_STATUS_ERR   0x02
+#define BMIDE_STATUS_IRQ   0x04
+
+// Marks the last entry of a PRD table
+#define PRD_FLAG_EOT       0x8000
+
 // Channels:
 #define ATA_PRIMARY      0x00
 #define ATA_SECONDARY    0x01
@@ -48,7 +48,9 @@ void vfs_part_probe(struct vfs_block_dev* dev) {
 		}
 
 		sprintf(pname, "%sp%d", dev->name, i);
-		vfs_block_register_dev(pname, part->start, dev->read_cb, dev->write_cb, dev->meta);
+		struct vfs_block_dev* pdev = vfs_block_register_dev(pname, part->start,
+			dev->read_cb, dev->write_cb, dev->meta);
+		pdev->parent = dev;
 		log(LOG_INFO, "part: /dev/%s: MBR part %d /dev/%s type %x size %#x\n",
 			dev->name, i, pname, part->type, part->size);
 	}
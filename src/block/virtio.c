@@ -49,90 +49,226 @@
 #define VIRTIO_BLK_S_IOERR 1
 #define VIRTIO_BLK_S_UNSUPP 2
 
+// Offsets of the device-specific configuration in the legacy IO space
+#define VIRTIO_BLK_CFG_SIZE_MAX 0x1c
+#define VIRTIO_BLK_CFG_SEG_MAX 0x20
+
+#define FEATURES_WANT (VIRTIO_BLK_F_SIZE_MAX | VIRTIO_BLK_F_SEG_MAX \
+	| VIRTIO_BLK_F_RO | VIRTIO_BLK_F_FLUSH)
+
+// Enough segments for BLOCK_MERGE_MAX blocks at any buffer alignment
+#define MAX_SEGMENTS 17
+
 struct virtio_blk_req {
 	uint32_t type;
 	uint32_t reserved;
 	uint64_t sector;
 };
 
+/* Per-request state, indexed by the first descriptor of the request. Aligned
+ * so header and status never cross a page boundary.
+ */
+struct request_slot {
+	struct virtio_blk_req hdr;
+	volatile uint8_t status;
+	bool polled;
+	struct block_request* req;
+} __attribute__((aligned(32)));
+
 static struct virtio_dev* dev = NULL;
+static struct request_slot* slots = NULL;
+static uint32_t max_segments;
+static uint32_t size_max;
+
 static uint32_t vendor_device_combos[][2] = {
 	{0x1AF4, 0x1001}, {0x1AF4, 0x1042}, {(uint32_t)NULL}
 };
 
+// Reap completed requests from the used ring. Needs interrupts disabled.
+static void process_used() {
+	struct virtqueue* queue = &dev->queues[0];
+
+	while((uint16_t)queue->used_index != queue->used->idx) {
+		struct virtq_used_elem* el = &queue->used->ring[queue->used_index % queue->size];
+		queue->used_index++;
+
+		struct request_slot* slot = &slots[el->id];
+		struct block_request* req = slot->req;
+		slot->req = NULL;
+		virtio_free_descs(queue, el->id);
+
+		if(!req) {
+			continue;
+		}
+
+		uint64_t result = req->flush ? 0 : req->num_blocks;
+		if(slot->status != VIRTIO_BLK_S_OK) {
+			log(LOG_ERR, "virtio_block: Request type %d, lba %d failed with status %d\n",
+				slot->hdr.type, slot->hdr.sector, slot->status);
+			result = -1;
+		}
+
+		if(slot->polled) {
+			req->result = result;
+			req->done = true;
+		} else {
+			vfs_block_complete(req, result);
+		}
+	}
+}
+
 static void int_handler(task_t* task, isf_t* state, int num) {
+	// Reading the ISR status acknowledges the interrupt
 	inb(dev->pci_dev->iobase + 0x13);
+	process_used();
 }
 
-static uint64_t send_request(struct virtio_dev* rdev, int type, uint64_t lba, uint64_t num_blocks, void* buf) {
-	if(num_blocks < 1) {
-		return -1;
+/* Translate a buffer into physically contiguous segments, honouring the
+ * maximum segment size of the device. Returns the number of segments or -1.
+ */
+static int map_buffer(uint8_t* buf, size_t size, void** addrs, size_t* lengths) {
+	int num = 0;
+	while(size) {
+		size_t chunk = MIN(size, PAGE_SIZE - ((uintptr_t)buf % PAGE_SIZE));
+		chunk = MIN(chunk, size_max);
+
+		void* phys = valloc_translate(VM_KERNEL, buf, false);
+		if(!phys) {
+			return -1;
+		}
+
+		if(num && addrs[num - 1] + lengths[num - 1] == phys
+			&& lengths[num - 1] + chunk <= size_max) {
+			lengths[num - 1] += chunk;
+		} else {
+			if(num == max_segments) {
+				return -1;
+			}
+
+			addrs[num] = phys;
+			lengths[num] = chunk;
+			num++;
+		}
+
+		buf += chunk;
+		size -= chunk;
 	}
+	return num;
+}
 
-	if(!(rdev->status & VIRTIO_PCI_STATUS_DRIVER_OK)) {
+static int send_request(struct block_request* req, bool polled) {
+	if(!(dev->status & VIRTIO_PCI_STATUS_DRIVER_OK)) {
 		return -1;
 	}
 
-	struct virtio_blk_req hdr = {
-		.type = type,
-		.reserved = 0,
-		.sector = lba
-	};
-
-	volatile uint8_t status = 0xff;
-	void* buffers[] = {
-		valloc_translate(VM_KERNEL, &hdr, false),
-		valloc_translate(VM_KERNEL, buf, false),
-		valloc_translate(VM_KERNEL, (void*)&status, false),
-	};
-
-	if(!(buffers[0] && buffers[1] && buffers[2])) {
-		log(LOG_ERR, "virtio_block: Could not map buffers to phys mem in send_request\n");
+	if(req->write && (dev->features & VIRTIO_BLK_F_RO)) {
 		return -1;
 	}
 
-	size_t lengths[] = {sizeof(struct virtio_blk_req), num_blocks * 512, sizeof(uint8_t)};
+	// Without the flush feature, the device has no volatile write cache
+	if(req->flush && !(dev->features & VIRTIO_BLK_F_FLUSH)) {
+		vfs_block_complete(req, 0);
+		return 0;
+	}
 
-	int user_buffer_flag = (type == VIRTIO_BLK_T_IN) ? VIRTQ_DESC_F_WRITE : 0;
-	int flags[] = {0, user_buffer_flag, VIRTQ_DESC_F_WRITE};
+	// Header, data segments, status
+	void* buffers[MAX_SEGMENTS + 2];
+	size_t lengths[MAX_SEGMENTS + 2];
+	int num = 1;
 
-	if(virtio_write(rdev, 0, 3, buffers, lengths, flags) < 0) {
+	if(!req->flush) {
+		int segments = map_buffer(req->buf, req->num_blocks * 512, buffers + 1, lengths + 1);
+		if(segments < 0) {
+			log(LOG_ERR, "virtio_block: Could not map buffer %#x for request\n", req->buf);
+			return -1;
+		}
+		num += segments;
+	}
+	num++;
+
+	int_disable();
+	struct virtqueue* queue = &dev->queues[0];
+	int head = virtio_alloc_descs(queue, num);
+	if(head < 0) {
+		int_enable();
+		log(LOG_ERR, "virtio_block: Out of descriptors\n");
 		return -1;
 	}
 
-	while(status == 0xff) {
-		scheduler_yield();
-	}
+	struct request_slot* slot = &slots[head];
+	slot->hdr.type = req->flush ? VIRTIO_BLK_T_FLUSH : (req->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN);
+	slot->hdr.reserved = 0;
+	slot->hdr.sector = req->lba;
+	slot->status = 0xff;
+	slot->polled = polled;
+	slot->req = req;
+
+	buffers[0] = valloc_translate(VM_KERNEL, &slot->hdr, false);
+	lengths[0] = sizeof(struct virtio_blk_req);
+	buffers[num - 1] = valloc_translate(VM_KERNEL, (void*)&slot->status, false);
+	lengths[num - 1] = sizeof(uint8_t);
+
+	struct virtq_desc* desc = &queue->descriptors[head];
+	for(int i = 0; i < num; i++) {
+		desc->addr = (uint64_t)(uintptr_t)buffers[i];
+		desc->len = lengths[i];
+
+		// Data buffers of reads and the status are written by the device
+		if(i == num - 1 || (i && !req->write)) {
+			desc->flags |= VIRTQ_DESC_F_WRITE;
+		}
 
-	if(status != VIRTIO_BLK_S_OK) {
-		log(LOG_ERR, "virtio_block: Request type %d, lba %d failed (align %d)\n", type, lba, (uintptr_t)buf % 0x1000);
-		return -1;
+		desc = &queue->descriptors[desc->next];
 	}
 
-	return num_blocks;
+	virtio_write_avail(dev, queue, head);
+	int_enable();
+	return 0;
 }
 
-static uint64_t read_cb(struct vfs_block_dev* block_dev, uint64_t lba, uint64_t num_blocks, void* buf) {
-	if(num_blocks < 16) {
-		return send_request(dev, VIRTIO_BLK_T_IN, lba, num_blocks, buf);
-	}
+static int submit_cb(struct vfs_block_dev* block_dev, struct block_request* req) {
+	return send_request(req, false);
+}
+
+static void poll_cb(struct vfs_block_dev* block_dev) {
+	int_disable();
+	process_used();
+	int_enable();
+}
+
+// Synchronous I/O that doesn't depend on interrupts, used for partition probing
+static uint64_t polled_rw(bool write, uint64_t lba, uint64_t num_blocks, void* buf) {
+	uint64_t max_blocks = (max_segments - 1) * MIN(size_max, PAGE_SIZE) / 512;
 
-	for(uint64_t i = 0; i < num_blocks; i++) {
-		if(send_request(dev, VIRTIO_BLK_T_IN, lba + i, 1, buf + (uint32_t)i * 512) == -1) {
-			return i;
+	for(uint64_t done = 0; done < num_blocks; done += max_blocks) {
+		struct block_request req = {
+			.write = write,
+			.lba = lba + done,
+			.num_blocks = MIN(max_blocks, num_blocks - done),
+			.buf = buf + done * 512,
+		};
+
+		if(send_request(&req, true) < 0) {
+			return done ? done : -1;
 		}
-	}
 
+		while(!req.done) {
+			poll_cb(NULL);
+		}
+
+		if(req.result == -1) {
+			return done ? done : -1;
+		}
+	}
 	return num_blocks;
 }
 
-static uint64_t write_cb(struct vfs_block_dev* block_dev, uint64_t lba, uint64_t num_blocks, void* buf) {
-	if(dev->features & VIRTIO_BLK_F_RO) {
-		return -1;
-	}
+static uint64_t read_cb(struct vfs_block_dev* block_dev, uint64_t lba, uint64_t num_blocks, void* buf) {
+	return polled_rw(false, lba, num_blocks, buf);
+}
 
-	//log(LOG_DEBUG, "virtio write_cb lba %d buf %#x\n", lba, buf);
-	return send_request(dev, VIRTIO_BLK_T_OUT, lba, num_blocks, buf);
+static uint64_t write_cb(struct vfs_block_dev* block_dev, uint64_t lba, uint64_t num_blocks, void* buf) {
+	return polled_rw(true, lba, num_blocks, buf);
 }
 
 static int pci_cb(pci_device_t* pci_dev) {
@@ -142,7 +278,7 @@ static int pci_cb(pci_device_t* pci_dev) {
 
 	log(LOG_INFO, "virtio_block: Discovered device %p\n", pci_dev);
 
-	dev = virtio_init_dev(pci_dev, 0, 1);
+	dev = virtio_init_dev(pci_dev, FEATURES_WANT, 1);
 	if(!dev) {
 		return 1;
 	}
@@ -151,14 +287,33 @@ static int pci_cb(pci_device_t* pci_dev) {
 		log(LOG_INFO, "virtio_block: Device is read-only\n");
 	}
 
-	dev->queues[0].available->flags = VIRTQ_AVAIL_F_NO_INTERRUPT;
-	dev->queues[0].used->flags = VIRTQ_USED_F_NO_NOTIFY;
+	struct virtqueue* queue = &dev->queues[0];
+	size_max = (dev->features & VIRTIO_BLK_F_SIZE_MAX) ? inl(pci_dev->iobase + VIRTIO_BLK_CFG_SIZE_MAX) : -1;
+	if(size_max < 512) {
+		size_max = 512;
+	}
+
+	max_segments = MIN(MAX_SEGMENTS, queue->size - 2);
+	if(dev->features & VIRTIO_BLK_F_SEG_MAX) {
+		max_segments = MIN(max_segments, MAX(inl(pci_dev->iobase + VIRTIO_BLK_CFG_SEG_MAX), 2));
+	}
+
+	slots = zmalloc_a(sizeof(struct request_slot) * queue->size);
 	int_register(IRQ(dev->pci_dev->interrupt_line), int_handler, false);
 
 	dev->status |= VIRTIO_PCI_STATUS_DRIVER_OK;
 	virtio_write_status(dev);
 
-	vfs_block_register_dev("vioblk1", (uint64_t)0, read_cb, write_cb, NULL);
+	struct vfs_block_dev* block_dev = vfs_block_register_dev("vioblk1", (uint64_t)0, read_cb, write_cb, NULL);
+
+	// Any request up to max_blocks fits into max_segments
+	block_dev->max_blocks = (max_segments - 1) * MIN(size_max, PAGE_SIZE) / 512;
+	block_dev->queue_depth = MAX(queue->size / (max_segments + 2), 1);
+	block_dev->poll_cb = poll_cb;
+	block_dev->submit_cb = submit_cb;
+
+	log(LOG_INFO, "virtio_block: %d segments of up to %d bytes, queue depth %d\n",
+		max_segments, size_max, block_dev->queue_depth);
 	return 0;
 }
 
@@ -25,6 +25,7 @@
 static struct multiboot_tag_mmap* mmap_info = NULL;
 static struct multiboot_tag_basic_meminfo* mem_info = NULL;
 static struct multiboot_tag_framebuffer framebuffer_info;
+static struct multiboot_tag_module initrd_info;
 
 /* These are set by i386-boot.asm right after boot */
 uint32_t multiboot_magic;
@@ -93,6 +94,11 @@ char* multiboot_get_cmdline(void) {
 	return cmdline;
 }
 
+// The first module passed by the bootloader is used as initramfs
+struct multiboot_tag_module* multiboot_get_initrd(void) {
+	return initrd_info.mod_end ? &initrd_info : NULL;
+}
+
 static int extract_symtab(struct multiboot_tag_elf_sections* multiboot_tag) {
 	int r = -2;
 	struct elf_section* elf_section = (struct elf_section*)multiboot_tag->sections;
@@ -169,6 +175,13 @@ void multiboot_init(void) {
 			case MULTIBOOT_TAG_TYPE_FRAMEBUFFER:
 				memcpy(&framebuffer_info, tag, sizeof(framebuffer_info));
 				break;
+			case MULTIBOOT_TAG_TYPE_MODULE:
+				if(!initrd_info.mod_end) {
+					memcpy(&initrd_info, tag, sizeof(initrd_info));
+				}
+				snprintf(strrep, 150, "%#x - %#x %s", ((struct multiboot_tag_module*)tag)->mod_start,
+					((struct multiboot_tag_module*)tag)->mod_end, ((struct multiboot_tag_module*)tag)->cmdline);
+				break;
 		}
 
 		log(LOG_INFO, "  %#p size %-4d %-18s %s\n", tag, tag->size, tag_type_names[tag->type], strrep);
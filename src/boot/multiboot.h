@@ -358,6 +358,7 @@ struct multiboot_tag_framebuffer* multiboot_get_framebuffer(void);
 struct elf_sym* multiboot_get_symtab(size_t* length);
 char* multiboot_get_strtab(size_t* length);
 char* multiboot_get_cmdline(void);
+struct multiboot_tag_module* multiboot_get_initrd(void);
 
 #endif /* ! MULTIBOOT_HEADER */
 
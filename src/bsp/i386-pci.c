@@ -154,7 +154,7 @@ int pci_check_vendor(pci_device_t* dev, const uint32_t combos[][2]) {
 }
 
 static size_t sfs_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
-	if(ctx->fp->offset) {
+	if(ctx->offset) {
 		return 0;
 	}
 
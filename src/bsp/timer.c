@@ -41,7 +41,7 @@ uint32_t timer_get_rate(void) {
 }
 
 static size_t sfs_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
-	if(ctx->fp->offset) {
+	if(ctx->offset) {
 		return 0;
 	}
 
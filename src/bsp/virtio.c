@@ -84,6 +84,40 @@ int virtio_write(struct virtio_dev* dev, uint8_t queue_id, int num_buffers,
 	return desc_head;
 }
 
+/* Allocate a chain of num descriptors that can be kept in use for a longer
+ * time and completed out of order, unlike the ones from virtio_write. A
+ * queue should only be used with one of the two. Returns the first
+ * descriptor of the chain, or -1 if there aren't enough free descriptors.
+ */
+int virtio_alloc_descs(struct virtqueue* queue, int num) {
+	if(num < 1 || queue->num_free < num) {
+		return -1;
+	}
+
+	int head = queue->free_head;
+	for(int i = 0; i < num; i++) {
+		struct virtq_desc* desc = &queue->descriptors[queue->free_head];
+		desc->flags = (i < num - 1) ? VIRTQ_DESC_F_NEXT : 0;
+		queue->free_head = desc->next;
+	}
+
+	queue->num_free -= num;
+	return head;
+}
+
+void virtio_free_descs(struct virtqueue* queue, int head) {
+	int last = head;
+	int num = 1;
+	while(queue->descriptors[last].flags & VIRTQ_DESC_F_NEXT) {
+		last = queue->descriptors[last].next;
+		num++;
+	}
+
+	queue->descriptors[last].next = queue->free_head;
+	queue->free_head = head;
+	queue->num_free += num;
+}
+
 void virtio_provide_descs(struct virtio_dev* dev, uint8_t queue_id, int num, size_t size) {
 	struct virtqueue* queue = &dev->queues[queue_id];
 
@@ -124,6 +158,12 @@ static inline int setup_virtqueue(struct virtio_dev* dev, uint8_t queue_id) {
 	queue->available = buf + desc_size;
 	queue->used = buf + desc_size + available_size;
 
+	for(int i = 0; i < queue->size; i++) {
+		queue->descriptors[i].next = i + 1;
+	}
+	queue->free_head = 0;
+	queue->num_free = queue->size;
+
 	__sync_synchronize();
 	ioutl(VIRTIO_IO_QUEUE_PFN, (uintptr_t)buf >> 12);
 	return 0;
@@ -89,6 +89,10 @@ struct virtqueue {
 	size_t size;
 	size_t desc_index;
 	size_t used_index;
+
+	// Free list for virtio_alloc_descs
+	uint16_t free_head;
+	uint16_t num_free;
 };
 
 struct virtio_dev {
@@ -113,5 +117,7 @@ static inline void virtio_write_avail(struct virtio_dev* dev, struct virtqueue*
 int virtio_write(struct virtio_dev* dev, uint8_t queue_id, int num_buffers,
 	void** buffers, size_t* lengths, int* flags);
 
+int virtio_alloc_descs(struct virtqueue* queue, int num);
+void virtio_free_descs(struct virtqueue* queue, int head);
 void virtio_provide_descs(struct virtio_dev* dev, uint8_t queue_id, int num, size_t size);
 struct virtio_dev* virtio_init_dev(pci_device_t* dev, uint32_t cap, int queues);
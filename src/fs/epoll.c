@@ -0,0 +1,399 @@
+/* epoll.c: Event notification for large sets of file descriptors
+ * Copyright © 2026 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Unlike poll(), which has to call the poll callback of every file descriptor
+ * on each invocation, an epoll instance keeps a persistent interest list. Each
+ * item is registered with the wait queue of its object, and gets put on the
+ * ready list of the instance when that object signals a change. epoll_wait
+ * then only needs to look at the items on the ready list.
+ *
+ * Level-triggered items stay on the ready list for as long as their poll
+ * callback reports them ready, EPOLLET items are removed from it once
+ * reported, and EPOLLONESHOT items are disabled until rearmed with
+ * EPOLL_CTL_MOD.
+ */
+
+#include <fs/epoll.h>
+#include <fs/poll.h>
+#include <fs/vfs.h>
+#include <tasks/task.h>
+#include <bsp/timer.h>
+#include <mem/kmalloc.h>
+#include <mem/vm.h>
+#include <errno.h>
+
+#define EPOLL_FLAGS (EPOLLET | EPOLLONESHOT)
+
+struct epoll;
+struct epoll_item {
+	struct poll_entry entry;
+	struct epoll* ep;
+	struct epoll_item* next;
+	struct epoll_item* ready_next;
+	bool ready;
+	bool closed;
+
+	int fd;
+	uint32_t events;
+	uint64_t data;
+};
+
+struct epoll {
+	// Instances are shared with children on fork
+	int refs;
+
+	struct epoll_item* items;
+	struct epoll_item* ready;
+	struct epoll_item* ready_tail;
+
+	// Tasks sleeping in epoll_wait
+	struct poll_waiter* waiters;
+};
+
+// All of the list manipulation below needs interrupts to be disabled.
+static void push_ready(struct epoll* ep, struct epoll_item* item) {
+	if(item->ready) {
+		return;
+	}
+
+	item->ready = true;
+	item->ready_next = NULL;
+	if(ep->ready_tail) {
+		ep->ready_tail->ready_next = item;
+	} else {
+		ep->ready = item;
+	}
+	ep->ready_tail = item;
+}
+
+static struct epoll_item* pop_ready(struct epoll* ep) {
+	struct epoll_item* item = ep->ready;
+	ep->ready = item->ready_next;
+	if(!ep->ready) {
+		ep->ready_tail = NULL;
+	}
+
+	item->ready = false;
+	return item;
+}
+
+static void remove_item(struct epoll* ep, struct epoll_item* item) {
+	poll_unregister(&item->entry);
+
+	for(struct epoll_item** i = &ep->items; *i; i = &(*i)->next) {
+		if(*i == item) {
+			*i = item->next;
+			break;
+		}
+	}
+
+	if(item->ready) {
+		struct epoll_item* prev = NULL;
+		for(struct epoll_item* i = ep->ready; i; prev = i, i = i->ready_next) {
+			if(i != item) {
+				continue;
+			}
+
+			if(prev) {
+				prev->ready_next = item->ready_next;
+			} else {
+				ep->ready = item->ready_next;
+			}
+
+			if(ep->ready_tail == item) {
+				ep->ready_tail = prev;
+			}
+			break;
+		}
+	}
+
+	kfree(item);
+}
+
+static void wake_waiters(struct epoll* ep) {
+	for(struct poll_waiter* waiter = ep->waiters; waiter; waiter = waiter->ep_next) {
+		poll_wake_waiter(waiter);
+	}
+}
+
+static void remove_waiter(struct epoll* ep, struct poll_waiter* waiter) {
+	for(struct poll_waiter** i = &ep->waiters; *i; i = &(*i)->ep_next) {
+		if(*i == waiter) {
+			*i = waiter->ep_next;
+			break;
+		}
+	}
+	waiter->ep = NULL;
+}
+
+// Called by poll_wake
+void epoll_item_ready(struct epoll_item* item) {
+	push_ready(item->ep, item);
+	wake_waiters(item->ep);
+}
+
+// Called by poll_forget, the item gets freed by the next epoll_wait
+void epoll_item_closed(struct epoll_item* item) {
+	item->closed = true;
+	push_ready(item->ep, item);
+	wake_waiters(item->ep);
+}
+
+// Called by poll_task_exit for tasks killed in epoll_wait
+void epoll_waiter_exit(struct poll_waiter* waiter) {
+	remove_waiter(waiter->ep, waiter);
+}
+
+static int epoll_fork(struct vfs_callback_ctx* ctx) {
+	struct epoll* ep = ctx->fp->mount_instance;
+	__sync_add_and_fetch(&ep->refs, 1);
+	return 0;
+}
+
+static int epoll_close(struct vfs_callback_ctx* ctx) {
+	struct epoll* ep = ctx->fp->mount_instance;
+	if(__sync_sub_and_fetch(&ep->refs, 1)) {
+		return 0;
+	}
+
+	bool irq = int_save();
+	while(ep->items) {
+		struct epoll_item* item = ep->items;
+		ep->items = item->next;
+		poll_unregister(&item->entry);
+		kfree(item);
+	}
+	int_restore(irq);
+
+	kfree(ep);
+	return 0;
+}
+
+static struct epoll* get_epoll(task_t* task, int epfd) {
+	vfs_file_t* fp = vfs_get_from_id(epfd, task);
+	if(!fp) {
+		sc_errno = EBADF;
+		return NULL;
+	}
+
+	if(fp->callbacks.close != epoll_close) {
+		sc_errno = EINVAL;
+		return NULL;
+	}
+	return fp->mount_instance;
+}
+
+int vfs_epoll_create(task_t* task, int flags) {
+	vfs_file_t* fp = vfs_alloc_fileno(task, 3);
+	if(!fp) {
+		sc_errno = EMFILE;
+		return -1;
+	}
+
+	struct epoll* ep = zmalloc(sizeof(struct epoll));
+	ep->refs = 1;
+
+	fp->mount_instance = ep;
+	fp->callbacks.close = epoll_close;
+	fp->callbacks.fork = epoll_fork;
+	fp->flags = O_RDONLY | (flags & O_CLOEXEC);
+	return fp->num;
+}
+
+int vfs_epoll_ctl(task_t* task, struct vfs_epoll_ctl_data* data) {
+	struct epoll* ep = get_epoll(task, data->epfd);
+	if(!ep) {
+		return -1;
+	}
+
+	struct vfs_callback_ctx ctx;
+	if(vfs_context_init_fd(&ctx, data->fd, task) < 0) {
+		sc_errno = EBADF;
+		return -1;
+	}
+
+	// Regular files are always ready, so there is no point in watching them
+	if(data->fd == data->epfd || !ctx.fp->callbacks.poll) {
+		sc_errno = EPERM;
+		return -1;
+	}
+
+	bool irq = int_save();
+	struct epoll_item* item = ep->items;
+	for(; item; item = item->next) {
+		if(item->fd == data->fd && !item->closed) {
+			break;
+		}
+	}
+
+	int ret = 0;
+	switch(data->op) {
+		case EPOLL_CTL_ADD:
+			if(item) {
+				sc_errno = EEXIST;
+				ret = -1;
+				break;
+			}
+
+			item = zmalloc(sizeof(struct epoll_item));
+			item->ep = ep;
+			item->fd = data->fd;
+			item->events = data->event.events;
+			item->data = data->event.data;
+			item->entry.fp = ctx.fp;
+			item->entry.item = item;
+			item->next = ep->items;
+			ep->items = item;
+
+			// First epoll_wait polls the item and registers its wait queue
+			push_ready(ep, item);
+			break;
+		case EPOLL_CTL_MOD:
+			if(!item) {
+				sc_errno = ENOENT;
+				ret = -1;
+				break;
+			}
+
+			item->events = data->event.events;
+			item->data = data->event.data;
+			push_ready(ep, item);
+			break;
+		case EPOLL_CTL_DEL:
+			if(!item) {
+				sc_errno = ENOENT;
+				ret = -1;
+				break;
+			}
+
+			remove_item(ep, item);
+			break;
+		default:
+			sc_errno = EINVAL;
+			ret = -1;
+	}
+
+	int_restore(irq);
+	return ret;
+}
+
+static int collect(struct epoll* ep, task_t* task, struct epoll_event* events,
+	int maxevents, bool* unnotified) {
+
+	int n = 0;
+
+	// Items that get requeued are appended, so stop at the current end
+	struct epoll_item* last = ep->ready_tail;
+	while(ep->ready && n < maxevents) {
+		struct epoll_item* item = pop_ready(ep);
+		bool was_last = item == last;
+
+		struct vfs_callback_ctx ctx;
+		if(item->closed || vfs_context_init_fd(&ctx, item->fd, task) < 0 ||
+			(!item->entry.waitq && ctx.fp != item->entry.fp)) {
+
+			remove_item(ep, item);
+		} else if(item->events & ~EPOLL_FLAGS) {
+			ctx.poll_entry = &item->entry;
+			int r = ctx.fp->callbacks.poll(&ctx, item->events & ~EPOLL_FLAGS);
+
+			// Some poll callbacks enable interrupts
+			int_disable();
+			bool requeue = false;
+			if(!ctx.fp->waitq) {
+				*unnotified = true;
+				requeue = true;
+			}
+
+			r = r > 0 ? r & (item->events | EPOLLERR | EPOLLHUP) : 0;
+			if(r) {
+				events[n].events = r;
+				events[n].data = item->data;
+				n++;
+
+				if(item->events & EPOLLONESHOT) {
+					item->events = 0;
+					requeue = false;
+				} else if(!(item->events & EPOLLET)) {
+					requeue = true;
+				}
+			}
+
+			if(requeue) {
+				push_ready(ep, item);
+			}
+		}
+
+		if(was_last) {
+			break;
+		}
+	}
+	return n;
+}
+
+int vfs_epoll_wait(task_t* task, struct vfs_epoll_wait_data* data) {
+	if(data->maxevents <= 0 || data->maxevents > 0x10000) {
+		sc_errno = EINVAL;
+		return -1;
+	}
+
+	struct epoll* ep = get_epoll(task, data->epfd);
+	if(!ep) {
+		return -1;
+	}
+
+	vm_alloc_t alloc;
+	struct epoll_event* events = data->events;
+	if(task) {
+		events = vm_map(VM_KERNEL, &alloc, task->vmem, data->events,
+			sizeof(struct epoll_event) * data->maxevents, VM_MAP_USER_ONLY | VM_RW);
+
+		if(!events) {
+			sc_errno = EFAULT;
+			return -1;
+		}
+	}
+
+	uint32_t deadline = poll_deadline(data->timeout);
+	struct poll_waiter waiter = {0};
+	int n;
+	while(1) {
+		int_disable();
+		waiter.woken = false;
+		bool unnotified = false;
+		n = collect(ep, task, events, data->maxevents, &unnotified);
+
+		uint32_t tick = timer_get_tick();
+		if(n || tick >= deadline) {
+			break;
+		}
+
+		// Other tasks can share the instance, so each one queues up itself
+		waiter.ep = ep;
+		waiter.ep_next = ep->waiters;
+		ep->waiters = &waiter;
+		poll_sleep(task, &waiter, unnotified ? MIN(deadline, tick + 1) : deadline);
+		remove_waiter(ep, &waiter);
+	}
+
+	if(task) {
+		vm_free(&alloc);
+	}
+	return n;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+/* Copyright © 2026 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <tasks/task.h>
+#include <fs/poll.h>
+
+// Same values as the corresponding POLL* events
+#define EPOLLIN			POLLIN
+#define EPOLLPRI		POLLPRI
+#define EPOLLOUT		POLLOUT
+#define EPOLLERR		POLLERR
+#define EPOLLHUP		POLLHUP
+#define EPOLLONESHOT	(1U << 30)
+#define EPOLLET			(1U << 31)
+
+#define EPOLL_CTL_ADD	1
+#define EPOLL_CTL_DEL	2
+#define EPOLL_CTL_MOD	3
+
+// Keep in sync with newlib
+struct epoll_event {
+	uint32_t events;
+	uint64_t data;
+} __attribute__((packed));
+
+struct vfs_epoll_ctl_data {
+	int epfd;
+	int op;
+	int fd;
+	struct epoll_event event;
+};
+
+struct vfs_epoll_wait_data {
+	int epfd;
+	struct epoll_event* events;
+	int maxevents;
+	int timeout;
+};
+
+void epoll_item_ready(struct epoll_item* item);
+void epoll_item_closed(struct epoll_item* item);
+void epoll_waiter_exit(struct poll_waiter* waiter);
+
+int vfs_epoll_create(task_t* task, int flags);
+int vfs_epoll_ctl(task_t* task, struct vfs_epoll_ctl_data* data);
+int vfs_epoll_wait(task_t* task, struct vfs_epoll_wait_data* data);
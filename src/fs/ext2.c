@@ -129,6 +129,18 @@ static int ext2_stat(struct vfs_callback_ctx* ctx, vfs_stat_t* dest) {
 	return 0;
 }
 
+// Release the data blocks and the number of an inode that has no links left
+static void purge_inode(struct ext2_fs* fs, struct inode* inode, uint32_t inode_num) {
+	inode->dtime = time_get();
+	inode->link_count = 0;
+
+	struct blockgroup* blockgroup = blockgroup_get(inode_to_blockgroup(inode_num));
+	ext2_inode_free_blocks(fs, inode);
+	ext2_bitmap_free(fs, blockgroup->inode_bitmap, (inode_num - 1) % fs->superblock->inodes_per_group, 1);
+	fs->superblock->free_inodes++;
+	blockgroup->free_inodes++;
+}
+
 static int ext2_mkdir(struct vfs_callback_ctx* ctx, uint32_t mode) {
 	struct ext2_fs* fs = ctx->mp->instance;
 
@@ -174,6 +186,12 @@ static int ext2_mkdir(struct vfs_callback_ctx* ctx, uint32_t mode) {
 
 	struct inode* inode = kmalloc(fs->superblock->inode_size);
 	uint32_t inode_num = ext2_inode_new(fs, inode, FT_IFDIR | S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH);
+	if(!inode_num) {
+		kfree(parent);
+		kfree(inode);
+		sc_errno = ENOSPC;
+		return -1;
+	}
 
 	// Create empty dirent block
 	struct dirent* buf = (struct dirent*)zmalloc(bl_off(1));
@@ -199,14 +217,23 @@ static int ext2_mkdir(struct vfs_callback_ctx* ctx, uint32_t mode) {
 	}
 
 	ext2_inode_write(fs, inode, inode_num);
-	ext2_dirent_add(fs, parent->inode, inode_num, basename(ctx->path), EXT2_DIRENT_FT_DIR);
+	if(ext2_dirent_add(fs, parent->inode, inode_num, basename(ctx->path), EXT2_DIRENT_FT_DIR) < 0) {
+		purge_inode(fs, inode, inode_num);
+		ext2_inode_write(fs, inode, inode_num);
+		write_superblock();
+		write_blockgroup_table();
+
+		kfree(parent);
+		kfree(inode);
+		return -1;
+	}
 
 	// Add . and .. dirents
 	ext2_dirent_add(fs, inode_num, inode_num, ".", EXT2_DIRENT_FT_DIR);
 	ext2_dirent_add(fs, inode_num, parent->inode, "..", EXT2_DIRENT_FT_DIR);
 
 	uint32_t blockgroup_num = inode_to_blockgroup(inode_num);
-	fs->blockgroup_table[blockgroup_num].used_directories++;
+	blockgroup_get(blockgroup_num)->used_directories++;
 	write_blockgroup_table();
 
 	kfree(parent);
@@ -324,33 +351,10 @@ static int do_unlink(struct ext2_fs* fs, char* path, bool is_dir, task_t* task)
 
 	if(link_count < 1) {
 		debug("do_unlink: inode %d link count < 1, purging.\n", dirent->inode);
-		inode->dtime = time_get();
-		inode->link_count = 0;
-
-		// Free data blocks
-		struct blockgroup* blockgroup = fs->blockgroup_table + inode_to_blockgroup(dirent->inode);
-		struct ext2_blocknum_resolver_cache* res_cache = zmalloc(sizeof(struct ext2_blocknum_resolver_cache));
-
-		for(int i = 0; true; i++) {
-			uint32_t num = ext2_resolve_blocknum(fs, inode, i, res_cache);
-			if(!num) {
-				break;
-			}
-
-			ext2_bitmap_free(fs, blockgroup->block_bitmap, num % fs->superblock->blocks_per_group);
-		}
-
-		ext2_free_blocknum_resolver_cache(res_cache);
-		ext2_bitmap_free(fs, blockgroup->inode_bitmap, (dirent->inode - 1) % fs->superblock->inodes_per_group);
-		fs->superblock->free_inodes++;
-		blockgroup->free_inodes++;
-
-		// inode->block_count counts IDE blocks, free_blocks counts ext2 blocks.
-		fs->superblock->free_blocks += inode->block_count / 8;
-		blockgroup->free_blocks += inode->block_count / 8;
+		purge_inode(fs, inode, dirent->inode);
 
 		if(is_dir) {
-			blockgroup->used_directories--;
+			blockgroup_get(inode_to_blockgroup(dirent->inode))->used_directories--;
 
 			// Decrease parent directory link count (removed .. entry)
 			struct inode* dir_inode = kmalloc(fs->superblock->inode_size);
@@ -418,10 +422,10 @@ static int ext2_link(struct vfs_callback_ctx* ctx, const char* new_path) {
 		return -1;
 	}
 
-	ext2_dirent_add(fs, dir_dirent->inode, dirent->inode, new_name, dirent->type);
+	int r = ext2_dirent_add(fs, dir_dirent->inode, dirent->inode, new_name, dirent->type);
 	kfree(dirent);
 	kfree(dir_dirent);
-	return 0;
+	return r;
 }
 
 static int ext2_access(struct vfs_callback_ctx* ctx, uint32_t amode) {
@@ -462,6 +466,19 @@ static int ext2_access(struct vfs_callback_ctx* ctx, uint32_t amode) {
 	return 0;
 }
 
+/* Metadata is written together with the data, so the only thing left to do
+ * is to get the device to write back everything. This syncs the whole file
+ * system rather than just the file.
+ */
+static int ext2_fsync(struct vfs_callback_ctx* ctx, bool datasync) {
+	struct ext2_fs* fs = ctx->mp->instance;
+	if(!ext2_table_cache_flush(fs) || vfs_block_flush(fs->dev) < 0) {
+		sc_errno = EIO;
+		return -1;
+	}
+	return 0;
+}
+
 static int ext2_readlink(struct vfs_callback_ctx* ctx, char* buf, size_t size) {
 	struct ext2_fs* fs = ctx->mp->instance;
 	struct dirent* dirent = ext2_dirent_find(fs, ctx->path, NULL, ctx->task);
@@ -507,7 +524,7 @@ static size_t ext2_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
 		return -1;
 	}
 
-	debug("ext2_read_file for %s, off %d, size %d\n", ctx->fp->mount_path, ctx->fp->offset, size);
+	debug("ext2_read_file for %s, off %d, size %d\n", ctx->fp->mount_path, ctx->offset, size);
 
 	struct inode* inode = kmalloc(fs->superblock->inode_size);
 	if(!ext2_inode_read(fs, inode, ctx->fp->inode)) {
@@ -537,17 +554,17 @@ static size_t ext2_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
 		return -1;
 	}
 
-	if(inode->size < 1 || ctx->fp->offset >= inode->size) {
+	if(inode->size < 1 || ctx->offset >= inode->size) {
 		kfree(inode);
 		return 0;
 	}
 
-	if(ctx->fp->offset + size > inode->size) {
-		size = inode->size - ctx->fp->offset;
+	if(ctx->offset + size > inode->size) {
+		size = inode->size - ctx->offset;
 		debug("ext2: Capping read size to 0x%x\n", size);
 	}
 
-	uint8_t* read = ext2_inode_read_data(fs, inode, ctx->fp->offset, size, dest);
+	uint8_t* read = ext2_inode_read_data(fs, inode, ctx->offset, size, dest);
 	kfree(inode);
 
 	if(!read) {
@@ -564,7 +581,7 @@ static size_t ext2_write(struct vfs_callback_ctx* ctx, void* source, size_t size
 		return -1;
 	}
 
-	debug("ext2_write_file for %s, off %d, size %d\n", ctx->fp->mount_path, ctx->fp->offset, size);
+	debug("ext2_write_file for %s, off %d, size %d\n", ctx->fp->mount_path, ctx->offset, size);
 
 	struct inode* inode = kmalloc(fs->superblock->inode_size);
 	if(!ext2_inode_read(fs, inode, ctx->fp->inode)) {
@@ -593,12 +610,12 @@ static size_t ext2_write(struct vfs_callback_ctx* ctx, void* source, size_t size
 		return -1;
 	}
 
-	if(!ext2_inode_write_data(fs, inode, ctx->fp->inode, ctx->fp->offset, size, source)) {
+	if(!ext2_inode_write_data(fs, inode, ctx->fp->inode, ctx->offset, size, source)) {
 		kfree(inode);
 		return -1;
 	}
 
-	inode->size = ctx->fp->offset + size;
+	inode->size = MAX(inode->size, ctx->offset + size);
 	inode->mtime = time_get();
 	ext2_inode_write(fs, inode, ctx->fp->inode);
 	kfree(inode);
@@ -628,27 +645,9 @@ static size_t ext2_getdents(struct vfs_callback_ctx* ctx, void* buf, size_t size
 		return -1;
 	}
 
-	struct rd_r* rd_reent = zmalloc(sizeof(struct rd_r));
-	uint64_t offset = 0;
-	vfs_dirent_t* ent = NULL;
-
-	while((ent = ext2_readdir_r(fs, inode, &ctx->fp->offset, rd_reent))) {
-		if(offset + ent->d_reclen >= size) {
-			ctx->fp->offset -= rd_reent->last_len;
-			kfree(ent);
-			break;
-		}
-
-		vfs_dirent_t* dest = (vfs_dirent_t*)(buf + offset);
-		memcpy(dest, ent, ent->d_reclen);
-		offset += ent->d_reclen;
-		dest->d_off = offset;
-		kfree(ent);
-	}
-
+	size_t done = ext2_dirent_getdents(fs, inode, &ctx->fp->offset, buf, size);
 	kfree(inode);
-	kfree(rd_reent);
-	return offset;
+	return done;
 }
 
 static int ext2_build_path_tree(struct vfs_callback_ctx* ctx) {
@@ -700,6 +699,11 @@ static vfs_file_t* ext2_open(struct vfs_callback_ctx* ctx, uint32_t flags) {
 		return NULL;
 	}
 
+	if(fs->read_only && (flags & (O_WRONLY | O_RDWR | O_CREAT))) {
+		sc_errno = EROFS;
+		return NULL;
+	}
+
 	// Duplicate path as basedir() is destructive
 	char* dup_path = strdup(ctx->path);
 	if(!dup_path) {
@@ -734,7 +738,23 @@ static vfs_file_t* ext2_open(struct vfs_callback_ctx* ctx, uint32_t flags) {
 
 	if(!dirent || !dirent->inode) {
 		inode_num = ext2_inode_new(fs, inode, FT_IFREG | S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-		ext2_dirent_add(fs, parent_inode, inode_num, basename(ctx->path), EXT2_DIRENT_FT_REG_FILE);
+		if(!inode_num) {
+			kfree(dirent);
+			kfree(inode);
+			sc_errno = ENOSPC;
+			return NULL;
+		}
+
+		if(ext2_dirent_add(fs, parent_inode, inode_num, basename(ctx->path), EXT2_DIRENT_FT_REG_FILE) < 0) {
+			purge_inode(fs, inode, inode_num);
+			ext2_inode_write(fs, inode, inode_num);
+			write_superblock();
+			write_blockgroup_table();
+
+			kfree(dirent);
+			kfree(inode);
+			return NULL;
+		}
 
 		if(ctx->task) {
 			inode->uid = ctx->task->euid;
@@ -809,6 +829,19 @@ struct vfs_callbacks cb = {
 	.readlink = ext2_readlink,
 	.access = ext2_access,
 	.build_path_tree = ext2_build_path_tree,
+	.fsync = ext2_fsync,
+};
+
+// For file systems with features we can't write, such as metadata checksums
+static struct vfs_callbacks cb_ro = {
+	.open = ext2_open,
+	.stat = ext2_stat,
+	.read = ext2_read,
+	.getdents = ext2_getdents,
+	.readlink = ext2_readlink,
+	.access = ext2_access,
+	.build_path_tree = ext2_build_path_tree,
+	.fsync = ext2_fsync,
 };
 
 int ext2_mount(struct vfs_block_dev* dev, const char* path) {
@@ -841,6 +874,34 @@ int ext2_mount(struct vfs_block_dev* dev, const char* path) {
 	log(LOG_INFO, "ext2: Inodes: %d free / %d total\n",
 		fs->superblock->free_inodes, fs->superblock->inode_count);
 
+	uint32_t incompat = fs->superblock->features_incompat & ~EXT2_FEATURE_INCOMPAT_SUPPORTED;
+	if(incompat) {
+		log(LOG_ERR, "ext2: File system on /dev/%s uses unsupported features 0x%x.\n",
+			dev->name, incompat);
+
+		kfree(fs);
+		sc_errno = EINVAL;
+		return -1;
+	}
+
+	fs->desc_size = sizeof(struct blockgroup);
+	if(fs->superblock->features_incompat & EXT4_FEATURE_INCOMPAT_64BIT) {
+		fs->desc_size = fs->superblock->desc_size;
+		if(fs->desc_size < sizeof(struct blockgroup)) {
+			log(LOG_ERR, "ext2: Invalid blockgroup descriptor size %d\n", fs->desc_size);
+			kfree(fs);
+			sc_errno = EINVAL;
+			return -1;
+		}
+	}
+
+	if(fs->superblock->features_ro & ~EXT2_FEATURE_RO_COMPAT_SUPPORTED) {
+		log(LOG_INFO, "ext2: File system on /dev/%s uses features 0x%x that can only be "
+			"read, mounting read-only.\n", dev->name,
+			fs->superblock->features_ro & ~EXT2_FEATURE_RO_COMPAT_SUPPORTED);
+		fs->read_only = true;
+	}
+
 	if(fs->superblock->state != SUPERBLOCK_STATE_CLEAN) {
 		log(LOG_ERR, "ext2: File system on /dev/%s is not marked as clean. "
 			"Please run fsck.ext2 on it.\n", dev->name);
@@ -874,11 +935,15 @@ int ext2_mount(struct vfs_block_dev* dev, const char* path) {
 	}
 
 	fs->root_inode = root_inode_buf;
-	fs->superblock->mount_count++;
-	fs->superblock->mount_time = time_get();
 	fs->callbacks = &cb;
-	write_superblock();
-	vfs_mount_register(dev, path, (void*)fs, "ext2", &cb);
+	if(fs->read_only) {
+		fs->callbacks = &cb_ro;
+	} else {
+		fs->superblock->mount_count++;
+		fs->superblock->mount_time = time_get();
+		write_superblock();
+	}
+	vfs_mount_register(dev, path, (void*)fs, "ext2", fs->callbacks);
 	return 0;
 }
 
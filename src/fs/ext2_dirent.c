@@ -23,6 +23,7 @@
 #include "ext2_misc.h"
 #include "ext2_inode.h"
 #include "ext2_dirent.h"
+#include "ext2_htree.h"
 #include <log.h>
 #include <string.h>
 #include <errno.h>
@@ -30,64 +31,133 @@
 #include <fs/vfs.h>
 #include <fs/ftree.h>
 
-#define dirent_off *offset - reent->read_off
-vfs_dirent_t* ext2_readdir_r(struct ext2_fs* fs, struct inode* inode, uint64_t* offset, struct rd_r* reent) {
-	while(1) {
-		if(dirent_off + sizeof(struct dirent) >= reent->read_len) {
-			if(*offset >= inode->size) {
-				return NULL;
+/* Decodes the directory entries of `inode` starting at byte position `offset`
+ * straight into the getdents buffer. Directory data is read in runs of
+ * blocks, and since ext2 entries never cross a block boundary, each run can
+ * be walked without further copying. `offset` is advanced past every entry
+ * that was consumed, so the next call continues where this one stopped.
+ */
+size_t ext2_dirent_getdents(struct ext2_fs* fs, struct inode* inode, uint64_t* offset,
+	void* buf, size_t size) {
+
+	size_t chunk_size = MIN(MAX(ALIGN(size, bl_off(1)), bl_off(1)), bl_off(EXT2_GETDENTS_BLOCKS));
+	uint8_t* chunk = kmalloc(chunk_size);
+	size_t done = 0;
+	bool full = false;
+
+	while(!full && *offset < inode->size) {
+		uint64_t start = *offset - (*offset % bl_off(1));
+		size_t len = MIN(chunk_size, inode->size - start);
+		if(!ext2_inode_read_data(fs, inode, start, len, chunk)) {
+			break;
+		}
+
+		while(*offset < start + len) {
+			size_t pos = *offset - start;
+			size_t block_end = MIN(pos - (pos % bl_off(1)) + bl_off(1), len);
+			struct dirent* ent = (struct dirent*)(chunk + pos);
+
+			// Skip the rest of blocks with broken entries
+			if(pos + sizeof(struct dirent) > block_end || ent->record_len < sizeof(struct dirent)
+				|| pos + ent->record_len > block_end
+				|| sizeof(struct dirent) + ent->name_len > ent->record_len) {
+
+				*offset = start + block_end;
+				continue;
 			}
 
-			size_t rsize = MIN(sizeof(reent->buf), inode->size - *offset);
-			if(!ext2_inode_read_data(fs, inode, *offset, rsize, reent->buf)) {
-				return NULL;
+			if(ent->inode) {
+				size_t rec_len = ALIGN(sizeof(vfs_dirent_t) + ent->name_len + 1, 4);
+				if(done + rec_len > size) {
+					full = true;
+					break;
+				}
+
+				vfs_dirent_t* dest = (vfs_dirent_t*)(buf + done);
+				dest->d_ino = ent->inode;
+				dest->d_reclen = rec_len;
+				dest->d_type = ent->type;
+				dest->d_off = done + rec_len;
+				memcpy(dest->d_name, ent->name, ent->name_len);
+				dest->d_name[ent->name_len] = 0;
+				done += rec_len;
 			}
-			reent->read_off = *offset;
-			reent->read_len = rsize;
+
+			*offset += ent->record_len;
 		}
+	}
 
-		struct dirent* ent = (struct dirent*)(reent->buf + dirent_off);
-		if(dirent_off + sizeof(struct dirent) + ent->name_len >= reent->read_len) {
-			reent->read_len = 0;
-			continue;
+	kfree(chunk);
+	if(full && !done) {
+		sc_errno = EINVAL;
+		return -1;
+	}
+	return done;
+}
+
+// Looks for a directory entry with name `search` in a single directory block
+static struct dirent* search_block(struct ext2_fs* fs, uint8_t* block, const char* search,
+	size_t search_len, struct dirent** prev) {
+
+	struct dirent* ent = (struct dirent*)block;
+	if(prev) {
+		*prev = NULL;
+	}
+
+	while((uint8_t*)ent + sizeof(struct dirent) <= block + bl_off(1)) {
+		if(ent->record_len < sizeof(struct dirent)) {
+			break;
 		}
 
-		reent->last_len = ent->record_len;
-		*offset += ent->record_len;
-		if(!ent->inode) {
-			continue;
+		if(ent->inode && ent->name_len == search_len && !memcmp(ent->name, search, search_len)) {
+			return ent;
 		}
 
-		// Convert ext2 dirent format to regular dirent
-		size_t length = sizeof(vfs_dirent_t) + ent->name_len + 2;
-		vfs_dirent_t* result = (vfs_dirent_t*)zmalloc(length);
-		result->d_ino = ent->inode;
-		result->d_type = ent->type;
-		result->d_reclen = length;
-		memcpy(result->d_name, ent->name, ent->name_len);
-		result->d_name[ent->name_len] = 0;
-		return result;
+		if(prev) {
+			*prev = ent;
+		}
+		ent = (struct dirent*)((uint8_t*)ent + ent->record_len);
 	}
+	return NULL;
+}
+
+/* Get the directory blocks that need to be searched for `search`. For
+ * indexed directories, this is usually just a single block.
+ */
+static uint32_t search_blocks(struct ext2_fs* fs, struct inode* inode, const char* search,
+	uint32_t* blocks, bool* indexed) {
+
+	int num = ext2_htree_lookup(fs, inode, search, strlen(search), blocks, EXT2_HTREE_MAX_CANDIDATES);
+	*indexed = num >= 0;
+	return *indexed ? num : inode->size / bl_off(1);
 }
 
 // Looks for a directory entry with name `search` in a directory inode
 static struct dirent* search_dir(struct ext2_fs* fs, struct inode* inode, const char* search) {
 	struct dirent* result = NULL;
-	struct rd_r* rd_reent = zmalloc(sizeof(struct rd_r));
-
-	vfs_dirent_t* ent = NULL;
-	uint64_t offset = 0;
-	while((ent = ext2_readdir_r(fs, inode, &offset, rd_reent))) {
-		if(!strcmp(ent->d_name, search)) {
-			result = kmalloc(ent->d_reclen);
-			memcpy(result, ent, ent->d_reclen);
-			kfree(ent);
+	uint8_t* block = kmalloc(bl_off(1));
+	size_t search_len = strlen(search);
+
+	uint32_t blocks[EXT2_HTREE_MAX_CANDIDATES];
+	bool indexed;
+	uint32_t num_blocks = search_blocks(fs, inode, search, blocks, &indexed);
+
+	for(uint32_t i = 0; i < num_blocks; i++) {
+		uint32_t block_num = indexed ? blocks[i] : i;
+		if(!ext2_inode_read_data(fs, inode, bl_off(block_num), bl_off(1), block)) {
+			break;
+		}
+
+		struct dirent* ent = search_block(fs, block, search, search_len, NULL);
+		if(ent) {
+			result = kmalloc(sizeof(struct dirent) + ent->name_len + 1);
+			memcpy(result, ent, sizeof(struct dirent) + ent->name_len);
+			result->name[ent->name_len] = 0;
 			break;
 		}
-		kfree(ent);
 	}
 
-	kfree(rd_reent);
+	kfree(block);
 	return result;
 }
 
@@ -171,6 +241,9 @@ bye:
 	return result;
 }
 
+/* Entries are only merged with their predecessor within the same block,
+ * which keeps the hash ranges of indexed directories intact.
+ */
 void ext2_dirent_rm(struct ext2_fs* fs, uint32_t inode_num, char* name) {
 	struct inode* inode = kmalloc(fs->superblock->inode_size);
 	if(!ext2_inode_read(fs, inode, inode_num)) {
@@ -178,50 +251,33 @@ void ext2_dirent_rm(struct ext2_fs* fs, uint32_t inode_num, char* name) {
 		return;
 	}
 
-	uint8_t* dirent_block = kmalloc(inode->size);
-	if(!ext2_inode_read_data(fs, inode, 0, inode->size, dirent_block)) {
-		kfree(dirent_block);
-		kfree(inode);
-		return;
-	}
-
-	struct dirent* dirent = (struct dirent*)dirent_block;
-	struct dirent* prev = NULL;
-	bool found = false;
-
-	while(dirent < (struct dirent*)(dirent_block + inode->size)) {
-		if(!dirent->inode) {
-			goto next;
-		}
+	uint8_t* block = kmalloc(bl_off(1));
+	uint32_t blocks[EXT2_HTREE_MAX_CANDIDATES];
+	bool indexed;
+	uint32_t num_blocks = search_blocks(fs, inode, name, blocks, &indexed);
 
-		// Check if this is what we're searching for
-		char* dirent_name = strndup(dirent->name, dirent->name_len);
-		if(!strcmp(name, dirent_name)) {
-			kfree(dirent_name);
-			found = true;
+	for(uint32_t i = 0; i < num_blocks; i++) {
+		uint32_t block_num = indexed ? blocks[i] : i;
+		if(!ext2_inode_read_data(fs, inode, bl_off(block_num), bl_off(1), block)) {
 			break;
 		}
 
-		kfree(dirent_name);
-
-		next:
-		prev = dirent;
-		dirent = ((struct dirent*)((intptr_t)dirent + dirent->record_len));
-	}
+		struct dirent* prev;
+		struct dirent* dirent = search_block(fs, block, name, strlen(name), &prev);
+		if(!dirent) {
+			continue;
+		}
 
-	if(!found) {
-		kfree(dirent_block);
-		kfree(inode);
-		return;
-	}
+		dirent->inode = 0;
+		if(prev) {
+			prev->record_len += dirent->record_len;
+		}
 
-	dirent->inode = 0;
-	if(prev) {
-		prev->record_len += dirent->record_len;
+		ext2_inode_write_data(fs, inode, inode_num, bl_off(block_num), bl_off(1), block);
+		break;
 	}
 
-	ext2_inode_write_data(fs, inode, inode_num, 0, inode->size, dirent_block);
-	kfree(dirent_block);
+	kfree(block);
 	kfree(inode);
 }
 
@@ -235,67 +291,140 @@ static inline uint32_t align_dirent_len(uint32_t dlen) {
 	return dlen;
 }
 
-void ext2_dirent_add(struct ext2_fs* fs, uint32_t dir_num, uint32_t inode_num, char* name, uint8_t type) {
+// Try to fit a new dirent into a directory block
+static bool insert_into_block(struct ext2_fs* fs, uint8_t* block, uint32_t inode_num,
+	char* name, uint8_t type) {
+
+	// Length/offsets need to be 4-aligned. +1 for NULL to terminate name
+	size_t dlen = align_dirent_len(sizeof(struct dirent) + strlen(name) + 1);
+	struct dirent* current_ent = (struct dirent*)block;
+
+	while((uint8_t*)current_ent + sizeof(struct dirent) <= block + bl_off(1)) {
+		if(current_ent->record_len < sizeof(struct dirent)) {
+			return false;
+		}
+
+		// Dirents with inode 0 are unused, we can recycle the whole of it
+		uint32_t used = 0;
+		if(current_ent->inode) {
+			used = align_dirent_len(sizeof(struct dirent) + current_ent->name_len);
+		}
+
+		if(current_ent->record_len - used >= dlen) {
+			struct dirent* new_dirent = current_ent;
+			if(used) {
+				new_dirent = (struct dirent*)((uint8_t*)current_ent + used);
+				new_dirent->record_len = current_ent->record_len - used;
+				current_ent->record_len = used;
+			}
+
+			new_dirent->inode = inode_num;
+			new_dirent->name_len = strlen(name);
+			new_dirent->type = type;
+			memcpy(new_dirent->name, name, new_dirent->name_len);
+			return true;
+		}
+
+		current_ent = (struct dirent*)((uint8_t*)current_ent + current_ent->record_len);
+	}
+	return false;
+}
+
+int ext2_dirent_add(struct ext2_fs* fs, uint32_t dir_num, uint32_t inode_num, char* name, uint8_t type) {
 	debug("ext2_new_dirent dir %d ino %d name %s\n", dir_num, inode_num, name);
 
 	struct inode* dir = kmalloc(fs->superblock->inode_size);
 	if(!ext2_inode_read(fs, dir, dir_num)) {
 		kfree(dir);
-		return;
+		sc_errno = EIO;
+		return -1;
 	}
 
-	if(dir->flags & EXT2_INDEX_FL) {
-		log(LOG_ERR, "ext2_dirent_add: No support for writing to indexed dirents.\n");
-		kfree(dir);
-		return;
-	}
+	uint8_t* block = kmalloc(bl_off(1));
+	bool done = false;
+
+	/* For indexed directories, the entry has to go into a leaf for its hash.
+	 * If it is full, split it and try again. A split only moves half of the
+	 * entries, so with many colliding hashes it can take more than one.
+	 */
+	uint32_t leaves[EXT2_HTREE_MAX_CANDIDATES];
+	int num_leaves = ext2_htree_lookup(fs, dir, name, strlen(name), leaves, EXT2_HTREE_MAX_CANDIDATES);
+	bool index_full = false;
+	for(int tries = 0; num_leaves >= 0; tries++) {
+		for(int i = 0; i < num_leaves && !done; i++) {
+			if(ext2_inode_read_data(fs, dir, bl_off(leaves[i]), bl_off(1), block)
+				&& insert_into_block(fs, block, inode_num, name, type)) {
+
+				ext2_inode_write_data(fs, dir, dir_num, bl_off(leaves[i]), bl_off(1), block);
+				done = true;
+			}
+		}
 
-	void* dirents = kmalloc(dir->size);
-	if(!ext2_inode_read_data(fs, dir, 0, dir->size, dirents)) {
-		kfree(dir);
-		kfree(dirents);
-		return;
-	}
+		if(done) {
+			break;
+		}
 
-	// Length/offsets need to be 4-aligned. +1 for NULL to terminate name
-	size_t dlen = align_dirent_len(sizeof(struct dirent) + strlen(name) + 1);
+		/* Index nodes aren't split and no levels are added, so once the
+		 * index is full, the leaf can't be split either.
+		 */
+		if(tries == 2) {
+			index_full = true;
+			break;
+		}
 
-	// Cycle through dirents until we find one with enough space to insert ours.
-	struct dirent* current_ent = dirents;
-	bool recycled_dirent = false;
+		if(ext2_htree_split(fs, dir, dir_num, name, strlen(name)) < 0) {
+			if(sc_errno != ENOSPC) {
+				goto fail;
+			}
+			index_full = true;
+			break;
+		}
 
-	while(current_ent < (struct dirent*)(dirents + dir->size)) {
-		uint32_t free_space;
-		if(current_ent->inode) {
-			free_space = current_ent->record_len - align_dirent_len(sizeof(struct dirent) + current_ent->name_len);
-			recycled_dirent = false;
-		} else {
-			// Dirents with inode 0 are unused, we can recycle the whole of it
-			free_space = current_ent->record_len;
-			recycled_dirent = true;
+		num_leaves = ext2_htree_lookup(fs, dir, name, strlen(name), leaves, EXT2_HTREE_MAX_CANDIDATES);
+		if(num_leaves < 0) {
+			sc_errno = EIO;
+			goto fail;
 		}
+	}
+
+	/* The index flag is set, but the index can't be used, for example because
+	 * of an unknown hash version, or it has no room for more leaves. Drop the
+	 * flag to turn this into a regular linear directory, which is what
+	 * implementations without HTree support are expected to do. e2fsck -D can
+	 * rebuild the index later.
+	 */
+	if(!done && (num_leaves < 0 || index_full) && (dir->flags & EXT2_INDEX_FL)) {
+		log(LOG_INFO, "ext2: Unusable directory index in inode %d, converting to linear directory.\n", dir_num);
+		dir->flags &= ~EXT2_INDEX_FL;
+		ext2_inode_write(fs, dir, dir_num);
+	}
 
-		if(free_space > dlen) {
+	// Cycle through blocks until we find one with enough space to insert ours.
+	for(uint32_t i = 0; !done && i < dir->size / bl_off(1); i++) {
+		if(!ext2_inode_read_data(fs, dir, bl_off(i), bl_off(1), block)) {
 			break;
 		}
 
-		current_ent = (struct dirent*)((intptr_t)current_ent + (intptr_t)current_ent->record_len);
+		if(insert_into_block(fs, block, inode_num, name, type)) {
+			ext2_inode_write_data(fs, dir, dir_num, bl_off(i), bl_off(1), block);
+			done = true;
+		}
 	}
 
-	struct dirent* new_dirent = recycled_dirent ? current_ent : zmalloc(dlen);
-	new_dirent->inode = inode_num;
-	new_dirent->name_len = strlen(name);
-	new_dirent->type = type;
-	memcpy((void*)new_dirent + sizeof(struct dirent), name, new_dirent->name_len);
-
-	if(!recycled_dirent) {
-		uint32_t old_len = current_ent->record_len;
-		current_ent->record_len = align_dirent_len(sizeof(struct dirent) + current_ent->name_len);
-		new_dirent->record_len = old_len - current_ent->record_len;
-		memcpy((void*)current_ent + current_ent->record_len, new_dirent, dlen);
-	}
+	// No space left, append a new block to the directory
+	if(!done) {
+		bzero(block, bl_off(1));
+		((struct dirent*)block)->record_len = bl_off(1);
+		insert_into_block(fs, block, inode_num, name, type);
 
-	ext2_inode_write_data(fs, dir, dir_num, 0, dir->size, dirents);
+		if(!ext2_inode_write_data(fs, dir, dir_num, dir->size, bl_off(1), block)) {
+			sc_errno = EIO;
+			goto fail;
+		}
+
+		dir->size += bl_off(1);
+		ext2_inode_write(fs, dir, dir_num);
+	}
 
 	// Increase inode link count
 	struct inode* inode = kmalloc(fs->superblock->inode_size);
@@ -306,12 +435,15 @@ void ext2_dirent_add(struct ext2_fs* fs, uint32_t dir_num, uint32_t inode_num, c
 
 	// FIXME Update parent directory mtime/ctime
 
-	if(!recycled_dirent) {
-		kfree(new_dirent);
-	}
+	kfree(inode);
+	kfree(block);
+	kfree(dir);
+	return 0;
 
-	kfree(dirents);
+fail:
+	kfree(block);
 	kfree(dir);
+	return -1;
 }
 
 #endif /* CONFIG_ENABLE_EXT2 */
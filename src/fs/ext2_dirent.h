@@ -38,14 +38,11 @@ struct dirent {
 	char name[] __attribute__ ((nonstring));
 } __attribute__((packed));
 
-struct rd_r {
-	uint8_t buf[0x200];
-	size_t read_len;
-	size_t read_off;
-	size_t last_len;
-};
+// Maximum number of directory blocks read at once by getdents
+#define EXT2_GETDENTS_BLOCKS 8
 
 struct dirent* ext2_dirent_find(struct ext2_fs* fs, const char* path, uint32_t* parent_ino, task_t* task);
 void ext2_dirent_rm(struct ext2_fs* fs, uint32_t inode_num, char* name);
-void ext2_dirent_add(struct ext2_fs* fs, uint32_t dir, uint32_t inode, char* name, uint8_t type);
-vfs_dirent_t* ext2_readdir_r(struct ext2_fs* fs, struct inode* inode, uint64_t* offset, struct rd_r* reent);
+int ext2_dirent_add(struct ext2_fs* fs, uint32_t dir, uint32_t inode, char* name, uint8_t type);
+size_t ext2_dirent_getdents(struct ext2_fs* fs, struct inode* inode, uint64_t* offset,
+	void* buf, size_t size);
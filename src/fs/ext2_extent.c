@@ -0,0 +1,264 @@
+/* ext2_extent.c: Ext4 extent trees
+ * Copyright © 2026 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef CONFIG_ENABLE_EXT2
+
+#include "ext2_internal.h"
+#include "ext2_inode.h"
+#include "ext2_extent.h"
+#include <log.h>
+#include <string.h>
+#include <mem/kmalloc.h>
+
+#define EXT4_EXTENT_MAGIC 0xF30A
+#define EXT4_EXTENT_MAX_DEPTH 5
+
+/* Files using extents store the root node of the tree in inode->blocks
+ * instead of block pointers. Every node starts with this header, followed by
+ * either struct extent_idx entries pointing to the next level, or, in leaf
+ * nodes (depth 0), the struct extent entries themselves. Entries are sorted
+ * by logical block.
+ */
+struct extent_header {
+	uint16_t magic;
+	uint16_t entries;
+	uint16_t max;
+	uint16_t depth;
+	uint32_t generation;
+} __attribute__((packed));
+
+struct extent_idx {
+	uint32_t block;
+	uint32_t leaf;
+	uint16_t leaf_high;
+	uint16_t unused;
+} __attribute__((packed));
+
+struct extent {
+	uint32_t block;
+	uint16_t len;
+	uint16_t start_high;
+	uint32_t start;
+} __attribute__((packed));
+
+static bool check_header(struct ext2_fs* fs, struct extent_header* hdr, size_t size) {
+	if(hdr->magic != EXT4_EXTENT_MAGIC || hdr->depth > EXT4_EXTENT_MAX_DEPTH
+		|| hdr->entries > hdr->max
+		|| sizeof(struct extent_header) + hdr->max * sizeof(struct extent) > size) {
+
+		log(LOG_ERR, "ext2: Invalid extent tree node\n");
+		return false;
+	}
+	return true;
+}
+
+// Length of an extent, and whether it is unwritten (allocated, but reads as zeroes)
+static inline uint32_t extent_len(struct extent* ext, bool* unwritten) {
+	bool uw = ext->len > EXT4_EXTENT_MAX_LEN;
+	if(unwritten) {
+		*unwritten = uw;
+	}
+	return uw ? ext->len - EXT4_EXTENT_MAX_LEN : ext->len;
+}
+
+/* Index of the last entry starting at or before block_num, or -1. Index and
+ * leaf entries both start with the logical block number, so this works for
+ * either, given the entry size.
+ */
+static int find_entry(struct extent_header* hdr, size_t entry_size, uint32_t block_num) {
+	uint8_t* entries = (uint8_t*)(hdr + 1);
+	int lo = 0;
+	int hi = hdr->entries - 1;
+	int result = -1;
+
+	while(lo <= hi) {
+		int mid = (lo + hi) / 2;
+		if(*(uint32_t*)(entries + mid * entry_size) <= block_num) {
+			result = mid;
+			lo = mid + 1;
+		} else {
+			hi = mid - 1;
+		}
+	}
+	return result;
+}
+
+/* Find the extent containing block_num. Walks down the tree once and returns
+ * the whole remainder of the extent, so a large read only needs one lookup
+ * per extent. For holes, map->len is the distance to the next extent.
+ */
+bool ext2_extent_map(struct ext2_fs* fs, struct inode* inode, uint32_t block_num,
+	struct ext2_mapping* map) {
+
+	struct extent_header* hdr = (struct extent_header*)inode->blocks;
+	size_t size = sizeof(inode->blocks);
+	uint32_t limit = UINT32_MAX;
+
+	while(1) {
+		if(!check_header(fs, hdr, size)) {
+			return false;
+		}
+
+		if(!hdr->depth) {
+			break;
+		}
+
+		struct extent_idx* idx = (struct extent_idx*)(hdr + 1);
+		int i = find_entry(hdr, sizeof(struct extent_idx), block_num);
+		if(i < 0) {
+			limit = hdr->entries ? idx[0].block : limit;
+			goto hole;
+		}
+
+		if(i + 1 < hdr->entries) {
+			limit = idx[i + 1].block;
+		}
+
+		if(idx[i].leaf_high) {
+			log(LOG_ERR, "ext2: Extent tree node beyond 2^32 blocks\n");
+			return false;
+		}
+
+		struct table_cache_entry* entry = ext2_table_get(fs, idx[i].leaf);
+		if(!entry) {
+			return false;
+		}
+
+		hdr = (struct extent_header*)entry->table;
+		size = bl_off(1);
+	}
+
+	struct extent* ext = (struct extent*)(hdr + 1);
+	int i = find_entry(hdr, sizeof(struct extent), block_num);
+	if(i >= 0) {
+		uint32_t len = extent_len(&ext[i], &map->unwritten);
+		if(block_num - ext[i].block < len) {
+			if(ext[i].start_high) {
+				log(LOG_ERR, "ext2: Extent beyond 2^32 blocks\n");
+				return false;
+			}
+
+			map->start = ext[i].start + (block_num - ext[i].block);
+			map->len = len - (block_num - ext[i].block);
+			return true;
+		}
+	}
+
+	if(i + 1 < hdr->entries) {
+		limit = ext[i + 1].block;
+	}
+
+hole:
+	map->start = 0;
+	map->len = limit - block_num;
+	map->unwritten = false;
+	return true;
+}
+
+/* Add a newly allocated run of blocks to the tree, extending the preceding
+ * extent where possible. Only trees that still fit into the inode can be
+ * modified right now.
+ */
+bool ext2_extent_insert(struct ext2_fs* fs, struct inode* inode, uint32_t block_num,
+	uint32_t start, uint32_t len) {
+
+	struct extent_header* hdr = (struct extent_header*)inode->blocks;
+	if(!check_header(fs, hdr, sizeof(inode->blocks))) {
+		return false;
+	}
+
+	if(hdr->depth) {
+		log(LOG_ERR, "ext2: Writing to multi-level extent trees is not supported\n");
+		return false;
+	}
+
+	struct extent* ext = (struct extent*)(hdr + 1);
+	int i = find_entry(hdr, sizeof(struct extent), block_num);
+	if(i >= 0) {
+		bool unwritten;
+		uint32_t prev_len = extent_len(&ext[i], &unwritten);
+		if(!unwritten && !ext[i].start_high && ext[i].block + prev_len == block_num
+			&& ext[i].start + prev_len == start && prev_len + len <= EXT4_EXTENT_MAX_LEN) {
+
+			ext[i].len += len;
+			return true;
+		}
+	}
+
+	if(hdr->entries >= hdr->max) {
+		log(LOG_ERR, "ext2: Extent tree in inode is full\n");
+		return false;
+	}
+
+	i++;
+	memmove(&ext[i + 1], &ext[i], (hdr->entries - i) * sizeof(struct extent));
+	ext[i].block = block_num;
+	ext[i].len = len;
+	ext[i].start_high = 0;
+	ext[i].start = start;
+	hdr->entries++;
+	return true;
+}
+
+static void free_node(struct ext2_fs* fs, struct extent_header* hdr, size_t size) {
+	if(!check_header(fs, hdr, size)) {
+		return;
+	}
+
+	if(!hdr->depth) {
+		struct extent* ext = (struct extent*)(hdr + 1);
+		for(int i = 0; i < hdr->entries; i++) {
+			if(!ext[i].start_high) {
+				ext2_block_free(fs, ext[i].start, extent_len(&ext[i], NULL));
+			}
+		}
+		return;
+	}
+
+	// Needs a private copy since the cache entry can get evicted while we descend
+	uint8_t* node = kmalloc(bl_off(1));
+	struct extent_idx* idx = (struct extent_idx*)(hdr + 1);
+	for(int i = 0; i < hdr->entries; i++) {
+		if(idx[i].leaf_high) {
+			continue;
+		}
+
+		struct table_cache_entry* entry = ext2_table_get(fs, idx[i].leaf);
+		if(entry) {
+			memcpy(node, entry->table, bl_off(1));
+			free_node(fs, (struct extent_header*)node, bl_off(1));
+		}
+		ext2_block_free(fs, idx[i].leaf, 1);
+	}
+	kfree(node);
+}
+
+/* Free all data and tree blocks of an inode and leave an empty tree behind.
+ * Caller needs to write back the superblock, blockgroup table and inode.
+ */
+void ext2_extent_free(struct ext2_fs* fs, struct inode* inode) {
+	struct extent_header* hdr = (struct extent_header*)inode->blocks;
+	free_node(fs, hdr, sizeof(inode->blocks));
+
+	bzero(inode->blocks, sizeof(inode->blocks));
+	hdr->magic = EXT4_EXTENT_MAGIC;
+	hdr->max = (sizeof(inode->blocks) - sizeof(struct extent_header)) / sizeof(struct extent);
+}
+
+#endif /* CONFIG_ENABLE_EXT2 */
@@ -0,0 +1,42 @@
+#pragma once
+
+/* Copyright © 2026 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ext2_internal.h"
+
+// inode->flags
+#define EXT4_EXTENTS_FL 0x00080000
+
+// Longest initialized extent. Longer lengths mark unwritten extents.
+#define EXT4_EXTENT_MAX_LEN 32768
+
+/* A run of blocks starting at a logical block. start is the physical block
+ * the logical block maps to, or 0 for holes.
+ */
+struct ext2_mapping {
+	uint32_t start;
+	uint32_t len;
+	bool unwritten;
+};
+
+bool ext2_extent_map(struct ext2_fs* fs, struct inode* inode, uint32_t block_num,
+	struct ext2_mapping* map);
+bool ext2_extent_insert(struct ext2_fs* fs, struct inode* inode, uint32_t block_num,
+	uint32_t start, uint32_t len);
+void ext2_extent_free(struct ext2_fs* fs, struct inode* inode);
@@ -0,0 +1,517 @@
+/* ext2_htree.c: Hashed directory index (HTree) lookups and leaf splits
+ * Copyright © 2026 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef CONFIG_ENABLE_EXT2
+
+#include "ext2_internal.h"
+#include "ext2_inode.h"
+#include "ext2_htree.h"
+#include "ext2_dirent.h"
+#include <log.h>
+#include <string.h>
+#include <errno.h>
+#include <mem/kmalloc.h>
+
+#define DX_HASH_LEGACY 0
+#define DX_HASH_HALF_MD4 1
+#define DX_HASH_TEA 2
+#define DX_HASH_LEGACY_UNSIGNED 3
+#define DX_HASH_HALF_MD4_UNSIGNED 4
+#define DX_HASH_TEA_UNSIGNED 5
+
+// Root plus up to two levels of index nodes
+#define DX_MAX_LEVELS 3
+
+/* The root block starts with the regular . and .. dirents, followed by this
+ * struct and the entries. Index nodes contain a single empty dirent spanning
+ * the whole block, followed by the entries. In both cases, the hash field of
+ * the first entry is replaced by a struct dx_countlimit.
+ */
+struct dx_root_info {
+	uint32_t reserved_zero;
+	uint8_t hash_version;
+	uint8_t info_length;
+	uint8_t indirect_levels;
+	uint8_t unused_flags;
+} __attribute__((packed));
+
+struct dx_entry {
+	uint32_t hash;
+	uint32_t block;
+} __attribute__((packed));
+
+struct dx_countlimit {
+	uint16_t limit;
+	uint16_t count;
+} __attribute__((packed));
+
+struct dx_frame {
+	uint8_t* buf;
+	uint32_t block;
+	struct dx_entry* entries;
+	uint32_t count;
+	uint32_t at;
+};
+
+#define DX_ROOT_INFO_OFFSET 24
+#define DX_NODE_ENTRIES_OFFSET 8
+
+static uint32_t dx_hack_hash(const char* name, size_t len, bool is_unsigned) {
+	uint32_t hash;
+	uint32_t hash0 = 0x12a3fe2d;
+	uint32_t hash1 = 0x37abe8f9;
+
+	for(size_t i = 0; i < len; i++) {
+		int c = is_unsigned ? (int)(unsigned char)name[i] : (int)(signed char)name[i];
+		hash = hash1 + (hash0 ^ (c * 7152373));
+		if(hash & 0x80000000) {
+			hash -= 0x7fffffff;
+		}
+		hash1 = hash0;
+		hash0 = hash;
+	}
+	return hash0 << 1;
+}
+
+static void str2hashbuf(const char* msg, int len, uint32_t* buf, int num, bool is_unsigned) {
+	uint32_t pad = (uint32_t)len | ((uint32_t)len << 8);
+	pad |= pad << 16;
+
+	uint32_t val = pad;
+	if(len > num * 4) {
+		len = num * 4;
+	}
+
+	for(int i = 0; i < len; i++) {
+		int c = is_unsigned ? (int)(unsigned char)msg[i] : (int)(signed char)msg[i];
+		val = c + (val << 8);
+		if((i % 4) == 3) {
+			*buf++ = val;
+			val = pad;
+			num--;
+		}
+	}
+
+	if(--num >= 0) {
+		*buf++ = val;
+	}
+	while(--num >= 0) {
+		*buf++ = pad;
+	}
+}
+
+static void tea_transform(uint32_t buf[4], uint32_t const in[4]) {
+	uint32_t sum = 0;
+	uint32_t b0 = buf[0], b1 = buf[1];
+	uint32_t a = in[0], b = in[1], c = in[2], d = in[3];
+
+	for(int n = 0; n < 16; n++) {
+		sum += 0x9E3779B9;
+		b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+		b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+	}
+
+	buf[0] += b0;
+	buf[1] += b1;
+}
+
+#define rol32(x, s) (((x) << (s)) | ((x) >> (32 - (s))))
+#define F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define G(x, y, z) (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define H(x, y, z) ((x) ^ (y) ^ (z))
+#define ROUND(f, a, b, c, d, x, s) (a += f(b, c, d) + x, a = rol32(a, s))
+#define K1 0
+#define K2 013240474631UL
+#define K3 015666365641UL
+
+static void half_md4_transform(uint32_t buf[4], uint32_t const in[8]) {
+	uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+	ROUND(F, a, b, c, d, in[0] + K1,  3);
+	ROUND(F, d, a, b, c, in[1] + K1,  7);
+	ROUND(F, c, d, a, b, in[2] + K1, 11);
+	ROUND(F, b, c, d, a, in[3] + K1, 19);
+	ROUND(F, a, b, c, d, in[4] + K1,  3);
+	ROUND(F, d, a, b, c, in[5] + K1,  7);
+	ROUND(F, c, d, a, b, in[6] + K1, 11);
+	ROUND(F, b, c, d, a, in[7] + K1, 19);
+
+	ROUND(G, a, b, c, d, in[1] + K2,  3);
+	ROUND(G, d, a, b, c, in[3] + K2,  5);
+	ROUND(G, c, d, a, b, in[5] + K2,  9);
+	ROUND(G, b, c, d, a, in[7] + K2, 13);
+	ROUND(G, a, b, c, d, in[0] + K2,  3);
+	ROUND(G, d, a, b, c, in[2] + K2,  5);
+	ROUND(G, c, d, a, b, in[4] + K2,  9);
+	ROUND(G, b, c, d, a, in[6] + K2, 13);
+
+	ROUND(H, a, b, c, d, in[3] + K3,  3);
+	ROUND(H, d, a, b, c, in[7] + K3,  9);
+	ROUND(H, c, d, a, b, in[2] + K3, 11);
+	ROUND(H, b, c, d, a, in[6] + K3, 15);
+	ROUND(H, a, b, c, d, in[1] + K3,  3);
+	ROUND(H, d, a, b, c, in[5] + K3,  9);
+	ROUND(H, c, d, a, b, in[0] + K3, 11);
+	ROUND(H, b, c, d, a, in[4] + K3, 15);
+
+	buf[0] += a;
+	buf[1] += b;
+	buf[2] += c;
+	buf[3] += d;
+}
+
+// Returns false for unknown hash versions
+static bool dx_hash(struct ext2_fs* fs, uint8_t version, const char* name, size_t len, uint32_t* result) {
+	uint32_t buf[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+	uint32_t in[8];
+	uint32_t hash;
+
+	uint32_t seed[4];
+	memcpy(seed, fs->superblock->hash_seed, sizeof(seed));
+	if(seed[0] || seed[1] || seed[2] || seed[3]) {
+		memcpy(buf, seed, sizeof(buf));
+	}
+
+	if(version <= DX_HASH_TEA && (fs->superblock->flags & EXT2_FLAGS_UNSIGNED_HASH)) {
+		version += 3;
+	}
+
+	bool is_unsigned = version >= DX_HASH_LEGACY_UNSIGNED;
+	switch(version) {
+		case DX_HASH_LEGACY:
+		case DX_HASH_LEGACY_UNSIGNED:
+			hash = dx_hack_hash(name, len, is_unsigned);
+			break;
+		case DX_HASH_HALF_MD4:
+		case DX_HASH_HALF_MD4_UNSIGNED:
+			for(int rem = len; rem > 0; rem -= 32, name += 32) {
+				str2hashbuf(name, rem, in, 8, is_unsigned);
+				half_md4_transform(buf, in);
+			}
+			hash = buf[1];
+			break;
+		case DX_HASH_TEA:
+		case DX_HASH_TEA_UNSIGNED:
+			for(int rem = len; rem > 0; rem -= 16, name += 16) {
+				str2hashbuf(name, rem, in, 4, is_unsigned);
+				tea_transform(buf, in);
+			}
+			hash = buf[0];
+			break;
+		default:
+			return false;
+	}
+
+	// The lowest bit is used as collision flag, and ~0 marks the end of the index
+	hash &= ~1;
+	if(hash == (0x7fffffff << 1)) {
+		hash = (0x7fffffff - 1) << 1;
+	}
+
+	*result = hash;
+	return true;
+}
+
+static bool read_node(struct ext2_fs* fs, struct inode* dir, struct dx_frame* frame, uint32_t block) {
+	frame->block = block & 0x0fffffff;
+	if(!ext2_inode_read_data(fs, dir, bl_off(frame->block), bl_off(1), frame->buf)) {
+		return false;
+	}
+
+	frame->entries = (struct dx_entry*)(frame->buf + DX_NODE_ENTRIES_OFFSET);
+	return true;
+}
+
+// Find the last entry with a hash <= hash. The first entry has an implicit hash of 0.
+static bool dx_search(struct dx_frame* frame, uint32_t hash, uint32_t max_entries) {
+	struct dx_countlimit* cl = (struct dx_countlimit*)frame->entries;
+	if(!cl->count || cl->count > cl->limit || cl->limit > max_entries) {
+		return false;
+	}
+
+	frame->count = cl->count;
+	frame->at = 0;
+
+	int lo = 1;
+	int hi = frame->count - 1;
+	while(lo <= hi) {
+		int mid = (lo + hi) / 2;
+		if(frame->entries[mid].hash > hash) {
+			hi = mid - 1;
+		} else {
+			frame->at = mid;
+			lo = mid + 1;
+		}
+	}
+	return true;
+}
+
+static inline bool dx_usable(struct ext2_fs* fs, struct inode* dir) {
+	return (dir->flags & EXT2_INDEX_FL)
+		&& (fs->superblock->features_compat & EXT2_FEATURE_COMPAT_DIR_INDEX);
+}
+
+/* Walk down the index to the leaf for `name`, filling in a frame for the root
+ * and every index node on the way. Returns the number of index levels below
+ * the root, or -1 if the index can't be used.
+ */
+static int dx_probe(struct ext2_fs* fs, struct inode* dir, const char* name, size_t name_len,
+	struct dx_frame* frames, uint32_t* hash, uint8_t* hash_version) {
+
+	frames[0].block = 0;
+	if(!ext2_inode_read_data(fs, dir, 0, bl_off(1), frames[0].buf)) {
+		return -1;
+	}
+
+	struct dx_root_info* info = (struct dx_root_info*)(frames[0].buf + DX_ROOT_INFO_OFFSET);
+	int levels = info->indirect_levels;
+
+	if(info->reserved_zero || info->info_length != sizeof(struct dx_root_info)
+		|| levels >= DX_MAX_LEVELS
+		|| !dx_hash(fs, info->hash_version, name, name_len, hash)) {
+		debug("ext2_htree: Unsupported index, falling back to linear search\n");
+		return -1;
+	}
+
+	*hash_version = info->hash_version;
+	frames[0].entries = (struct dx_entry*)(frames[0].buf + DX_ROOT_INFO_OFFSET + info->info_length);
+	const uint32_t root_max = (bl_off(1) - DX_ROOT_INFO_OFFSET - info->info_length) / sizeof(struct dx_entry);
+	const uint32_t node_max = (bl_off(1) - DX_NODE_ENTRIES_OFFSET) / sizeof(struct dx_entry);
+
+	for(int i = 0; i <= levels; i++) {
+		if(!dx_search(&frames[i], *hash, i ? node_max : root_max)) {
+			return -1;
+		}
+
+		if(i < levels && !read_node(fs, dir, &frames[i + 1], frames[i].entries[frames[i].at].block)) {
+			return -1;
+		}
+	}
+	return levels;
+}
+
+/* Look up the logical blocks of an indexed directory that can contain a name.
+ * Usually this is a single leaf block, but names with colliding hashes can
+ * continue in the following leaves, so up to max_blocks block numbers are
+ * returned. Returns -1 if the directory isn't indexed or the index can't be
+ * used, in which case callers should fall back to a linear scan.
+ */
+int ext2_htree_lookup(struct ext2_fs* fs, struct inode* dir, const char* name,
+	size_t name_len, uint32_t* blocks, int max_blocks) {
+
+	if(!dx_usable(fs, dir)) {
+		return -1;
+	}
+
+	// . and .. are always stored at the beginning of the root block
+	if((name_len == 1 && name[0] == '.') || (name_len == 2 && !memcmp(name, "..", 2))) {
+		blocks[0] = 0;
+		return 1;
+	}
+
+	uint8_t* buf = kmalloc(bl_off(1) * DX_MAX_LEVELS);
+	struct dx_frame frames[DX_MAX_LEVELS];
+	for(int i = 0; i < DX_MAX_LEVELS; i++) {
+		frames[i].buf = buf + bl_off(i);
+	}
+
+	int num = -1;
+	uint32_t hash;
+	uint8_t hash_version;
+	int levels = dx_probe(fs, dir, name, name_len, frames, &hash, &hash_version);
+	if(levels < 0) {
+		goto out;
+	}
+
+	num = 0;
+	blocks[num++] = frames[levels].entries[frames[levels].at].block & 0x0fffffff;
+
+	// Continue with the following leaves as long as their hash is identical
+	while(num < max_blocks) {
+		int level = levels;
+		while(level >= 0 && frames[level].at + 1 >= frames[level].count) {
+			level--;
+		}
+
+		if(level < 0 || (frames[level].entries[frames[level].at + 1].hash & ~1) != hash) {
+			break;
+		}
+
+		frames[level].at++;
+		for(; level < levels; level++) {
+			struct dx_frame* frame = &frames[level + 1];
+			if(!read_node(fs, dir, frame, frames[level].entries[frames[level].at].block)) {
+				goto out;
+			}
+
+			frame->count = ((struct dx_countlimit*)frame->entries)->count;
+			frame->at = 0;
+		}
+
+		blocks[num++] = frames[levels].entries[frames[levels].at].block & 0x0fffffff;
+	}
+
+out:
+	kfree(buf);
+	return num;
+}
+
+// Position, size and hash of a dirent in a leaf that is being split
+struct dx_map {
+	uint32_t hash;
+	uint16_t offset;
+	uint16_t size;
+};
+
+// Copy the entries in `map` to `dest`, the last one taking up the rest of the block
+static void dx_pack(struct ext2_fs* fs, uint8_t* dest, uint8_t* src, struct dx_map* map, int count) {
+	bzero(dest, bl_off(1));
+	struct dirent* ent = (struct dirent*)dest;
+	ent->record_len = bl_off(1);
+
+	uint32_t pos = 0;
+	for(int i = 0; i < count; i++) {
+		ent = (struct dirent*)(dest + pos);
+		memcpy(ent, src + map[i].offset, map[i].size);
+		ent->record_len = map[i].size;
+		pos += map[i].size;
+	}
+	ent->record_len += bl_off(1) - pos;
+}
+
+/* Split the leaf that `name` hashes to, so there is room to add it. The upper
+ * half of the entries by hash is moved to a new block at the end of the
+ * directory, which is then added to the index node right after the old leaf.
+ * If the lower half ends in the same hash the upper half starts with, the
+ * new index entry gets the collision bit so lookups continue into it.
+ *
+ * Splitting index nodes and adding levels to the index is not supported, so
+ * this fails with ENOSPC once the index node above the leaf is full.
+ */
+int ext2_htree_split(struct ext2_fs* fs, struct inode* dir, uint32_t dir_num,
+	const char* name, size_t name_len) {
+
+	if(!dx_usable(fs, dir)) {
+		sc_errno = EINVAL;
+		return -1;
+	}
+
+	uint8_t* buf = kmalloc(bl_off(1) * (DX_MAX_LEVELS + 2));
+	struct dx_frame frames[DX_MAX_LEVELS];
+	for(int i = 0; i < DX_MAX_LEVELS; i++) {
+		frames[i].buf = buf + bl_off(i);
+	}
+	uint8_t* leaf = buf + bl_off(DX_MAX_LEVELS);
+	uint8_t* half = leaf + bl_off(1);
+
+	// Smallest possible dirent is 12 bytes
+	struct dx_map* map = kmalloc(sizeof(struct dx_map) * (bl_off(1) / 12));
+	int r = -1;
+	sc_errno = EIO;
+
+	uint32_t hash;
+	uint8_t hash_version;
+	int levels = dx_probe(fs, dir, name, name_len, frames, &hash, &hash_version);
+	if(levels < 0) {
+		goto out;
+	}
+
+	struct dx_frame* frame = &frames[levels];
+	struct dx_countlimit* cl = (struct dx_countlimit*)frame->entries;
+	if(cl->count >= cl->limit) {
+		log(LOG_INFO, "ext2: Directory index of inode %d is full\n", dir_num);
+		sc_errno = ENOSPC;
+		goto out;
+	}
+
+	uint32_t leaf_block = frame->entries[frame->at].block & 0x0fffffff;
+	if(!ext2_inode_read_data(fs, dir, bl_off(leaf_block), bl_off(1), leaf)) {
+		goto out;
+	}
+
+	int count = 0;
+	for(uint32_t pos = 0; pos + sizeof(struct dirent) <= bl_off(1);) {
+		struct dirent* ent = (struct dirent*)(leaf + pos);
+		if(ent->record_len < sizeof(struct dirent) || pos + ent->record_len > bl_off(1)) {
+			log(LOG_WARN, "ext2: Broken dirent in block %d of inode %d\n", leaf_block, dir_num);
+			goto out;
+		}
+
+		if(ent->inode) {
+			map[count].offset = pos;
+			map[count].size = ALIGN(sizeof(struct dirent) + ent->name_len, 4);
+			dx_hash(fs, hash_version, ent->name, ent->name_len, &map[count].hash);
+			count++;
+		}
+		pos += ent->record_len;
+	}
+
+	if(count < 2) {
+		sc_errno = ENOSPC;
+		goto out;
+	}
+
+	// Sort by hash, leaves are small enough for an insertion sort
+	for(int i = 1; i < count; i++) {
+		struct dx_map cur = map[i];
+		int j = i - 1;
+		for(; j >= 0 && map[j].hash > cur.hash; j--) {
+			map[j + 1] = map[j];
+		}
+		map[j + 1] = cur;
+	}
+
+	int split = count / 2;
+	uint32_t split_hash = map[split].hash;
+	bool continued = map[split - 1].hash == split_hash;
+
+	// Write the new leaf first, so the index never points to a missing block
+	uint32_t new_block = dir->size / bl_off(1);
+	dx_pack(fs, half, leaf, map + split, count - split);
+	if(!ext2_inode_write_data(fs, dir, dir_num, dir->size, bl_off(1), half)) {
+		goto out;
+	}
+
+	dir->size += bl_off(1);
+	ext2_inode_write(fs, dir, dir_num);
+
+	dx_pack(fs, half, leaf, map, split);
+	if(!ext2_inode_write_data(fs, dir, dir_num, bl_off(leaf_block), bl_off(1), half)) {
+		goto out;
+	}
+
+	struct dx_entry* entries = frame->entries;
+	memmove(&entries[frame->at + 2], &entries[frame->at + 1],
+		sizeof(struct dx_entry) * (cl->count - frame->at - 1));
+	entries[frame->at + 1].hash = split_hash | continued;
+	entries[frame->at + 1].block = new_block;
+	cl->count++;
+
+	if(!ext2_inode_write_data(fs, dir, dir_num, bl_off(frame->block), bl_off(1), frame->buf)) {
+		goto out;
+	}
+	r = 0;
+
+out:
+	kfree(map);
+	kfree(buf);
+	return r;
+}
+
+#endif /* CONFIG_ENABLE_EXT2 */
@@ -0,0 +1,29 @@
+#pragma once
+
+/* Copyright © 2026 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ext2_internal.h"
+
+// Maximum number of leaf blocks returned for names with colliding hashes
+#define EXT2_HTREE_MAX_CANDIDATES 4
+
+int ext2_htree_lookup(struct ext2_fs* fs, struct inode* dir, const char* name,
+	size_t name_len, uint32_t* blocks, int max_blocks);
+int ext2_htree_split(struct ext2_fs* fs, struct inode* dir, uint32_t dir_num,
+	const char* name, size_t name_len);
@@ -22,6 +22,7 @@
 #include "ext2_internal.h"
 #include "ext2_misc.h"
 #include "ext2_inode.h"
+#include "ext2_extent.h"
 #include <log.h>
 #include <string.h>
 #include <time.h>
@@ -38,7 +39,7 @@ static uint64_t find_inode(struct ext2_fs* fs, uint32_t inode_num) {
 	if(blockgroup_num > (fs->superblock->block_count / fs->superblock->blocks_per_group))
 		return 0;
 
-	struct blockgroup* blockgroup = fs->blockgroup_table + blockgroup_num;
+	struct blockgroup* blockgroup = blockgroup_get(blockgroup_num);
 	if(!blockgroup || !blockgroup->inode_table) {
 		log(LOG_ERR, "ext2: Could not locate entry %d in blockgroup table\n", blockgroup_num);
 		return 0;
@@ -104,11 +105,18 @@ bool ext2_inode_write(struct ext2_fs* fs, struct inode* buf, uint32_t inode_num)
 }
 
 uint32_t ext2_inode_new(struct ext2_fs* fs, struct inode* inode, uint16_t mode) {
-	struct blockgroup* blockgroup = fs->blockgroup_table;
-	while(!blockgroup->free_inodes) { blockgroup++; }
+	uint32_t group_num = 0;
+	struct blockgroup* blockgroup = blockgroup_get(group_num);
+	while(!blockgroup->free_inodes) { blockgroup = blockgroup_get(++group_num); }
+
+	int32_t bit = ext2_bitmap_search_and_claim(fs, blockgroup->inode_bitmap);
+	if(bit < 0) {
+		log(LOG_ERR, "ext2: Inode bitmap of blockgroup %d is full\n", group_num);
+		return 0;
+	}
 
 	// Inodes are 1-indexed, so add 1 to result.
-	uint32_t inode_num = ext2_bitmap_search_and_claim(fs, blockgroup->inode_bitmap) + 1;
+	uint32_t inode_num = bit + 1 + group_num * fs->superblock->inodes_per_group;
 
 	bzero(inode, fs->superblock->inode_size);
 	inode->mode = mode;
@@ -126,124 +134,388 @@ uint32_t ext2_inode_new(struct ext2_fs* fs, struct inode* inode, uint16_t mode)
 	return inode_num;
 }
 
-void ext2_free_blocknum_resolver_cache(struct ext2_blocknum_resolver_cache* cache) {
-	if(cache->indirect_table) {
-		kfree(cache->indirect_table);
+static bool table_writeback(struct ext2_fs* fs, struct table_cache_entry* entry) {
+	if(!entry->dirty) {
+		return true;
 	}
 
-	if(cache->double_table) {
-		kfree(cache->double_table);
+	if(vfs_block_swrite(fs->dev, bl_off(entry->block), bl_off(1), (uint8_t*)entry->table) != bl_off(1)) {
+		log(LOG_ERR, "ext2: Could not write indirection table in block %d\n", entry->block);
+		return false;
 	}
 
-	if(cache->double_second_table) {
-		kfree(cache->double_second_table);
+	entry->dirty = false;
+	return true;
+}
+
+// Grab the next cache entry in round-robin order, writing back its old contents
+static struct table_cache_entry* table_evict(struct ext2_fs* fs) {
+	struct table_cache_entry* entry = &fs->table_cache[fs->table_cache_end];
+	if(!table_writeback(fs, entry)) {
+		return NULL;
 	}
 
-	kfree(cache);
+	if(!entry->table) {
+		entry->table = kmalloc(bl_off(1));
+	}
+
+	entry->block = 0;
+	fs->table_cache_end = (fs->table_cache_end + 1) % TABLE_CACHE_MAX;
+	return entry;
 }
 
-// FIXME This is a mess (and also has no triply-indirect block support).
-uint32_t ext2_resolve_blocknum(struct ext2_fs* fs, struct inode* inode, uint32_t block_num, struct ext2_blocknum_resolver_cache* cache) {
-	uint32_t real_block_num = 0;
+struct table_cache_entry* ext2_table_get(struct ext2_fs* fs, uint32_t block) {
+	for(int i = 0; i < TABLE_CACHE_MAX; i++) {
+		if(fs->table_cache[i].block == block) {
+			return &fs->table_cache[i];
+		}
+	}
+
+	struct table_cache_entry* entry = table_evict(fs);
+	if(!entry) {
+		return NULL;
+	}
+
+	if(vfs_block_sread(fs->dev, bl_off(block), bl_off(1), (uint8_t*)entry->table) != bl_off(1)) {
+		return NULL;
+	}
+
+	entry->block = block;
+	return entry;
+}
+
+static inline uint32_t table_lookup(struct ext2_fs* fs, uint32_t table_block, uint32_t index) {
+	if(!table_block) {
+		return 0;
+	}
+
+	struct table_cache_entry* entry = ext2_table_get(fs, table_block);
+	return entry ? entry->table[index] : 0;
+}
+
+static bool table_set(struct ext2_fs* fs, uint32_t table_block, uint32_t index, uint32_t value) {
+	struct table_cache_entry* entry = ext2_table_get(fs, table_block);
+	if(!entry) {
+		return false;
+	}
+
+	entry->table[index] = value;
+	entry->dirty = true;
+	return true;
+}
+
+bool ext2_table_cache_flush(struct ext2_fs* fs) {
+	bool result = true;
+	for(int i = 0; i < TABLE_CACHE_MAX; i++) {
+		if(fs->table_cache[i].block && !table_writeback(fs, &fs->table_cache[i])) {
+			result = false;
+		}
+	}
+	return result;
+}
+
+/* Called for freshly allocated blocks, which might still have a stale
+ * table cached from a previous life as an indirect block.
+ */
+void ext2_table_cache_drop(struct ext2_fs* fs, uint32_t start, uint32_t count) {
+	for(int i = 0; i < TABLE_CACHE_MAX; i++) {
+		if(fs->table_cache[i].block - start < count) {
+			fs->table_cache[i].block = 0;
+			fs->table_cache[i].dirty = false;
+		}
+	}
+}
+
+/* Get the path through the indirection tables for a logical block number
+ * >= 12. Returns the depth (1 for single indirect, 2 for double indirect, 3
+ * for triple indirect) and fills in the table indices for each level, or 0
+ * if the block number is out of range.
+ */
+static int block_path(struct ext2_fs* fs, uint32_t block_num, uint32_t idx[3]) {
 	const uint32_t entries_per_block = bl_off(1) / sizeof(uint32_t);
+	const uint32_t entries_sq = entries_per_block * entries_per_block;
+
+	block_num -= 12;
+	if(block_num < entries_per_block) {
+		idx[0] = block_num;
+		return 1;
+	}
+
+	block_num -= entries_per_block;
+	if(block_num < entries_sq) {
+		idx[0] = block_num / entries_per_block;
+		idx[1] = block_num % entries_per_block;
+		return 2;
+	}
 
+	block_num -= entries_sq;
+	if(block_num / entries_sq < entries_per_block) {
+		idx[0] = block_num / entries_sq;
+		idx[1] = (block_num / entries_per_block) % entries_per_block;
+		idx[2] = block_num % entries_per_block;
+		return 3;
+	}
+
+	return 0;
+}
+
+uint32_t ext2_resolve_blocknum(struct ext2_fs* fs, struct inode* inode, uint32_t block_num) {
 	if(block_num < 12) {
-		real_block_num = inode->blocks[block_num];
-	} else if(block_num < entries_per_block + 12) {
-		if(!inode->blocks[12]) {
+		return inode->blocks[block_num];
+	}
+
+	uint32_t idx[3];
+	int depth = block_path(fs, block_num, idx);
+	if(!depth) {
+		return 0;
+	}
+
+	uint32_t real_block_num = inode->blocks[11 + depth];
+	for(int i = 0; i < depth && real_block_num; i++) {
+		real_block_num = table_lookup(fs, real_block_num, idx[i]);
+	}
+	return real_block_num;
+}
+
+/* State for block allocations during one ext2_inode_data_rw call. Blocks are
+ * claimed from the bitmap in runs and then handed out one by one, so a large
+ * write only needs a couple of bitmap/superblock updates.
+ */
+struct alloc_ctx {
+	uint32_t inode_num;
+	uint32_t next;
+	uint32_t left;
+	bool inode_dirty;
+};
+
+static uint32_t alloc_block(struct ext2_fs* fs, struct inode* inode,
+	struct alloc_ctx* actx, uint32_t want) {
+
+	if(!actx->left) {
+		uint32_t count = MAX(want, 1);
+		actx->next = ext2_block_new(fs, actx->inode_num, actx->next, &count);
+		if(!actx->next) {
 			return 0;
 		}
+		actx->left = count;
+	}
+
+	// Counts 512-byte sectors, not ext2 blocks
+	inode->block_count += bl_off(1) / 512;
+	actx->inode_dirty = true;
+	actx->left--;
+	return actx->next++;
+}
+
+static uint32_t alloc_table(struct ext2_fs* fs, struct inode* inode,
+	struct alloc_ctx* actx, uint32_t want) {
 
-		if(!cache->indirect_table) {
-			cache->indirect_table = (uint32_t*)zmalloc(bl_off(1));
-			vfs_block_sread(fs->dev, bl_off(inode->blocks[12]), bl_off(1), (uint8_t*)cache->indirect_table);
+	uint32_t block = alloc_block(fs, inode, actx, want);
+	if(!block) {
+		return 0;
+	}
+
+	struct table_cache_entry* entry = table_evict(fs);
+	if(!entry) {
+		return 0;
+	}
+
+	bzero(entry->table, bl_off(1));
+	entry->block = block;
+	entry->dirty = true;
+	return block;
+}
+
+/* Allocate a new block for logical block block_num of the inode, including
+ * any missing indirection tables on the way. Tables are allocated first so
+ * they end up in front of the data blocks they point to.
+ */
+static uint32_t map_new_block(struct ext2_fs* fs, struct inode* inode,
+	struct alloc_ctx* actx, uint32_t block_num, uint32_t want) {
+
+	if(block_num < 12) {
+		uint32_t real_block_num = alloc_block(fs, inode, actx, want);
+		inode->blocks[block_num] = real_block_num;
+		return real_block_num;
+	}
+
+	uint32_t idx[3];
+	int depth = block_path(fs, block_num, idx);
+	if(!depth) {
+		log(LOG_ERR, "ext2: Block %d out of range for triple indirect table\n", block_num);
+		return 0;
+	}
+
+	uint32_t table = inode->blocks[11 + depth];
+	if(!table) {
+		table = alloc_table(fs, inode, actx, want);
+		if(!table) {
+			return 0;
 		}
+		inode->blocks[11 + depth] = table;
+	}
 
-		real_block_num = cache->indirect_table[block_num - 12];
-	} else if(block_num < entries_per_block * entries_per_block + 12) {
-		if(!inode->blocks[13]) {
+	for(int i = 0; i < depth - 1; i++) {
+		struct table_cache_entry* entry = ext2_table_get(fs, table);
+		if(!entry) {
 			return 0;
 		}
 
-		if(!cache->double_table) {
-			cache->double_table = (uint32_t*)zmalloc(bl_off(1));
-			vfs_block_sread(fs->dev, bl_off(inode->blocks[13]), bl_off(1), (uint8_t*)cache->double_table);
+		uint32_t next = entry->table[idx[i]];
+		if(!next) {
+			next = alloc_table(fs, inode, actx, want);
+			if(!next || !table_set(fs, table, idx[i], next)) {
+				return 0;
+			}
 		}
+		table = next;
+	}
 
-		uint32_t indir_block_num = cache->double_table[(block_num - entries_per_block - 12) / entries_per_block];
-		if(!indir_block_num) {
+	uint32_t real_block_num = alloc_block(fs, inode, actx, want);
+	if(!real_block_num || !table_set(fs, table, idx[depth - 1], real_block_num)) {
+		return 0;
+	}
+	return real_block_num;
+}
+
+/* Resolve block number, allocating a new block if it doesn't exist yet and
+ * actx is set. want is the number of blocks the caller is going to need,
+ * including this one.
+ */
+static uint32_t resolve_or_alloc(struct ext2_fs* fs, struct inode* inode,
+	struct alloc_ctx* actx, uint32_t block_num, uint32_t want) {
+
+	uint32_t real_block_num = ext2_resolve_blocknum(fs, inode, block_num);
+	if(real_block_num || !actx) {
+		return real_block_num;
+	}
+
+	// Try to continue right after the preceding block of the file
+	if(!actx->left && block_num) {
+		uint32_t prev = ext2_resolve_blocknum(fs, inode, block_num - 1);
+		actx->next = prev ? prev + 1 : 0;
+	}
+
+	return map_new_block(fs, inode, actx, block_num, want);
+}
+
+/* Allocate up to want blocks for a hole in an extent-mapped file and add them
+ * to the extent tree. Returns the first block and stores the number of
+ * allocated blocks in *len.
+ */
+static uint32_t alloc_extent(struct ext2_fs* fs, struct inode* inode,
+	struct alloc_ctx* actx, uint32_t block_num, uint32_t want, uint32_t* len) {
+
+	// Try to continue right after the preceding block of the file
+	struct ext2_mapping prev;
+	if(!actx->left && block_num && ext2_extent_map(fs, inode, block_num - 1, &prev)) {
+		actx->next = prev.start ? prev.start + 1 : 0;
+	}
+
+	want = MIN(want, EXT4_EXTENT_MAX_LEN);
+	uint32_t start = alloc_block(fs, inode, actx, want);
+	if(!start) {
+		return 0;
+	}
+
+	// Blocks handed out by alloc_block are consecutive as long as the run lasts
+	uint32_t count = 1;
+	for(; count < want && actx->left; count++) {
+		alloc_block(fs, inode, actx, want - count);
+	}
+
+	if(!ext2_extent_insert(fs, inode, block_num, start, count)) {
+		ext2_block_free(fs, start, count);
+		inode->block_count -= count * (bl_off(1) / 512);
+		write_superblock();
+		write_blockgroup_table();
+		return 0;
+	}
+
+	*len = count;
+	return start;
+}
+
+/* Map the run of up to want logical blocks starting at block_num to a run of
+ * physically contiguous blocks, allocating missing blocks if actx is set.
+ * Returns the first physical block or 0 for holes, and stores the length of
+ * the run in *len. *len is 0 on errors.
+ */
+static uint32_t map_run(struct ext2_fs* fs, struct inode* inode,
+	struct alloc_ctx* actx, uint32_t block_num, uint32_t want, uint32_t* len) {
+
+	*len = 0;
+	if(inode->flags & EXT4_EXTENTS_FL) {
+		struct ext2_mapping map;
+		if(!ext2_extent_map(fs, inode, block_num, &map)) {
 			return 0;
 		}
 
-		if(!cache->double_second_table) {
-			cache->double_second_table = (uint32_t*)zmalloc(bl_off(1));
+		if(map.unwritten) {
+			if(actx) {
+				log(LOG_ERR, "ext2: Writing to unwritten extents is not supported\n");
+				return 0;
+			}
+			map.start = 0;
 		}
 
-		if(cache->double_second_block != indir_block_num) {
-			vfs_block_sread(fs->dev, bl_off(indir_block_num), bl_off(1), (uint8_t*)cache->double_second_table);
-			cache->double_second_block = indir_block_num;
+		if(!map.start && actx) {
+			return alloc_extent(fs, inode, actx, block_num, MIN(want, map.len), len);
 		}
 
-		real_block_num = cache->double_second_table[(block_num - entries_per_block - 12) % entries_per_block];
-	} else {
+		*len = MIN(want, map.len);
+		return map.start;
+	}
+
+	uint32_t start = resolve_or_alloc(fs, inode, actx, block_num, want);
+	if(!start) {
+		*len = actx ? 0 : 1;
 		return 0;
 	}
 
-	return real_block_num;
+	*len = 1;
+	while(*len < want && resolve_or_alloc(fs, inode, actx, block_num + *len,
+		want - *len) == start + *len) {
+		(*len)++;
+	}
+	return start;
 }
 
 /* Will write if write_inode_num is set, otherwise read. Use
  * exta_inode_read_data/exta_inode_write_data macros instead.
+ *
+ * Runs of logical blocks that are also physically contiguous on disk are
+ * transferred using a single block device request. Holes read as zeroes.
  */
 uint8_t* ext2_inode_data_rw(struct ext2_fs* fs, struct inode* inode, uint32_t write_inode_num,
 	uint64_t offset, size_t length, uint8_t* buf) {
 
-
-	uint32_t num_blocks = bl_size(length);
-	if(bl_mod(length)) {
-		num_blocks++;
-	}
-	if(bl_mod(offset) && bl_mod(offset) + bl_mod(length) > bl_off(1)) {
-		num_blocks++;
+	if(!length) {
+		return buf;
 	}
 
-	uint32_t buf_offset = 0;
-	struct ext2_blocknum_resolver_cache* res_cache = zmalloc(sizeof(struct ext2_blocknum_resolver_cache));
-	for(int i = 0; i < num_blocks; i++) {
-		uint32_t block_num = ext2_resolve_blocknum(fs, inode, i + bl_size(offset), res_cache);
+	uint32_t block_num = bl_size(offset);
+	uint32_t last_block_num = bl_size(offset + length - 1);
+	uint64_t buf_offset = 0;
+	uint8_t* result = NULL;
 
-		if(!block_num) {
-			if(!write_inode_num) {
-				return NULL;
-			}
+	struct alloc_ctx _actx = { .inode_num = write_inode_num };
+	struct alloc_ctx* actx = write_inode_num ? &_actx : NULL;
 
-			block_num = ext2_block_new(fs, write_inode_num);
-			if(!block_num) {
-				ext2_free_blocknum_resolver_cache(res_cache);
-				return NULL;
-			}
-
-			// Counts 512-byte ide blocks, not ext2 blocks, so 8.
-			// FIXME Properly calculate from block size rather than hardcoding
-			inode->block_count += 8;
-
-			if(i < 12) {
-				inode->blocks[i] = block_num;
-			} else {
-				// TODO
-				log(LOG_ERR, "ext2: Indirect block writes not supported atm.\n");
-				ext2_free_blocknum_resolver_cache(res_cache);
-				return NULL;
-			}
+	while(block_num <= last_block_num) {
+		uint32_t run_len;
+		uint32_t run_start = map_run(fs, inode, actx, block_num,
+			last_block_num - block_num + 1, &run_len);
 
-			ext2_inode_write(fs, inode, write_inode_num);
+		if(!run_len) {
+			goto out;
 		}
 
-		uint64_t wr_offset = bl_off(block_num);
-		uint64_t wr_size = bl_off(1);
+		uint64_t wr_offset = bl_off(run_start);
+		uint64_t wr_size = bl_off(run_len);
 
 		// Handle remainder of offset if first block
-		if(i == 0) {
+		if(!buf_offset) {
 			wr_offset += bl_mod(offset);
 			wr_size -= bl_mod(offset);
 		}
@@ -252,23 +524,127 @@ uint8_t* ext2_inode_data_rw(struct ext2_fs* fs, struct inode* inode, uint32_t wr
 			wr_size = length - buf_offset;
 		}
 
-		int nread = -1;
-		if(write_inode_num) {
+		uint64_t nread;
+		if(!run_start) {
+			bzero(buf + buf_offset, wr_size);
+			nread = wr_size;
+		} else if(write_inode_num) {
 			nread = vfs_block_swrite(fs->dev, wr_offset, wr_size, buf + buf_offset);
 		} else {
 			nread = vfs_block_sread(fs->dev, wr_offset, wr_size, buf + buf_offset);
 		}
 
-		if(nread < wr_size) {
-			ext2_free_blocknum_resolver_cache(res_cache);
-			return NULL;
+		if(nread != wr_size) {
+			goto out;
 		}
 
 		buf_offset += wr_size;
+		block_num += run_len;
+	}
+
+	result = buf;
+out:
+	if(actx) {
+		// Return blocks that were claimed but ended up unused
+		if(actx->left) {
+			ext2_block_free(fs, actx->next, actx->left);
+			write_superblock();
+			write_blockgroup_table();
+		}
+
+		if(!ext2_table_cache_flush(fs)) {
+			result = NULL;
+		}
+
+		if(actx->inode_dirty) {
+			ext2_inode_write(fs, inode, write_inode_num);
+		}
+	}
+	return result;
+}
+
+// Frees a (possibly still running) accumulated run of blocks
+static void free_run(struct ext2_fs* fs, uint32_t* run_start, uint32_t* run_len, uint32_t block) {
+	if(*run_len && block == *run_start + *run_len) {
+		(*run_len)++;
+		return;
+	}
+
+	if(*run_len) {
+		ext2_block_free(fs, *run_start, *run_len);
+	}
+
+	*run_start = block;
+	*run_len = block ? 1 : 0;
+}
+
+static void free_table(struct ext2_fs* fs, uint32_t block, int depth,
+	uint32_t* run_start, uint32_t* run_len) {
+
+	const uint32_t entries_per_block = bl_off(1) / sizeof(uint32_t);
+	struct table_cache_entry* entry = ext2_table_get(fs, block);
+	if(!entry) {
+		return;
+	}
+
+	/* Upper levels need a private copy since the cache entry can get evicted
+	 * while we descend.
+	 */
+	uint32_t* table = entry->table;
+	if(depth > 1) {
+		table = kmalloc(bl_off(1));
+		memcpy(table, entry->table, bl_off(1));
+	}
+
+	for(uint32_t i = 0; i < entries_per_block; i++) {
+		if(!table[i]) {
+			continue;
+		}
+
+		if(depth > 1) {
+			free_table(fs, table[i], depth - 1, run_start, run_len);
+		}
+		free_run(fs, run_start, run_len, table[i]);
+	}
+
+	if(depth > 1) {
+		kfree(table);
+	}
+}
+
+/* Free all data and indirection blocks of an inode. Caller needs to write
+ * back the superblock, blockgroup table and inode.
+ */
+void ext2_inode_free_blocks(struct ext2_fs* fs, struct inode* inode) {
+	if(!inode->block_count) {
+		return;
+	}
+
+	if(inode->flags & EXT4_EXTENTS_FL) {
+		ext2_extent_free(fs, inode);
+		inode->block_count = 0;
+		return;
+	}
+
+	uint32_t run_start = 0;
+	uint32_t run_len = 0;
+	for(int i = 0; i < 12; i++) {
+		if(inode->blocks[i]) {
+			free_run(fs, &run_start, &run_len, inode->blocks[i]);
+		}
+	}
+
+	for(int depth = 1; depth <= 3; depth++) {
+		uint32_t table = inode->blocks[11 + depth];
+		if(table) {
+			free_table(fs, table, depth, &run_start, &run_len);
+			free_run(fs, &run_start, &run_len, table);
+		}
 	}
 
-	ext2_free_blocknum_resolver_cache(res_cache);
-	return buf;
+	free_run(fs, &run_start, &run_len, 0);
+	bzero(inode->blocks, sizeof(inode->blocks));
+	inode->block_count = 0;
 }
 
 int ext2_inode_check_perm(enum inode_check_op op, struct inode* inode, task_t* task) {
@@ -67,7 +67,28 @@ struct superblock {
 	char volume_name[16];
 	char last_mounted[64];
 	uint32_t algo_bitmap;
-	uint32_t reserved[205];
+	uint8_t prealloc_blocks;
+	uint8_t prealloc_dir_blocks;
+	uint16_t reserved_gdt_blocks;
+	uint8_t journal_uuid[16];
+	uint32_t journal_inode;
+	uint32_t journal_dev;
+	uint32_t last_orphan;
+	uint32_t hash_seed[4];
+	uint8_t def_hash_version;
+	uint8_t journal_backup_type;
+	uint16_t desc_size;
+	uint32_t default_mount_opts;
+	uint32_t first_meta_bg;
+	uint32_t mkfs_time;
+	uint32_t journal_blocks[17];
+	uint32_t block_count_high;
+	uint32_t reserved_blocks_high;
+	uint32_t free_blocks_high;
+	uint16_t min_extra_isize;
+	uint16_t want_extra_isize;
+	uint32_t flags;
+	uint32_t reserved[167];
 } __attribute__((packed));
 
 struct blockgroup {
@@ -87,6 +108,17 @@ struct inode_cache_entry {
 	struct inode inode;
 };
 
+/* Indirection tables (single/double indirect block contents), keyed by their
+ * physical block number. Shared by all files on the file system so repeated
+ * reads and writes of the same file don't re-read its indirect blocks.
+ */
+#define TABLE_CACHE_MAX 0x10
+struct table_cache_entry {
+	uint32_t block;
+	uint32_t* table;
+	bool dirty;
+};
+
 struct ext2_fs {
 	struct vfs_block_dev* dev;
 	struct superblock* superblock;
@@ -96,6 +128,13 @@ struct ext2_fs {
 
 	struct inode_cache_entry inode_cache[INODE_CACHE_MAX];
 	uint32_t inode_cache_end;
+
+	struct table_cache_entry table_cache[TABLE_CACHE_MAX];
+	uint32_t table_cache_end;
+
+	// Size of a blockgroup descriptor, 64 bytes with the ext4 64bit feature
+	uint32_t desc_size;
+	bool read_only;
 };
 
 #define SUPERBLOCK_MAGIC 0xEF53
@@ -105,30 +144,69 @@ struct ext2_fs {
 
 #define EXT2_INDEX_FL 0x00001000
 
+#define EXT2_FEATURE_COMPAT_DIR_INDEX 0x0020
+
+#define EXT2_FEATURE_INCOMPAT_FILETYPE 0x0002
+#define EXT3_FEATURE_INCOMPAT_RECOVER 0x0004
+#define EXT4_FEATURE_INCOMPAT_EXTENTS 0x0040
+#define EXT4_FEATURE_INCOMPAT_64BIT 0x0080
+#define EXT4_FEATURE_INCOMPAT_FLEX_BG 0x0200
+#define EXT4_FEATURE_INCOMPAT_CSUM_SEED 0x2000
+#define EXT2_FEATURE_INCOMPAT_SUPPORTED (EXT2_FEATURE_INCOMPAT_FILETYPE \
+	| EXT4_FEATURE_INCOMPAT_EXTENTS | EXT4_FEATURE_INCOMPAT_64BIT \
+	| EXT4_FEATURE_INCOMPAT_FLEX_BG | EXT4_FEATURE_INCOMPAT_CSUM_SEED)
+
+/* Read-only compatible features we can write without breaking. Anything else,
+ * in particular checksums, causes the file system to be mounted read-only.
+ */
+#define EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER 0x0001
+#define EXT2_FEATURE_RO_COMPAT_LARGE_FILE 0x0002
+#define EXT4_FEATURE_RO_COMPAT_HUGE_FILE 0x0008
+#define EXT4_FEATURE_RO_COMPAT_DIR_NLINK 0x0020
+#define EXT4_FEATURE_RO_COMPAT_EXTRA_ISIZE 0x0040
+#define EXT2_FEATURE_RO_COMPAT_SUPPORTED (EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER \
+	| EXT2_FEATURE_RO_COMPAT_LARGE_FILE | EXT4_FEATURE_RO_COMPAT_HUGE_FILE \
+	| EXT4_FEATURE_RO_COMPAT_DIR_NLINK | EXT4_FEATURE_RO_COMPAT_EXTRA_ISIZE)
+
+// superblock->flags
+#define EXT2_FLAGS_SIGNED_HASH 0x0001
+#define EXT2_FLAGS_UNSIGNED_HASH 0x0002
+
 #define inode_to_blockgroup(inode) ((inode - 1) / fs->superblock->inodes_per_group)
+#define block_to_blockgroup(block) ((block - fs->superblock->first_data_block) / fs->superblock->blocks_per_group)
+#define blockgroup_count (RDIV(fs->superblock->block_count - fs->superblock->first_data_block, \
+	fs->superblock->blocks_per_group))
 
 #define _block_size(fs) (1024 << fs->superblock->block_size)
 #define bl_off(block) (uint64_t)((uint64_t)(block) * _block_size(fs))
 #define bl_size(block) (uint64_t)((uint64_t)(block) / _block_size(fs))
 #define bl_mod(block) (uint64_t)((uint64_t)(block) % _block_size(fs))
 
+/* Descriptors can be larger than struct blockgroup with the 64bit feature,
+ * so don't index the table directly. The fields we use are all in the
+ * common 32 byte part.
+ */
+#define blockgroup_get(num) ((struct blockgroup*)((uint8_t*)fs->blockgroup_table \
+	+ (num) * fs->desc_size))
+
 /* Blockgroup table is located in the block following the superblock. This
  * is usually the second block, but with a 1k block size, the superblock
  * takes up two blocks and the blockgroup table thus starts in block 3.
  */
 #define blockgroup_table_start (bl_off(1) == 1024 ? 2 : 1)
 
-/* The number of blocks occupied by the blockgroup table
- * There doesn't seem to be a way to directly get the number of blockgroups,
- * so figure it out by dividing block count with blocks per group. Multiply
- * with struct size to get total space required, then divide by block size
- * to get ext2 blocks. Add 1 since partially used blocks also need to be
- * allocated.
+/* The number of blocks occupied by the blockgroup table. Partially used
+ * blocks also need to be allocated, so round up.
  */
-#define blockgroup_table_size (bl_size(fs->superblock->block_count / fs->superblock->blocks_per_group * sizeof(struct blockgroup)) + 1)
+#define blockgroup_table_bytes (blockgroup_count * fs->desc_size)
+#define blockgroup_table_size (bl_size(blockgroup_table_bytes + bl_off(1) - 1))
 
 #define write_superblock() vfs_block_swrite(fs->dev, 1024, sizeof(struct superblock), (uint8_t*)fs->superblock)
+/* Only write the table itself, not the remainder of its last block, which
+ * can be the block bitmap of the first blockgroup.
+ */
 #define write_blockgroup_table() vfs_block_swrite(fs->dev, bl_off(blockgroup_table_start), \
-	bl_off(blockgroup_table_size), (uint8_t*)fs->blockgroup_table)
+	blockgroup_table_bytes, (uint8_t*)fs->blockgroup_table)
 
-uint32_t ext2_block_new(struct ext2_fs* fs, uint32_t neighbor);
+uint32_t ext2_block_new(struct ext2_fs* fs, uint32_t neighbor, uint32_t goal, uint32_t* count);
+void ext2_block_free(struct ext2_fs* fs, uint32_t block, uint32_t count);
@@ -24,12 +24,14 @@
 #include <mem/kmalloc.h>
 #include <block/block.h>
 #include <bitmap.h>
+#include <log.h>
 
-uint32_t ext2_bitmap_search_and_claim(struct ext2_fs* fs, uint32_t bitmap_block) {
+// Returns the claimed bit, or -1 if the bitmap is full
+int32_t ext2_bitmap_search_and_claim(struct ext2_fs* fs, uint32_t bitmap_block) {
 	// Todo check blockgroup->free_blocks to see if any blocks are free and otherwise switch block group
 	uint8_t* bitmap = kmalloc(bl_off(1));
 	vfs_block_sread(fs->dev, bl_off(bitmap_block), bl_off(1), bitmap);
-	uint32_t result = 0;
+	int32_t result = -1;
 
 	for(int i = 0; i < bl_off(1); i++) {
 		uint8_t* blt = bitmap + i;
@@ -47,7 +49,7 @@ uint32_t ext2_bitmap_search_and_claim(struct ext2_fs* fs, uint32_t bitmap_block)
 		}
 	}
 
-	if(result) {
+	if(result >= 0) {
 		vfs_block_swrite(fs->dev, bl_off(bitmap_block), bl_off(1), bitmap);
 	}
 
@@ -55,35 +57,130 @@ uint32_t ext2_bitmap_search_and_claim(struct ext2_fs* fs, uint32_t bitmap_block)
 	return result;
 }
 
-void ext2_bitmap_free(struct ext2_fs* fs, uint32_t bitmap_block, uint32_t bit) {
+void ext2_bitmap_free(struct ext2_fs* fs, uint32_t bitmap_block, uint32_t bit, uint32_t count) {
 	uint8_t* bitmap = kmalloc(bl_off(1));
 	vfs_block_sread(fs->dev, bl_off(bitmap_block), bl_off(1), bitmap);
-	bitmap[bit / 8] = bit_clear(bitmap[bit / 8], bit % 8);
+	for(uint32_t i = bit; i < bit + count; i++) {
+		bitmap[i / 8] = bit_clear(bitmap[i / 8], i % 8);
+	}
 	vfs_block_swrite(fs->dev, bl_off(bitmap_block), bl_off(1), bitmap);
 	kfree(bitmap);
 }
 
-uint32_t ext2_block_new(struct ext2_fs* fs, uint32_t neighbor) {
+/* Claims up to *count consecutive free bits in a bitmap, starting the search
+ * at start and wrapping around at max. Returns the first claimed bit and
+ * stores the number of claimed bits in *count, or returns -1 if the bitmap
+ * is full.
+ */
+static int32_t bitmap_claim_run(struct ext2_fs* fs, uint32_t bitmap_block,
+	uint32_t start, uint32_t max, uint32_t* count) {
+
+	uint8_t* bitmap = kmalloc(bl_off(1));
+	if(vfs_block_sread(fs->dev, bl_off(bitmap_block), bl_off(1), bitmap) != bl_off(1)) {
+		kfree(bitmap);
+		return -1;
+	}
+
+	int32_t first = -1;
+	for(uint32_t n = 0; n < max; n++) {
+		uint32_t i = (start + n) % max;
+
+		// Skip over full bytes quickly
+		if(!(i % 8) && bitmap[i / 8] == 0xff && n + 8 <= max) {
+			n += 7;
+			continue;
+		}
+
+		if(!bit_get(bitmap[i / 8], i % 8)) {
+			first = i;
+			break;
+		}
+	}
+
+	if(first < 0) {
+		kfree(bitmap);
+		return -1;
+	}
+
+	uint32_t claimed = 0;
+	for(uint32_t i = first; i < max && claimed < *count; i++, claimed++) {
+		if(bit_get(bitmap[i / 8], i % 8)) {
+			break;
+		}
+		bitmap[i / 8] = bit_set(bitmap[i / 8], i % 8);
+	}
+
+	vfs_block_swrite(fs->dev, bl_off(bitmap_block), bl_off(1), bitmap);
+	kfree(bitmap);
+	*count = claimed;
+	return first;
+}
+
+/* Allocate up to *count consecutive blocks, preferably starting at goal or
+ * otherwise in the blockgroup of the inode neighbor. Returns the first block
+ * and stores the number of allocated blocks in *count.
+ */
+uint32_t ext2_block_new(struct ext2_fs* fs, uint32_t neighbor, uint32_t goal, uint32_t* count) {
+	uint32_t num_groups = blockgroup_count;
 	uint32_t pref_blockgroup = inode_to_blockgroup(neighbor);
+	uint32_t start_bit = 0;
 
-	struct blockgroup* blockgroup = fs->blockgroup_table + pref_blockgroup;
-	if(!blockgroup || !blockgroup->inode_table) {
-		log(LOG_ERR, "ext2: Could not locate entry %d in blockgroup table\n", pref_blockgroup);
-		return 0;
+	if(goal && goal < fs->superblock->block_count) {
+		pref_blockgroup = block_to_blockgroup(goal);
+		start_bit = (goal - fs->superblock->first_data_block) % fs->superblock->blocks_per_group;
 	}
 
-	uint32_t block_num = ext2_bitmap_search_and_claim(fs, blockgroup->block_bitmap);
-	if(!block_num) {
-		log(LOG_ERR, "ext2: Could not find free block in preferred blockgroup %d.\n", pref_blockgroup);
-		return 0;
+	for(uint32_t i = 0; i < num_groups; i++, start_bit = 0) {
+		uint32_t group_num = (pref_blockgroup + i) % num_groups;
+		struct blockgroup* blockgroup = blockgroup_get(group_num);
+		if(!blockgroup->free_blocks) {
+			continue;
+		}
+
+		uint32_t group_start = group_num * fs->superblock->blocks_per_group
+			+ fs->superblock->first_data_block;
+		uint32_t group_size = MIN(fs->superblock->blocks_per_group,
+			fs->superblock->block_count - group_start);
+
+		uint32_t claimed = MIN(*count, blockgroup->free_blocks);
+		int32_t bit = bitmap_claim_run(fs, blockgroup->block_bitmap, start_bit, group_size, &claimed);
+		if(bit < 0) {
+			continue;
+		}
+
+		uint32_t block_num = group_start + bit;
+		ext2_table_cache_drop(fs, block_num, claimed);
+		fs->superblock->free_blocks -= claimed;
+		blockgroup->free_blocks -= claimed;
+		write_superblock();
+		write_blockgroup_table();
+
+		*count = claimed;
+		return block_num;
 	}
 
-	fs->superblock->free_blocks--;
-	blockgroup->free_blocks--;
-	write_superblock();
-	write_blockgroup_table();
-	return block_num;
+	log(LOG_ERR, "ext2: Could not find free block.\n");
+	return 0;
+}
+
+/* Free count consecutive blocks. Caller needs to write back the superblock
+ * and blockgroup table.
+ */
+void ext2_block_free(struct ext2_fs* fs, uint32_t block, uint32_t count) {
+	ext2_table_cache_drop(fs, block, count);
+
+	while(count) {
+		uint32_t group_num = block_to_blockgroup(block);
+		struct blockgroup* blockgroup = blockgroup_get(group_num);
+		uint32_t bit = (block - fs->superblock->first_data_block) % fs->superblock->blocks_per_group;
+		uint32_t num = MIN(count, fs->superblock->blocks_per_group - bit);
 
+		ext2_bitmap_free(fs, blockgroup->block_bitmap, bit, num);
+		fs->superblock->free_blocks += num;
+		blockgroup->free_blocks += num;
+		block += num;
+		count -= num;
+	}
 }
 
 #endif /* CONFIG_ENABLE_EXT2 */
@@ -122,7 +122,7 @@ static size_t sfs_iter(struct vfs_callback_ctx* ctx, void* dest, size_t size,
 }
 
 static size_t sfs_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
-	if(ctx->fp->offset) {
+	if(ctx->offset) {
 		return 0;
 	}
 
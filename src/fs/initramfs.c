@@ -0,0 +1,418 @@
+/* initramfs.c: Root file system from a boot module
+ * Copyright © 2026 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* If the bootloader passes a module, it is unpacked into a tmpfs that is
+ * then used as root file system. This way, early userland doesn't have to be
+ * read from disk, and test runs don't need a disk image at all. The archive
+ * can either be a cpio archive in the "newc" format used by Linux, or a
+ * POSIX tar archive.
+ *
+ * init can later switch to a disk root by mounting it over /.
+ */
+
+#ifdef CONFIG_ENABLE_INITRAMFS
+
+#include <fs/initramfs.h>
+#include <fs/tmpfs.h>
+#include <fs/vfs.h>
+#include <boot/multiboot.h>
+#include <mem/vm.h>
+#include <mem/kmalloc.h>
+#include <log.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#define CPIO_MAGIC "070701"
+#define CPIO_MAGIC_CRC "070702"
+#define CPIO_TRAILER "TRAILER!!!"
+#define TAR_MAGIC "ustar"
+#define TAR_BLOCK 512
+
+struct cpio_header {
+	char magic[6];
+	char ino[8];
+	char mode[8];
+	char uid[8];
+	char gid[8];
+	char nlink[8];
+	char mtime[8];
+	char filesize[8];
+	char devmajor[8];
+	char devminor[8];
+	char rdevmajor[8];
+	char rdevminor[8];
+	char namesize[8];
+	char check[8];
+} __attribute__((packed));
+
+struct tar_header {
+	char name[100];
+	char mode[8];
+	char uid[8];
+	char gid[8];
+	char size[12];
+	char mtime[12];
+	char checksum[8];
+	char type;
+	char linkname[100];
+	char magic[6];
+	char version[2];
+	char uname[32];
+	char gname[32];
+	char devmajor[8];
+	char devminor[8];
+	char prefix[155];
+} __attribute__((packed));
+
+struct entry {
+	char path[VFS_PATH_MAX];
+	uint32_t mode;
+	uint16_t uid;
+	uint16_t gid;
+	uint32_t mtime;
+	char* data;
+	size_t size;
+
+	// Target of hard links, stored in link_buf
+	char* link;
+	char link_buf[VFS_PATH_MAX];
+};
+
+/* Regular files with more than one link in a cpio archive. Only the last of
+ * the links carries the data, the others have a size of 0.
+ */
+struct cpio_link {
+	struct cpio_link* next;
+	uint32_t ino;
+	uint32_t dev;
+	char* path;
+};
+
+static uint32_t parse_num(const char* str, size_t len, int base) {
+	uint32_t result = 0;
+	for(size_t i = 0; i < len && str[i]; i++) {
+		char c = str[i];
+		int digit;
+		if(c >= '0' && c <= '9') {
+			digit = c - '0';
+		} else if(c >= 'a' && c <= 'f') {
+			digit = c - 'a' + 10;
+		} else if(c >= 'A' && c <= 'F') {
+			digit = c - 'A' + 10;
+		} else if(c == ' ' && !result) {
+			continue;
+		} else {
+			break;
+		}
+
+		if(digit >= base) {
+			break;
+		}
+		result = result * base + digit;
+	}
+	return result;
+}
+
+// Build an absolute path from an archive name, which is usually relative
+static void set_path(struct entry* ent, const char* prefix, size_t prefix_len,
+	const char* name, size_t name_len) {
+
+	char* dest = ent->path;
+	size_t left = sizeof(ent->path) - 1;
+	*dest++ = '/';
+
+	if(prefix_len && *prefix) {
+		size_t len = MIN(strnlen(prefix, prefix_len), left - 1);
+		memcpy(dest, prefix, len);
+		dest[len] = '/';
+		dest += len + 1;
+		left -= len + 1;
+	}
+
+	size_t len = MIN(strnlen(name, name_len), left);
+	memcpy(dest, name, len);
+	dest[len] = 0;
+}
+
+// Strip ./ prefixes and trailing slashes, "/." is the root itself
+static char* clean_path(char* path) {
+	while(!strncmp(path + 1, "./", 2)) {
+		path += 2;
+	}
+	if(!strcmp(path, "/.")) {
+		path[1] = 0;
+	}
+	for(size_t len = strlen(path); len > 1 && path[len - 1] == '/'; len--) {
+		path[len - 1] = 0;
+	}
+	return path;
+}
+
+static int write_file(const char* path, struct entry* ent) {
+	int fd = vfs_open(NULL, path, O_WRONLY | O_CREAT | O_TRUNC);
+	if(fd < 0) {
+		return -1;
+	}
+
+	int r = 0;
+	if(vfs_write(NULL, fd, ent->data, ent->size) != ent->size) {
+		r = -1;
+	}
+	vfs_close(NULL, fd);
+	return r;
+}
+
+static void add_entry(struct entry* ent) {
+	char* path = clean_path(ent->path);
+	int r = 0;
+	if(ent->link) {
+		r = vfs_link(NULL, clean_path(ent->link), path);
+	} else {
+		switch(vfs_mode_to_filetype(ent->mode)) {
+			case FT_IFDIR:
+				if(strcmp(path, "/")) {
+					r = vfs_mkdir(NULL, path, ent->mode & 0xfff);
+				}
+				break;
+			case FT_IFREG:
+				r = write_file(path, ent);
+				break;
+			case FT_IFLNK:;
+				char* target = strndup(ent->data, ent->size);
+				r = vfs_symlink(NULL, target, path);
+				kfree(target);
+				if(r < 0) {
+					log(LOG_WARN, "initramfs: Could not create %s: %d\n", path, sc_errno);
+				}
+				return;
+			default:
+				log(LOG_WARN, "initramfs: Skipping %s, unsupported file type\n", path);
+				return;
+		}
+	}
+
+	if(r < 0 && sc_errno != EEXIST) {
+		log(LOG_WARN, "initramfs: Could not create %s: %d\n", path, sc_errno);
+		return;
+	}
+
+	if(!ent->link) {
+		vfs_chmod(NULL, path, ent->mode & 0xfff);
+		vfs_chown(NULL, path, ent->uid, ent->gid);
+
+		struct timeval times[2] = {{.tv_sec = ent->mtime}, {.tv_sec = ent->mtime}};
+		vfs_utimes(NULL, path, times);
+	}
+}
+
+/* Later names of a hard linked file become links to the first one. The data
+ * comes with the last name and is written through the first one.
+ */
+static void add_cpio_entry(struct entry* ent, struct cpio_header* hdr,
+	struct cpio_link** links) {
+
+	uint32_t nlink = parse_num(hdr->nlink, 8, 16);
+	if(vfs_mode_to_filetype(ent->mode) != FT_IFREG || nlink < 2) {
+		add_entry(ent);
+		return;
+	}
+
+	uint32_t ino = parse_num(hdr->ino, 8, 16);
+	uint32_t dev = parse_num(hdr->devmajor, 8, 16) << 16 | parse_num(hdr->devminor, 8, 16);
+	struct cpio_link* link = *links;
+	for(; link; link = link->next) {
+		if(link->ino == ino && link->dev == dev) {
+			break;
+		}
+	}
+
+	if(!link) {
+		link = zmalloc(sizeof(struct cpio_link));
+		link->ino = ino;
+		link->dev = dev;
+		link->path = strdup(clean_path(ent->path));
+		link->next = *links;
+		*links = link;
+		add_entry(ent);
+		return;
+	}
+
+	strlcpy(ent->link_buf, link->path, sizeof(ent->link_buf));
+	ent->link = ent->link_buf;
+	add_entry(ent);
+
+	if(ent->size && write_file(link->path, ent) < 0) {
+		log(LOG_WARN, "initramfs: Could not write %s: %d\n", link->path, sc_errno);
+	}
+}
+
+static int unpack_cpio(char* data, size_t size) {
+	struct entry* ent = zmalloc(sizeof(struct entry));
+	struct cpio_link* links = NULL;
+	int num = 0;
+
+	for(size_t off = 0; off + sizeof(struct cpio_header) <= size;) {
+		struct cpio_header* hdr = (struct cpio_header*)(data + off);
+		if(strncmp(hdr->magic, CPIO_MAGIC, 6) && strncmp(hdr->magic, CPIO_MAGIC_CRC, 6)) {
+			log(LOG_ERR, "initramfs: Invalid cpio header at offset %#x\n", off);
+			break;
+		}
+
+		size_t name_size = parse_num(hdr->namesize, 8, 16);
+		size_t name_off = off + sizeof(struct cpio_header);
+		size_t data_off = ALIGN(name_off + name_size, 4);
+		bzero(ent, sizeof(struct entry));
+		ent->size = parse_num(hdr->filesize, 8, 16);
+		if(data_off + ent->size > size) {
+			log(LOG_ERR, "initramfs: Truncated cpio archive\n");
+			break;
+		}
+
+		if(!strncmp(data + name_off, CPIO_TRAILER, name_size)) {
+			break;
+		}
+
+		set_path(ent, NULL, 0, data + name_off, name_size);
+		ent->mode = parse_num(hdr->mode, 8, 16);
+		ent->uid = parse_num(hdr->uid, 8, 16);
+		ent->gid = parse_num(hdr->gid, 8, 16);
+		ent->mtime = parse_num(hdr->mtime, 8, 16);
+		ent->data = data + data_off;
+		add_cpio_entry(ent, hdr, &links);
+
+		off = ALIGN(data_off + ent->size, 4);
+		num++;
+	}
+
+	while(links) {
+		struct cpio_link* next = links->next;
+		kfree(links->path);
+		kfree(links);
+		links = next;
+	}
+
+	kfree(ent);
+	return num;
+}
+
+static int unpack_tar(char* data, size_t size) {
+	struct entry* ent = zmalloc(sizeof(struct entry));
+	int num = 0;
+
+	for(size_t off = 0; off + TAR_BLOCK <= size;) {
+		struct tar_header* hdr = (struct tar_header*)(data + off);
+		if(!*hdr->name) {
+			break;
+		}
+
+		bzero(ent, sizeof(struct entry));
+		ent->size = parse_num(hdr->size, sizeof(hdr->size), 8);
+		ent->data = data + off + TAR_BLOCK;
+		if(off + TAR_BLOCK + ent->size > size) {
+			log(LOG_ERR, "initramfs: Truncated tar archive\n");
+			break;
+		}
+
+		set_path(ent, hdr->prefix, sizeof(hdr->prefix), hdr->name, sizeof(hdr->name));
+		ent->mode = parse_num(hdr->mode, sizeof(hdr->mode), 8) & 0xfff;
+		ent->uid = parse_num(hdr->uid, sizeof(hdr->uid), 8);
+		ent->gid = parse_num(hdr->gid, sizeof(hdr->gid), 8);
+		ent->mtime = parse_num(hdr->mtime, sizeof(hdr->mtime), 8);
+
+		switch(hdr->type) {
+			case '0':
+			case '\0':
+				ent->mode |= FT_IFREG;
+				break;
+			case '1':
+				ent->link_buf[0] = '/';
+				strlcpy(ent->link_buf + 1, hdr->linkname,
+					MIN(sizeof(hdr->linkname) + 1, sizeof(ent->link_buf) - 1));
+				ent->link = ent->link_buf;
+				break;
+			case '2':
+				ent->mode |= FT_IFLNK;
+				ent->data = hdr->linkname;
+				ent->size = strnlen(hdr->linkname, sizeof(hdr->linkname));
+				break;
+			case '5':
+				ent->mode |= FT_IFDIR;
+				break;
+		}
+
+		// Other types, such as device nodes, are skipped by add_entry
+		add_entry(ent);
+
+		// Symlinks and hard links have a size of 0
+		off += TAR_BLOCK + ALIGN(parse_num(hdr->size, sizeof(hdr->size), 8), TAR_BLOCK);
+		num++;
+	}
+
+	kfree(ent);
+	return num;
+}
+
+int initramfs_init(void) {
+	struct multiboot_tag_module* initrd = multiboot_get_initrd();
+	if(!initrd) {
+		return -1;
+	}
+
+	/* The module memory has already been reserved in mem.c together with the
+	 * early paging allocations, so just map it.
+	 */
+	void* phys = (void*)ALIGN_DOWN(initrd->mod_start, PAGE_SIZE);
+	size_t size = initrd->mod_end - initrd->mod_start;
+	size_t pages = RDIV(initrd->mod_end - (uintptr_t)phys, PAGE_SIZE);
+
+	vm_alloc_t mem;
+	char* data = vm_alloc(VM_KERNEL, &mem, pages, phys, 0);
+	if(!data) {
+		log(LOG_ERR, "initramfs: Could not map module\n");
+		return -1;
+	}
+	data += initrd->mod_start - (uintptr_t)phys;
+
+	int (*unpack)(char* data, size_t size) = NULL;
+	if(size >= sizeof(struct cpio_header) && (!strncmp(data, CPIO_MAGIC, 6)
+		|| !strncmp(data, CPIO_MAGIC_CRC, 6))) {
+		unpack = unpack_cpio;
+	} else if(size >= TAR_BLOCK && !strncmp(((struct tar_header*)data)->magic, TAR_MAGIC, 5)) {
+		unpack = unpack_tar;
+	}
+
+	if(!unpack) {
+		log(LOG_ERR, "initramfs: Unknown archive format\n");
+		vm_free(&mem);
+		return -1;
+	}
+
+	if(tmpfs_mount("/") < 0) {
+		vm_free(&mem);
+		return -1;
+	}
+
+	int num = unpack(data, size);
+	log(LOG_INFO, "initramfs: Unpacked %d entries, %u KiB\n", num, size / 1024);
+	vm_free(&mem);
+	return 0;
+}
+
+#endif /* CONFIG_ENABLE_INITRAMFS */
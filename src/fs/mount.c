@@ -22,14 +22,95 @@
 #include <block/block.h>
 #include <fs/sysfs.h>
 #include <fs/ext2.h>
+#include <fs/tmpfs.h>
+#include <fs/initramfs.h>
 #include <tasks/task.h>
 #include <mem/kmalloc.h>
+#include <kavl.h>
 #include <errno.h>
 #include <panic.h>
 #include <stdbool.h>
 
+/* Mount points are indexed in a trie of path components, so finding the mount
+ * point for a path takes one lookup per path component instead of comparing
+ * the path against every mount point. Nodes only exist for mount points and
+ * the directories leading up to them.
+ */
+struct mount_node {
+	char* name;
+	struct mount_node* parent;
+	struct mount_node* children;
+	struct vfs_mountpoint* mp;
+	KAVL_HEAD(struct mount_node) head;
+};
+
+#define mount_node_cmp(p, q) (strcmp((p)->name, (q)->name))
+KAVL_INIT2(mount_node, static inline, struct mount_node, head, mount_node_cmp)
+
+static struct mount_node root_node = { .name = "" };
+
+// All mount points, newest first. Used for listing them
 static struct vfs_mountpoint* mountpoints;
 
+static inline size_t component_len(const char* path) {
+	const char* end = strchr(path, '/');
+	return end ? end - path : strlen(path);
+}
+
+static struct mount_node* find_child(struct mount_node* node, const char* name, size_t len) {
+	char buf[VFS_NAME_MAX + 1];
+	if(len >= ARRAY_SIZE(buf)) {
+		return NULL;
+	}
+
+	memcpy(buf, name, len);
+	buf[len] = 0;
+
+	struct mount_node key = { .name = buf };
+	return kavl_find(mount_node, node->children, &key, NULL);
+}
+
+// Returns the node for exactly this path, optionally creating missing nodes
+static struct mount_node* get_node(const char* path, bool create) {
+	struct mount_node* node = &root_node;
+	while(1) {
+		while(*path == '/') {
+			path++;
+		}
+
+		if(!*path) {
+			return node;
+		}
+
+		size_t len = component_len(path);
+		struct mount_node* child = find_child(node, path, len);
+		if(!child) {
+			if(!create || len > VFS_NAME_MAX) {
+				return NULL;
+			}
+
+			child = zmalloc(sizeof(struct mount_node) + len + 1);
+			child->name = (char*)(child + 1);
+			memcpy(child->name, path, len);
+			child->parent = node;
+			kavl_insert(mount_node, &node->children, child, NULL);
+		}
+
+		node = child;
+		path += len;
+	}
+}
+
+// Drop nodes that no longer lead to any mount point
+static void prune_node(struct mount_node* node) {
+	while(node != &root_node && !node->mp && !node->children) {
+		struct mount_node* parent = node->parent;
+		kavl_erase(mount_node, &parent->children, node, NULL);
+		kfree(node);
+		node = parent;
+	}
+}
+
 int vfs_mount_register(struct vfs_block_dev* dev, const char* path,
 	void* instance, const char* type, struct vfs_callbacks* callbacks) {
 
@@ -44,6 +125,9 @@ int vfs_mount_register(struct vfs_block_dev* dev, const char* path,
 
 	mp->instance = instance;
 	mp->dev = dev;
+	mp->node = get_node(path, true);
+	mp->shadowed = mp->node->mp;
+	mp->node->mp = mp;
 	mp->prev = NULL;
 	mp->next = mountpoints;
 	if(mp->next) {
@@ -60,29 +144,39 @@ int vfs_mount_register(struct vfs_block_dev* dev, const char* path,
 	return 0;
 }
 
+/* Finds the mount point for a path, which is the one mounted on the longest
+ * matching sequence of path components. mount_path is set to the remainder of
+ * the path inside of the mount point.
+ */
 struct vfs_mountpoint* vfs_mount_get(const char* path, char** mount_path) {
-	struct vfs_mountpoint* match = NULL;
-	size_t match_len = 0;
-	const char* mpath = NULL;
-
-	struct vfs_mountpoint* cur_mp = mountpoints;
-	for(; cur_mp; cur_mp = cur_mp->next) {
-		size_t plen = strlen(cur_mp->path);
-
-		if(!strncmp(path, cur_mp->path, plen - 1) && plen > match_len) {
-			match = cur_mp;
-			match_len = plen;
-
-			if(strlen(path) - plen > 0) {
-				mpath = path + plen;
-			} else {
-				mpath = "/";
-			}
+	struct mount_node* node = &root_node;
+	struct vfs_mountpoint* match = node->mp;
+	const char* mpath = path;
+
+	while(1) {
+		while(*path == '/') {
+			path++;
+		}
+
+		if(!*path) {
+			break;
+		}
+
+		size_t len = component_len(path);
+		node = find_child(node, path, len);
+		if(!node) {
+			break;
+		}
+
+		path += len;
+		if(node->mp) {
+			match = node->mp;
+			mpath = path;
 		}
 	}
 
-	if(mount_path && mpath) {
-		*mount_path = strdup(mpath);
+	if(mount_path && match) {
+		*mount_path = strdup(*mpath ? mpath : "/");
 	}
 	return match;
 }
@@ -123,6 +217,15 @@ int vfs_mount(task_t* task, const char* source, const char* target, int flags) {
 		}
 	}
 
+	#ifdef CONFIG_ENABLE_TMPFS
+	// Not backed by any device
+	if(!strcmp(source, "tmpfs")) {
+		int r = tmpfs_mount(mnt_target);
+		kfree(mnt_target);
+		return r;
+	}
+	#endif
+
 	struct vfs_block_dev* dev = vfs_block_get_dev(source);
 	if(!dev) {
 		kfree(mnt_target);
@@ -151,17 +254,29 @@ int vfs_umount(task_t* task, const char* target, int flags) {
 		return -1;
 	}
 
-	struct vfs_mountpoint* mp =  vfs_mount_get(target, NULL);
-	if(!mp) {
+	char* path = vfs_normalize_path(target, task->cwd);
+	if(!path) {
 		sc_errno = EINVAL;
 		return -1;
 	}
 
-	if(!strcmp(mp->path, "/")) {
+	struct mount_node* node = get_node(path, false);
+	kfree(path);
+
+	if(!node || !node->mp) {
+		sc_errno = EINVAL;
+		return -1;
+	}
+
+	if(node == &root_node) {
 		sc_errno = EBUSY;
 		return -1;
 	}
 
+	struct vfs_mountpoint* mp = node->mp;
+	node->mp = mp->shadowed;
+	prune_node(node);
+
 	if(mp->prev) {
 		mp->prev->next = mp->next;
 	}
@@ -175,6 +290,7 @@ int vfs_umount(task_t* task, const char* target, int flags) {
 	}
 
 	if(mp->dev) {
+		vfs_block_flush(mp->dev);
 		mp->dev->mounted = false;
 	}
 
@@ -183,7 +299,7 @@ int vfs_umount(task_t* task, const char* target, int flags) {
 }
 
 static size_t sfs_mounts_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
-	if(ctx->fp->offset) {
+	if(ctx->offset) {
 		return 0;
 	}
 
@@ -199,10 +315,28 @@ static size_t sfs_mounts_read(struct vfs_callback_ctx* ctx, void* dest, size_t s
 	return rsize;
 }
 
-void vfs_mount_init(const char* root_path) {
+/* With an initramfs, the disk root (if any) is mounted over it by init once
+ * early userland is done.
+ */
+static void mount_root(const char* root_path) {
+	#ifdef CONFIG_ENABLE_INITRAMFS
+	if(!initramfs_init()) {
+		return;
+	}
+	#endif
+
+	if(!root_path) {
+		panic("vfs: Could not get root device path - Make sure root= "
+			"is set in kernel command line.\n");
+	}
+
 	if(vfs_mount(NULL, root_path, "/", 0) < 0) {
 		panic("vfs: Could not mount root filesystem\n");
 	}
+}
+
+void vfs_mount_init(const char* root_path) {
+	mount_root(root_path);
 
 	struct vfs_callbacks sfs_cb = {
 		.read = sfs_mounts_read,
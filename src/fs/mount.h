@@ -22,6 +22,7 @@
 #include <fs/vfs.h>
 
 struct vfs_callback_ctx;
+struct mount_node;
 struct vfs_mountpoint {
 	struct vfs_mountpoint* prev;
 	struct vfs_mountpoint* next;
@@ -30,6 +31,10 @@ struct vfs_mountpoint {
 	char type[50];
 	struct vfs_block_dev* dev;
 	struct vfs_callbacks callbacks;
+
+	// Position in the mount trie, and the mount point this one is on top of
+	struct mount_node* node;
+	struct vfs_mountpoint* shadowed;
 };
 
 int vfs_mount_register(struct vfs_block_dev* dev, const char* path, void* instance, const char* type,
@@ -26,19 +26,26 @@
 #include <mem/kmalloc.h>
 #include <buffer.h>
 
+/* The ends are counted per file table slot, so fork increments them through
+ * the fork callback. Dups of a slot only bump its refs, and the close callback
+ * only runs once the last of them is gone.
+ */
 struct pipe {
 	struct buffer* buf;
-	int fd[2];
+	volatile int readers;
+	volatile int writers;
 };
 
+static inline bool is_write_end(vfs_file_t* fp) {
+	return fp->flags & O_WRONLY;
+}
+
 static size_t pipe_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
 	struct pipe* pipe = (struct pipe*)ctx->fp->mount_instance;
 
 	while(!buffer_size(pipe->buf)) {
-		vfs_file_t* write_fp = vfs_get_from_id(pipe->fd[1], ctx->task);
-
-		// Input end closed, indicate EOF
-		if(!write_fp) {
+		// Input end closed everywhere, indicate EOF
+		if(!pipe->writers) {
 			return 0;
 		}
 
@@ -56,7 +63,32 @@ static size_t pipe_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
 
 static size_t pipe_write(struct vfs_callback_ctx* ctx, void* source, size_t size) {
 	struct pipe* pipe = (struct pipe*)ctx->fp->mount_instance;
-	return buffer_write(pipe->buf, source, size);
+	size_t written = 0;
+
+	while(1) {
+		written += buffer_write(pipe->buf, source + written, size - written);
+		if(written == size) {
+			return written;
+		}
+
+		// Output end closed everywhere, nobody will ever read this
+		if(!pipe->readers) {
+			sc_errno = EPIPE;
+			return written ? written : -1;
+		}
+
+		if(ctx->fp->flags & O_NONBLOCK) {
+			if(!written) {
+				sc_errno = EAGAIN;
+				return -1;
+			}
+			return written;
+		}
+
+		// Wait for the reader to make room
+		int_enable();
+		scheduler_yield();
+	}
 }
 
 static int pipe_poll(struct vfs_callback_ctx* ctx, int events) {
@@ -66,14 +98,52 @@ static int pipe_poll(struct vfs_callback_ctx* ctx, int events) {
 		return -1;
 	}
 
+	poll_register(ctx, &pipe->buf->waitq);
 	int_enable();
 	if(events & POLLIN && buffer_size(pipe->buf)) {
 		return POLLIN;
 	}
+	if(events & POLLOUT && is_write_end(ctx->fp) && buffer_space(pipe->buf)) {
+		return POLLOUT;
+	}
+
+	// Input end closed, read() would return EOF
+	if(!is_write_end(ctx->fp) && !pipe->writers) {
+		return POLLHUP;
+	}
+
+	// Output end closed, write() would fail with EPIPE
+	if(is_write_end(ctx->fp) && !pipe->readers) {
+		return POLLERR;
+	}
 	int_disable();
 	return 0;
 }
 
+static int pipe_fork(struct vfs_callback_ctx* ctx) {
+	struct pipe* pipe = (struct pipe*)ctx->fp->mount_instance;
+	__sync_add_and_fetch(is_write_end(ctx->fp) ? &pipe->writers : &pipe->readers, 1);
+	return 0;
+}
+
+static int pipe_close(struct vfs_callback_ctx* ctx) {
+	struct pipe* pipe = (struct pipe*)ctx->fp->mount_instance;
+	int readers = is_write_end(ctx->fp) ? pipe->readers
+		: __sync_sub_and_fetch(&pipe->readers, 1);
+	int writers = is_write_end(ctx->fp) ? __sync_sub_and_fetch(&pipe->writers, 1)
+		: pipe->writers;
+
+	if(!readers && !writers) {
+		buffer_free(pipe->buf);
+		kfree(pipe);
+		return 0;
+	}
+
+	// Let the other end see EOF or EPIPE
+	poll_wake(&pipe->buf->waitq);
+	return 0;
+}
+
 static int pipe_stat(struct vfs_callback_ctx* ctx, vfs_stat_t* dest) {
 	dest->st_dev = 3;
 	dest->st_ino = 1;
@@ -107,20 +177,24 @@ int vfs_pipe(task_t* task, int fildes[2]) {
 	}
 
 	struct pipe* pipe = zmalloc(sizeof(struct pipe));
-	pipe->buf = buffer_new(150);
+	pipe->buf = buffer_new(16);
 	if(!pipe->buf) {
 		return -1;
 	}
 
-	pipe->fd[0] = fd1->num;
-	pipe->fd[1] = fd2->num;
+	pipe->readers = 1;
+	pipe->writers = 1;
 
 	fd1->callbacks.read = pipe_read;
 	fd1->callbacks.poll = pipe_poll;
 	fd1->callbacks.stat = pipe_stat;
+	fd1->callbacks.fork = pipe_fork;
+	fd1->callbacks.close = pipe_close;
 	fd2->callbacks.write = pipe_write;
 	fd2->callbacks.poll = pipe_poll;
 	fd2->callbacks.stat = pipe_stat;
+	fd2->callbacks.fork = pipe_fork;
+	fd2->callbacks.close = pipe_close;
 	fd1->flags = O_RDONLY;
 	fd2->flags = O_WRONLY;
 	fd1->mount_instance = (void*)pipe;
@@ -128,6 +202,10 @@ int vfs_pipe(task_t* task, int fildes[2]) {
 	fd1->type = FT_IFPIPE;
 	fd2->type = FT_IFPIPE;
 
+	// Set right away so closing either end wakes up pollers of the other one
+	fd1->waitq = &pipe->buf->waitq;
+	fd2->waitq = &pipe->buf->waitq;
+
 	fildes[0] = fd1->num;
 	fildes[1] = fd2->num;
 	return 0;
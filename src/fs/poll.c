@@ -1,5 +1,5 @@
 /* poll.c: VFS polling
- * Copyright © 2019-2020 Lukas Martini
+ * Copyright © 2019-2026 Lukas Martini
  *
  * This file is part of Xelix.
  *
@@ -18,58 +18,233 @@
  */
 
 #include <fs/poll.h>
+#include <fs/epoll.h>
 #include <fs/vfs.h>
 #include <tasks/task.h>
+#include <tasks/scheduler.h>
+#include <bsp/timer.h>
 #include <mem/kmalloc.h>
+#include <stdint.h>
 #include <errno.h>
 
-int vfs_poll(task_t* task, struct pollfd* fds, uint32_t nfds, int timeout) {
-	int ret = 0;
-	uint32_t timeout_end = 0;
-	if(timeout >= 0) {
-		timeout_end = timer_get_tick() + (timeout * 1000 / timer_get_rate());
+/* Wait queue lists are modified from both syscalls and interrupt handlers
+ * (buffer writes from the keyboard or network drivers), so all accesses happen
+ * with interrupts disabled.
+ */
+void poll_register(struct vfs_callback_ctx* ctx, struct poll_waitq* waitq) {
+	if(ctx->fp) {
+		ctx->fp->waitq = waitq;
+	}
+
+	struct poll_entry* entry = ctx->poll_entry;
+	if(!entry || entry->waitq) {
+		return;
+	}
+
+	bool irq = int_save();
+	entry->waitq = waitq;
+	entry->fp = ctx->fp;
+	entry->next = waitq->entries;
+	waitq->entries = entry;
+	int_restore(irq);
+}
+
+void poll_unregister(struct poll_entry* entry) {
+	bool irq = int_save();
+	if(entry->waitq) {
+		struct poll_entry** e = &entry->waitq->entries;
+		for(; *e; e = &(*e)->next) {
+			if(*e == entry) {
+				*e = entry->next;
+				break;
+			}
+		}
+		entry->waitq = NULL;
+	}
+	int_restore(irq);
+}
+
+void poll_wake_waiter(struct poll_waiter* waiter) {
+	waiter->woken = true;
+	task_t* task = waiter->task;
+	if(task && task->task_state == TASK_STATE_SLEEPING) {
+		task->sleep_until = 0;
+	}
+}
+
+void poll_wake(struct poll_waitq* waitq) {
+	if(!waitq->entries) {
+		return;
+	}
+
+	bool irq = int_save();
+	for(struct poll_entry* entry = waitq->entries; entry; entry = entry->next) {
+		if(entry->item) {
+			epoll_item_ready(entry->item);
+		} else {
+			poll_wake_waiter(entry->waiter);
+		}
+	}
+	int_restore(irq);
+}
+
+// Called when the last reference to fp is closed
+void poll_forget(vfs_file_t* fp) {
+	if(!fp->waitq) {
+		return;
+	}
+
+	bool irq = int_save();
+	struct poll_entry** e = &fp->waitq->entries;
+	while(*e) {
+		struct poll_entry* entry = *e;
+		if(entry->fp != fp) {
+			e = &entry->next;
+			continue;
+		}
+
+		*e = entry->next;
+		entry->waitq = NULL;
+		if(entry->item) {
+			epoll_item_closed(entry->item);
+		} else {
+			poll_wake_waiter(entry->waiter);
+		}
+	}
+
+	int_restore(irq);
+}
+
+// Called by objects that get freed while they might still have waiters
+void poll_waitq_destroy(struct poll_waitq* waitq) {
+	bool irq = int_save();
+	while(waitq->entries) {
+		struct poll_entry* entry = waitq->entries;
+		waitq->entries = entry->next;
+		entry->waitq = NULL;
+		if(entry->item) {
+			epoll_item_ready(entry->item);
+		} else {
+			poll_wake_waiter(entry->waiter);
+		}
+	}
+	int_restore(irq);
+}
+
+uint32_t poll_deadline(int timeout) {
+	if(timeout < 0) {
+		return UINT32_MAX;
 	}
+	return timer_get_tick() + RDIV((uint32_t)timeout * timer_get_rate(), 1000);
+}
+
+/* Sleep until woken through the wait queues or until the deadline. Needs to be
+ * called with interrupts disabled, otherwise wakeups that happen between
+ * checking waiter->woken and going to sleep get lost.
+ */
+void poll_sleep(task_t* task, struct poll_waiter* waiter, uint32_t until) {
+	if(waiter->woken) {
+		return;
+	}
+
+	waiter->task = task;
+	task->poll_waiter = waiter;
+	task->sleep_until = until;
+	task->task_state = TASK_STATE_SLEEPING;
+	scheduler_yield();
+
+	int_disable();
+	task->poll_waiter = NULL;
+	waiter->task = NULL;
+}
+
+// Called for tasks killed while sleeping in poll()/epoll_wait()
+void poll_task_exit(task_t* task) {
+	struct poll_waiter* waiter = task->poll_waiter;
+	if(!waiter) {
+		return;
+	}
+
+	bool irq = int_save();
+	for(uint32_t i = 0; i < waiter->nentries; i++) {
+		poll_unregister(&waiter->entries[i]);
+	}
+	if(waiter->ep) {
+		epoll_waiter_exit(waiter);
+	}
+	waiter->task = NULL;
+	task->poll_waiter = NULL;
+	int_restore(irq);
+}
+
+int vfs_poll(task_t* task, struct pollfd* fds, uint32_t nfds, int timeout) {
+	uint32_t deadline = poll_deadline(timeout);
 
 	// Build contexts ahead of time to avoid constantly reallocating in the loop
-	struct vfs_callback_ctx** contexts = kmalloc(sizeof(void*) * nfds);
-	for(int i = 0; i < nfds; i++) {
-		contexts[i] = vfs_context_from_fd(fds[i].fd, task);
+	struct vfs_callback_ctx* contexts = kmalloc(sizeof(struct vfs_callback_ctx) * nfds);
+	struct poll_entry* entries = zmalloc(sizeof(struct poll_entry) * nfds);
+	struct poll_waiter waiter = {
+		.entries = entries,
+		.nentries = nfds,
+	};
 
-		if(!contexts[i] || !contexts[i]->fp) {
+	for(uint32_t i = 0; i < nfds; i++) {
+		if(vfs_context_init_fd(&contexts[i], fds[i].fd, task) < 0) {
+			kfree(contexts);
+			kfree(entries);
 			sc_errno = EBADF;
 			return -1;
 		}
 
-		if(!contexts[i]->fp->callbacks.poll) {
+		if(!contexts[i].fp->callbacks.poll) {
+			kfree(contexts);
+			kfree(entries);
 			sc_errno = ENOSYS;
 			return -1;
 		}
+
+		entries[i].waiter = &waiter;
+		contexts[i].poll_entry = &entries[i];
 	}
 
+	int ret;
 	while(1) {
+		int_disable();
+		waiter.woken = false;
+		bool unnotified = false;
+		ret = 0;
+
+		/* The first pass registers with the wait queues of all objects that
+		 * support them, so from then on any change wakes us up.
+		 */
 		for(uint32_t i = 0; i < nfds; i++) {
+			int r = contexts[i].fp->callbacks.poll(&contexts[i], fds[i].events);
+
+			// Some poll callbacks enable interrupts
 			int_disable();
-			int r = contexts[i]->fp->callbacks.poll(contexts[i], fds[i].events);
+			fds[i].revents = r > 0 ? r : 0;
 			if(r > 0) {
-				fds[i].revents = r;
-				ret = 1;
-				goto bye;
+				ret++;
+			}
+
+			if(!contexts[i].fp->waitq) {
+				unnotified = true;
 			}
-			int_enable();
 		}
 
-		if(timeout_end && timer_get_tick() > timeout_end) {
+		uint32_t tick = timer_get_tick();
+		if(ret || tick >= deadline) {
 			break;
 		}
 
-		scheduler_yield();
+		poll_sleep(task, &waiter, unnotified ? MIN(deadline, tick + 1) : deadline);
 	}
 
-bye:
-	int_disable();
-	for(int i = 0; i < nfds; i++) {
-		vfs_free_context(contexts[i]);
+	for(uint32_t i = 0; i < nfds; i++) {
+		poll_unregister(&entries[i]);
 	}
+
 	kfree(contexts);
+	kfree(entries);
 	return ret;
 }
@@ -1,6 +1,6 @@
 #pragma once
 
-/* Copyright © 2019-2020 Lukas Martini
+/* Copyright © 2019-2026 Lukas Martini
  *
  * This file is part of Xelix.
  *
@@ -40,4 +40,13 @@ struct pollfd {
 	short revents;	/* returned events */
 };
 
+void poll_register(struct vfs_callback_ctx* ctx, struct poll_waitq* waitq);
+void poll_unregister(struct poll_entry* entry);
+void poll_wake(struct poll_waitq* waitq);
+void poll_wake_waiter(struct poll_waiter* waiter);
+void poll_forget(vfs_file_t* fp);
+void poll_waitq_destroy(struct poll_waitq* waitq);
+uint32_t poll_deadline(int timeout);
+void poll_sleep(task_t* task, struct poll_waiter* waiter, uint32_t until);
+void poll_task_exit(task_t* task);
 int vfs_poll(struct task* task, struct pollfd* fds, uint32_t nfds, int timeout);
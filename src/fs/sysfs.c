@@ -1,5 +1,5 @@
 /* sysfs.c: System FS. Used for /dev and /sys.
- * Copyright © 2018-2019 Lukas Martini
+ * Copyright © 2018-2026 Lukas Martini
  *
  * This file is part of Xelix.
  *
@@ -46,34 +46,58 @@ static struct vfs_callbacks callbacks = {
 	.chown = chown,
 };
 
-static struct sysfs_file* sys_files;
-static struct sysfs_file* dev_files;
+#define sysfs_cmp(p, q) (strcmp((p)->name, (q)->name))
+KAVL_INIT2(sysfs, static inline, struct sysfs_file, head, sysfs_cmp)
 
-static struct sysfs_file* get_file(const char* path, struct sysfs_file* first) {
-	if(!first || !strncmp(path, "/", 2)) {
+static struct sysfs_file sys_root = { .type = FT_IFDIR };
+static struct sysfs_file dev_root = { .type = FT_IFDIR };
+
+static inline size_t component_len(const char* path) {
+	const char* end = strchr(path, '/');
+	return end ? end - path : strlen(path);
+}
+
+static struct sysfs_file* find_child(struct sysfs_file* dir, const char* name, size_t len) {
+	if(len >= ARRAY_SIZE(dir->name)) {
 		return NULL;
 	}
 
-	if(*path == '/') {
-		path++;
-	}
+	struct sysfs_file key;
+	memcpy(key.name, name, len);
+	key.name[len] = 0;
+	return kavl_find(sysfs, dir->children, &key, NULL);
+}
 
-	struct sysfs_file* file = first;
+// Returns the directory itself for "/"
+static struct sysfs_file* get_file(const char* path, struct sysfs_file* root) {
+	struct sysfs_file* file = root;
 	while(file) {
-		if(!strcmp(file->name, path)) {
+		while(*path == '/') {
+			path++;
+		}
+
+		if(!*path) {
 			return file;
 		}
 
-		file = file->next;
-	}
+		if(file->type != FT_IFDIR) {
+			return NULL;
+		}
 
+		size_t len = component_len(path);
+		file = find_child(file, path, len);
+		path += len;
+	}
 	return NULL;
 }
 
+static inline bool is_dir(struct sysfs_file* file) {
+	return file->type == FT_IFDIR;
+}
+
 int sysfs_build_path_tree(struct vfs_callback_ctx* ctx) {
-	bool is_root = !strncmp(ctx->path, "/", 2);
-	struct sysfs_file* file = get_file(ctx->path, *(struct sysfs_file**)ctx->mp->instance);
-	if(!is_root && !file) {
+	struct sysfs_file* file = get_file(ctx->path, ctx->mp->instance);
+	if(!file) {
 		sc_errno = ENOENT;
 		return -1;
 	}
@@ -81,15 +105,15 @@ int sysfs_build_path_tree(struct vfs_callback_ctx* ctx) {
 	vfs_stat_t stat;
 
 	// Check if file has its own stat callback
-	if(file && file->cb.stat) {
+	if(file->cb.stat) {
 		file->cb.stat(ctx, &stat);
 	} else {
 		stat.st_dev = 2;
 		stat.st_ino = 1;
-		if(!file || is_root) {
+		if(is_dir(file)) {
 			stat.st_mode = FT_IFDIR | S_IXUSR | S_IRUSR | S_IXGRP | S_IRGRP | S_IXOTH | S_IROTH;
 		} else {
-			stat.st_mode = file ? file->type : FT_IFDIR;
+			stat.st_mode = file->type;
 
 			if(file->cb.read)
 				stat.st_mode |= S_IRUSR | S_IRGRP | S_IROTH;
@@ -118,24 +142,23 @@ int sysfs_build_path_tree(struct vfs_callback_ctx* ctx) {
 
 
 int sysfs_stat(struct vfs_callback_ctx* ctx, vfs_stat_t* dest) {
-	bool is_root = !strncmp(ctx->path, "/", 2);
-	struct sysfs_file* file = get_file(ctx->path, *(struct sysfs_file**)ctx->mp->instance);
-	if(!is_root && !file) {
+	struct sysfs_file* file = get_file(ctx->path, ctx->mp->instance);
+	if(!file) {
 		sc_errno = ENOENT;
 		return -1;
 	}
 
 	// Check if file has its own stat callback
-	if(file && file->cb.stat) {
+	if(file->cb.stat) {
 		return file->cb.stat(ctx, dest);
 	}
 
 	dest->st_dev = 2;
 	dest->st_ino = 1;
-	if(!file || is_root) {
+	if(is_dir(file)) {
 		dest->st_mode = FT_IFDIR | S_IXUSR | S_IRUSR | S_IXGRP | S_IRGRP | S_IXOTH | S_IROTH;
 	} else {
-		dest->st_mode = file ? file->type : FT_IFDIR;
+		dest->st_mode = file->type;
 
 		if(file->cb.read)
 			dest->st_mode |= S_IRUSR | S_IRGRP | S_IROTH;
@@ -157,25 +180,22 @@ int sysfs_stat(struct vfs_callback_ctx* ctx, vfs_stat_t* dest) {
 }
 
 int sysfs_access(struct vfs_callback_ctx* ctx, uint32_t amode) {
-	if(!strncmp(ctx->path, "/", 2)) {
-		return 0;
-	}
-
-	// Only root dir has exec perm
-	if(amode & X_OK) {
-		sc_errno = EACCES;
+	struct sysfs_file* file = get_file(ctx->path, ctx->mp->instance);
+	if(!file) {
+		sc_errno = ENOENT;
 		return -1;
 	}
 
-	if(!get_file(ctx->path, *(struct sysfs_file**)ctx->mp->instance)) {
-		sc_errno = ENOENT;
+	// Only directories have exec perm
+	if(amode & X_OK && !is_dir(file)) {
+		sc_errno = EACCES;
 		return -1;
 	}
 	return 0;
 }
 
 int sysfs_readlink(struct vfs_callback_ctx* ctx, char* buf, size_t size) {
-	struct sysfs_file* file = get_file(ctx->path, *(struct sysfs_file**)ctx->mp->instance);
+	struct sysfs_file* file = get_file(ctx->path, ctx->mp->instance);
 	if(!file) {
 		sc_errno = ENOENT;
 		return -1;
@@ -190,16 +210,18 @@ int sysfs_readlink(struct vfs_callback_ctx* ctx, char* buf, size_t size) {
 }
 
 size_t sysfs_getdents(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
-	struct sysfs_file* file = *(struct sysfs_file**)ctx->mp->instance;
-
-	if(!file || ctx->fp->offset) {
+	struct sysfs_file* parent = get_file(ctx->path, ctx->mp->instance);
+	if(!parent || !parent->children || ctx->fp->offset) {
 		return 0;
 	}
 
 	vfs_dirent_t* dir = (vfs_dirent_t*)dest;
 	size_t total_length = 0;
 
-	for(int i = 2; file; i++) {
+	kavl_itr_t(sysfs) itr;
+	kavl_itr_first(sysfs, parent->children, &itr);
+	for(int i = 2;; i++) {
+		const struct sysfs_file* file = kavl_at(&itr);
 		uint32_t name_len = strlen(file->name);
 		uint32_t rec_len = sizeof(vfs_dirent_t) + name_len + 1;
 		if(total_length + rec_len > size) {
@@ -214,22 +236,23 @@ size_t sysfs_getdents(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
 		total_length += rec_len;
 		ctx->fp->offset++;
 		dir = (vfs_dirent_t*)((intptr_t)dir + dir->d_reclen);
-		file = file->next;
+		if(!kavl_itr_next(sysfs, &itr)) {
+			break;
+		}
 	}
 
 	return total_length;
 }
 
 vfs_file_t* sysfs_open(struct vfs_callback_ctx* ctx, uint32_t flags) {
-	struct sysfs_file* file = get_file(ctx->path, *(struct sysfs_file**)ctx->mp->instance);
-	bool is_root = !strncmp(ctx->path, "/", 2);
-	if(!(file || is_root)) {
+	struct sysfs_file* file = get_file(ctx->path, ctx->mp->instance);
+	if(!file) {
 		sc_errno = ENOENT;
 		return NULL;
 	}
 
 	// Check if file has its own open callback
-	if(file && file->cb.open) {
+	if(file->cb.open) {
 		return file->cb.open(ctx, flags);
 	}
 
@@ -240,7 +263,7 @@ vfs_file_t* sysfs_open(struct vfs_callback_ctx* ctx, uint32_t flags) {
 
 	fp->inode = 1;
 
-	if(is_root) {
+	if(is_dir(file)) {
 		fp->type = FT_IFDIR;
 		memcpy(&fp->callbacks, &callbacks, sizeof(struct vfs_callbacks));
 		fp->callbacks.getdents = sysfs_getdents;
@@ -258,60 +281,93 @@ vfs_file_t* sysfs_open(struct vfs_callback_ctx* ctx, uint32_t flags) {
 	return fp;
 }
 
-static struct sysfs_file* add_file(struct sysfs_file** table, char* name,
-	struct vfs_callbacks* cb) {
+static struct sysfs_file* add_file(struct sysfs_file* root, char* name,
+	struct vfs_callbacks* cb, uint16_t type) {
+
+	struct sysfs_file* dir = root;
+	struct sysfs_file* fp = NULL;
+	bool created = false;
+	while(*name) {
+		size_t len = component_len(name);
+		if(!len) {
+			name++;
+			continue;
+		}
 
-	struct sysfs_file* fp = zmalloc(sizeof(struct sysfs_file));
-	strcpy(fp->name, name);
-	fp->type = table == &sys_files ? FT_IFREG : FT_IFCHR;
-	memcpy(&fp->cb, cb, sizeof(struct vfs_callbacks));
-	if(*table) {
-		fp->next = *table;
-		(*table)->prev = fp;
+		if(len >= ARRAY_SIZE(fp->name)) {
+			log(LOG_ERR, "sysfs: Name %s is too long\n", name);
+			return NULL;
+		}
+
+		if(dir->type != FT_IFDIR) {
+			log(LOG_ERR, "sysfs: Can't add %s, parent is not a directory\n", name);
+			return NULL;
+		}
+
+		fp = find_child(dir, name, len);
+		created = !fp;
+		if(!fp) {
+			fp = zmalloc(sizeof(struct sysfs_file));
+			memcpy(fp->name, name, len);
+			fp->type = FT_IFDIR;
+			fp->parent = dir;
+			kavl_insert(sysfs, &dir->children, fp, NULL);
+		}
+
+		dir = fp;
+		name += len;
 	}
-	*table = fp;
-	return fp;
-}
 
-static void remove_file(struct sysfs_file** table, struct sysfs_file* fp) {
 	if(!fp) {
-		return;
+		return NULL;
 	}
 
-	if(fp->prev) {
-		fp->prev->next = fp->next;
+	/* The existing file belongs to someone else who may remove it at any
+	 * time, so it can't be handed out a second time.
+	 */
+	if(!created) {
+		log(LOG_ERR, "sysfs: Can't add %s, file exists\n", fp->name);
+		sc_errno = EEXIST;
+		return NULL;
 	}
 
-	if(fp->next) {
-		fp->next->prev = fp->prev;
-	}
+	fp->type = type;
+	memcpy(&fp->cb, cb, sizeof(struct vfs_callbacks));
+	return fp;
+}
 
-	if(*table == fp) {
-		*table = fp->next;
+static void remove_file(struct sysfs_file* fp) {
+	if(!fp || !fp->parent) {
+		return;
 	}
 
+	kavl_erase(sysfs, &fp->parent->children, fp, NULL);
 	kfree(fp);
 }
 
 struct sysfs_file* sysfs_add_file(char* name, struct vfs_callbacks* cb) {
-	return add_file(&sys_files, name, cb);
+	return add_file(&sys_root, name, cb, FT_IFREG);
 }
 
 struct sysfs_file* sysfs_add_dev(char* name, struct vfs_callbacks* cb) {
-	return add_file(&dev_files, name, cb);
+	return add_file(&dev_root, name, cb, FT_IFCHR);
+}
+
+struct sysfs_file* sysfs_get_dev(const char* name) {
+	return get_file(name, &dev_root);
 }
 
 void sysfs_rm_file(struct sysfs_file* fp) {
-	remove_file(&sys_files, fp);
+	remove_file(fp);
 }
 
 void sysfs_rm_dev(struct sysfs_file* fp) {
-	remove_file(&dev_files, fp);
+	remove_file(fp);
 }
 
 void sysfs_init(void) {
 	//sys_root = vfs_ftree_insert(NULL, "sys", stat);
 	//dev_root = vfs_ftree_insert(NULL, "dev", stat);
-	vfs_mount_register(NULL, "/sys", &sys_files, "sysfs", &callbacks);
-	vfs_mount_register(NULL, "/dev", &dev_files, "sysfs", &callbacks);
+	vfs_mount_register(NULL, "/sys", &sys_root, "sysfs", &callbacks);
+	vfs_mount_register(NULL, "/dev", &dev_root, "sysfs", &callbacks);
 }
@@ -1,6 +1,6 @@
 #pragma once
 
-/* Copyright © 2018-2019 Lukas Martini
+/* Copyright © 2018-2026 Lukas Martini
  *
  * This file is part of Xelix.
  *
@@ -20,20 +20,31 @@
 
 #include <printf.h>
 #include <fs/vfs.h>
+#include <kavl.h>
 
 #define sysfs_printf(args...) rsize += snprintf(dest + rsize, size - rsize, args);
 
+/* Files are kept in an AVL tree per directory, so lookups don't get slower
+ * with the number of tasks (each of which has a /sys/taskN file) or devices.
+ * Names passed to sysfs_add_file/sysfs_add_dev may contain slashes, missing
+ * parent directories are created automatically.
+ */
 struct sysfs_file {
 	char name[40];
 	struct vfs_callbacks cb;
 	void* meta;
 	uint16_t type;
-	struct sysfs_file* next;
-	struct sysfs_file* prev;
+
+	KAVL_HEAD(struct sysfs_file) head;
+	struct sysfs_file* parent;
+
+	// Only used for directories
+	struct sysfs_file* children;
 };
 
 struct sysfs_file* sysfs_add_file(char* name, struct vfs_callbacks* cb);
 struct sysfs_file* sysfs_add_dev(char* name, struct vfs_callbacks* cb);
+struct sysfs_file* sysfs_get_dev(const char* name);
 void sysfs_rm_file(struct sysfs_file* fp);
 void sysfs_rm_dev(struct sysfs_file* fp);
 void sysfs_init(void);
@@ -0,0 +1,1123 @@
+/* tmpfs.c: In-memory file system
+ * Copyright © 2026 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Everything in a tmpfs lives in memory and is gone after a reboot. Inodes and
+ * directory entries are allocated on the kernel heap, but file contents are
+ * kept in individual pages outside of it, since the heap is far too small for
+ * that. Pages that have never been written to are not allocated at all and
+ * read back as zeroes.
+ *
+ * Inodes are separate from directory entries so hard links work. They also
+ * count the file descriptors referencing them, so files that get unlinked
+ * while they are still open stay around until the last descriptor is closed.
+ * The links together hold one more reference, which is dropped once nlink
+ * reaches zero, so whoever drops the last reference frees the inode.
+ */
+
+#ifdef CONFIG_ENABLE_TMPFS
+
+#include <fs/tmpfs.h>
+#include <fs/vfs.h>
+#include <fs/mount.h>
+#include <tasks/task.h>
+#include <mem/kmalloc.h>
+#include <mem/vm.h>
+#include <spinlock.h>
+#include <kavl.h>
+#include <libgen.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <log.h>
+
+#define MAX_SYMLINK_DEPTH 8
+
+// Same values as the ext2 directory entry types / newlib DT_*
+#define DT_REG 1
+#define DT_DIR 2
+#define DT_LNK 7
+
+enum perm_op {
+	PERM_EXEC = 0,
+	PERM_WRITE = 1,
+	PERM_READ = 2
+};
+
+struct tmpfs_inode;
+struct tmpfs_dirent {
+	char* name;
+	struct tmpfs_inode* inode;
+	KAVL_HEAD(struct tmpfs_dirent) head;
+};
+
+struct tmpfs_inode {
+	uint32_t num;
+	uint32_t mode;
+	uint16_t uid;
+	uint16_t gid;
+	uint32_t nlink;
+	uint32_t size;
+	uint32_t atime;
+	uint32_t mtime;
+	uint32_t ctime;
+
+	/* One for each open file descriptor plus one as long as nlink isn't zero.
+	 * Modified atomically, as close can't take the lock.
+	 */
+	uint32_t refs;
+
+	// Regular files: Data pages, indexed by file offset / PAGE_SIZE
+	vm_alloc_t* pages;
+	uint32_t npages;
+
+	// Directories
+	struct tmpfs_dirent* children;
+	struct tmpfs_inode* parent;
+
+	// Symbolic links
+	char* target;
+};
+
+struct tmpfs {
+	spinlock_t lock;
+	struct tmpfs_dirent root;
+	uint32_t next_num;
+	uint16_t dev;
+
+	// Modified atomically, also updated from the close callback
+	uint32_t used_pages;
+	uint32_t max_pages;
+};
+
+#define tmpfs_cmp(p, q) (strcmp((p)->name, (q)->name))
+KAVL_INIT2(tmpfs, static inline, struct tmpfs_dirent, head, tmpfs_cmp)
+
+static struct vfs_callbacks callbacks;
+static uint16_t next_dev = 0x10;
+
+// Data pages of all instances, modified atomically
+static uint32_t total_pages = 0;
+
+static inline bool is_dir(struct tmpfs_inode* inode) {
+	return vfs_mode_to_filetype(inode->mode) == FT_IFDIR;
+}
+
+static inline size_t component_len(const char* path) {
+	const char* end = strchr(path, '/');
+	return end ? end - path : strlen(path);
+}
+
+static int check_perm(enum perm_op op, struct tmpfs_inode* inode, task_t* task) {
+	// Kernel / root
+	if(!task || task->euid == 0) {
+		return 0;
+	}
+
+	int bit_offset = 0;
+	if(task->euid == inode->uid) {
+		bit_offset = 6;
+	} else if(task->egid == inode->gid) {
+		bit_offset = 3;
+	}
+
+	if(inode->mode & (1 << (bit_offset + op))) {
+		return 0;
+	}
+
+	sc_errno = EACCES;
+	return -1;
+}
+
+// Removing or renaming entries needs write access, and ownership in sticky dirs
+static int check_delete(struct tmpfs_inode* dir, struct tmpfs_inode* inode, task_t* task) {
+	if(check_perm(PERM_WRITE, dir, task) < 0) {
+		return -1;
+	}
+
+	if(task && task->euid != 0 && (dir->mode & S_ISVTX) &&
+		task->euid != dir->uid && task->euid != inode->uid) {
+
+		sc_errno = EPERM;
+		return -1;
+	}
+	return 0;
+}
+
+static int check_owner(struct tmpfs_inode* inode, task_t* task) {
+	if(task && task->euid != 0 && task->euid != inode->uid) {
+		sc_errno = EPERM;
+		return -1;
+	}
+	return 0;
+}
+
+/* Walks the path from the root of the file system. Returns the entry for the
+ * last path component, or NULL if it doesn't exist. In the latter case, *dir
+ * is still set to the parent directory and name to the missing component so
+ * that callers can create it, unless some earlier component was missing too.
+ */
+static struct tmpfs_dirent* lookup(struct tmpfs* fs, const char* path,
+	struct tmpfs_inode** dir, char name[VFS_NAME_MAX + 1]) {
+
+	struct tmpfs_dirent key = { .name = name };
+	struct tmpfs_dirent* dirent = &fs->root;
+	*dir = fs->root.inode;
+	name[0] = 0;
+
+	while(1) {
+		while(*path == '/') {
+			path++;
+		}
+
+		if(!*path) {
+			if(!dirent) {
+				sc_errno = ENOENT;
+			}
+			return dirent;
+		}
+
+		if(!dirent || !is_dir(dirent->inode)) {
+			sc_errno = dirent ? ENOTDIR : ENOENT;
+			*dir = NULL;
+			return NULL;
+		}
+
+		size_t len = component_len(path);
+		if(len > VFS_NAME_MAX) {
+			sc_errno = ENAMETOOLONG;
+			*dir = NULL;
+			return NULL;
+		}
+
+		memcpy(name, path, len);
+		name[len] = 0;
+		*dir = dirent->inode;
+		dirent = kavl_find(tmpfs, (*dir)->children, &key, NULL);
+		path += len;
+	}
+}
+
+static struct tmpfs_inode* new_inode(struct tmpfs* fs, task_t* task, uint32_t mode) {
+	struct tmpfs_inode* inode = zmalloc(sizeof(struct tmpfs_inode));
+	if(!inode) {
+		sc_errno = ENOMEM;
+		return NULL;
+	}
+
+	inode->num = fs->next_num++;
+	inode->mode = mode;
+	if(task) {
+		inode->uid = task->euid;
+		inode->gid = task->egid;
+	}
+
+	uint32_t t = time_get();
+	inode->atime = t;
+	inode->mtime = t;
+	inode->ctime = t;
+
+	// Reference of the links the caller is about to add
+	inode->refs = 1;
+	return inode;
+}
+
+// Frees all data pages starting at the one containing size
+static void truncate_data(struct tmpfs* fs, struct tmpfs_inode* inode, uint32_t size) {
+	uint32_t first = RDIV(size, PAGE_SIZE);
+	for(uint32_t i = first; i < inode->npages; i++) {
+		if(inode->pages[i].addr) {
+			vm_free(&inode->pages[i]);
+			inode->pages[i].addr = NULL;
+			__sync_sub_and_fetch(&fs->used_pages, 1);
+			__sync_sub_and_fetch(&total_pages, 1);
+		}
+	}
+
+	// Data past the end needs to read as zero should the file grow again
+	if(size % PAGE_SIZE && first - 1 < inode->npages && inode->pages[first - 1].addr) {
+		bzero(inode->pages[first - 1].addr + size % PAGE_SIZE, PAGE_SIZE - size % PAGE_SIZE);
+	}
+
+	inode->size = MIN(inode->size, size);
+}
+
+static void free_inode(struct tmpfs* fs, struct tmpfs_inode* inode) {
+	truncate_data(fs, inode, 0);
+	kfree(inode->pages);
+	kfree(inode->target);
+	kfree(inode);
+}
+
+// Called once the last link or an open file descriptor has gone away
+static inline void put_inode(struct tmpfs* fs, struct tmpfs_inode* inode) {
+	if(!__sync_sub_and_fetch(&inode->refs, 1)) {
+		free_inode(fs, inode);
+	}
+}
+
+static struct tmpfs_dirent* add_dirent(struct tmpfs_inode* dir, const char* name,
+	struct tmpfs_inode* inode) {
+
+	size_t len = strlen(name);
+	struct tmpfs_dirent* dirent = kmalloc(sizeof(struct tmpfs_dirent) + len + 1);
+	if(!dirent) {
+		sc_errno = ENOMEM;
+		return NULL;
+	}
+
+	dirent->name = (char*)(dirent + 1);
+	memcpy(dirent->name, name, len + 1);
+	dirent->inode = inode;
+	kavl_insert(tmpfs, &dir->children, dirent, NULL);
+
+	if(is_dir(inode)) {
+		inode->parent = dir;
+	}
+
+	dir->mtime = dir->ctime = time_get();
+	return dirent;
+}
+
+static void remove_dirent(struct tmpfs_inode* dir, struct tmpfs_dirent* dirent) {
+	kavl_erase(tmpfs, &dir->children, dirent, NULL);
+	dir->mtime = dir->ctime = time_get();
+	kfree(dirent);
+}
+
+/* Resolves a symbolic link target relative to path, which is the global path
+ * of the link. Returns the new global path, or NULL if it points outside of
+ * this file system.
+ */
+static char* follow_symlink(struct vfs_mountpoint* mp, const char* path, const char* target) {
+	char* dup_path = strdup(path);
+	if(!dup_path) {
+		return NULL;
+	}
+
+	char* new_path = vfs_normalize_path(target, dirname(dup_path));
+	kfree(dup_path);
+	if(!new_path) {
+		return NULL;
+	}
+
+	// FIXME Should go through the VFS to make symlinks across mount points possible
+	size_t plen = strlen(mp->path);
+	if(strcmp(mp->path, "/") && (strncmp(new_path, mp->path, plen) ||
+		(new_path[plen] && new_path[plen] != '/'))) {
+
+		kfree(new_path);
+		return NULL;
+	}
+	return new_path;
+}
+
+static inline const char* mount_relative(struct vfs_mountpoint* mp, const char* path) {
+	if(!strcmp(mp->path, "/")) {
+		return path;
+	}
+
+	path += strlen(mp->path);
+	return *path ? path : "/";
+}
+
+static vfs_file_t* open_locked(struct tmpfs* fs, struct vfs_callback_ctx* ctx, uint32_t flags) {
+	char name[VFS_NAME_MAX + 1];
+	struct tmpfs_inode* dir;
+	struct tmpfs_dirent* dirent = lookup(fs, ctx->path, &dir, name);
+
+	char* link_path = NULL;
+	for(int depth = 0; dirent && vfs_mode_to_filetype(dirent->inode->mode) == FT_IFLNK; depth++) {
+		if(depth == MAX_SYMLINK_DEPTH) {
+			kfree(link_path);
+			sc_errno = ELOOP;
+			return NULL;
+		}
+
+		char* new_path = follow_symlink(ctx->mp, link_path ? link_path : ctx->orig_path,
+			dirent->inode->target);
+
+		kfree(link_path);
+		link_path = new_path;
+		if(!link_path) {
+			sc_errno = ENOENT;
+			return NULL;
+		}
+
+		dirent = lookup(fs, mount_relative(ctx->mp, link_path), &dir, name);
+	}
+	kfree(link_path);
+
+	struct tmpfs_inode* inode;
+	if(!dirent) {
+		if(!dir || !(flags & O_CREAT)) {
+			return NULL;
+		}
+
+		if(check_perm(PERM_WRITE, dir, ctx->task) < 0) {
+			return NULL;
+		}
+
+		inode = new_inode(fs, ctx->task, FT_IFREG | S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+		if(!inode) {
+			return NULL;
+		}
+
+		if(!add_dirent(dir, name, inode)) {
+			kfree(inode);
+			return NULL;
+		}
+		inode->nlink = 1;
+	} else {
+		inode = dirent->inode;
+		if((flags & O_CREAT) && (flags & O_EXCL)) {
+			sc_errno = EEXIST;
+			return NULL;
+		}
+
+		bool writing = (flags & O_WRONLY) || (flags & O_RDWR);
+		if(writing && is_dir(inode)) {
+			sc_errno = EISDIR;
+			return NULL;
+		}
+
+		if(writing && check_perm(PERM_WRITE, inode, ctx->task) < 0) {
+			return NULL;
+		}
+
+		if(!(flags & O_WRONLY) && check_perm(PERM_READ, inode, ctx->task) < 0) {
+			return NULL;
+		}
+
+		if(writing && (flags & O_TRUNC) && inode->size) {
+			truncate_data(fs, inode, 0);
+			inode->mtime = inode->ctime = time_get();
+		}
+	}
+
+	vfs_file_t* fp = vfs_alloc_fileno(ctx->task, 3);
+	if(!fp) {
+		return NULL;
+	}
+
+	fp->type = vfs_mode_to_filetype(inode->mode);
+	fp->inode = inode->num;
+	fp->meta = (uint32_t)inode;
+	fp->mount_instance = fs;
+	memcpy(&fp->callbacks, &callbacks, sizeof(struct vfs_callbacks));
+	__sync_add_and_fetch(&inode->refs, 1);
+	return fp;
+}
+
+static vfs_file_t* tmpfs_open(struct vfs_callback_ctx* ctx, uint32_t flags) {
+	struct tmpfs* fs = ctx->mp->instance;
+	spinlock_get(&fs->lock, -1);
+	vfs_file_t* fp = open_locked(fs, ctx, flags);
+	spinlock_release(&fs->lock);
+	return fp;
+}
+
+static int tmpfs_close(struct vfs_callback_ctx* ctx) {
+	struct tmpfs* fs = ctx->fp->mount_instance;
+	struct tmpfs_inode* inode = (struct tmpfs_inode*)ctx->fp->meta;
+
+	/* This also gets called by the scheduler for exiting tasks, so can't take
+	 * the lock. Only one of close and unlink sees the counter drop to zero.
+	 */
+	put_inode(fs, inode);
+	return 0;
+}
+
+static int tmpfs_fork(struct vfs_callback_ctx* ctx) {
+	struct tmpfs_inode* inode = (struct tmpfs_inode*)ctx->fp->meta;
+	__sync_add_and_fetch(&inode->refs, 1);
+	return 0;
+}
+
+static size_t tmpfs_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
+	struct tmpfs* fs = ctx->fp->mount_instance;
+	struct tmpfs_inode* inode = (struct tmpfs_inode*)ctx->fp->meta;
+	if(is_dir(inode)) {
+		sc_errno = EISDIR;
+		return -1;
+	}
+
+	spinlock_get(&fs->lock, -1);
+	if(ctx->offset >= inode->size) {
+		spinlock_release(&fs->lock);
+		return 0;
+	}
+
+	size = MIN(size, inode->size - ctx->offset);
+	for(size_t done = 0; done < size;) {
+		uint32_t pos = ctx->offset + done;
+		uint32_t off = pos % PAGE_SIZE;
+		size_t len = MIN(PAGE_SIZE - off, size - done);
+
+		void* page = inode->pages[pos / PAGE_SIZE].addr;
+		if(page) {
+			memcpy(dest + done, page + off, len);
+		} else {
+			bzero(dest + done, len);
+		}
+		done += len;
+	}
+
+	spinlock_release(&fs->lock);
+	return size;
+}
+
+static int grow_pages(struct tmpfs_inode* inode, uint32_t npages) {
+	if(npages <= inode->npages) {
+		return 0;
+	}
+
+	// Grow in larger steps to avoid reallocating on every appended page
+	uint32_t new_npages = MAX(npages, inode->npages * 2);
+	vm_alloc_t* pages = krealloc(inode->pages, new_npages * sizeof(vm_alloc_t));
+	if(!pages) {
+		return -1;
+	}
+
+	bzero(pages + inode->npages, (new_npages - inode->npages) * sizeof(vm_alloc_t));
+	inode->pages = pages;
+	inode->npages = new_npages;
+	return 0;
+}
+
+static void* alloc_page(struct tmpfs* fs, vm_alloc_t* page) {
+	if(__sync_add_and_fetch(&fs->used_pages, 1) > fs->max_pages) {
+		__sync_sub_and_fetch(&fs->used_pages, 1);
+		return NULL;
+	}
+
+	if(!vm_alloc(VM_KERNEL, page, 1, NULL, VM_RW | VM_FREE | VM_ZERO)) {
+		__sync_sub_and_fetch(&fs->used_pages, 1);
+		bzero(page, sizeof(vm_alloc_t));
+		return NULL;
+	}
+
+	__sync_add_and_fetch(&total_pages, 1);
+	return page->addr;
+}
+
+static size_t tmpfs_write(struct vfs_callback_ctx* ctx, void* source, size_t size) {
+	struct tmpfs* fs = ctx->fp->mount_instance;
+	struct tmpfs_inode* inode = (struct tmpfs_inode*)ctx->fp->meta;
+
+	if(ctx->offset + size > UINT32_MAX) {
+		sc_errno = EFBIG;
+		return -1;
+	}
+
+	spinlock_get(&fs->lock, -1);
+	if(grow_pages(inode, RDIV(ctx->offset + size, PAGE_SIZE)) < 0) {
+		spinlock_release(&fs->lock);
+		sc_errno = ENOSPC;
+		return -1;
+	}
+
+	size_t done = 0;
+	while(done < size) {
+		uint32_t pos = ctx->offset + done;
+		uint32_t off = pos % PAGE_SIZE;
+		size_t len = MIN(PAGE_SIZE - off, size - done);
+
+		vm_alloc_t* page = &inode->pages[pos / PAGE_SIZE];
+		if(!page->addr && !alloc_page(fs, page)) {
+			break;
+		}
+
+		memcpy(page->addr + off, source + done, len);
+		done += len;
+	}
+
+	if(done) {
+		inode->size = MAX(inode->size, ctx->offset + done);
+		inode->mtime = inode->ctime = time_get();
+	}
+
+	spinlock_release(&fs->lock);
+	if(!done) {
+		sc_errno = ENOSPC;
+		return -1;
+	}
+	return done;
+}
+
+static inline uint8_t dirent_type(struct tmpfs_inode* inode) {
+	switch(vfs_mode_to_filetype(inode->mode)) {
+		case FT_IFDIR: return DT_DIR;
+		case FT_IFLNK: return DT_LNK;
+		default: return DT_REG;
+	}
+}
+
+static size_t put_dirent(void* buf, size_t size, size_t offset, struct tmpfs_inode* inode,
+	const char* name) {
+
+	size_t name_len = strlen(name);
+	size_t rec_len = ALIGN(sizeof(vfs_dirent_t) + name_len + 1, 4);
+	if(offset + rec_len > size) {
+		return 0;
+	}
+
+	vfs_dirent_t* dest = (vfs_dirent_t*)(buf + offset);
+	dest->d_ino = inode->num;
+	dest->d_reclen = rec_len;
+	dest->d_type = dirent_type(inode);
+	dest->d_off = offset + rec_len;
+	memcpy(dest->d_name, name, name_len + 1);
+	return rec_len;
+}
+
+// Returns the nth child in name order, using the subtree sizes kept by kavl
+static struct tmpfs_dirent* nth_child(struct tmpfs_dirent* p, uint32_t n) {
+	while(p) {
+		uint32_t left = kavl_size_child(head, p, 0);
+		if(n < left) {
+			p = p->head.p[0];
+		} else if(n == left) {
+			return p;
+		} else {
+			n -= left + 1;
+			p = p->head.p[1];
+		}
+	}
+	return NULL;
+}
+
+/* The file offset counts entries returned so far, with the first two being
+ * "." and "..".
+ */
+static size_t tmpfs_getdents(struct vfs_callback_ctx* ctx, void* buf, size_t size) {
+	struct tmpfs* fs = ctx->fp->mount_instance;
+	struct tmpfs_inode* inode = (struct tmpfs_inode*)ctx->fp->meta;
+	if(!is_dir(inode)) {
+		sc_errno = ENOTDIR;
+		return -1;
+	}
+
+	if(check_perm(PERM_READ, inode, ctx->task) < 0) {
+		return -1;
+	}
+
+	spinlock_get(&fs->lock, -1);
+	size_t offset = 0;
+	bool full = false;
+	while(1) {
+		size_t len;
+		uint64_t n = ctx->fp->offset;
+		if(n == 0) {
+			len = put_dirent(buf, size, offset, inode, ".");
+		} else if(n == 1) {
+			len = put_dirent(buf, size, offset, inode->parent ? inode->parent : inode, "..");
+		} else {
+			struct tmpfs_dirent* dirent = nth_child(inode->children, n - 2);
+			if(!dirent) {
+				break;
+			}
+			len = put_dirent(buf, size, offset, dirent->inode, dirent->name);
+		}
+
+		if(!len) {
+			full = true;
+			break;
+		}
+
+		offset += len;
+		ctx->fp->offset++;
+	}
+
+	spinlock_release(&fs->lock);
+
+	// Buffer too small for even a single entry
+	if(!offset && full) {
+		sc_errno = EINVAL;
+		return -1;
+	}
+	return offset;
+}
+
+static void fill_stat(struct tmpfs* fs, struct tmpfs_inode* inode, vfs_stat_t* dest) {
+	uint32_t pages = 0;
+	for(uint32_t i = 0; i < inode->npages; i++) {
+		if(inode->pages[i].addr) {
+			pages++;
+		}
+	}
+
+	dest->st_dev = fs->dev;
+	dest->st_ino = inode->num;
+	dest->st_mode = inode->mode;
+	dest->st_nlink = inode->nlink;
+	dest->st_uid = inode->uid;
+	dest->st_gid = inode->gid;
+	dest->st_rdev = 0;
+	dest->st_size = inode->size;
+	dest->st_atime = inode->atime;
+	dest->st_mtime = inode->mtime;
+	dest->st_ctime = inode->ctime;
+	dest->st_blksize = PAGE_SIZE;
+	dest->st_blocks = pages * (PAGE_SIZE / 512);
+}
+
+static int tmpfs_stat(struct vfs_callback_ctx* ctx, vfs_stat_t* dest) {
+	struct tmpfs* fs = ctx->mp->instance;
+	spinlock_get(&fs->lock, -1);
+
+	// Open files might have been unlinked already, so don't go by the path
+	if(ctx->fp) {
+		fill_stat(fs, (struct tmpfs_inode*)ctx->fp->meta, dest);
+		spinlock_release(&fs->lock);
+		return 0;
+	}
+
+	char name[VFS_NAME_MAX + 1];
+	struct tmpfs_inode* dir;
+	struct tmpfs_dirent* dirent = lookup(fs, ctx->path, &dir, name);
+	if(dirent) {
+		fill_stat(fs, dirent->inode, dest);
+	}
+
+	spinlock_release(&fs->lock);
+	return dirent ? 0 : -1;
+}
+
+static int access_locked(struct tmpfs* fs, struct vfs_callback_ctx* ctx, uint32_t amode) {
+	char name[VFS_NAME_MAX + 1];
+	struct tmpfs_inode* dir;
+	struct tmpfs_dirent* dirent = lookup(fs, ctx->path, &dir, name);
+	if(!dirent) {
+		return -1;
+	}
+
+	if(((amode & R_OK) && check_perm(PERM_READ, dirent->inode, ctx->task) < 0) ||
+		((amode & W_OK) && check_perm(PERM_WRITE, dirent->inode, ctx->task) < 0) ||
+		((amode & X_OK) && check_perm(PERM_EXEC, dirent->inode, ctx->task) < 0)) {
+		return -1;
+	}
+	return 0;
+}
+
+static int mkdir_locked(struct tmpfs* fs, struct vfs_callback_ctx* ctx, uint32_t mode) {
+	char name[VFS_NAME_MAX + 1];
+	struct tmpfs_inode* dir;
+	struct tmpfs_dirent* dirent = lookup(fs, ctx->path, &dir, name);
+	if(dirent) {
+		sc_errno = EEXIST;
+		return -1;
+	}
+
+	if(!dir || check_perm(PERM_WRITE, dir, ctx->task) < 0) {
+		return -1;
+	}
+
+	struct tmpfs_inode* inode = new_inode(fs, ctx->task, FT_IFDIR | (mode & 0xfff));
+	if(!inode) {
+		return -1;
+	}
+
+	if(!add_dirent(dir, name, inode)) {
+		kfree(inode);
+		return -1;
+	}
+
+	// One link for the entry in the parent and one for "."
+	inode->nlink = 2;
+	dir->nlink++;
+	return 0;
+}
+
+static int symlink_locked(struct tmpfs* fs, struct vfs_callback_ctx* ctx, const char* target) {
+	char name[VFS_NAME_MAX + 1];
+	struct tmpfs_inode* dir;
+	struct tmpfs_dirent* dirent = lookup(fs, ctx->path, &dir, name);
+	if(dirent) {
+		sc_errno = EEXIST;
+		return -1;
+	}
+
+	if(!dir || check_perm(PERM_WRITE, dir, ctx->task) < 0) {
+		return -1;
+	}
+
+	struct tmpfs_inode* inode = new_inode(fs, ctx->task, FT_IFLNK | 0777);
+	if(!inode) {
+		return -1;
+	}
+
+	inode->target = strdup(target);
+	inode->size = strlen(target);
+	if(!inode->target || !add_dirent(dir, name, inode)) {
+		free_inode(fs, inode);
+		sc_errno = ENOMEM;
+		return -1;
+	}
+
+	inode->nlink = 1;
+	return 0;
+}
+
+static int unlink_locked(struct tmpfs* fs, struct vfs_callback_ctx* ctx, bool rmdir) {
+	char name[VFS_NAME_MAX + 1];
+	struct tmpfs_inode* dir;
+	struct tmpfs_dirent* dirent = lookup(fs, ctx->path, &dir, name);
+	if(!dirent) {
+		return -1;
+	}
+
+	struct tmpfs_inode* inode = dirent->inode;
+	if(dirent == &fs->root) {
+		sc_errno = EBUSY;
+		return -1;
+	}
+
+	if(rmdir && !is_dir(inode)) {
+		sc_errno = ENOTDIR;
+		return -1;
+	}
+
+	if(!rmdir && is_dir(inode)) {
+		sc_errno = EISDIR;
+		return -1;
+	}
+
+	if(rmdir && inode->children) {
+		sc_errno = ENOTEMPTY;
+		return -1;
+	}
+
+	if(check_delete(dir, inode, ctx->task) < 0) {
+		return -1;
+	}
+
+	remove_dirent(dir, dirent);
+	if(rmdir) {
+		inode->nlink = 0;
+		dir->nlink--;
+	} else {
+		inode->nlink--;
+		inode->ctime = time_get();
+	}
+
+	if(!inode->nlink) {
+		put_inode(fs, inode);
+	}
+	return 0;
+}
+
+static int link_locked(struct tmpfs* fs, struct vfs_callback_ctx* ctx, const char* new_path) {
+	char name[VFS_NAME_MAX + 1];
+	struct tmpfs_inode* dir;
+	struct tmpfs_dirent* dirent = lookup(fs, ctx->path, &dir, name);
+	if(!dirent) {
+		return -1;
+	}
+
+	struct tmpfs_inode* inode = dirent->inode;
+	if(is_dir(inode)) {
+		sc_errno = EPERM;
+		return -1;
+	}
+
+	if(lookup(fs, new_path, &dir, name)) {
+		sc_errno = EEXIST;
+		return -1;
+	}
+
+	if(!dir || check_perm(PERM_WRITE, dir, ctx->task) < 0) {
+		return -1;
+	}
+
+	if(!add_dirent(dir, name, inode)) {
+		return -1;
+	}
+
+	inode->nlink++;
+	inode->ctime = time_get();
+	return 0;
+}
+
+static int rename_locked(struct tmpfs* fs, struct vfs_callback_ctx* ctx, const char* new_path) {
+	char name[VFS_NAME_MAX + 1];
+	struct tmpfs_inode* old_dir;
+	struct tmpfs_dirent* old = lookup(fs, ctx->path, &old_dir, name);
+	if(!old) {
+		return -1;
+	}
+
+	struct tmpfs_inode* inode = old->inode;
+	if(old == &fs->root) {
+		sc_errno = EBUSY;
+		return -1;
+	}
+
+	struct tmpfs_inode* new_dir;
+	struct tmpfs_dirent* new = lookup(fs, new_path, &new_dir, name);
+	if(!new_dir) {
+		return -1;
+	}
+
+	// Both names are links to the same file
+	if(new && new->inode == inode) {
+		return 0;
+	}
+
+	if(check_delete(old_dir, inode, ctx->task) < 0 ||
+		check_perm(PERM_WRITE, new_dir, ctx->task) < 0) {
+		return -1;
+	}
+
+	// Directories can't be moved into themselves
+	if(is_dir(inode)) {
+		for(struct tmpfs_inode* p = new_dir; p; p = p->parent) {
+			if(p == inode) {
+				sc_errno = EINVAL;
+				return -1;
+			}
+		}
+	}
+
+	if(new) {
+		struct tmpfs_inode* replaced = new->inode;
+		if(new == &fs->root) {
+			sc_errno = EBUSY;
+			return -1;
+		}
+
+		if(is_dir(inode) && !is_dir(replaced)) {
+			sc_errno = ENOTDIR;
+			return -1;
+		}
+
+		if(!is_dir(inode) && is_dir(replaced)) {
+			sc_errno = EISDIR;
+			return -1;
+		}
+
+		if(replaced->children) {
+			sc_errno = ENOTEMPTY;
+			return -1;
+		}
+
+		if(check_delete(new_dir, replaced, ctx->task) < 0) {
+			return -1;
+		}
+
+		remove_dirent(new_dir, new);
+		if(is_dir(replaced)) {
+			replaced->nlink = 0;
+			new_dir->nlink--;
+		} else {
+			replaced->nlink--;
+		}
+
+		if(!replaced->nlink) {
+			put_inode(fs, replaced);
+		}
+	}
+
+	if(!add_dirent(new_dir, name, inode)) {
+		return -1;
+	}
+
+	remove_dirent(old_dir, old);
+	if(is_dir(inode)) {
+		old_dir->nlink--;
+		new_dir->nlink++;
+	}
+
+	inode->ctime = time_get();
+	return 0;
+}
+
+static int chmod_locked(struct tmpfs* fs, struct vfs_callback_ctx* ctx, uint32_t mode) {
+	char name[VFS_NAME_MAX + 1];
+	struct tmpfs_inode* dir;
+	struct tmpfs_dirent* dirent = lookup(fs, ctx->path, &dir, name);
+	if(!dirent || check_owner(dirent->inode, ctx->task) < 0) {
+		return -1;
+	}
+
+	struct tmpfs_inode* inode = dirent->inode;
+	inode->mode = vfs_mode_to_filetype(inode->mode) | (mode & 0xfff);
+	inode->ctime = time_get();
+	return 0;
+}
+
+static int chown_locked(struct tmpfs* fs, struct vfs_callback_ctx* ctx, uint16_t uid, uint16_t gid) {
+	char name[VFS_NAME_MAX + 1];
+	struct tmpfs_inode* dir;
+	struct tmpfs_dirent* dirent = lookup(fs, ctx->path, &dir, name);
+	if(!dirent || check_owner(dirent->inode, ctx->task) < 0) {
+		return -1;
+	}
+
+	struct tmpfs_inode* inode = dirent->inode;
+	if(uid != (uint16_t)-1) {
+		inode->uid = uid;
+	}
+	if(gid != (uint16_t)-1) {
+		inode->gid = gid;
+	}
+	inode->ctime = time_get();
+	return 0;
+}
+
+static int utimes_locked(struct tmpfs* fs, struct vfs_callback_ctx* ctx, struct timeval times[2]) {
+	char name[VFS_NAME_MAX + 1];
+	struct tmpfs_inode* dir;
+	struct tmpfs_dirent* dirent = lookup(fs, ctx->path, &dir, name);
+	if(!dirent || check_perm(PERM_WRITE, dirent->inode, ctx->task) < 0) {
+		return -1;
+	}
+
+	struct tmpfs_inode* inode = dirent->inode;
+	if(times) {
+		inode->atime = times[0].tv_sec;
+		inode->mtime = times[1].tv_sec;
+	} else {
+		inode->atime = inode->mtime = time_get();
+	}
+	return 0;
+}
+
+static int readlink_locked(struct tmpfs* fs, struct vfs_callback_ctx* ctx, char* buf, size_t size) {
+	char name[VFS_NAME_MAX + 1];
+	struct tmpfs_inode* dir;
+	struct tmpfs_dirent* dirent = lookup(fs, ctx->path, &dir, name);
+	if(!dirent) {
+		return -1;
+	}
+
+	if(vfs_mode_to_filetype(dirent->inode->mode) != FT_IFLNK) {
+		sc_errno = EINVAL;
+		return -1;
+	}
+
+	return strlcpy(buf, dirent->inode->target, size);
+}
+
+// Wrappers that run the path-based calls above with the file system locked
+#define LOCKED(call) \
+	struct tmpfs* fs = ctx->mp->instance; \
+	spinlock_get(&fs->lock, -1); \
+	int r = call; \
+	spinlock_release(&fs->lock); \
+	return r;
+
+static int tmpfs_access(struct vfs_callback_ctx* ctx, uint32_t amode) {
+	LOCKED(access_locked(fs, ctx, amode));
+}
+
+static int tmpfs_mkdir(struct vfs_callback_ctx* ctx, uint32_t mode) {
+	LOCKED(mkdir_locked(fs, ctx, mode));
+}
+
+static int tmpfs_symlink(struct vfs_callback_ctx* ctx, const char* target) {
+	LOCKED(symlink_locked(fs, ctx, target));
+}
+
+static int tmpfs_unlink(struct vfs_callback_ctx* ctx) {
+	LOCKED(unlink_locked(fs, ctx, false));
+}
+
+static int tmpfs_rmdir(struct vfs_callback_ctx* ctx) {
+	LOCKED(unlink_locked(fs, ctx, true));
+}
+
+static int tmpfs_link(struct vfs_callback_ctx* ctx, const char* new_path) {
+	LOCKED(link_locked(fs, ctx, new_path));
+}
+
+static int tmpfs_rename(struct vfs_callback_ctx* ctx, const char* new_path) {
+	LOCKED(rename_locked(fs, ctx, new_path));
+}
+
+static int tmpfs_chmod(struct vfs_callback_ctx* ctx, uint32_t mode) {
+	LOCKED(chmod_locked(fs, ctx, mode));
+}
+
+static int tmpfs_chown(struct vfs_callback_ctx* ctx, uint16_t uid, uint16_t gid) {
+	LOCKED(chown_locked(fs, ctx, uid, gid));
+}
+
+static int tmpfs_utimes(struct vfs_callback_ctx* ctx, struct timeval times[2]) {
+	LOCKED(utimes_locked(fs, ctx, times));
+}
+
+static int tmpfs_readlink(struct vfs_callback_ctx* ctx, char* buf, size_t size) {
+	LOCKED(readlink_locked(fs, ctx, buf, size));
+}
+
+static int tmpfs_build_path_tree(struct vfs_callback_ctx* ctx) {
+	LOCKED(access_locked(fs, ctx, F_OK));
+}
+
+static struct vfs_callbacks callbacks = {
+	.open = tmpfs_open,
+	.close = tmpfs_close,
+	.fork = tmpfs_fork,
+	.stat = tmpfs_stat,
+	.read = tmpfs_read,
+	.write = tmpfs_write,
+	.getdents = tmpfs_getdents,
+	.access = tmpfs_access,
+	.mkdir = tmpfs_mkdir,
+	.symlink = tmpfs_symlink,
+	.unlink = tmpfs_unlink,
+	.rmdir = tmpfs_rmdir,
+	.link = tmpfs_link,
+	.rename = tmpfs_rename,
+	.chmod = tmpfs_chmod,
+	.chown = tmpfs_chown,
+	.utimes = tmpfs_utimes,
+	.readlink = tmpfs_readlink,
+	.build_path_tree = tmpfs_build_path_tree,
+};
+
+size_t tmpfs_mem_used(void) {
+	return total_pages * PAGE_SIZE;
+}
+
+int tmpfs_mount(const char* path) {
+	struct tmpfs* fs = zmalloc(sizeof(struct tmpfs));
+	if(!fs) {
+		sc_errno = ENOMEM;
+		return -1;
+	}
+
+	fs->next_num = 1;
+	fs->dev = next_dev++;
+	fs->max_pages = CONFIG_TMPFS_MAX_SIZE * 1024 * 1024 / PAGE_SIZE;
+
+	// World-writable with the sticky bit set, as is customary for /tmp
+	fs->root.name = "";
+	fs->root.inode = new_inode(fs, NULL, FT_IFDIR | S_ISVTX | 0777);
+	if(!fs->root.inode) {
+		kfree(fs);
+		return -1;
+	}
+	fs->root.inode->nlink = 2;
+
+	log(LOG_INFO, "tmpfs: Mounting to %s, maximum size %d MiB\n", path, CONFIG_TMPFS_MAX_SIZE);
+	return vfs_mount_register(NULL, path, fs, "tmpfs", &callbacks);
+}
+
+#endif /* CONFIG_ENABLE_TMPFS */
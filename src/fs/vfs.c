@@ -35,7 +35,14 @@
 #include <block/part.h>
 #include <fs/ext2.h>
 #include <fs/ftree.h>
+#include <fs/poll.h>
 #include <net/socket.h>
+#include <tasks/scheduler.h>
+#include <bsp/timer.h>
+
+#define VFS_IOV_MAX 1024
+#define VFS_IOV_STACK 8
+#define VFS_SPLICE_CHUNK 0x10000
 
 vfs_file_t kernel_files[CONFIG_VFS_MAX_OPENFILES];
 
@@ -114,16 +121,27 @@ char* vfs_normalize_path(const char* orig_path, char* cwd) {
 }
 
 vfs_file_t* vfs_get_from_id(int fd, task_t* task) {
-	if(fd < 0 || fd >= ARRAY_SIZE(task->files)) {
+	if(unlikely(fd < 0 || fd >= CONFIG_VFS_MAX_OPENFILES)) {
 		return NULL;
 	}
 
-	vfs_file_t* fp = task ? &task->files[fd] : &kernel_files[fd];
-	if(!fp->refs) {
+	vfs_file_t* files = task ? task->files : kernel_files;
+	vfs_file_t* fp = &files[fd];
+	if(unlikely(!fp->refs)) {
 		return NULL;
 	}
 
-	return fp->dup_target ? vfs_get_from_id(fp->dup_target, task) : fp;
+	/* vfs_fcntl and vfs_dup2 always point dup_target at the file the source
+	 * fd resolves to, so there is never more than one hop to follow.
+	 */
+	if(fp->dup_target) {
+		fp = &files[fp->dup_target];
+		if(unlikely(!fp->refs)) {
+			return NULL;
+		}
+	}
+
+	return fp;
 }
 
 void vfs_free_context(struct vfs_callback_ctx* ctx) {
@@ -135,13 +153,14 @@ void vfs_free_context(struct vfs_callback_ctx* ctx) {
 	kfree(ctx);
 }
 
-struct vfs_callback_ctx* vfs_context_from_fd(int fd, task_t* task) {
-	struct vfs_callback_ctx* ctx = zmalloc(sizeof(struct vfs_callback_ctx));
-
+/* Fills in a caller-provided context for an open file. Used by the fd-based
+ * calls below with a context on the stack so they don't need to allocate.
+ * Contexts set up this way never own their paths and don't need to be freed.
+ */
+int vfs_context_init_fd(struct vfs_callback_ctx* ctx, int fd, task_t* task) {
 	ctx->fp = vfs_get_from_id(fd, task);
 	if(!ctx->fp) {
-		kfree(ctx);
-		return NULL;
+		return -1;
 	}
 
 	ctx->free_paths = false;
@@ -149,6 +168,18 @@ struct vfs_callback_ctx* vfs_context_from_fd(int fd, task_t* task) {
 	ctx->orig_path = ctx->fp->path;
 	ctx->mp = ctx->fp->mp;
 	ctx->task = task;
+	ctx->offset = ctx->fp->offset;
+	ctx->poll_entry = NULL;
+	return 0;
+}
+
+struct vfs_callback_ctx* vfs_context_from_fd(int fd, task_t* task) {
+	struct vfs_callback_ctx* ctx = zmalloc(sizeof(struct vfs_callback_ctx));
+	if(vfs_context_init_fd(ctx, fd, task) < 0) {
+		kfree(ctx);
+		return NULL;
+	}
+
 	return ctx;
 }
 
@@ -183,6 +214,7 @@ vfs_file_t* vfs_alloc_fileno(task_t* task, int min) {
 		if(!file->refs) {
 			if(likely(__sync_bool_compare_and_swap(&file->refs, 0, 1))) {
 				file->num = i;
+				file->sync_error = 0;
 				return file;
 			}
 		}
@@ -241,30 +273,52 @@ size_t vfs_read(task_t* task, int fd, void* dest, size_t size) {
 		return -1;
 	}
 
-	struct vfs_callback_ctx* ctx = vfs_context_from_fd(fd, task);
-	if(!ctx || !ctx->fp || ctx->fp->flags & O_WRONLY) {
+	struct vfs_callback_ctx ctx;
+	if(vfs_context_init_fd(&ctx, fd, task) < 0 || ctx.fp->flags & O_WRONLY) {
 		sc_errno = EBADF;
 		return -1;
 	}
 
-	if(!ctx->fp->callbacks.read) {
-		vfs_free_context(ctx);
+	if(!ctx.fp->callbacks.read) {
 		sc_errno = ENOSYS;
 		return -1;
 	}
 
 	if(!size) {
-		vfs_free_context(ctx);
 		return 0;
 	}
 
 	int_enable();
-	size_t read = ctx->fp->callbacks.read(ctx, dest, size);
-	ctx->fp->offset += read;
-	vfs_free_context(ctx);
+	size_t read = ctx.fp->callbacks.read(&ctx, dest, size);
+	if(read != -1) {
+		ctx.fp->offset += read;
+	}
 	return read;
 }
 
+/* Make written data durable right away for files opened with O_SYNC. The
+ * data has already been written and the offset advanced at this point, so a
+ * failed flush can't fail this write without the caller writing it twice.
+ * Instead, it is reported by the next write or fsync on the file.
+ */
+static inline size_t sync_written(struct vfs_callback_ctx* ctx, size_t written) {
+	if(written != -1 && written && ctx->fp->flags & O_SYNC && ctx->fp->callbacks.fsync
+		&& ctx->fp->callbacks.fsync(ctx, true) < 0) {
+		ctx->fp->sync_error = sc_errno;
+	}
+	return written;
+}
+
+// Report and clear the error of an earlier failed O_SYNC flush
+static inline int sync_error(struct vfs_callback_ctx* ctx) {
+	if(ctx->fp->sync_error) {
+		sc_errno = ctx->fp->sync_error;
+		ctx->fp->sync_error = 0;
+		return -1;
+	}
+	return 0;
+}
+
 size_t vfs_write(task_t* task, int fd, void* source, size_t size) {
 	// Not checked by syscall code as we want to allow NULL dest if size is 0
 	if(!source && size) {
@@ -272,47 +326,426 @@ size_t vfs_write(task_t* task, int fd, void* source, size_t size) {
 		return -1;
 	}
 
-	struct vfs_callback_ctx* ctx = vfs_context_from_fd(fd, task);
-	if(!ctx || !ctx->fp || ctx->fp->flags & O_RDONLY) {
+	struct vfs_callback_ctx ctx;
+	if(vfs_context_init_fd(&ctx, fd, task) < 0 || ctx.fp->flags & O_RDONLY) {
 		sc_errno = EBADF;
 		return -1;
 	}
 
-	if(!ctx->fp->callbacks.write) {
-		vfs_free_context(ctx);
+	if(!ctx.fp->callbacks.write) {
 		sc_errno = ENOSYS;
 		return -1;
 	}
 
+	if(sync_error(&ctx) < 0) {
+		return -1;
+	}
+
 	if(!size) {
-		vfs_free_context(ctx);
 		return 0;
 	}
 
-	size_t written = ctx->fp->callbacks.write(ctx, source, size);
-	ctx->fp->offset += written;
-	vfs_free_context(ctx);
-	return written;
+	size_t written = ctx.fp->callbacks.write(&ctx, source, size);
+	if(written != -1) {
+		ctx.fp->offset += written;
+	}
+	return sync_written(&ctx, written);
 }
 
-size_t vfs_getdents(task_t* task, int fd, void* dest, size_t size) {
-	struct vfs_callback_ctx* ctx = vfs_context_from_fd(fd, task);
-	if(!ctx || !ctx->fp) {
+/* Maps the buffers of a user scatter list into kernel memory. Kernel callers
+ * (task is NULL) already pass kernel addresses.
+ */
+static int map_iov(task_t* task, struct iovec* iov, int iovcnt,
+	struct iovec* kiov, vm_alloc_t* allocs) {
+
+	bzero(allocs, sizeof(vm_alloc_t) * iovcnt);
+	for(int i = 0; i < iovcnt; i++) {
+		kiov[i].iov_len = iov[i].iov_len;
+		if(!task || !iov[i].iov_len) {
+			kiov[i].iov_base = task ? NULL : iov[i].iov_base;
+			continue;
+		}
+
+		kiov[i].iov_base = vm_map(VM_KERNEL, &allocs[i], task->vmem,
+			iov[i].iov_base, iov[i].iov_len, VM_MAP_USER_ONLY | VM_RW);
+
+		if(!kiov[i].iov_base) {
+			for(int j = 0; j < i; j++) {
+				if(allocs[j].self) {
+					vm_free(&allocs[j]);
+				}
+			}
+
+			task_signal(task, NULL, SIGSEGV);
+			sc_errno = EFAULT;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Hands the whole scatter list to the file's readv/writev callback if it has
+ * one, otherwise calls read/write once per segment. Stops at the first short
+ * transfer, like the equivalent sequence of read/write calls would.
+ */
+static size_t do_rw_iov(struct vfs_callback_ctx* ctx, bool write,
+	struct iovec* iov, int iovcnt) {
+
+	if(write && ctx->fp->callbacks.writev) {
+		return ctx->fp->callbacks.writev(ctx, iov, iovcnt);
+	}
+	if(!write && ctx->fp->callbacks.readv) {
+		return ctx->fp->callbacks.readv(ctx, iov, iovcnt);
+	}
+
+	size_t total = 0;
+	for(int i = 0; i < iovcnt; i++) {
+		if(!iov[i].iov_len) {
+			continue;
+		}
+
+		size_t done = write ?
+			ctx->fp->callbacks.write(ctx, iov[i].iov_base, iov[i].iov_len) :
+			ctx->fp->callbacks.read(ctx, iov[i].iov_base, iov[i].iov_len);
+
+		if(done == -1) {
+			return total ? total : -1;
+		}
+
+		total += done;
+		ctx->offset += done;
+		if(done < iov[i].iov_len) {
+			break;
+		}
+	}
+	return total;
+}
+
+/* Common code for readv, writev, preadv and pwritev. Positional variants pass
+ * offset and leave the file offset untouched.
+ */
+static size_t rw_iov(task_t* task, int fd, bool write, struct iovec* iov,
+	int iovcnt, uint64_t* offset) {
+
+	if(iovcnt < 0 || iovcnt > VFS_IOV_MAX || (!iov && iovcnt)) {
+		sc_errno = EINVAL;
+		return -1;
+	}
+
+	struct vfs_callback_ctx ctx;
+	if(vfs_context_init_fd(&ctx, fd, task) < 0 ||
+		ctx.fp->flags & (write ? O_RDONLY : O_WRONLY)) {
 		sc_errno = EBADF;
 		return -1;
 	}
 
-	if(!ctx->fp->callbacks.getdents) {
-		vfs_free_context(ctx);
+	if(!(write ? ctx.fp->callbacks.write : ctx.fp->callbacks.read)) {
 		sc_errno = ENOSYS;
 		return -1;
 	}
 
-	size_t r = ctx->fp->callbacks.getdents(ctx, dest, size);
-	vfs_free_context(ctx);
+	if(write && sync_error(&ctx) < 0) {
+		return -1;
+	}
+
+	if(offset) {
+		if(ctx.fp->type == FT_IFSOCK || ctx.fp->type == FT_IFPIPE) {
+			sc_errno = ESPIPE;
+			return -1;
+		}
+		ctx.offset = *offset;
+	}
+
+	if(!iovcnt) {
+		return 0;
+	}
+
+	// Avoid allocating for the common case of a handful of segments
+	struct iovec stack_kiov[VFS_IOV_STACK];
+	vm_alloc_t stack_allocs[VFS_IOV_STACK];
+	struct iovec* kiov = stack_kiov;
+	vm_alloc_t* allocs = stack_allocs;
+	if(iovcnt > VFS_IOV_STACK) {
+		kiov = kmalloc(sizeof(struct iovec) * iovcnt);
+		allocs = kmalloc(sizeof(vm_alloc_t) * iovcnt);
+	}
+
+	size_t done = -1;
+	if(map_iov(task, iov, iovcnt, kiov, allocs) == 0) {
+		if(!write) {
+			int_enable();
+		}
+
+		done = do_rw_iov(&ctx, write, kiov, iovcnt);
+		if(done != -1 && !offset) {
+			ctx.fp->offset += done;
+		}
+
+		for(int i = 0; i < iovcnt; i++) {
+			if(allocs[i].self) {
+				vm_free(&allocs[i]);
+			}
+		}
+	}
+
+	if(iovcnt > VFS_IOV_STACK) {
+		kfree(kiov);
+		kfree(allocs);
+	}
+	return write ? sync_written(&ctx, done) : done;
+}
+
+size_t vfs_readv(task_t* task, int fd, struct iovec* iov, int iovcnt) {
+	return rw_iov(task, fd, false, iov, iovcnt, NULL);
+}
+
+size_t vfs_writev(task_t* task, int fd, struct iovec* iov, int iovcnt) {
+	return rw_iov(task, fd, true, iov, iovcnt, NULL);
+}
+
+/* The positional variants take their arguments in a struct since they don't
+ * fit into three syscall arguments. That means the scatter list itself has to
+ * be mapped here rather than by the syscall code.
+ */
+static size_t prw_iov(task_t* task, struct vfs_prw_data* data, bool write) {
+	if(data->iovcnt < 0 || data->iovcnt > VFS_IOV_MAX) {
+		sc_errno = EINVAL;
+		return -1;
+	}
+
+	if(!task || !data->iovcnt) {
+		return rw_iov(task, data->fd, write, data->iov, data->iovcnt, &data->offset);
+	}
+
+	vm_alloc_t alloc;
+	struct iovec* iov = vm_map(VM_KERNEL, &alloc, task->vmem, data->iov,
+		sizeof(struct iovec) * data->iovcnt, VM_MAP_USER_ONLY | VM_RW);
+
+	if(!iov) {
+		task_signal(task, NULL, SIGSEGV);
+		sc_errno = EFAULT;
+		return -1;
+	}
+
+	size_t r = rw_iov(task, data->fd, write, iov, data->iovcnt, &data->offset);
+	vm_free(&alloc);
+	return r;
+}
+
+size_t vfs_preadv(task_t* task, struct vfs_prw_data* data) {
+	return prw_iov(task, data, false);
+}
+
+size_t vfs_pwritev(task_t* task, struct vfs_prw_data* data) {
+	return prw_iov(task, data, true);
+}
+
+static int splice_ctx(struct vfs_callback_ctx* ctx, task_t* task, int fd,
+	bool write, bool use_offset, uint64_t offset) {
+
+	if(vfs_context_init_fd(ctx, fd, task) < 0 ||
+		ctx->fp->flags & (write ? O_RDONLY : O_WRONLY)) {
+		sc_errno = EBADF;
+		return -1;
+	}
+
+	if(!(write ? ctx->fp->callbacks.write : ctx->fp->callbacks.read)) {
+		sc_errno = EINVAL;
+		return -1;
+	}
+
+	if(write && sync_error(ctx) < 0) {
+		return -1;
+	}
+
+	if(use_offset) {
+		if(ctx->fp->type == FT_IFSOCK || ctx->fp->type == FT_IFPIPE) {
+			sc_errno = ESPIPE;
+			return -1;
+		}
+		ctx->offset = offset;
+	}
+	return 0;
+}
+
+/* Sleep until the output of a splice can take more data. Returns -1 if the
+ * sleep got interrupted by a signal.
+ */
+static int splice_wait(struct vfs_callback_ctx* out) {
+	if(!out->fp->callbacks.poll) {
+		scheduler_yield();
+		return 0;
+	}
+
+	struct poll_entry entry = {0};
+	struct poll_waiter waiter = {
+		.entries = &entry,
+		.nentries = 1,
+	};
+	entry.waiter = &waiter;
+	out->poll_entry = &entry;
+
+	int r = 0;
+	while(1) {
+		int_disable();
+		waiter.woken = false;
+		int events = out->fp->callbacks.poll(out, POLLOUT);
+
+		// Some poll callbacks enable interrupts
+		int_disable();
+
+		// Errors and hangups are left for the write to report
+		if(events) {
+			break;
+		}
+
+		// Objects without wait queue have to be checked again on each tick
+		bool notified = out->fp->waitq;
+		poll_sleep(out->task, &waiter, notified ? UINT32_MAX : timer_get_tick() + 1);
+		if(notified && !waiter.woken) {
+			r = -1;
+			break;
+		}
+	}
+
+	poll_unregister(&entry);
+	out->poll_entry = NULL;
+	int_enable();
 	return r;
 }
 
+// Whether a non-blocking output can take data right now
+static inline bool splice_writable(struct vfs_callback_ctx* out) {
+	if(!out->fp->callbacks.poll) {
+		return true;
+	}
+
+	int events = out->fp->callbacks.poll(out, POLLOUT);
+	int_enable();
+	return events != 0;
+}
+
+/* Moves up to len bytes from fd_in to fd_out without a round trip through
+ * user space. Backs both sendfile() and splice(). Data is read into a kernel
+ * buffer in VFS_SPLICE_CHUNK sized pieces and handed straight to the output's
+ * write callback. Like pread/pwrite, offsets passed in data are used and
+ * updated instead of the file offsets if the respective flag is set.
+ */
+size_t vfs_splice(task_t* task, struct vfs_splice_data* data) {
+	bool use_off_in = data->flags & VFS_SPLICE_OFF_IN;
+	bool use_off_out = data->flags & VFS_SPLICE_OFF_OUT;
+
+	struct vfs_callback_ctx in;
+	struct vfs_callback_ctx out;
+	if(splice_ctx(&in, task, data->fd_in, false, use_off_in, data->off_in) < 0 ||
+		splice_ctx(&out, task, data->fd_out, true, use_off_out, data->off_out) < 0) {
+		return -1;
+	}
+
+	if(!data->len) {
+		return 0;
+	}
+
+	bool seekable_in = in.fp->type != FT_IFSOCK && in.fp->type != FT_IFPIPE;
+	void* buf = kmalloc(MIN(data->len, VFS_SPLICE_CHUNK));
+	size_t total = 0;
+	bool failed = false;
+
+	bool nonblock_out = out.fp->flags & O_NONBLOCK;
+
+	int_enable();
+	while(total < data->len) {
+		/* Data taken from a pipe or socket can't be put back, so don't take
+		 * any unless a non-blocking output has room for it.
+		 */
+		if(!seekable_in && nonblock_out && !splice_writable(&out)) {
+			sc_errno = EAGAIN;
+			failed = true;
+			break;
+		}
+
+		size_t chunk = MIN(data->len - total, VFS_SPLICE_CHUNK);
+		size_t read = in.fp->callbacks.read(&in, buf, chunk);
+		if(read == -1 || !read) {
+			failed = read == -1;
+			break;
+		}
+		in.offset += read;
+
+		size_t written = 0;
+		while(written < read) {
+			size_t r = out.fp->callbacks.write(&out, buf + written, read - written);
+			if(r != -1 && r) {
+				written += r;
+				out.offset += r;
+				continue;
+			}
+
+			/* Hold on to data from a pipe or socket until a blocking output
+			 * has room for it. Non-blocking outputs return what was spliced
+			 * so far, as do signals, like for a short write.
+			 */
+			if(!seekable_in && r == -1 && sc_errno == EAGAIN && !nonblock_out) {
+				if(splice_wait(&out) < 0) {
+					sc_errno = EINTR;
+					failed = true;
+					break;
+				}
+				continue;
+			}
+
+			failed = r == -1;
+			break;
+		}
+
+		total += written;
+		if(written < read) {
+			// Leave unsent data to be read again next time
+			if(seekable_in) {
+				in.offset -= read - written;
+			}
+			break;
+		}
+
+		// Short read means EOF on files, or nothing more buffered in pipes
+		if(read < chunk) {
+			break;
+		}
+	}
+
+	kfree(buf);
+
+	if(use_off_in) {
+		data->off_in = in.offset;
+	} else {
+		in.fp->offset = in.offset;
+	}
+
+	if(use_off_out) {
+		data->off_out = out.offset;
+	} else {
+		out.fp->offset = out.offset;
+	}
+
+	// Only report an error if nothing could be transferred
+	return sync_written(&out, total ? total : (failed ? -1 : 0));
+}
+
+size_t vfs_getdents(task_t* task, int fd, void* dest, size_t size) {
+	struct vfs_callback_ctx ctx;
+	if(vfs_context_init_fd(&ctx, fd, task) < 0) {
+		sc_errno = EBADF;
+		return -1;
+	}
+
+	if(!ctx.fp->callbacks.getdents) {
+		sc_errno = ENOSYS;
+		return -1;
+	}
+
+	return ctx.fp->callbacks.getdents(&ctx, dest, size);
+}
+
 int vfs_seek(task_t* task, int fd, size_t offset, int origin) {
 	vfs_file_t* fp = vfs_get_from_id(fd, task);
 	if(!fp) {
@@ -382,7 +815,7 @@ int vfs_fcntl(task_t* task, int fd, int cmd, int arg3) {
 		return 0;
 	} else if(cmd == F_GETPATH) {
 		vm_alloc_t alloc;
-		void* dest = vm_map(VM_KERNEL, &alloc, &task->vmem, (void*)arg3,
+		void* dest = vm_map(VM_KERNEL, &alloc, task->vmem, (void*)arg3,
 			VFS_PATH_MAX, VM_MAP_USER_ONLY | VM_RW);
 
 		if(!dest) {
@@ -435,39 +868,61 @@ int vfs_dup2(task_t* task, int fd1, int fd2) {
 }
 
 int vfs_ioctl(task_t* task, int fd, int request, void* arg) {
-	struct vfs_callback_ctx* ctx = vfs_context_from_fd(fd, task);
-	if(!ctx || !ctx->fp) {
+	struct vfs_callback_ctx ctx;
+	if(vfs_context_init_fd(&ctx, fd, task) < 0) {
 		sc_errno = EBADF;
 		return -1;
 	}
 
-	if(!ctx->fp->callbacks.ioctl) {
-		vfs_free_context(ctx);
+	if(!ctx.fp->callbacks.ioctl) {
 		sc_errno = ENOSYS;
 		return -1;
 	}
 
-	int r = ctx->fp->callbacks.ioctl(ctx, request, arg);
-	vfs_free_context(ctx);
-	return r;
+	return ctx.fp->callbacks.ioctl(&ctx, request, arg);
+}
+
+/* Files without an fsync callback, such as pipes or tmpfs files, have nothing
+ * that could be made more durable, so this succeeds for them.
+ */
+int vfs_fsync(task_t* task, int fd, int datasync) {
+	struct vfs_callback_ctx ctx;
+	if(vfs_context_init_fd(&ctx, fd, task) < 0) {
+		sc_errno = EBADF;
+		return -1;
+	}
+
+	if(sync_error(&ctx) < 0) {
+		return -1;
+	}
+
+	if(!ctx.fp->callbacks.fsync) {
+		return 0;
+	}
+	return ctx.fp->callbacks.fsync(&ctx, datasync);
+}
+
+int vfs_sync(task_t* task) {
+	if(vfs_block_sync() < 0) {
+		sc_errno = EIO;
+		return -1;
+	}
+	return 0;
 }
 
 int vfs_fstat(task_t* task, int fd, vfs_stat_t* dest) {
-	struct vfs_callback_ctx* ctx = vfs_context_from_fd(fd, task);
-	if(!ctx) {
+	struct vfs_callback_ctx ctx;
+	if(vfs_context_init_fd(&ctx, fd, task) < 0) {
 		sc_errno = EBADF;
 		return -1;
 	}
 
-	if(!ctx->fp->callbacks.stat) {
-		vfs_free_context(ctx);
+	if(!ctx.fp->callbacks.stat) {
 		sc_errno = ENOSYS;
 		return -1;
 	}
 
-	int r = ctx->fp->callbacks.stat(ctx, dest);
-	vfs_free_context(ctx);
-	return r;
+	return ctx.fp->callbacks.stat(&ctx, dest);
 }
 
 int vfs_stat(task_t* task, char* orig_path, vfs_stat_t* dest) {
@@ -489,8 +944,14 @@ int vfs_stat(task_t* task, char* orig_path, vfs_stat_t* dest) {
 }
 
 int vfs_close(task_t* task, int fd) {
-	vfs_file_t* fp = vfs_get_from_id(fd, task);
-	if(!fp) {
+	if(fd < 0 || fd >= CONFIG_VFS_MAX_OPENFILES) {
+		sc_errno = EBADF;
+		return -1;
+	}
+
+	// Don't resolve dups here, closing a dup releases its own slot first
+	vfs_file_t* fp = task ? &task->files[fd] : &kernel_files[fd];
+	if(!fp->refs) {
 		sc_errno = EBADF;
 		return -1;
 	}
@@ -502,6 +963,23 @@ int vfs_close(task_t* task, int fd) {
 			vfs_close(task, fp->dup_target);
 		}
 
+		if(fp->waitq) {
+			// Drop epoll items for this file and let other waiters recheck
+			poll_forget(fp);
+			poll_wake(fp->waitq);
+		}
+
+		if(fp->callbacks.close) {
+			struct vfs_callback_ctx ctx = {
+				.fp = fp,
+				.task = task,
+				.mp = fp->mp,
+				.path = fp->mount_path,
+				.orig_path = fp->path,
+			};
+			fp->callbacks.close(&ctx);
+		}
+
 		#ifdef CONFIG_ENABLE_PICOTCP
 		if(fp->type == FT_IFSOCK) {
 			int r = net_vfs_close_cb(fp);
@@ -516,6 +994,34 @@ int vfs_close(task_t* task, int fd) {
 	return 0;
 }
 
+// Called for tasks that exit, so file systems can release open files
+void vfs_close_all(task_t* task) {
+	for(int i = 0; i < CONFIG_VFS_MAX_OPENFILES; i++) {
+		if(task->files[i].refs) {
+			vfs_close(task, i);
+		}
+	}
+}
+
+// Called after fork() has copied the open files to the new task
+void vfs_fork_files(task_t* task) {
+	for(int i = 0; i < CONFIG_VFS_MAX_OPENFILES; i++) {
+		vfs_file_t* fp = &task->files[i];
+		if(!fp->refs || fp->dup_target || !fp->callbacks.fork) {
+			continue;
+		}
+
+		struct vfs_callback_ctx ctx = {
+			.fp = fp,
+			.task = task,
+			.mp = fp->mp,
+			.path = fp->mount_path,
+			.orig_path = fp->path,
+		};
+		fp->callbacks.fork(&ctx);
+	}
+}
+
 int vfs_unlink(task_t* task, char* orig_path) {
 	struct vfs_callback_ctx* ctx = vfs_context_from_path(orig_path, task);
 	if(!ctx) {
@@ -699,21 +1205,134 @@ int vfs_link(task_t* task, const char* orig_path, const char* orig_new_path) {
 	return r;
 }
 
-void vfs_init(void) {
-	char* root_path = cmdline_get("root");
-	if(!root_path) {
-		panic("vfs: Could not get root device path - Make sure root= "
-			"is set in kernel command line.\n");
+/* File systems without a rename callback get a link followed by an unlink,
+ * which unlike a real rename is not atomic and doesn't work for directories.
+ *
+ * An existing target is moved to a temporary name first, so it can be put
+ * back if linking the source fails.
+ */
+static int rename_link(task_t* task, struct vfs_callback_ctx* ctx,
+	const char* orig_new_path, const char* new_mount_path) {
+
+	if(!ctx->mp->callbacks.link || !ctx->mp->callbacks.unlink || !ctx->mp->callbacks.stat) {
+		sc_errno = ENOSYS;
+		return -1;
+	}
+
+	int r = ctx->mp->callbacks.link(ctx, new_mount_path);
+	if(r >= 0 || sc_errno != EEXIST) {
+		return r < 0 ? r : ctx->mp->callbacks.unlink(ctx);
+	}
+
+	struct vfs_callback_ctx* new_ctx = vfs_context_from_path(orig_new_path, task);
+	if(!new_ctx) {
+		sc_errno = ENOENT;
+		return -1;
+	}
+
+	// Both names are links to the same file, rename() does nothing
+	vfs_stat_t stat, new_stat;
+	if(ctx->mp->callbacks.stat(ctx, &stat) < 0 || ctx->mp->callbacks.stat(new_ctx, &new_stat) < 0) {
+		vfs_free_context(new_ctx);
+		return -1;
+	}
+
+	if(stat.st_dev == new_stat.st_dev && stat.st_ino == new_stat.st_ino) {
+		vfs_free_context(new_ctx);
+		return 0;
+	}
+
+	size_t tmp_len = strlen(new_mount_path) + 20;
+	char* tmp_path = kmalloc(tmp_len);
+	snprintf(tmp_path, tmp_len, "%s.rename-%d", new_mount_path, task ? task->pid : 0);
+
+	r = ctx->mp->callbacks.link(new_ctx, tmp_path);
+	if(r >= 0) {
+		r = ctx->mp->callbacks.unlink(new_ctx);
+		if(r >= 0) {
+			r = ctx->mp->callbacks.link(ctx, new_mount_path);
+			if(r < 0) {
+				// Put the old target back
+				int err = sc_errno;
+				struct vfs_callback_ctx tmp_ctx = *new_ctx;
+				tmp_ctx.path = tmp_path;
+				ctx->mp->callbacks.link(&tmp_ctx, new_mount_path);
+				sc_errno = err;
+			}
+		}
+
+		struct vfs_callback_ctx tmp_ctx = *new_ctx;
+		tmp_ctx.path = tmp_path;
+		ctx->mp->callbacks.unlink(&tmp_ctx);
+	}
+
+	kfree(tmp_path);
+	vfs_free_context(new_ctx);
+	if(r < 0) {
+		return r;
+	}
+	return ctx->mp->callbacks.unlink(ctx);
+}
+
+int vfs_rename(task_t* task, const char* orig_path, const char* orig_new_path) {
+	struct vfs_callback_ctx* ctx = vfs_context_from_path(orig_path, task);
+	if(!ctx) {
+		sc_errno = EBADF;
+		return -1;
+	}
+
+	char* new_path = vfs_normalize_path(orig_new_path, task ? task->cwd : "/");
+	char* new_mount_path = NULL;
+	struct vfs_mountpoint* new_mp = vfs_mount_get(new_path, &new_mount_path);
+	kfree(new_path);
+
+	if(ctx->mp != new_mp) {
+		kfree(new_mount_path);
+		vfs_free_context(ctx);
+		sc_errno = EXDEV;
+		return -1;
+	}
+
+	int r;
+	if(ctx->mp->callbacks.rename) {
+		r = ctx->mp->callbacks.rename(ctx, new_mount_path);
+	} else {
+		r = rename_link(task, ctx, orig_new_path, new_mount_path);
+	}
+
+	kfree(new_mount_path);
+	vfs_free_context(ctx);
+	return r;
+}
+
+int vfs_symlink(task_t* task, const char* target, const char* orig_path) {
+	struct vfs_callback_ctx* ctx = vfs_context_from_path(orig_path, task);
+	if(!ctx) {
+		sc_errno = EBADF;
+		return -1;
 	}
 
-	log(LOG_INFO, "vfs: initializing, root=%s\n", root_path);
+	if(!ctx->mp->callbacks.symlink) {
+		vfs_free_context(ctx);
+		sc_errno = ENOSYS;
+		return -1;
+	}
+
+	int r = ctx->mp->callbacks.symlink(ctx, target);
+	vfs_free_context(ctx);
+	return r;
+}
+
+void vfs_init(void) {
+	char* root_path = cmdline_get("root");
+	log(LOG_INFO, "vfs: initializing, root=%s\n", root_path ? root_path : "(none)");
 
 	#ifdef CONFIG_ENABLE_FTREE
 	vfs_ftree_init();
 	#endif
 
+	// Needs to be cleared before mounting, the initramfs uses kernel fds
+	bzero(kernel_files, sizeof(kernel_files));
 	sysfs_init();
 	vfs_mount_init(root_path);
-
-	bzero(kernel_files, sizeof(kernel_files));
 }
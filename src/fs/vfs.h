@@ -99,6 +99,7 @@
 
 // Can't include <tasks/task.h> as that includes us, so use stub struct def.
 struct task;
+struct epoll_item;
 struct vfs_file;
 
 // Keep in sync with newlib
@@ -135,6 +136,76 @@ struct vfs_callback_ctx {
 	struct vfs_mountpoint* mp;
 	struct task* task;
 	bool free_paths;
+
+	/* Position for read and write callbacks. Set from the file offset, except
+	 * for positional I/O, where it is independent of it.
+	 */
+	uint64_t offset;
+
+	// Set by poll() and epoll to register with the object's wait queue
+	struct poll_entry* poll_entry;
+};
+
+/* Wait queues let pollable objects (pipes, ttys, sockets, ...) notify tasks
+ * blocked in poll() or epoll_wait() when their state changes, instead of those
+ * tasks having to call the poll callbacks over and over.
+ *
+ * An object embeds a struct poll_waitq, calls poll_register from its poll
+ * callback and poll_wake whenever it might have become readable or writable.
+ * Objects that don't do this still work, but get polled on every tick.
+ */
+struct poll_waitq {
+	struct poll_entry* entries;
+};
+
+struct poll_waiter {
+	struct task* task;
+	volatile bool woken;
+
+	// Entries registered by poll(), dropped if the task gets killed
+	struct poll_entry* entries;
+	uint32_t nentries;
+
+	// Set while sleeping in epoll_wait, where each task has its own waiter
+	struct epoll* ep;
+	struct poll_waiter* ep_next;
+};
+
+struct poll_entry {
+	struct poll_entry* next;
+	struct poll_waitq* waitq;
+	struct vfs_file* fp;
+
+	// Either a poll() waiter or an epoll item, which wakes its own waiters
+	struct poll_waiter* waiter;
+	struct epoll_item* item;
+};
+
+// Keep in sync with newlib
+struct iovec {
+	void* iov_base;
+	size_t iov_len;
+};
+
+struct vfs_prw_data {
+	int fd;
+	struct iovec* iov;
+	int iovcnt;
+	uint64_t offset;
+};
+
+// Set in vfs_splice_data flags if off_in/off_out are to be used
+#define VFS_SPLICE_OFF_IN	0x100
+#define VFS_SPLICE_OFF_OUT	0x200
+
+// Keep in sync with newlib
+struct vfs_splice_data {
+	int fd_in;
+	int fd_out;
+	uint64_t off_in;
+	uint64_t off_out;
+	size_t len;
+	uint32_t flags;
 };
 
 struct vfs_callbacks {
@@ -142,6 +213,8 @@ struct vfs_callbacks {
 	int (*access)(struct vfs_callback_ctx* ctx, uint32_t amode);
 	size_t (*read)(struct vfs_callback_ctx* ctx, void* dest, size_t size);
 	size_t (*write)(struct vfs_callback_ctx* ctx, void* source, size_t size);
+	size_t (*readv)(struct vfs_callback_ctx* ctx, struct iovec* iov, int iovcnt);
+	size_t (*writev)(struct vfs_callback_ctx* ctx, struct iovec* iov, int iovcnt);
 	size_t (*getdents)(struct vfs_callback_ctx* ctx, void* dest, size_t size);
 	int (*stat)(struct vfs_callback_ctx* ctx, vfs_stat_t* dest);
 	int (*mkdir)(struct vfs_callback_ctx* ctx, uint32_t mode);
@@ -151,12 +224,21 @@ struct vfs_callbacks {
 	int (*chown)(struct vfs_callback_ctx* ctx, uint16_t owner, uint16_t group);
 	int (*utimes)(struct vfs_callback_ctx* ctx, struct timeval times[2]);
 	int (*link)(struct vfs_callback_ctx* ctx, const char* new_path);
+	int (*rename)(struct vfs_callback_ctx* ctx, const char* new_path);
 	int (*readlink)(struct vfs_callback_ctx* ctx, char* buf, size_t size);
 	int (*rmdir)(struct vfs_callback_ctx* ctx);
 	int (*ioctl)(struct vfs_callback_ctx* ctx, int request, void* arg);
 	int (*poll)(struct vfs_callback_ctx* ctx, int events);
 	int (*build_path_tree)(struct vfs_callback_ctx* ctx);
 
+	// Write back cached data of the file, only what is needed to read it with datasync
+	int (*fsync)(struct vfs_callback_ctx* ctx, bool datasync);
+
+	// Called when the last reference to an open file is closed
+	int (*close)(struct vfs_callback_ctx* ctx);
+
+	// Called for each open file when a task forks and the child gets a copy
+	int (*fork)(struct vfs_callback_ctx* ctx);
 };
 
 typedef struct vfs_file {
@@ -175,6 +257,12 @@ typedef struct vfs_file {
 	uint64_t offset;
 	uint32_t inode;
 
+	// Wait queue of the underlying object, set by poll_register
+	struct poll_waitq* waitq;
+
+	// Error of a failed O_SYNC flush, reported by the next write or fsync
+	int sync_error;
+
 	// File-system specific
 	uint32_t meta;
 } vfs_file_t;
@@ -192,18 +280,26 @@ char* vfs_normalize_path(const char* orig_path, char* cwd);
 vfs_file_t* vfs_get_from_id(int id, struct task* task);
 vfs_file_t* vfs_alloc_fileno(struct task* task, int min);
 void vfs_free_context(struct vfs_callback_ctx* ctx);
+int vfs_context_init_fd(struct vfs_callback_ctx* ctx, int fd, struct task* task);
 struct vfs_callback_ctx* vfs_context_from_fd(int fd, struct task* task);
 struct vfs_callback_ctx* vfs_context_from_path(const char* path, struct task* task);
 
 int vfs_open(struct task* task, const char* orig_path, uint32_t flags);
 size_t vfs_read(struct task* task, int fd, void* dest, size_t size);
 size_t vfs_write(struct task* task, int fd, void* source, size_t size);
+size_t vfs_readv(struct task* task, int fd, struct iovec* iov, int iovcnt);
+size_t vfs_writev(struct task* task, int fd, struct iovec* iov, int iovcnt);
+size_t vfs_preadv(struct task* task, struct vfs_prw_data* data);
+size_t vfs_pwritev(struct task* task, struct vfs_prw_data* data);
+size_t vfs_splice(struct task* task, struct vfs_splice_data* data);
 size_t vfs_getdents(struct task* task, int fd, void* dest, size_t size);
 int vfs_seek(struct task* task, int fd, size_t offset, int origin);
 int vfs_close(struct task* task, int fd);
 int vfs_fcntl(struct task* task, int fd, int cmd, int arg3);
 int vfs_dup2(struct task* task, int fd1, int fd2);
 int vfs_ioctl(struct task* task, int fd, int request, void* arg);
+int vfs_fsync(struct task* task, int fd, int datasync);
+int vfs_sync(struct task* task);
 int vfs_unlink(struct task* task, char* orig_path);
 int vfs_chmod(struct task* task, const char* orig_path, uint32_t mode);
 int vfs_chown(struct task* task, const char* orig_path, uint16_t uid, uint16_t gid);
@@ -212,9 +308,13 @@ int vfs_access(struct task* task, const char* orig_path, uint32_t amode);
 int vfs_realpath(struct task* task, const char* orig_path, char* dest);
 int vfs_utimes(struct task* task, const char* orig_path, struct timeval times[2]);
 int vfs_link(struct task* task, const char* orig_path, const char* orig_new_path);
+int vfs_rename(struct task* task, const char* orig_path, const char* orig_new_path);
+int vfs_symlink(struct task* task, const char* target, const char* orig_path);
 int vfs_readlink(struct task* task, const char* orig_path, char* buf, size_t size);
 int vfs_rmdir(struct task* task, const char* orig_path);
 int vfs_stat(struct task* task, char* path, vfs_stat_t* dest);
+void vfs_fork_files(struct task* task);
+void vfs_close_all(struct task* task);
 void vfs_init(void);
 
 // legacy
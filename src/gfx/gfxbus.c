@@ -50,14 +50,25 @@ static size_t sfs_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
 
 
 static size_t sfs_write(struct vfs_callback_ctx* ctx, void* source, size_t size) {
-	int wr = buffer_write(buf, source, size);
+	// Messages have to be written in one piece
+	if(size > buf->capacity) {
+		sc_errno = EFBIG;
+		return -1;
+	}
+
 	int_enable();
+	while(buffer_space(buf) < size) {
+		scheduler_yield();
+	}
+
+	int wr = buffer_write(buf, source, size);
 	while(buffer_size(buf));
 	int_disable();
 	return wr;
 }
 
 static int sfs_poll(struct vfs_callback_ctx* ctx, int events) {
+	poll_register(ctx, &buf->waitq);
 	int_enable();
 	if(events & POLLIN && buffer_size(buf)) {
 		return POLLIN;
@@ -78,8 +89,8 @@ static int sfs_ioctl(struct vfs_callback_ctx* ctx, int request, void* _arg) {
 		}
 
 		task_t* task = ctx->task;
-		int flags[] = {VM_USER | VM_RW | VM_ZERO, VM_USER | VM_RW};
-		struct vm_ctx* vm_ctx[] = {&master_task->vmem, &task->vmem};
+		int flags[] = {VM_USER | VM_RW | VM_ZERO | VM_LARGE, VM_USER | VM_RW | VM_LARGE};
+		struct vm_ctx* vm_ctx[] = {master_task->vmem, task->vmem};
 
 		void* addr = vm_alloc_many(2, vm_ctx, NULL, RDIV(size, PAGE_SIZE), NULL, flags);
 		if(!addr) {
@@ -104,7 +115,7 @@ void tty_gfxbus_init(void) {
 		.poll = sfs_poll
 	};
 
-	buf = buffer_new(1500);
+	buf = buffer_new(64);
 	if(!buf) {
 		return;
 	}
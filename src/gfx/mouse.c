@@ -108,6 +108,7 @@ static size_t sfs_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
 }
 
 static int sfs_poll(struct vfs_callback_ctx* ctx, int events) {
+	poll_register(ctx, &buf->waitq);
 	if(events & POLLIN && buffer_size(buf)) {
 		return POLLIN;
 	}
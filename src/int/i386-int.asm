@@ -75,8 +75,11 @@ handle_eoi:
 ; Once it's done, it returns a new isf_t that needs to be applied.
 
 int_i386_dispatch:
-	; push ds, cr2 & cr3
+	; push gs, ds, cr2 & cr3
 	xor eax, eax
+	mov ax, gs
+	push eax
+
 	mov ax, ds
 	push eax
 
@@ -102,10 +105,15 @@ int_i386_dispatch:
 	jnz .return
 
 	; Load kernel paging context from global variable set during
-	; early boot in paging_init
+	; early boot in paging_init. Skip the load if it is already active
+	; (interrupts in kernel tasks), since it flushes the TLB.
 	mov ecx, [paging_kernel_ctx]
+	cmp ecx, [esp + 512]
+	je .kernel_ctx
 	mov cr3, ecx
 
+.kernel_ctx:
+
 	; Call C handler with fastcall convention
 	mov ecx, ebx
 	mov edx, esp
@@ -118,10 +126,15 @@ int_i386_dispatch:
 	fxrstor [sse_state]
 	add esp, 512
 
-	; Set paging context
+	; Set paging context, unless it stays the same
 	pop eax
+	mov edx, cr3
+	cmp eax, edx
+	je .same_ctx
 	mov cr3, eax
 
+.same_ctx:
+
 	; Drop cr2
 	add esp, 4
 
@@ -130,6 +143,7 @@ int_i386_dispatch:
 	mov ds, ax
 	mov es, ax
 	mov fs, ax
+	pop eax
 	mov gs, ax
 
 	popa
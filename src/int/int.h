@@ -27,6 +27,19 @@
 
 	#define int_disable() asm volatile("cli")
 	#define int_enable() asm volatile("sti")
+
+	// Disable interrupts, returning whether they were enabled before
+	static inline bool int_save() {
+		uint32_t eflags;
+		asm volatile("pushf; pop %0; cli" : "=r"(eflags) :: "memory");
+		return eflags & EFLAGS_IF;
+	}
+
+	static inline void int_restore(bool enabled) {
+		if(enabled) {
+			int_enable();
+		}
+	}
 #endif
 
 struct task;
@@ -38,6 +51,9 @@ typedef struct {
 	void* cr2;
 	uint32_t ds;
 
+	// Separate from ds since userland uses it for thread-local storage
+	uint32_t gs;
+
 	uint32_t edi;
 	uint32_t esi;
 	uint8_t* ebp;
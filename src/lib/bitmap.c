@@ -122,6 +122,33 @@ uint32_t bitmap_find(struct bitmap* bm, uint32_t start, uint32_t num) {
 	return -1;
 }
 
+/* Like bitmap_find, but only returns positions for which pos % align equals
+ * offset. align needs to be a power of two.
+ */
+uint32_t bitmap_find_aligned(struct bitmap* bm, uint32_t num, uint32_t align, uint32_t offset) {
+	uint32_t first = bitmap_find(bm, 0, num);
+	if(first == -1) {
+		return -1;
+	}
+
+	uint32_t pos = ALIGN_DOWN(first, align) + offset;
+	if(pos < first) {
+		pos += align;
+	}
+
+	for(; pos + num <= bm->size; pos += align) {
+		uint32_t i = 0;
+		while(i < num && !bitmap_get(bm, pos + i)) {
+			i++;
+		}
+
+		if(i == num) {
+			return pos;
+		}
+	}
+	return -1;
+}
+
 uint32_t bitmap_get_range(struct bitmap* bm, uint32_t start, uint32_t num) {
 	uint32_t remainder = num;
 	uint32_t arraypos = start / 32;
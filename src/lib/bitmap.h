@@ -38,5 +38,6 @@ void bitmap_set(struct bitmap* bm, uint32_t pos, uint32_t num);
 void bitmap_clear(struct bitmap* bm, uint32_t pos, uint32_t num);
 void bitmap_clear_all(struct bitmap* bm);
 uint32_t bitmap_find(struct bitmap* bm, uint32_t start, uint32_t num);
+uint32_t bitmap_find_aligned(struct bitmap* bm, uint32_t num, uint32_t align, uint32_t offset);
 uint32_t bitmap_get_range(struct bitmap* bm, uint32_t start, uint32_t num);
 uint32_t bitmap_count(struct bitmap* bm);
@@ -1,5 +1,5 @@
-/* buffer.c: Generic growing fifo buffer
- * Copyright © 2020 Lukas Martini
+/* buffer.c: Generic fifo ring buffer
+ * Copyright © 2020-2026 Lukas Martini
  *
  * This file is part of Xelix.
  *
@@ -20,101 +20,105 @@
 #include <buffer.h>
 #include <mem/kmalloc.h>
 #include <mem/mem.h>
+#include <fs/poll.h>
 #include <errno.h>
 
-struct buffer* buffer_new(size_t max_pages) {
-	struct buffer* buf = zmalloc(sizeof(struct buffer));
-	buf->max_pages = max_pages;
-	buf->pages = 1;
-	vm_alloc_t vmem;
+struct buffer* buffer_new(size_t pages) {
+	size_t npages = 1;
+	while(npages < pages) {
+		npages <<= 1;
+	}
 
-	if(!vm_alloc(VM_KERNEL, &vmem, 1, NULL, VM_RW)) {
+	struct buffer* buf = zmalloc(sizeof(struct buffer));
+	if(!vm_alloc(VM_KERNEL, &buf->vmem, npages, NULL, VM_RW | VM_FREE)) {
+		kfree(buf);
 		return NULL;
 	}
 
-	buf->data = vmem.addr;
+	buf->data = buf->vmem.addr;
+	buf->capacity = npages * PAGE_SIZE;
+	buf->mask = buf->capacity - 1;
 	return buf;
 }
 
+// Copy into the ring at pos, wrapping around the end if needed
+static inline void copy_in(struct buffer* buf, size_t pos, const void* src, size_t size) {
+	size_t off = pos & buf->mask;
+	size_t first = MIN(size, buf->capacity - off);
+	memcpy(buf->data + off, src, first);
+	memcpy(buf->data, src + first, size - first);
+}
+
+static inline void copy_out(struct buffer* buf, size_t pos, void* dest, size_t size) {
+	size_t off = pos & buf->mask;
+	size_t first = MIN(size, buf->capacity - off);
+	memcpy(dest, buf->data + off, first);
+	memcpy(dest + first, buf->data, size - first);
+}
+
 size_t buffer_write(struct buffer* buf, const void* src, size_t size) {
-	if(!spinlock_get(&buf->lock, -1)) {
+	if(!spinlock_get(&buf->write_lock, -1)) {
 		return -1;
 	}
 
-	if(buf->size + size > buf->pages * PAGE_SIZE) {
-		size_t size_needed = buf->pages + RDIV(size, PAGE_SIZE);
-		size_t size_wanted = MAX(buf->pages * 3, size_needed);
-		size_t size_new = MIN(size_wanted, buf->max_pages);
-
-		if(size_needed > buf->max_pages) {
-			sc_errno = EFBIG;
-			return -1;
-		}
-
-		vm_alloc_t vmem;
-		if(!vm_alloc(VM_KERNEL, &vmem, size_new, NULL, VM_RW)) {
-			return -1;
-		}
-
-		memcpy(vmem.addr, buf->data, buf->size);
-		pfree((uintptr_t)buf->data / PAGE_SIZE, buf->pages);
-		buf->data = vmem.addr;
-		buf->pages = size_new;
-	}
-
-	memcpy(buf->data + buf->size, src, size);
-	buf->size += size;
+	size_t head = buf->head;
+	size = MIN(size, buf->capacity - (head - buf->tail));
+	copy_in(buf, head, src, size);
 
-	spinlock_release(&buf->lock);
-	return size;
-}
+	// Make sure the data is in place before the reader can see it
+	__sync_synchronize();
+	buf->head = head + size;
 
-static inline size_t do_read(struct buffer* buf, void* dest, size_t size, size_t offset) {
-	if(offset >= buf->size) {
-		return 0;
+	spinlock_release(&buf->write_lock);
+	if(size) {
+		poll_wake(&buf->waitq);
 	}
-
-	size = MIN(buf->size - offset, size);
-	memcpy(dest, buf->data + offset, size);
 	return size;
 }
 
 size_t buffer_read(struct buffer* buf, void* dest, size_t size, size_t offset) {
-	if(!spinlock_get(&buf->lock, -1)) {
+	if(!spinlock_get(&buf->read_lock, -1)) {
 		return -1;
 	}
 
-	size_t nread = do_read(buf, dest, size, offset);
-	spinlock_release(&buf->lock);
-	return nread;
+	size_t tail = buf->tail;
+	size_t used = buf->head - tail;
+	__sync_synchronize();
+
+	if(offset >= used) {
+		spinlock_release(&buf->read_lock);
+		return 0;
+	}
+
+	size = MIN(size, used - offset);
+	copy_out(buf, tail + offset, dest, size);
+	spinlock_release(&buf->read_lock);
+	return size;
 }
 
 size_t buffer_pop(struct buffer* buf, void* dest, size_t size) {
-	if(!spinlock_get(&buf->lock, -1)) {
+	if(!spinlock_get(&buf->read_lock, -1)) {
 		return -1;
 	}
 
-	size_t nread = do_read(buf, dest, size, 0);
-	buf->size -= nread;
-	if(buf->size) {
-		memmove(buf->data, buf->data + size, buf->size);
-	}
+	size_t tail = buf->tail;
+	size = MIN(size, buf->head - tail);
+	__sync_synchronize();
+	copy_out(buf, tail, dest, size);
 
-	spinlock_release(&buf->lock);
-	return nread;
-}
+	// Don't hand the space back to the writer before we're done copying
+	__sync_synchronize();
+	buf->tail = tail + size;
 
-size_t buffer_size(struct buffer* buf) {
-	if(!spinlock_get(&buf->lock, -1)) {
-		return -1;
+	spinlock_release(&buf->read_lock);
+	if(size) {
+		poll_wake(&buf->waitq);
 	}
-
-	size_t sz = buf->size;
-	spinlock_release(&buf->lock);
-	return sz;
+	return size;
 }
 
 void buffer_free(struct buffer* buf) {
-	pfree((uintptr_t)buf->data / PAGE_SIZE, buf->pages);
+	poll_waitq_destroy(&buf->waitq);
+	vm_free(&buf->vmem);
 	kfree(buf);
 }
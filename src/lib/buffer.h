@@ -19,26 +19,40 @@
  */
 
 #include <spinlock.h>
+#include <mem/vm.h>
+#include <fs/vfs.h>
 
+/* Fixed-size ring buffer. Capacity is a power of two so positions can be kept
+ * as free-running counters and masked on access. The writer only moves head
+ * and the reader only moves tail, so one reader and one writer can work on a
+ * buffer at the same time without locking. The locks only serialize multiple
+ * readers or multiple writers against each other.
+ */
 struct buffer {
 	void* data;
-	spinlock_t lock;
+	vm_alloc_t vmem;
+	size_t capacity;
+	size_t mask;
+
+	volatile size_t head;
+	volatile size_t tail;
 
-	// How much data is currently stored
-	size_t size;
+	spinlock_t read_lock;
+	spinlock_t write_lock;
 
-	// Allocation size (in pages)
-	size_t pages;
-	size_t max_pages;
+	// Woken whenever data is written or space is freed
+	struct poll_waitq waitq;
 };
 
-// Allocate new buffer
-struct buffer* buffer_new(size_t max_pages);
+// Allocate new buffer with a capacity of at least the given number of pages
+struct buffer* buffer_new(size_t pages);
 
 // Free buffer
 void buffer_free(struct buffer* buf);
 
-// Write to end of buffer
+/* Write to end of buffer. Writes as much as fits and returns the number of
+ * bytes written, which may be 0 if the buffer is full.
+ */
 size_t buffer_write(struct buffer* buf, const void* src, size_t size);
 
 // Read from arbitrary location in buffer, leaving content intact
@@ -48,4 +62,11 @@ size_t buffer_read(struct buffer* buf, void* dest, size_t size, size_t offset);
 size_t buffer_pop(struct buffer* buf, void* dest, size_t size);
 
 // Get size of data contained in the buffer
-size_t buffer_size(struct buffer* buf);
+static inline size_t buffer_size(struct buffer* buf) {
+	return buf->head - buf->tail;
+}
+
+// Get amount of free space in the buffer
+static inline size_t buffer_space(struct buffer* buf) {
+	return buf->capacity - buffer_size(buf);
+}
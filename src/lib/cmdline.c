@@ -53,7 +53,7 @@ bool cmdline_get_bool(const char* key) {
 }
 
 static size_t sfs_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
-	if(ctx->fp->offset) {
+	if(ctx->offset) {
 		return 0;
 	}
 
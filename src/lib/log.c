@@ -140,15 +140,15 @@ void log_set_console_level(int level) {
 }
 
 static size_t sfs_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
-	if(ctx->fp->offset >= log_size) {
+	if(ctx->offset >= log_size) {
 		return 0;
 	}
 
-	if(ctx->fp->offset + size > log_size) {
-		size = log_size - ctx->fp->offset;
+	if(ctx->offset + size > log_size) {
+		size = log_size - ctx->offset;
 	}
 
-	memcpy(dest, buffer + ctx->fp->offset, size);
+	memcpy(dest, buffer + ctx->offset, size);
 	return size;
 }
 
@@ -172,7 +172,7 @@ int time_get_timeval(task_t* task, struct timeval* tv) {
 }
 
 static size_t sfs_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
-	if(ctx->fp->offset) {
+	if(ctx->offset) {
 		return 0;
 	}
 
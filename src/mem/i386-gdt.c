@@ -69,7 +69,7 @@ extern void gdt_flush(void*);
 extern void* stack_end;
 static uint8_t initial_tss[0x60] UL_VISIBLE("bss");
 static uint32_t* tss = (uint32_t*)&initial_tss;
-static uint64_t descs[6] UL_VISIBLE("bss");
+static uint64_t descs[7] UL_VISIBLE("bss");
 
 static struct {
 	// The upper 16 bits of all selector limits.
@@ -102,8 +102,16 @@ void gdt_set_tss(void* addr) {
 	gdt_flush(&pointer);
 }
 
+/* Set the base of the userland %gs segment, which points to the thread-local
+ * storage of the current thread. Takes effect the next time gs is loaded,
+ * which happens when returning to userland.
+ */
+void gdt_set_tls(void* base) {
+	create_descriptor(6, (uint32_t)base, 0xffffffff, GDT_DATA_PL3);
+}
+
 void gdt_init(void) {
-	pointer.limit = (sizeof(uint64_t) * 6) - 1;
+	pointer.limit = (sizeof(uint64_t) * 7) - 1;
 	pointer.base = descs;
 
 	create_descriptor(0, 0, 0, 0);
@@ -111,6 +119,7 @@ void gdt_init(void) {
 	create_descriptor(2, 0, 0xffffffff, GDT_DATA_PL0); // 0x10
 	create_descriptor(3, 0, 0xffffffff, GDT_CODE_PL3); // 0x1b
 	create_descriptor(4, 0, 0xffffffff, GDT_DATA_PL3); // 0x23
+	gdt_set_tls(NULL); // 0x33
 
 	gdt_set_tss(&stack_end);
     log(LOG_INFO, "gdt: Set initial tss %#x\n", &stack_end);
@@ -23,6 +23,8 @@
 #define GDT_SEG_DATA_PL0 0x10
 #define GDT_SEG_CODE_PL3 0x1b
 #define GDT_SEG_DATA_PL3 0x23
+#define GDT_SEG_TLS_PL3 0x33
 
 void gdt_set_tss(void* addr);
+void gdt_set_tls(void* base);
 void gdt_init(void);
@@ -23,11 +23,78 @@
 #include <string.h>
 #include <panic.h>
 #include <int/int.h>
+#include <boot/multiboot.h>
+#include <cpuid.h>
 
 // Used in interrupt handlers to return to kernel paging context
 struct paging_context* paging_kernel_ctx UL_VISIBLE("bss");
 void* paging_alloc_end = KERNEL_END;
 
+// Page directories and tables of all contexts, for memory statistics
+uint32_t paging_table_pages = 0;
+
+// Set if the CPU supports PSE
+bool paging_large_pages = false;
+
+// Set if the CPU supports PGE
+bool paging_global_pages = false;
+
+// Past this number of pages, reloading CR3 is cheaper than invlpg for each
+#define FLUSH_THRESHOLD 32
+
+// The page tables allocated in paging_init, 1:1 mapped
+static inline void* early_table(int dir_offset) {
+	return (void*)paging_kernel_ctx + sizeof(struct paging_context) + dir_offset * PAGE_SIZE;
+}
+
+/* Large pages replace the page table of their directory entry. This is only
+ * done if there is no page table yet, or for the unused early page tables of
+ * the kernel context, which are put back when the large page is cleared.
+ */
+static inline bool can_map_large(struct paging_context* ctx, uint32_t page_dir_offset) {
+	struct page* page_dir = &(ctx->dir_entries[page_dir_offset]);
+	if(!page_dir->present) {
+		return true;
+	}
+
+	return ctx == paging_kernel_ctx && !page_dir->large
+		&& page_dir->frame == (uintptr_t)early_table(page_dir_offset) >> 12;
+}
+
+/* Invalidate the TLB entries of a range after it has been changed. Only the
+ * kernel context is active while these functions run, other contexts get
+ * flushed anyway when their page directory is loaded on interrupt return.
+ * Global entries survive that, but they are the same in every context.
+ */
+static void flush_range(struct paging_context* ctx, uintptr_t start, size_t size, bool global) {
+	if(ctx != paging_kernel_ctx) {
+		return;
+	}
+
+	if(size > FLUSH_THRESHOLD * PAGE_SIZE) {
+		if(global && paging_global_pages) {
+			// Toggling CR4.PGE flushes everything, including global entries
+			asm volatile(
+				"mov %%cr4, %%eax;"
+				"xor $0x80, %%eax;"
+				"mov %%eax, %%cr4;"
+				"xor $0x80, %%eax;"
+				"mov %%eax, %%cr4;"
+			::: "eax", "memory");
+		} else {
+			asm volatile(
+				"mov %%cr3, %%eax;"
+				"mov %%eax, %%cr3;"
+			::: "eax", "memory");
+		}
+		return;
+	}
+
+	for(uintptr_t addr = start; addr < start + size; addr += PAGE_SIZE) {
+		asm volatile("invlpg (%0)":: "r" (addr) : "memory");
+	}
+}
+
 /*
 void* paging_translate_to_phys(struct paging_context* ctx, void* virt) {
 	uint32_t page_dir_offset = virt >> 22;
@@ -48,6 +115,22 @@ void paging_set_range(struct paging_context* ctx, void* virt_addr, void* phys_ad
 		uint32_t page_table_offset = (current_virt >> 12) % 1024;
 
 		struct page* page_dir = &(ctx->dir_entries[page_dir_offset]);
+		uintptr_t current_phys = (uintptr_t)phys_addr + off;
+
+		if(flags & VM_LARGE && paging_large_pages && !(current_virt % LARGE_PAGE_SIZE)
+			&& !(current_phys % LARGE_PAGE_SIZE) && size - off >= LARGE_PAGE_SIZE
+			&& can_map_large(ctx, page_dir_offset)) {
+
+			*(uint32_t*)page_dir = 0;
+			page_dir->present = 1;
+			page_dir->rw = flags & VM_RW;
+			page_dir->user = flags & VM_USER;
+			page_dir->large = 1;
+			page_dir->global = !!(flags & VM_GLOBAL);
+			page_dir->frame = current_phys >> 12;
+			off += LARGE_PAGE_SIZE - PAGE_SIZE;
+			continue;
+		}
 
 		void* phys_table;
 		struct page* page_table;
@@ -59,6 +142,7 @@ void paging_set_range(struct paging_context* ctx, void* virt_addr, void* phys_ad
 			vm_alloc(VM_KERNEL, &page_table_alloc, 1, NULL, VM_RW | VM_ZERO);
 			page_table = page_table_alloc.addr;
 			phys_table = page_table_alloc.phys;
+			__sync_add_and_fetch(&paging_table_pages, 1);
 
 			page_dir->present = true;
 			page_dir->rw = 1;
@@ -80,15 +164,15 @@ void paging_set_range(struct paging_context* ctx, void* virt_addr, void* phys_ad
 		page->present = 1;
 		page->rw = flags & VM_RW;
 		page->user = flags & VM_USER;
-		page->frame = ((uintptr_t)phys_addr + off) >> 12;
-
-		if(ctx == paging_kernel_ctx) {
-			asm volatile("invlpg (%0)":: "r" (current_virt));
-		}
+		page->global = !!(flags & VM_GLOBAL);
+		page->frame = current_phys >> 12;
 	}
+
+	flush_range(ctx, (uintptr_t)virt_addr, size, flags & VM_GLOBAL);
 }
 
 void paging_clear_range(struct paging_context* ctx, void* virt_addr, size_t size) {
+	bool global = false;
 	for(uintptr_t off = 0; off < size; off += PAGE_SIZE) {
 		uintptr_t current_virt = (uintptr_t)virt_addr + off;
 
@@ -100,6 +184,20 @@ void paging_clear_range(struct paging_context* ctx, void* virt_addr, size_t size
 			continue;
 		}
 
+		// Large pages are only used if the range covers them completely
+		if(page_dir->large) {
+			global |= page_dir->global;
+			*(uint32_t*)page_dir = 0;
+			if(ctx == paging_kernel_ctx) {
+				page_dir->present = 1;
+				page_dir->rw = 1;
+				page_dir->frame = (uintptr_t)early_table(page_dir_offset) >> 12;
+			}
+
+			off += LARGE_PAGE_SIZE - current_virt % LARGE_PAGE_SIZE - PAGE_SIZE;
+			continue;
+		}
+
 		void* phys_table = (void*)(page_dir->frame << 12);
 
 		struct page* page_table;
@@ -110,25 +208,48 @@ void paging_clear_range(struct paging_context* ctx, void* virt_addr, size_t size
 		}
 
 		struct page* page = page_table + page_table_offset;
+		global |= page->global;
 		page->present = 0;
-
-		if(ctx == paging_kernel_ctx) {
-			asm volatile("invlpg (%0)":: "r" (current_virt));
-		}
+		page->global = 0;
 	}
+
+	flush_range(ctx, (uintptr_t)virt_addr, size, global);
 }
 
 void paging_rm_context(struct paging_context* ctx) {
 	for(int i = 0; i < 1024; i++) {
-		if(ctx->dir_entries[i].present) {
+		if(ctx->dir_entries[i].present && !ctx->dir_entries[i].large) {
 			pfree((ctx->dir_entries[i].frame << 12) / PAGE_SIZE, 1);
+			__sync_sub_and_fetch(&paging_table_pages, 1);
 		}
 	}
 	pfree((uintptr_t)ctx / PAGE_SIZE, 1);
+	__sync_sub_and_fetch(&paging_table_pages, 1);
 }
 
 void paging_init(void) {
-	paging_kernel_ctx = ALIGN(KERNEL_END, PAGE_SIZE);
+	/* Bootloaders usually place modules right behind the kernel, so start
+	 * the early allocations after the initramfs to keep it intact.
+	 */
+	void* early_start = KERNEL_END;
+	struct multiboot_tag_module* initrd = multiboot_get_initrd();
+	if(initrd && (void*)initrd->mod_end > early_start) {
+		early_start = (void*)initrd->mod_end;
+	}
+
+	// CPUID leaf 1, EDX bit 3 (PSE) and 13 (PGE)
+	uint32_t eax = 0, ebx = 0, ecx = 0, edx = 0;
+	bool has_cpuid = __get_cpuid(1, &eax, &ebx, &ecx, &edx);
+	if(has_cpuid && edx & (1 << 3)) {
+		paging_large_pages = true;
+		asm volatile(
+			"mov %%cr4, %%eax;"
+			"or $0x10, %%eax;"
+			"mov %%eax, %%cr4;"
+		::: "eax");
+	}
+
+	paging_kernel_ctx = ALIGN(early_start, PAGE_SIZE);
 	bzero(paging_kernel_ctx, sizeof(struct paging_context));
 	paging_alloc_end = (void*)paging_kernel_ctx + sizeof(struct paging_context);
 
@@ -158,13 +279,30 @@ void paging_init(void) {
 	}
 
 	log(LOG_INFO, "paging: Early page tables allocated up to %p\n", paging_alloc_end);
+	paging_table_pages = 1025;
 
 	// Create a new vm_alloc context with the page dir and allocate the kernel / page dir in it
 	vm_new(&vm_kernel_ctx, paging_kernel_ctx);
 
-	uint32_t kernel_pages = RDIV(paging_alloc_end - KERNEL_START, PAGE_SIZE);
-	if(!vm_alloc_at(VM_KERNEL, NULL, kernel_pages, KERNEL_START, KERNEL_START, VM_RW | VM_FIXED)) {
-		panic("paging: Could not allocate kernel vmem");
+	/* Map the kernel in three parts so the UL_VISIBLE region, which is also
+	 * mapped into every task context, can use global pages. The rest of the
+	 * kernel and the early page tables are only mapped here, and task memory
+	 * can end up at the same addresses, so they can't.
+	 */
+	void* ul_end = ALIGN(UL_VISIBLE_END, PAGE_SIZE);
+	void* parts[][2] = {
+		{KERNEL_START, UL_VISIBLE_START},
+		{UL_VISIBLE_START, ul_end},
+		{ul_end, paging_alloc_end},
+	};
+	int part_flags[] = {VM_LARGE, VM_GLOBAL, VM_LARGE};
+
+	for(int i = 0; i < 3; i++) {
+		uint32_t pages = RDIV(parts[i][1] - parts[i][0], PAGE_SIZE);
+		if(pages && !vm_alloc_at(VM_KERNEL, NULL, pages, parts[i][0], parts[i][0],
+			VM_RW | VM_FIXED | part_flags[i])) {
+			panic("paging: Could not allocate kernel vmem");
+		}
 	}
 
 	asm volatile(
@@ -174,5 +312,16 @@ void paging_init(void) {
 		"mov %%eax, %%cr0;"
 	:: "r"(paging_kernel_ctx) : "memory", "eax");
 
-	log(LOG_INFO, "paging: Enabled\n");
+	// PGE must only be enabled after paging
+	if(has_cpuid && edx & (1 << 13)) {
+		paging_global_pages = true;
+		asm volatile(
+			"mov %%cr4, %%eax;"
+			"or $0x80, %%eax;"
+			"mov %%eax, %%cr4;"
+		::: "eax");
+	}
+
+	log(LOG_INFO, "paging: Enabled%s%s\n", paging_large_pages ? ", using large pages" : "",
+		paging_global_pages ? ", using global pages" : "");
 }
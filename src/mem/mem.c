@@ -29,12 +29,14 @@
 #include <mem/vm.h>
 #include <boot/multiboot.h>
 #include <fs/sysfs.h>
+#include <fs/tmpfs.h>
+#include <block/cache.h>
 
 struct mem_page_alloc_ctx mem_phys_alloc_ctx;
 struct vm_ctx vm_kernel_ctx;
 
 static size_t sfs_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
-	if(ctx->fp->offset) {
+	if(ctx->offset) {
 		return 0;
 	}
 
@@ -46,11 +48,23 @@ static size_t sfs_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
 	mem_page_alloc_stats(&mem_phys_alloc_ctx, &palloc_total, &palloc_used);
 	vm_stats(&vm_kernel_ctx, &vm_total, &vm_used);
 
+	// tmpfs contents are counted as shared memory, like Linux does for shmem
+	uint32_t mem_shared = 0;
+	uint32_t mem_cache = 0;
+	#ifdef CONFIG_ENABLE_TMPFS
+	mem_shared = tmpfs_mem_used();
+	#endif
+	#ifdef CONFIG_BLOCK_WRITEBACK
+	mem_cache = block_cache_size();
+	#endif
+
 	size_t rsize = 0;
 	sysfs_printf("mem_total: %u\n", palloc_total);
 	sysfs_printf("mem_used: %u\n", palloc_used - kmalloc_total + kmalloc_used);
-	sysfs_printf("mem_shared: %u\n", 0);
-	sysfs_printf("mem_cache: %u\n", 0);
+	sysfs_printf("mem_shared: %u\n", mem_shared);
+	sysfs_printf("mem_cache: %u\n", mem_cache);
+	sysfs_printf("page_tables: %u\n", paging_table_pages * PAGE_SIZE);
+	sysfs_printf("user_anon: %u\n", vm_user_pages * PAGE_SIZE);
 	sysfs_printf("palloc_total: %u\n", palloc_total);
 	sysfs_printf("palloc_used: %u\n", palloc_used);
 	sysfs_printf("vm_total: %u\n", vm_total);
@@ -115,7 +129,7 @@ void mem_init(void) {
 void mem_late_init(void) {
 	/* In physical memory, block out all lower memory up to the end of early
 	 * allocations from paging.c. Since the early allocations follow
-	 * KERNEL_END, this implicitly includes the kernel binary.
+	 * KERNEL_END and the initramfs module, this implicitly includes both.
 	 */
 	mem_page_alloc_at(&mem_phys_alloc_ctx, 0, (uintptr_t)paging_alloc_end / PAGE_SIZE);
 
@@ -26,6 +26,7 @@
 extern struct mem_page_alloc_ctx mem_phys_alloc_ctx;
 
 #define palloc(size) (mem_page_alloc(&mem_phys_alloc_ctx, size))
+#define palloc_aligned(size, align) (mem_page_alloc_aligned(&mem_phys_alloc_ctx, size, align))
 //#define pfree(num, size) (mem_page_free(&mem_phys_alloc_ctx, num, size))
 #define pfree(num, size)
 
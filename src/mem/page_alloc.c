@@ -42,6 +42,23 @@ void* mem_page_alloc(struct mem_page_alloc_ctx* ctx, size_t size) {
 	return (void*)(num * PAGE_SIZE);
 }
 
+// Allocate pages starting at a multiple of align pages
+void* mem_page_alloc_aligned(struct mem_page_alloc_ctx* ctx, size_t size, size_t align) {
+	if(!spinlock_get(&ctx->lock, -1)) {
+		return NULL;
+	}
+
+	uint32_t num = bitmap_find_aligned(&ctx->bitmap, size, align, 0);
+	if(num == -1) {
+		spinlock_release(&ctx->lock);
+		return NULL;
+	}
+
+	bitmap_set(&ctx->bitmap, num, size);
+	spinlock_release(&ctx->lock);
+	return (void*)(num * PAGE_SIZE);
+}
+
 int mem_page_alloc_at(struct mem_page_alloc_ctx* ctx, void* addr, size_t size) {
 	if(!spinlock_get(&ctx->lock, -1)) {
 		return -1;
@@ -33,6 +33,7 @@ struct mem_page_alloc_ctx {
 };
 
 void* mem_page_alloc(struct mem_page_alloc_ctx* ctx, size_t size);
+void* mem_page_alloc_aligned(struct mem_page_alloc_ctx* ctx, size_t size, size_t align);
 int mem_page_alloc_at(struct mem_page_alloc_ctx* ctx, void* addr, size_t size);
 int mem_page_free(struct mem_page_alloc_ctx* ctx, uint32_t num, size_t size);
 int mem_page_alloc_stats(struct mem_page_alloc_ctx* ctx, uint32_t* total, uint32_t* used);
@@ -22,6 +22,9 @@
 
 #define PAGE_SIZE 0x1000
 
+// Size of PSE pages, mapped directly by a page directory entry
+#define LARGE_PAGE_SIZE 0x400000
+
 struct page {
 	bool present:1;
 	bool rw:1;
@@ -29,11 +32,15 @@ struct page {
 	bool write_through:1;
 	bool cache_disabled:1;
 	bool accessed:1;
-	// Or page size for dir entries
 	bool dirty:1;
+
+	// Page size for dir entries, set for large pages (PAT in table entries)
+	bool large:1;
+
+	// Not flushed on CR3 loads, only for mappings shared by all contexts
 	bool global:1;
 
-	uint8_t _unused:4;
+	uint8_t _unused:3;
 
 	uint32_t frame:20;
 };
@@ -44,6 +51,9 @@ struct paging_context {
 
 extern struct paging_context* paging_kernel_ctx UL_VISIBLE("bss");
 extern void* paging_alloc_end;
+extern bool paging_large_pages;
+extern bool paging_global_pages;
+extern uint32_t paging_table_pages;
 
 struct vmem_range;
 void paging_set_range(struct paging_context* ctx, void* virt_addr, void* phys_addr, size_t size, int flags);
@@ -29,6 +29,7 @@
 
 static vm_alloc_t malloc_ranges[50];
 static int have_malloc_ranges = 50;
+uint32_t vm_user_pages = 0;
 
 #ifdef CONFIG_VM_DEBUG
 	#ifdef CONFIG_VM_DEBUG_ALL
@@ -45,7 +46,9 @@ static int have_malloc_ranges = 50;
  * and could cause trouble during later reallocations (such as VM_ZERO in
  * vm_copy).
  */
-#define CLEANUP_FLAGS(x) ((x) & (VM_RW | VM_USER | VM_FREE | VM_TFORK | VM_NOCOW))
+#define CLEANUP_FLAGS(x) ((x) & (VM_RW | VM_USER | VM_FREE | VM_TFORK | VM_NOCOW | VM_LARGE | VM_GLOBAL))
+
+#define LARGE_PAGES (LARGE_PAGE_SIZE / PAGE_SIZE)
 
 static inline vm_alloc_t* new_range(void) {
 	/* During initialization, kmalloc_init calls vm_alloc once to get its
@@ -83,6 +86,22 @@ static inline void insert_range(struct vm_ctx* ctx, vm_alloc_t* new_range) {
 	ctx->ranges = new_range;
 }
 
+// Update the resident page counters when a range is added (1) or removed (-1)
+static inline void account(vm_alloc_t* range, int sign) {
+	int32_t pages = range->phys ? RDIV(range->size, PAGE_SIZE) : 0;
+	for(struct vm_alloc_shard* shard = range->shards; shard; shard = shard->next) {
+		pages++;
+	}
+
+	pages *= sign;
+	__sync_add_and_fetch(&range->ctx->resident, pages);
+	if(!(range->flags & VM_FREE)) {
+		__sync_add_and_fetch(&range->ctx->shared, pages);
+	} else if(range->flags & VM_USER) {
+		__sync_add_and_fetch(&vm_user_pages, pages);
+	}
+}
+
 static inline vm_alloc_t* get_range(struct vm_ctx* ctx, void* addr, bool phys) {
 	if(!phys && !bitmap_get(&ctx->bitmap, (uintptr_t)addr / PAGE_SIZE)) {
 		return NULL;
@@ -128,6 +147,21 @@ static inline void* alloc_virt(struct vm_ctx* ctx, size_t size, void* request, b
 	return virt;
 }
 
+/* Find a virtual address at the same offset into a large page as phys, so
+ * everything between the first and last large page boundary of the range
+ * can use them.
+ */
+static inline void* alloc_virt_large(struct vm_ctx* ctx, size_t size, void* phys) {
+	uint32_t offset = ((uintptr_t)phys / PAGE_SIZE) % LARGE_PAGES;
+	uint32_t page_num = bitmap_find_aligned(&ctx->bitmap, size, LARGE_PAGES, offset);
+	if(page_num == -1) {
+		return NULL;
+	}
+
+	bitmap_set(&ctx->bitmap, page_num, size);
+	return (void*)(page_num * PAGE_SIZE);
+}
+
 vm_alloc_t* vm_get(struct vm_ctx* ctx, void* addr, bool phys) {
 	if(!spinlock_get(&ctx->lock, -1)) {
 		return NULL;
@@ -181,12 +215,24 @@ static inline void* setup_phys(struct vm_ctx* ctx, size_t size, void* virt, void
 void* vm_alloc_at(struct vm_ctx* ctx, vm_alloc_t* vmem, size_t size, void* virt_request, void* phys, int flags) {
 	// FIXME Fail if size, virt_request or phys are not page aligned?
 
+	bool large = flags & VM_LARGE && paging_large_pages && size >= LARGE_PAGES;
+	if(large && !phys) {
+		phys = palloc_aligned(size, LARGE_PAGES);
+	}
+
 	if(!spinlock_get(&ctx->lock, -1)) {
 		return NULL;
 	}
 
 	// Allocate virtual address
-	void* virt = alloc_virt(ctx, size, virt_request, flags & VM_FIXED);
+	void* virt = NULL;
+	if(large && phys && !virt_request) {
+		virt = alloc_virt_large(ctx, size, phys);
+	}
+
+	if(!virt) {
+		virt = alloc_virt(ctx, size, virt_request, flags & VM_FIXED);
+	}
 	spinlock_release(&ctx->lock);
 	if(!virt) {
 		return NULL;
@@ -210,6 +256,7 @@ void* vm_alloc_at(struct vm_ctx* ctx, vm_alloc_t* vmem, size_t size, void* virt_
 	range->size = size * PAGE_SIZE;
 	range->flags = CLEANUP_FLAGS(flags);
 	insert_range(ctx, range);
+	account(range, 1);
 
 	if(vmem) {
 		memcpy(vmem, range, sizeof(vm_alloc_t));
@@ -221,6 +268,15 @@ void* vm_alloc_at(struct vm_ctx* ctx, vm_alloc_t* vmem, size_t size, void* virt_
 }
 
 void* vm_alloc_many(int num, struct vm_ctx** mctx, vm_alloc_t** mvmem, size_t size, void* phys, int* mflags) {
+	bool large = mflags[0] & VM_LARGE && paging_large_pages && size >= LARGE_PAGES;
+	if(large && !phys) {
+		phys = palloc_aligned(size, LARGE_PAGES);
+	}
+
+	// Offset into a large page the virtual address needs to have, if any
+	uint32_t large_offset = ((uintptr_t)phys / PAGE_SIZE) % LARGE_PAGES;
+	large = large && phys;
+
 	for(int i = 0; i < num; i++) {
 		if(!spinlock_get(&mctx[i]->lock, -1)) {
 			for(int j = i - 1; j >= 0; j++) {
@@ -238,8 +294,19 @@ void* vm_alloc_many(int num, struct vm_ctx** mctx, vm_alloc_t** mvmem, size_t si
 			goto release_and_fail;
 		}
 
+		uint32_t first = 1;
+		if(large) {
+			uint32_t aligned = ALIGN_DOWN(page_num, LARGE_PAGES) + large_offset;
+			page_num = aligned < page_num ? aligned + LARGE_PAGES : aligned;
+			first = 0;
+
+			if(page_num + size > mctx[0]->bitmap.size) {
+				goto release_and_fail;
+			}
+		}
+
 		bool all_free = true;
-		for(int i = 1; i < num; i++) {
+		for(int i = first; i < num; i++) {
 			if(bitmap_get_range(&mctx[i]->bitmap, page_num, size)) {
 				all_free = false;
 				page_num++;
@@ -271,6 +338,7 @@ void* vm_alloc_many(int num, struct vm_ctx** mctx, vm_alloc_t** mvmem, size_t si
 		range->size = size * PAGE_SIZE;
 		range->flags = CLEANUP_FLAGS(mflags[i]);
 		insert_range(lctx, range);
+		account(range, 1);
 		spinlock_release(&lctx->lock);
 
 		if(mvmem && mvmem[i]) {
@@ -381,6 +449,7 @@ void* vm_map(struct vm_ctx* ctx, vm_alloc_t* vmem, struct vm_ctx* src_ctx,
 		pages_mapped++;
 	} while(pages_mapped < size_pages);
 
+	account(range, 1);
 	if(vmem) {
 		memcpy(vmem, range, sizeof(vm_alloc_t));
 	}
@@ -493,6 +562,7 @@ int vm_free(vm_alloc_t* range) {
 	}
 
 	bitmap_clear(&ctx->bitmap, (uintptr_t)range->addr / PAGE_SIZE, RDIV(range->size, PAGE_SIZE));
+	account(range, -1);
 	spinlock_release(lock);
 
 	paging_clear_range(ctx->page_dir, range->addr, range->size);
@@ -542,6 +612,7 @@ void vm_cleanup(struct vm_ctx* ctx) {
 
 	vm_alloc_t* range = ctx->ranges;
 	while(range) {
+		account(range, -1);
 		if(range->flags & VM_FREE) {
 			pfree((uintptr_t)range->phys / PAGE_SIZE, RDIV(range->size, PAGE_SIZE));
 		}
@@ -561,6 +632,7 @@ void* vm_pagedir(struct vm_ctx* ctx) {
 
 		ctx->page_dir = vmem.addr;
 		ctx->page_dir_phys = vmem.phys;
+		__sync_add_and_fetch(&paging_table_pages, 1);
 
 		vm_alloc_t* range = ctx->ranges;
 
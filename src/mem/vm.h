@@ -49,6 +49,16 @@
 // Zero out address space after allocation
 #define VM_ZERO 32
 
+/* Use large pages for the parts of the range that cover them completely. If
+ * no physical address is given, the memory is allocated aligned to them.
+ */
+#define VM_LARGE 64
+
+/* Keep the TLB entries across paging context switches. Only for ranges that
+ * are mapped at the same address with the same contents in every context.
+ */
+#define VM_GLOBAL 128
+
 #define VM_DEBUG 4096
 
 /* Flags to vm_map */
@@ -78,6 +88,12 @@ struct vm_ctx {
 	struct bitmap bitmap;
 	struct vm_alloc* ranges;
 
+	/* Number of pages backed by physical memory in this context, and how many
+	 * of those belong to someone else (ranges without VM_FREE).
+	 */
+	uint32_t resident;
+	uint32_t shared;
+
 	// Address of the actual page tables that will be read by the hardware
 	struct paging_context* page_dir;
 	struct paging_context* page_dir_phys;
@@ -111,6 +127,9 @@ typedef struct vm_alloc {
 
 extern struct vm_ctx vm_kernel_ctx;
 
+// Private user pages across all task contexts
+extern uint32_t vm_user_pages;
+
 void* vm_alloc_at(struct vm_ctx* ctx, vm_alloc_t* vmem, size_t size,
 	void* virt_request, void* phys, int flags);
 
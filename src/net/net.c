@@ -72,8 +72,11 @@ void net_receive(struct net_device* dev, void* data, size_t len) {
 		return;
 	}
 
-	if(buffer_write(dev->recv_buf, data, len) < len) {
+	// Don't store partial packets
+	if(buffer_space(dev->recv_buf) < len) {
 		log(LOG_WARN, "net: Receive buffer overflow, discarding incoming packets\n");
+	} else {
+		buffer_write(dev->recv_buf, data, len);
 	}
 
 	dev->pico_dev.__serving_interrupt = 1;
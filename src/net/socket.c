@@ -47,6 +47,7 @@ struct socket {
 	bool can_write;
 	char read_buffer[READ_BUFFER_SIZE];
 	size_t read_buffer_length;
+	struct poll_waitq waitq;
 
 	enum {
 		SOCK_OPEN,
@@ -122,6 +123,8 @@ static void socket_cb(uint16_t ev, struct pico_socket* pico_sock) {
 		sock->can_write = true;
 		debug("Read done, buffer size %#x\n", sock->read_buffer_length);
 	}
+
+	poll_wake(&sock->waitq);
 	int_enable();
 }
 
@@ -191,7 +194,7 @@ int net_recvfrom(task_t* task, struct recvfrom_data* data, int struct_size) {
 	}
 
 	vm_alloc_t alloc;
-	void* dest = vm_map(VM_KERNEL, &alloc, &task->vmem, data->dest,
+	void* dest = vm_map(VM_KERNEL, &alloc, task->vmem, data->dest,
 		data->size, VM_MAP_USER_ONLY | VM_RW);
 
 	if(!dest) {
@@ -208,9 +211,7 @@ int net_recvfrom(task_t* task, struct recvfrom_data* data, int struct_size) {
 	return read;
 }
 
-static size_t vfs_write_cb(struct vfs_callback_ctx* ctx, void* source, size_t size) {
-	struct socket* sock = (struct socket*)(ctx->fp->mount_instance);
-
+static int wait_writable(struct socket* sock) {
 	int_enable();
 	while(!sock->can_write) {
 		if(sock->state == SOCK_CLOSED) {
@@ -225,6 +226,14 @@ static size_t vfs_write_cb(struct vfs_callback_ctx* ctx, void* source, size_t si
 		scheduler_yield();
 	}
 	int_disable();
+	return 0;
+}
+
+static size_t vfs_write_cb(struct vfs_callback_ctx* ctx, void* source, size_t size) {
+	struct socket* sock = (struct socket*)(ctx->fp->mount_instance);
+	if(wait_writable(sock) < 0) {
+		return -1;
+	}
 
 	if(!spinlock_get(&net_pico_lock, 200)) {
 		sc_errno = EAGAIN;
@@ -237,6 +246,45 @@ static size_t vfs_write_cb(struct vfs_callback_ctx* ctx, void* source, size_t si
 	return written;
 }
 
+/* Queues all segments under one lock so the stack can send them together
+ * (e.g. HTTP headers and body in the same TCP segment).
+ */
+static size_t vfs_writev_cb(struct vfs_callback_ctx* ctx, struct iovec* iov, int iovcnt) {
+	struct socket* sock = (struct socket*)(ctx->fp->mount_instance);
+	if(wait_writable(sock) < 0) {
+		return -1;
+	}
+
+	if(!spinlock_get(&net_pico_lock, 200)) {
+		sc_errno = EAGAIN;
+		return -1;
+	}
+
+	size_t total = 0;
+	for(int i = 0; i < iovcnt; i++) {
+		if(!iov[i].iov_len) {
+			continue;
+		}
+
+		int written = pico_socket_write(sock->pico_socket, iov[i].iov_base, iov[i].iov_len);
+		if(written < 0) {
+			if(!total) {
+				total = -1;
+			}
+			sc_errno = pico_err;
+			break;
+		}
+
+		total += written;
+		if(written < iov[i].iov_len) {
+			break;
+		}
+	}
+
+	spinlock_release(&net_pico_lock);
+	return total;
+}
+
 void* lp = 0;
 
 static int vfs_poll_cb(struct vfs_callback_ctx* ctx, int events) {
@@ -249,6 +297,7 @@ static int vfs_poll_cb(struct vfs_callback_ctx* ctx, int events) {
 	//}
 
 	//debug("poll %#x pico %#x\n", sock, sock->pico_socket);
+	poll_register(ctx, &sock->waitq);
 	if(!spinlock_get(&net_pico_lock, 200)) {
 		sc_errno = EAGAIN;
 		return -1;
@@ -262,6 +311,9 @@ static int vfs_poll_cb(struct vfs_callback_ctx* ctx, int events) {
 		debug("POLLOUT\n");
 		ret |= POLLOUT;
 	}
+	if(sock->state == SOCK_CLOSED || sock->state == SOCK_RESET_BY_PEER) {
+		ret |= POLLHUP;
+	}
 
 	spinlock_release(&net_pico_lock);
 	return ret;
@@ -306,8 +358,10 @@ static vfs_file_t* new_socket_fd(task_t* task, struct pico_socket* pico_sock, in
 	fd->flags = O_RDWR;
 	fd->callbacks.read = vfs_read_cb;
 	fd->callbacks.write = vfs_write_cb;
+	fd->callbacks.writev = vfs_writev_cb;
 	fd->callbacks.poll = vfs_poll_cb;
 	fd->mount_instance = (void*)sock;
+	fd->waitq = &sock->waitq;
 	debug("new_socket_fd, set up %#x pico %#x\n", pico_sock->priv, pico_sock);
 	return fd;
 }
@@ -429,7 +483,7 @@ int net_accept(task_t* task, int sockfd, struct sockaddr* oaddr,
 		 * we can't use the syscall system's automagic kernel memory mapping.
 		 */
 		vm_alloc_t alloc;
-		addr = vm_map(VM_KERNEL, &alloc, &task->vmem, oaddr,
+		addr = vm_map(VM_KERNEL, &alloc, task->vmem, oaddr,
 			*addrlen, VM_MAP_USER_ONLY | VM_RW);
 
 		if(!addr) {
@@ -504,7 +558,7 @@ int net_getpeername(task_t* task, int sockfd, struct sockaddr* osa,
 	 * we can't use the syscall system's automagic kernel memory mapping.
 	 */
 	vm_alloc_t alloc;
-	struct sockaddr* sa = vm_map(VM_KERNEL, &alloc, &task->vmem, osa,
+	struct sockaddr* sa = vm_map(VM_KERNEL, &alloc, task->vmem, osa,
 		*addrlen, VM_MAP_USER_ONLY | VM_RW);
 
 	if(!sa) {
@@ -540,7 +594,7 @@ int net_getsockname(task_t* task, int sockfd, struct sockaddr* oaddr,
 	 * we can't use the syscall system's automagic kernel memory mapping.
 	 */
 	vm_alloc_t alloc;
-	struct sockaddr* addr = vm_map(VM_KERNEL, &alloc, &task->vmem, oaddr,
+	struct sockaddr* addr = vm_map(VM_KERNEL, &alloc, task->vmem, oaddr,
 		*addrlen, VM_MAP_USER_ONLY | VM_RW);
 
 	if(!addr) {
@@ -0,0 +1,144 @@
+/* futex.c: Wait queues on userland addresses
+ * Copyright © 2026 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Userland locks only call into the kernel when they are contended. A thread
+ * that has to wait calls futex_wait with the value it last saw, which puts it
+ * to sleep unless the value has changed in the meantime. Whoever releases the
+ * lock changes the value and then wakes the waiters with futex_wake.
+ *
+ * Waiters are keyed by address space and virtual address, so futexes only
+ * work between threads of the same process.
+ */
+
+#include <tasks/futex.h>
+#include <tasks/scheduler.h>
+#include <fs/poll.h>
+#include <bsp/timer.h>
+#include <errno.h>
+
+#define HASH_SIZE 64
+
+// Only modified with interrupts disabled
+static struct futex_waiter* hash[HASH_SIZE];
+
+static inline struct futex_waiter** hash_slot(struct vm_ctx* ctx, uintptr_t addr) {
+	return &hash[(((uintptr_t)ctx >> 4) ^ (addr >> 2)) % HASH_SIZE];
+}
+
+static void remove_waiter(struct futex_waiter* waiter) {
+	struct futex_waiter** pos = hash_slot(waiter->ctx, waiter->addr);
+	for(; *pos; pos = &(*pos)->next) {
+		if(*pos == waiter) {
+			*pos = waiter->next;
+			break;
+		}
+	}
+}
+
+int task_futex_wait(task_t* task, uintptr_t addr, uint32_t val, int timeout) {
+	if(!addr || addr % sizeof(uint32_t)) {
+		sc_errno = EINVAL;
+		return -1;
+	}
+
+	vm_alloc_t alloc;
+	uint32_t* value = vm_map(VM_KERNEL, &alloc, task->vmem, (void*)addr,
+		sizeof(uint32_t), VM_MAP_USER_ONLY);
+	if(!value) {
+		sc_errno = EFAULT;
+		return -1;
+	}
+
+	uint32_t deadline = poll_deadline(timeout);
+	struct futex_waiter waiter = {
+		.task = task,
+		.ctx = task->vmem,
+		.addr = addr,
+	};
+
+	/* Check the value and queue up atomically, so a wakeup between the two
+	 * can't get lost.
+	 */
+	bool irq = int_save();
+	if(*value != val) {
+		int_restore(irq);
+		vm_free(&alloc);
+		sc_errno = EAGAIN;
+		return -1;
+	}
+
+	struct futex_waiter** slot = hash_slot(waiter.ctx, addr);
+	waiter.next = *slot;
+	*slot = &waiter;
+
+	task->futex_waiter = &waiter;
+	task->sleep_until = deadline;
+	task->task_state = TASK_STATE_SLEEPING;
+	scheduler_yield();
+
+	int_disable();
+	task->futex_waiter = NULL;
+	remove_waiter(&waiter);
+	int_restore(irq);
+	vm_free(&alloc);
+
+	if(waiter.woken) {
+		return 0;
+	}
+
+	sc_errno = timer_get_tick() >= deadline ? ETIMEDOUT : EINTR;
+	return -1;
+}
+
+// Wake up to num threads waiting on addr, returns the number woken
+int task_futex_wake(task_t* task, uintptr_t addr, int num) {
+	int woken = 0;
+	bool irq = int_save();
+
+	struct futex_waiter** pos = hash_slot(task->vmem, addr);
+	while(*pos && woken < num) {
+		struct futex_waiter* waiter = *pos;
+		if(waiter->ctx != task->vmem || waiter->addr != addr) {
+			pos = &waiter->next;
+			continue;
+		}
+
+		*pos = waiter->next;
+		waiter->woken = true;
+		if(waiter->task->task_state == TASK_STATE_SLEEPING) {
+			waiter->task->sleep_until = 0;
+		}
+		woken++;
+	}
+
+	int_restore(irq);
+	return woken;
+}
+
+// Called for tasks killed while waiting on a futex
+void futex_task_exit(task_t* task) {
+	if(!task->futex_waiter) {
+		return;
+	}
+
+	bool irq = int_save();
+	remove_waiter(task->futex_waiter);
+	task->futex_waiter = NULL;
+	int_restore(irq);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+/* Copyright © 2026 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <tasks/task.h>
+
+struct futex_waiter {
+	struct futex_waiter* next;
+	task_t* task;
+	struct vm_ctx* ctx;
+	uintptr_t addr;
+	volatile bool woken;
+};
+
+int task_futex_wait(task_t* task, uintptr_t addr, uint32_t val, int timeout);
+int task_futex_wake(task_t* task, uintptr_t addr, int num);
+void futex_task_exit(task_t* task);
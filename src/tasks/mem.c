@@ -40,7 +40,7 @@ static int task_stack_grow(task_t* task, size_t alloc_size) {
 	}
 
 	uintptr_t stack_lower = TASK_STACK_LOCATION - task->stack_size;
-	if(!vm_alloc_at(&task->vmem, NULL, RDIV(alloc_size, PAGE_SIZE), (void*)(stack_lower - alloc_size), NULL,
+	if(!vm_alloc_at(task->vmem, NULL, RDIV(alloc_size, PAGE_SIZE), (void*)(stack_lower - alloc_size), NULL,
 		VM_USER | VM_RW | VM_FREE | VM_NOCOW | VM_TFORK | VM_ZERO | VM_FIXED)) {
 		return -1;
 	}
@@ -57,6 +57,11 @@ int task_page_fault_cb(task_t* task, void* _addr) {
 	uintptr_t addr = (uintptr_t)_addr;
 	addr = ALIGN_DOWN(addr, PAGE_SIZE);
 
+	// Threads have fixed size stacks allocated by userland
+	if(!task->stack_size) {
+		return -1;
+	}
+
 	uintptr_t stack_lower = TASK_STACK_LOCATION - task->stack_size;
 	if(addr >= stack_lower) {
 		return -1;
@@ -66,9 +71,32 @@ int task_page_fault_cb(task_t* task, void* _addr) {
 	return task_stack_grow(task, alloc_size);
 }
 
-// Free a task and all associated memory
+/* Free a task and all associated memory. The address space goes away with
+ * the last thread of the process, before that only the state and kernel
+ * stack mappings of the thread are removed. The kernel side mappings don't
+ * have VM_FREE set, the physical pages are released through the task side.
+ */
 void task_free(task_t* t) {
-	vm_cleanup(&t->vmem);
+	struct task_shared* shared = t->shared;
+	task_t** pos = &shared->threads;
+	while(*pos && *pos != t) {
+		pos = &(*pos)->thread_next;
+	}
+	if(*pos) {
+		*pos = t->thread_next;
+	}
+
+	vm_free(&t->kernel_maps[0]);
+	vm_free(&t->kernel_maps[1]);
+
+	if(!__sync_sub_and_fetch(&shared->refs, 1)) {
+		vm_cleanup(t->vmem);
+		kfree(shared);
+	} else {
+		vm_free(&t->kernel_allocs[0]);
+		vm_free(&t->kernel_allocs[1]);
+	}
+
 	kfree_array(t->environ, t->envc);
 	kfree_array(t->argv, t->argc);
 	kfree(t);
@@ -76,15 +104,15 @@ void task_free(task_t* t) {
 
 void* task_sbrk(task_t* task, int32_t length) {
 	if(length <= 0) {
-		return task->sbrk;
+		return task->shared->sbrk;
 	}
 
 	length = ALIGN(length, PAGE_SIZE);
 
-	void* virt_addr = task->sbrk;
-	task->sbrk += length;
+	void* virt_addr = task->shared->sbrk;
+	task->shared->sbrk += length;
 
-	if(!vm_alloc_at(&task->vmem, NULL, RDIV(length, PAGE_SIZE), virt_addr, NULL,
+	if(!vm_alloc_at(task->vmem, NULL, RDIV(length, PAGE_SIZE), virt_addr, NULL,
 		VM_USER | VM_RW | VM_NOCOW | VM_TFORK | VM_FREE | VM_FIXED)) {
 		return (void*)-1;
 	}
@@ -135,7 +163,7 @@ void* task_mmap(task_t* task, struct task_mmap_ctx* ctx) {
 		req = (void*)CONFIG_MMAP_BASE;
 	}
 
-	void* addr = vm_alloc_at(&task->vmem, NULL, RDIV(ctx->len, PAGE_SIZE), req, NULL, vaflags);
+	void* addr = vm_alloc_at(task->vmem, NULL, RDIV(ctx->len, PAGE_SIZE), req, NULL, vaflags);
 	if(!addr) {
 		return (void*)-1;
 	}
@@ -164,12 +192,12 @@ char** task_copy_strings(task_t* task, char** array, uint32_t* count) {
 	int i = 0;
 	for(; i < size; i++) {
 		vm_alloc_t vmem;
-		char* old_string = vm_map(VM_KERNEL, &vmem, &task->vmem, array[i], VFS_PATH_MAX, 0);
+		char* old_string = vm_map(VM_KERNEL, &vmem, task->vmem, array[i], VFS_PATH_MAX, 0);
 
 		if(!old_string) {
 			// Retry with shorter length to stay within the page
 			max_length = ALIGN(array[i], PAGE_SIZE) - array[i] - 1;
-			old_string = vm_map(VM_KERNEL, &vmem, &task->vmem, array[i], max_length, 0);
+			old_string = vm_map(VM_KERNEL, &vmem, task->vmem, array[i], max_length, 0);
 			if(!old_string) {
 				return NULL;
 			}
@@ -23,6 +23,7 @@
 
 // FIXME map below binary
 #define TASK_STACK_LOCATION 0xc0000000
+#define TASK_SBRK_BASE 0xf000000
 
 struct task_mmap_ctx {
     void *addr;
@@ -25,15 +25,75 @@
 #include <mem/i386-gdt.h>
 #include <tasks/worker.h>
 
+#define PID_HASH_SIZE 256
+
 static struct scheduler_qentry* current_entry = NULL;
 struct scheduler_qentry idle_qentry;
+
+/* Task unlinked while its kernel stack was still in use by the running
+ * interrupt handler. Cleaned up on the next scheduler_select.
+ */
+static task_t* cleanup_pending = NULL;
 enum scheduler_state scheduler_state;
 
+/* Tasks by PID. A PID can briefly have more than one task during execve, in
+ * which case all but one of them are TASK_STATE_REPLACED.
+ */
+static task_t* pid_hash[PID_HASH_SIZE];
+
 task_t* scheduler_get_current(void) {
 	return current_entry ? current_entry->task : NULL;
 }
 
+static inline void add_child(task_t* parent, task_t* task) {
+	task->parent = parent;
+	task->sibling_prev = NULL;
+	task->sibling_next = parent->children;
+	if(parent->children) {
+		parent->children->sibling_prev = task;
+	}
+	parent->children = task;
+}
+
+static inline void remove_child(task_t* task) {
+	if(task->sibling_prev) {
+		task->sibling_prev->sibling_next = task->sibling_next;
+	} else if(task->parent) {
+		task->parent->children = task->sibling_next;
+	}
+
+	if(task->sibling_next) {
+		task->sibling_next->sibling_prev = task->sibling_prev;
+	}
+	task->sibling_next = NULL;
+	task->sibling_prev = NULL;
+}
+
+static inline void index_task(task_t* task) {
+	task_t** bucket = &pid_hash[task->pid % PID_HASH_SIZE];
+	task->pid_next = *bucket;
+	*bucket = task;
+
+	if(task->parent) {
+		add_child(task->parent, task);
+	}
+}
+
+static inline void unindex_task(task_t* task) {
+	task_t** pos = &pid_hash[task->pid % PID_HASH_SIZE];
+	for(; *pos; pos = &(*pos)->pid_next) {
+		if(*pos == task) {
+			*pos = task->pid_next;
+			break;
+		}
+	}
+
+	remove_child(task);
+}
+
 void scheduler_add(task_t* task) {
+	index_task(task);
+
 	struct scheduler_qentry* entry = kmalloc(sizeof(struct scheduler_qentry));
 	entry->task = task;
 	entry->worker = NULL;
@@ -51,7 +111,8 @@ void scheduler_add(task_t* task) {
 		current_entry->next = entry;
 	}
 
-	if(task->ctty) {
+	// Threads don't take over the terminal, the process stays in front of it
+	if(task->ctty && task->pid == task->shared->pid) {
 		task->ctty->fg_task = task;
 	}
 }
@@ -75,24 +136,33 @@ void scheduler_add_worker(worker_t* worker) {
 }
 
 task_t* scheduler_find(uint32_t pid) {
-	struct scheduler_qentry* start = current_entry;
-	for(struct scheduler_qentry* entry = start; entry->next != start; entry = entry->next) {
-		task_t* t = entry->task;
-		if(!t) {
-			continue;
-		}
-
+	for(task_t* t = pid_hash[pid % PID_HASH_SIZE]; t; t = t->pid_next) {
 		if(t->pid == pid && t->task_state != TASK_STATE_REPLACED &&
 			t->task_state != TASK_STATE_TERMINATED &&
 			t->task_state != TASK_STATE_REAPED) {
 			return t;
 		}
+	}
+	return NULL;
+}
 
-		if(entry->next == entry) {
-			break;
+/* Hand all children of a task to another one, used when a task exits (to
+ * init) or is replaced by execve. With to set to NULL, the children are
+ * orphaned.
+ */
+void scheduler_move_children(task_t* from, task_t* to) {
+	task_t* next;
+	for(task_t* child = from->children; child; child = next) {
+		next = child->sibling_next;
+		if(to) {
+			add_child(to, child);
+		} else {
+			child->parent = NULL;
+			child->sibling_next = NULL;
+			child->sibling_prev = NULL;
 		}
 	}
-	return NULL;
+	from->children = NULL;
 }
 
 void scheduler_yield() {
@@ -109,7 +179,13 @@ static inline void unlink(struct scheduler_qentry* entry) {
 	entry->prev->next = entry->next;
 
 	if(entry->task) {
-		task_cleanup(entry->task);
+		unindex_task(entry->task);
+
+		if(entry == current_entry) {
+			cleanup_pending = entry->task;
+		} else {
+			task_cleanup(entry->task);
+		}
 	}
 
 	// FIXME Free entry
@@ -201,6 +277,11 @@ isf_t* scheduler_select(isf_t* last_regs) {
 		return NULL;
 	}
 
+	if(cleanup_pending) {
+		task_cleanup(cleanup_pending);
+		cleanup_pending = NULL;
+	}
+
 	struct scheduler_qentry* qe = find_runnable_qentry(current_entry);
 	if(qe) {
 		current_entry = qe;
@@ -216,6 +297,7 @@ ret:
 
 		// FIXME per-task storage of SSE state needed?
 		//memcpy(sse_state, new_task->state->sse_state, 512);
+		gdt_set_tls(current_entry->task->tls);
 		gdt_set_tss(current_entry->task->kernel_stack + KERNEL_STACK_SIZE);
 		return current_entry->task->state;
 	} else if(current_entry->worker) {
@@ -226,13 +308,13 @@ ret:
 }
 
 static size_t sfs_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
-	if(ctx->fp->offset) {
+	if(ctx->offset) {
 		return 0;
 	}
 
 	struct scheduler_qentry* entry = current_entry;
 	size_t rsize = 0;
-	sysfs_printf("# pid uid gid ppid state name memory tty\n")
+	sysfs_printf("# pid uid gid ppid state name rss tty\n")
 
 	do {
 		task_t* task = entry->task;
@@ -258,21 +340,13 @@ static size_t sfs_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
 			default: state = 'U'; break;
 		}
 
-		vm_alloc_t* range = task->vmem.ranges;
-		uint32_t mem_alloc = 0;
-		for(; range; range = range->next) {
-			if(range->flags & VM_TFORK) {
-				mem_alloc += range->size;
-			}
-		}
-
 		sysfs_printf("%d %d %d %d %c \"%s", task->pid, task->euid, task->gid,
 			ppid, state, task->name);
 
 		for(int i = 1; i < task->argc; i++) {
 			sysfs_printf(" %s", task->argv[i]);
 		}
-		sysfs_printf("\" %d %s\n", mem_alloc, task->ctty ? task->ctty->path : "-");
+		sysfs_printf("\" %d %s\n", task->vmem->resident * PAGE_SIZE, task->ctty ? task->ctty->path : "-");
 
 	next:
 		entry = entry->next;
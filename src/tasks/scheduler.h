@@ -40,6 +40,7 @@ extern enum scheduler_state scheduler_state;
 void scheduler_add(task_t *task);
 void scheduler_add_worker(worker_t* worker);
 task_t* scheduler_find(uint32_t pid);
+void scheduler_move_children(task_t* from, task_t* to);
 void scheduler_store_isf(isf_t* last_regs);
 task_t* scheduler_get_current(void);
 void scheduler_yield(void);
@@ -37,8 +37,26 @@ int task_signal(task_t* task, task_t* source, int sig) {
 		return -1;
 	}
 
-	if(sig == SIGKILL || sig == SIGSTOP) {
-		task->task_state = (sig == SIGKILL) ? TASK_STATE_TERMINATED : TASK_STATE_STOPPED;
+	/* The initial thread can exit before the others. Signals sent to the
+	 * process then go to one of the remaining threads.
+	 */
+	if(!task_alive(task)) {
+		for(task_t* t = task->shared->threads; t; t = t->thread_next) {
+			if(task_alive(t)) {
+				task = t;
+				break;
+			}
+		}
+	}
+
+	// Terminating signals take down all threads of the process
+	if(sig == SIGKILL) {
+		task_terminate(task, task->exit_code);
+		return 0;
+	}
+
+	if(sig == SIGSTOP) {
+		task->task_state = TASK_STATE_STOPPED;
 		task->interrupt_yield = true;
 		return 0;
 	}
@@ -60,7 +78,7 @@ int task_signal(task_t* task, task_t* source, int sig) {
 		iret->user_esp -= 11 * sizeof(uint32_t);
 
 		vm_alloc_t alloc;
-		uint32_t* user_stack = vm_map(VM_KERNEL, &alloc, &task->vmem, iret->user_esp,
+		uint32_t* user_stack = vm_map(VM_KERNEL, &alloc, task->vmem, iret->user_esp,
 			sizeof(uint32_t) * 11, VM_MAP_USER_ONLY | VM_RW);
 
 		if(!user_stack) {
@@ -101,9 +119,7 @@ int task_signal(task_t* task, task_t* source, int sig) {
 		return 0;
 	}
 
-	task->task_state = TASK_STATE_TERMINATED;
-	task->exit_code = 0x100 | sig;
-	task->interrupt_yield = true;
+	task_terminate(task, 0x100 | sig);
 	return 0;
 }
 
@@ -134,7 +134,7 @@ static void int_handler(task_t* task, isf_t* state, int num) {
 			call_fail();
 		}
 
-		args[i] = (uint32_t)vm_map(VM_KERNEL, &vmem[i], &task->vmem,
+		args[i] = (uint32_t)vm_map(VM_KERNEL, &vmem[i], task->vmem,
 			(void*)args[i], ptr_sizes[i], map_flags);
 
 		if(unlikely(!args[i])) {
@@ -225,7 +225,7 @@ static inline char* arg_type_name(int flags) {
 }
 
 static size_t sfs_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
-	if(ctx->fp->offset) {
+	if(ctx->offset) {
 		return 0;
 	}
 
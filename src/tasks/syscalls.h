@@ -23,10 +23,12 @@
 #include <tasks/signal.h>
 #include <tasks/task.h>
 #include <tasks/wait.h>
+#include <tasks/futex.h>
 #include <net/socket.h>
 #include <fs/vfs.h>
 #include <fs/pipe.h>
 #include <fs/poll.h>
+#include <fs/epoll.h>
 #include <fs/mount.h>
 #include <time.h>
 
@@ -326,4 +328,72 @@ const struct syscall_definition syscall_table[] = {
 	// 53
 	{"sleep", (syscall_cb)task_sleep, 0,
 		SCA_POINTER, 0, 0, sizeof(struct timeval)},
+
+	// 54
+	{"readv", (syscall_cb)vfs_readv, 0,
+		SCA_INT, SCA_POINTER | SCA_SIZE_IN_2 | SCA_NULLOK, SCA_INT, sizeof(struct iovec)},
+
+	// 55
+	{"writev", (syscall_cb)vfs_writev, 0,
+		SCA_INT, SCA_POINTER | SCA_SIZE_IN_2 | SCA_NULLOK, SCA_INT, sizeof(struct iovec)},
+
+	// 56
+	{"preadv", (syscall_cb)vfs_preadv, 0,
+		SCA_POINTER, 0, 0, sizeof(struct vfs_prw_data)},
+
+	// 57
+	{"pwritev", (syscall_cb)vfs_pwritev, 0,
+		SCA_POINTER, 0, 0, sizeof(struct vfs_prw_data)},
+
+	// 58
+	{"splice", (syscall_cb)vfs_splice, 0,
+		SCA_POINTER, 0, 0, sizeof(struct vfs_splice_data)},
+
+	// 59
+	{"epoll_create", (syscall_cb)vfs_epoll_create, 0,
+		SCA_INT, 0, 0, 0},
+
+	// 60
+	{"epoll_ctl", (syscall_cb)vfs_epoll_ctl, 0,
+		SCA_POINTER, 0, 0, sizeof(struct vfs_epoll_ctl_data)},
+
+	// 61
+	{"epoll_wait", (syscall_cb)vfs_epoll_wait, 0,
+		SCA_POINTER, 0, 0, sizeof(struct vfs_epoll_wait_data)},
+
+	// 62
+	{"rename", (syscall_cb)vfs_rename, 0,
+		SCA_STRING, SCA_STRING, 0, 0},
+
+	// 63
+	{"symlink", (syscall_cb)vfs_symlink, 0,
+		SCA_STRING, SCA_STRING, 0, 0},
+
+	// 64
+	{"fsync", (syscall_cb)vfs_fsync, 0,
+		SCA_INT, SCA_INT, 0, 0},
+
+	// 65
+	{"sync", (syscall_cb)vfs_sync, 0,
+		0, 0, 0, 0},
+
+	// 66
+	{"clone", (syscall_cb)task_clone, SCF_STATE,
+		SCA_INT, SCA_INT, SCA_INT, 0},
+
+	// 67
+	{"futex_wait", (syscall_cb)task_futex_wait, 0,
+		SCA_INT, SCA_INT, SCA_INT, 0},
+
+	// 68
+	{"futex_wake", (syscall_cb)task_futex_wake, 0,
+		SCA_INT, SCA_INT, 0, 0},
+
+	// 69
+	{"thread_exit", (syscall_cb)task_thread_exit, 0,
+		SCA_INT, 0, 0, 0},
+
+	// 70
+	{"set_tls", (syscall_cb)task_set_tls, 0,
+		SCA_INT, 0, 0, 0},
 };
@@ -21,6 +21,7 @@
 #include <tasks/execdata.h>
 #include <tasks/syscall.h>
 #include <tasks/wait.h>
+#include <tasks/futex.h>
 #include <mem/kmalloc.h>
 #include <mem/mem.h>
 #include <mem/vm.h>
@@ -29,6 +30,7 @@
 #include <fs/vfs.h>
 #include <fs/sysfs.h>
 #include <fs/pipe.h>
+#include <fs/poll.h>
 #include <string.h>
 #include <errno.h>
 #include <panic.h>
@@ -36,34 +38,60 @@
 static vm_alloc_t loader_alloc;
 static uint32_t highest_pid = 0;
 static size_t sfs_read(struct vfs_callback_ctx* ctx, void* dest, size_t size);
+static size_t sfs_maps_read(struct vfs_callback_ctx* ctx, void* dest, size_t size);
+
+static void set_shared(task_t* task, struct task_shared* shared) {
+	task->shared = shared;
+	task->vmem = &shared->vmem;
+	task->files = shared->files;
+	task->cwd = shared->cwd;
+	task->signal_handlers = shared->signal_handlers;
+
+	__sync_add_and_fetch(&shared->refs, 1);
+	__sync_add_and_fetch(&shared->live, 1);
+	task->thread_next = shared->threads;
+	shared->threads = task;
+}
 
+/* Allocate a task. With shared set, the task becomes a new thread of that
+ * process, otherwise it gets a new address space.
+ */
 static task_t* alloc_task(task_t* parent, uint32_t pid, char name[VFS_NAME_MAX],
-	char** environ, uint32_t envc, char** argv, uint32_t argc) {
+	char** environ, uint32_t envc, char** argv, uint32_t argc, struct task_shared* shared) {
 
 	task_t* task = zmalloc(sizeof(task_t));
-	vm_new(&task->vmem, NULL);
+	task->pid = pid ? pid : __sync_add_and_fetch(&highest_pid, 1);
 
-	/* Map parts of the kernel marked as UL_VISIBLE into the task address
-	 * space (But readable only to PL0). These are the functions and data
-	 * structures used in the interrupt handler before the paging context is
-	 * switched.
-	 */
-	if(!vm_alloc_at(&task->vmem, NULL, RDIV(UL_VISIBLE_SIZE, PAGE_SIZE),
-		UL_VISIBLE_START, UL_VISIBLE_START, VM_FIXED)) {
+	if(shared) {
+		set_shared(task, shared);
+	} else {
+		shared = zmalloc(sizeof(struct task_shared));
+		shared->pid = task->pid;
+		set_shared(task, shared);
+		vm_new(task->vmem, NULL);
+
+		if(parent) {
+			memcpy(task->cwd, parent->cwd, VFS_PATH_MAX);
+		} else {
+			task->cwd[0] = '/';
+		}
 
-		return NULL;
+		/* Map parts of the kernel marked as UL_VISIBLE into the task address
+		 * space (But readable only to PL0). These are the functions and data
+		 * structures used in the interrupt handler before the paging context
+		 * is switched. They are identical in all contexts, so keep them global.
+		 */
+		if(!vm_alloc_at(task->vmem, NULL, RDIV(UL_VISIBLE_SIZE, PAGE_SIZE),
+			UL_VISIBLE_START, UL_VISIBLE_START, VM_FIXED | VM_GLOBAL)) {
+
+			return NULL;
+		}
 	}
 
-	task->pid = pid ? pid : __sync_add_and_fetch(&highest_pid, 1);
 	task->task_state = TASK_STATE_RUNNING;
 	task->interrupt_yield = false;
 
 	strlcpy(task->name, name, VFS_NAME_MAX);
-	if(parent) {
-		memcpy(task->cwd, parent->cwd, VFS_PATH_MAX);
-	} else {
-		task->cwd[0] = '/';
-	}
 
 	task->parent = parent;
 	task->envc = envc;
@@ -90,7 +118,17 @@ static task_t* alloc_task(task_t* parent, uint32_t pid, char name[VFS_NAME_MAX],
 	};
 
 	task->sysfs_file = sysfs_add_file(tname, &sfs_cb);
-	task->sysfs_file->meta = (void*)task;
+	if(task->sysfs_file) {
+		task->sysfs_file->meta = (void*)task;
+	}
+
+	char mname[20];
+	snprintf(mname, 20, "maps/%d", task->pid);
+	sfs_cb.read = sfs_maps_read;
+	task->sysfs_maps = sysfs_add_file(mname, &sfs_cb);
+	if(task->sysfs_maps) {
+		task->sysfs_maps->meta = (void*)task;
+	}
 	return task;
 }
 
@@ -100,7 +138,7 @@ static inline int map_task(task_t* task) {
 	vm_alloc_t* mvmem[] = {&vmem1, &vmem2};
 
 	int flags[] = {VM_RW, VM_FREE};
-	struct vm_ctx* ctx[] = {VM_KERNEL, &task->vmem};
+	struct vm_ctx* ctx[] = {VM_KERNEL, task->vmem};
 
 	if(!vm_alloc_many(2, ctx, mvmem, 1, NULL, flags)) {
 		kfree(task);
@@ -108,6 +146,8 @@ static inline int map_task(task_t* task) {
 	}
 
 	task->state = vmem1.addr;
+	task->kernel_maps[0] = vmem1;
+	task->kernel_allocs[0] = vmem2;
 	bzero(task->state, sizeof(isf_t));
 
 	// Kernel stack used during interrupts while this task is running
@@ -119,6 +159,8 @@ static inline int map_task(task_t* task) {
 	}
 
 	task->kernel_stack = vmem1.addr;
+	task->kernel_maps[1] = vmem1;
+	task->kernel_allocs[1] = vmem2;
 	return 0;
 }
 
@@ -128,7 +170,7 @@ static inline int map_task(task_t* task) {
 task_t* task_new(task_t* parent, uint32_t pid, char name[VFS_NAME_MAX],
 	char** environ, uint32_t envc, char** argv, uint32_t argc) {
 
-	task_t* task = alloc_task(parent, pid, name, environ, envc, argv, argc);
+	task_t* task = alloc_task(parent, pid, name, environ, envc, argv, argc, NULL);
 	if(!task) {
 		return NULL;
 	}
@@ -140,7 +182,7 @@ task_t* task_new(task_t* parent, uint32_t pid, char name[VFS_NAME_MAX],
 	// Allocate initial stack. Will dynamically grow, so be conservative.
 	task->stack_size = PAGE_SIZE * 2;
 
-	if(!vm_alloc_at(&task->vmem, NULL, 2, (void*)TASK_STACK_LOCATION - task->stack_size, NULL,
+	if(!vm_alloc_at(task->vmem, NULL, 2, (void*)TASK_STACK_LOCATION - task->stack_size, NULL,
 		VM_USER | VM_RW | VM_FREE | VM_TFORK | VM_FIXED)) {
 		return NULL;
 	}
@@ -154,25 +196,26 @@ task_t* task_new(task_t* parent, uint32_t pid, char name[VFS_NAME_MAX],
 	kfree(abs_path);
 
 	// Load ELF binary loader into task memory space
-	if(vm_copy(&task->vmem, 0x500000, NULL, &loader_alloc, VM_USER | VM_RW | VM_TFORK | VM_FREE) < 0) {
+	if(vm_copy(task->vmem, 0x500000, NULL, &loader_alloc, VM_USER | VM_RW | VM_TFORK | VM_FREE) < 0) {
 		return NULL;
 	}
 
 	task->entry = 0x500000;
 	// FIXME
-	task->sbrk = 0xf000000;
+	task->shared->sbrk = (void*)TASK_SBRK_BASE;
 
 	task_setup_execdata(task);
 
 	task->state->ds = GDT_SEG_DATA_PL3;
-	task->state->cr3 = (uint32_t)vm_pagedir(&task->vmem);
+	task->state->gs = GDT_SEG_TLS_PL3;
+	task->state->cr3 = (uint32_t)vm_pagedir(task->vmem);
 	task->state->ebp = 0;
 	task->state->esp = (void*)TASK_STACK_LOCATION - sizeof(iret_t);
 
 	// Temporarily map part of the userland stack into kernel memory to set up
 	// stack for initial iret
 	vm_alloc_t alloc;
-	iret_t* iret = vm_map(VM_KERNEL, &alloc, &task->vmem, task->state->esp, sizeof(iret_t), 0);
+	iret_t* iret = vm_map(VM_KERNEL, &alloc, task->vmem, task->state->esp, sizeof(iret_t), 0);
 
 	iret->eip = task->entry;
 	iret->cs = GDT_SEG_CODE_PL3;
@@ -184,6 +227,18 @@ task_t* task_new(task_t* parent, uint32_t pid, char name[VFS_NAME_MAX],
 	return task;
 }
 
+/* The initial thread of the process, which stands for it towards its parent
+ * and children. NULL once it has been freed.
+ */
+task_t* task_get_leader(task_t* task) {
+	for(task_t* t = task->shared->threads; t; t = t->thread_next) {
+		if(t->pid == task->shared->pid) {
+			return t;
+		}
+	}
+	return NULL;
+}
+
 /* Called by the scheduler whenever a task terminates from the userland
  * perspective. For example, this is called when a task changes to
  * TASK_STATE_TERMINATED, but not for TASK_STATE_REPLACED, since that task
@@ -191,27 +246,74 @@ task_t* task_new(task_t* parent, uint32_t pid, char name[VFS_NAME_MAX],
  */
 void task_userland_eol(task_t* t) {
 	t->task_state = TASK_STATE_ZOMBIE;
+	poll_task_exit(t);
+	futex_task_exit(t);
+
+	if(t->clear_tid) {
+		vm_alloc_t alloc;
+		uint32_t* tid = vm_map(VM_KERNEL, &alloc, t->vmem, t->clear_tid,
+			sizeof(uint32_t), VM_MAP_USER_ONLY | VM_RW);
+
+		if(tid) {
+			*tid = 0;
+			vm_free(&alloc);
+			task_futex_wake(t, (uintptr_t)t->clear_tid, INT32_MAX);
+		}
+	}
 
-	task_t* init = scheduler_find(1);
-	for(struct scheduler_qentry* e = t->qentry->next; e->next != t->qentry->next; e = e->next) {
-		if(e->task && e->task->parent == t) {
-			e->task->parent = init;
+	// Files are shared by the threads, so only close them with the last one
+	bool last = !__sync_sub_and_fetch(&t->shared->live, 1);
+	if(last) {
+		vfs_close_all(t);
+	}
+
+	// Children belong to the process, so keep them until its last thread is gone
+	if(last) {
+		task_t* init = scheduler_find(1);
+		for(task_t* i = t->shared->threads; i; i = i->thread_next) {
+			scheduler_move_children(i, init != i ? init : NULL);
 		}
 	}
 
-	if(t->parent) {
-		if(t->parent->task_state == TASK_STATE_WAITING) {
-			wait_finish(t->parent, t);
+	/* The initial thread stands for the process towards its parent. If it
+	 * exits while other threads are still running, it stays a zombie, and the
+	 * parent only gets notified once the last thread is gone.
+	 */
+	task_t* leader = t;
+	if(t->pid != t->shared->pid) {
+		t->task_state = TASK_STATE_REAPED;
+		if(!last) {
+			return;
+		}
+
+		leader = task_get_leader(t);
+		if(!leader || leader->task_state != TASK_STATE_ZOMBIE) {
+			return;
+		}
+		leader->exit_code = t->exit_code;
+	} else if(!last) {
+		return;
+	}
+
+	if(leader->parent) {
+		// Any thread of the parent process can be waiting for the child
+		for(task_t* i = leader->parent->shared->threads; i; i = i->thread_next) {
+			if(i->task_state == TASK_STATE_WAITING) {
+				wait_finish(i, leader);
+				if(leader->task_state == TASK_STATE_REAPED) {
+					break;
+				}
+			}
 		}
-		task_signal(t->parent, t, SIGCHLD);
+		task_signal(leader->parent, leader, SIGCHLD);
 	}
 
-	if(t->ctty && t == t->ctty->fg_task) {
-		t->ctty->fg_task = t->parent;
+	if(leader->ctty && leader == leader->ctty->fg_task) {
+		leader->ctty->fg_task = leader->parent;
 	}
 
-	if(t->strace_observer && t->strace_fd) {
-		vfs_close(t->strace_observer, t->strace_fd);
+	if(leader->strace_observer && leader->strace_fd) {
+		vfs_close(leader->strace_observer, leader->strace_fd);
 	}
 }
 
@@ -220,17 +322,29 @@ void task_userland_eol(task_t* t) {
  * to userspace.
  */
 void task_cleanup(task_t* t) {
-	// Could have already been removed by execve
-	if(t->sysfs_file) {
-		sysfs_rm_file(t->sysfs_file);
+	// Could have already been removed by execve, in which case these are NULL
+	sysfs_rm_file(t->sysfs_file);
+	sysfs_rm_file(t->sysfs_maps);
+
+	// Hand the terminal back instead of leaving it pointing at freed memory
+	if(t->ctty && t->ctty->fg_task == t) {
+		task_t* fg = t->parent;
+		for(task_t* i = t->shared->threads; i; i = i->thread_next) {
+			if(i != t && i->pid == t->shared->pid && task_alive(i)) {
+				fg = i;
+			}
+		}
+		t->ctty->fg_task = fg;
 	}
 
 	task_free(t);
 }
 
 static task_t* _fork(task_t* to_fork, isf_t* state) {
-	task_t* task = alloc_task(to_fork, 0, to_fork->name, to_fork->environ,
-		to_fork->envc, to_fork->argv, to_fork->argc);
+	// The child belongs to the process, not just to the thread that forked
+	task_t* parent = task_get_leader(to_fork);
+	task_t* task = alloc_task(parent ? parent : to_fork, 0, to_fork->name,
+		to_fork->environ, to_fork->envc, to_fork->argv, to_fork->argc, NULL);
 
 	task->uid = to_fork->uid;
 	task->gid = to_fork->gid;
@@ -238,13 +352,15 @@ static task_t* _fork(task_t* to_fork, isf_t* state) {
 	task->egid = to_fork->egid;
 	task->ctty = to_fork->ctty;
 	task->stack_size = to_fork->stack_size;
-	task->sbrk = to_fork->sbrk;
+	task->shared->sbrk = to_fork->shared->sbrk;
+	task->tls = to_fork->tls;
 
 	memcpy(task->cwd, to_fork->cwd, VFS_PATH_MAX);
 	memcpy(task->binary_path, to_fork->binary_path, sizeof(task->binary_path));
 	memcpy(task->files, to_fork->files, sizeof(vfs_file_t) * CONFIG_VFS_MAX_OPENFILES);
+	vfs_fork_files(task);
 
-	if(vm_clone(&task->vmem, &to_fork->vmem) != 0) {
+	if(vm_clone(task->vmem, to_fork->vmem) != 0) {
 		return NULL;
 	}
 
@@ -266,7 +382,7 @@ static task_t* _fork(task_t* to_fork, isf_t* state) {
 	intptr_t diff = state->esp - to_fork->kernel_stack;
 	task->state->esp = task->kernel_stack + diff;
 
-	task->state->cr3 = (uint32_t)vm_pagedir(&task->vmem);
+	task->state->cr3 = (uint32_t)vm_pagedir(task->vmem);
 
 	/* Set syscall return values for the forked task – need to set here since
 	 * the regular syscall return handling only affects the main process.
@@ -287,13 +403,87 @@ int task_fork(task_t* to_fork, isf_t* state) {
 	}
 }
 
+/* Create a new thread in the address space of task. It starts out as a copy
+ * of the calling thread, returning 0 from the syscall on the given user stack.
+ */
+int task_clone(task_t* task, isf_t* state, void* stack, void* tls, uint32_t* clear_tid) {
+	if(!stack) {
+		sc_errno = EINVAL;
+		return -1;
+	}
+
+	task_t* thread = alloc_task(NULL, 0, task->name, task->environ,
+		task->envc, task->argv, task->argc, task->shared);
+	if(!thread) {
+		sc_errno = ENOMEM;
+		return -1;
+	}
+
+	thread->uid = task->uid;
+	thread->gid = task->gid;
+	thread->euid = task->euid;
+	thread->egid = task->egid;
+	thread->ctty = task->ctty;
+	thread->entry = task->entry;
+	thread->signal_mask = task->signal_mask;
+	thread->tls = tls;
+	thread->clear_tid = clear_tid;
+	memcpy(thread->binary_path, task->binary_path, sizeof(thread->binary_path));
+
+	if(map_task(thread) != 0) {
+		sc_errno = ENOMEM;
+		return -1;
+	}
+
+	memcpy(thread->state, state, sizeof(isf_t));
+	memcpy(thread->kernel_stack, task->kernel_stack, KERNEL_STACK_SIZE);
+
+	intptr_t diff = state->esp - task->kernel_stack;
+	thread->state->esp = thread->kernel_stack + diff;
+	((iret_t*)thread->state->esp)->user_esp = stack;
+
+	thread->state->cr3 = (uint32_t)vm_pagedir(thread->vmem);
+	thread->state->eax = 0;
+	thread->state->ebx = 0;
+
+	scheduler_add(thread);
+	return thread->pid;
+}
+
+// Terminate all threads of the process task belongs to
+void task_terminate(task_t* task, int exit_code) {
+	for(task_t* t = task->shared->threads; t; t = t->thread_next) {
+		if(!task_alive(t)) {
+			continue;
+		}
+
+		t->task_state = TASK_STATE_TERMINATED;
+		t->exit_code = exit_code;
+		t->interrupt_yield = true;
+	}
+}
+
 int task_exit(task_t* task, int code) {
+	task_terminate(task, code << 8);
+	return 0;
+}
+
+/* Exit only the calling thread. The process exits once its last thread is
+ * gone, see task_userland_eol.
+ */
+int task_thread_exit(task_t* task, int code) {
 	task->task_state = TASK_STATE_TERMINATED;
 	task->exit_code = code << 8;
 	task->interrupt_yield = true;
 	return 0;
 }
 
+int task_set_tls(task_t* task, void* tls) {
+	task->tls = tls;
+	gdt_set_tls(tls);
+	return 0;
+}
+
 // Task setuid/setgid
 int task_setid(task_t* task, int which, int id) {
 	if(task->euid != 0) {
@@ -301,18 +491,22 @@ int task_setid(task_t* task, int which, int id) {
 		return -1;
 	}
 
-	switch(which) {
-		case 0:
-			task->uid = id;
-			task->euid = id;
-			return 0;
-		case 1:
-			task->gid = id;
-			task->egid = id;
-			return 0;
+	if(which != 0 && which != 1) {
+		sc_errno = EINVAL;
+		return -1;
+	}
+
+	// IDs are per process, so change them for all threads
+	for(task_t* t = task->shared->threads; t; t = t->thread_next) {
+		if(which == 0) {
+			t->uid = id;
+			t->euid = id;
+		} else {
+			t->gid = id;
+			t->egid = id;
+		}
 	}
-	sc_errno = EINVAL;
-	return -1;
+	return 0;
 }
 
 int task_execve(task_t* task, char* path, char** argv, char** env) {
@@ -329,12 +523,38 @@ int task_execve(task_t* task, char* path, char** argv, char** env) {
 	 * function is done for the scheduler to invoke it. Since task_new adds a
 	 * new sysfs file, remove the old one here to avoid conflicts.
 	 */
-	if(task->sysfs_file) {
-		sysfs_rm_file(task->sysfs_file);
-	}
+	sysfs_rm_file(task->sysfs_file);
+	sysfs_rm_file(task->sysfs_maps);
 	task->sysfs_file = NULL;
+	task->sysfs_maps = NULL;
+
+	/* The new program replaces the whole process, so the other threads go
+	 * away, and the new task takes over the identity of the initial thread.
+	 */
+	task_t* leader = task;
+	for(task_t* t = task->shared->threads; t; t = t->thread_next) {
+		if(t->pid == task->shared->pid) {
+			leader = t;
+		}
+
+		/* A zombie initial thread has to go as well, as new_task takes over
+		 * its PID and place among the parent's children.
+		 */
+		if(t == task || (!task_alive(t) && t->task_state != TASK_STATE_ZOMBIE)) {
+			continue;
+		}
+
+		poll_task_exit(t);
+		futex_task_exit(t);
+		sysfs_rm_file(t->sysfs_file);
+		sysfs_rm_file(t->sysfs_maps);
+		t->sysfs_file = NULL;
+		t->sysfs_maps = NULL;
+		t->task_state = TASK_STATE_REPLACED;
+		scheduler_move_children(t, task);
+	}
 
-	task_t* new_task = task_new(task->parent, task->pid, path, __env, __envc, __argv, __argc);
+	task_t* new_task = task_new(leader->parent, task->shared->pid, path, __env, __envc, __argv, __argc);
 	kfree_array(__argv, __argc);
 	kfree_array(__env, __envc);
 
@@ -357,6 +577,7 @@ int task_execve(task_t* task, char* path, char** argv, char** env) {
 		}
 	}
 
+	scheduler_move_children(task, new_task);
 	scheduler_add(new_task);
 	task->task_state = TASK_STATE_REPLACED;
 	task->interrupt_yield = true;
@@ -433,7 +654,7 @@ void task_init(void) {
 }
 
 static size_t sfs_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
-	if(ctx->fp->offset) {
+	if(ctx->offset) {
 		return 0;
 	}
 
@@ -447,11 +668,13 @@ static size_t sfs_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
 	sysfs_printf("%-10s: %d\n", "egid", task->egid);
 	sysfs_printf("%-10s: %s\n", "name", task->name);
 	sysfs_printf("%-10s: %p\n", "entry", task->entry);
-	sysfs_printf("%-10s: %p\n", "sbrk", task->sbrk);
+	sysfs_printf("%-10s: %p\n", "sbrk", task->shared->sbrk);
 	sysfs_printf("%-10s: %d\n", "state", task->task_state);
 	sysfs_printf("%-10s: %s\n", "cwd", task->cwd);
 	sysfs_printf("%-10s: %s\n", "tty", task->ctty ? task->ctty->path : "");
 	sysfs_printf("%-10s: %d\n", "argc", task->argc);
+	sysfs_printf("%-10s: %u\n", "rss", task->vmem->resident * PAGE_SIZE);
+	sysfs_printf("%-10s: %u\n", "shared", task->vmem->shared * PAGE_SIZE);
 
 	sysfs_printf("%-10s: ", "argv");
 	for(int i = 0; i < task->argc; i++) {
@@ -474,16 +697,62 @@ static size_t sfs_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
 		sysfs_printf("%3d %-10s %s\n", i,
 			vfs_flags_verbose(task->files[i].flags), task->files[i].path);
 	}
+	return rsize;
+}
+
+static const char* range_backing(task_t* task, vm_alloc_t* range) {
+	if(!(range->flags & VM_USER)) {
+		return "[kernel]";
+	}
+
+	uintptr_t addr = (uintptr_t)range->addr;
+	if(addr >= TASK_STACK_LOCATION - task->stack_size && addr < TASK_STACK_LOCATION) {
+		return "[stack]";
+	}
+	if(addr >= TASK_SBRK_BASE && range->addr < task->shared->sbrk) {
+		return "[heap]";
+	}
+	if(range->addr == task->entry) {
+		return "[loader]";
+	}
+	if(range->shards) {
+		return "[mapped]";
+	}
+	return range->flags & VM_FREE ? "[anon]" : "[phys]";
+}
+
+/* One line per range: Address range, permissions (r, w, u for user, p/s for
+ * private or shared), resident pages, what happens to the range on fork and
+ * what it is used for. All memory is mapped when it is allocated and copied
+ * right away on fork, so there is no copy-on-write state to report.
+ */
+static size_t sfs_maps_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
+	if(ctx->offset) {
+		return 0;
+	}
 
-	sysfs_printf("\nTask memory:\n");
-	vm_alloc_t* range = task->vmem.ranges;
-	for(; range; range = range->next) {
-		sysfs_printf("%p - %p  ->  %p - %p length %#-6lx\n",
-			range->addr, range->addr + range->size - 1,
-			range->phys, range->phys + range->size - 1,
-			range->size);
+	size_t rsize = 0;
+	task_t* task = (task_t*)ctx->fp->meta;
+	if(!spinlock_get(&task->vmem->lock, -1)) {
+		return 0;
 	}
 
+	for(vm_alloc_t* range = task->vmem->ranges; range; range = range->next) {
+		uint32_t resident = range->phys ? RDIV(range->size, PAGE_SIZE) : 0;
+		for(struct vm_alloc_shard* shard = range->shards; shard; shard = shard->next) {
+			resident++;
+		}
+
+		sysfs_printf("%08x-%08x r%c%c%c %6u %-4s %s\n",
+			(uint32_t)range->addr, (uint32_t)range->addr + range->size,
+			range->flags & VM_RW ? 'w' : '-',
+			range->flags & VM_USER ? 'u' : '-',
+			range->flags & VM_FREE ? 'p' : 's',
+			resident,
+			range->flags & VM_TFORK ? "copy" : "-",
+			range_backing(task, range));
+	}
 
+	spinlock_release(&task->vmem->lock);
 	return rsize;
 }
@@ -28,6 +28,33 @@
 #define KERNEL_STACK_PAGES 4
 #define KERNEL_STACK_SIZE PAGE_SIZE * KERNEL_STACK_PAGES
 
+struct task;
+
+/* State shared by all threads of a process. Every new process gets its own,
+ * threads created with task_clone take a reference to the one of their
+ * process.
+ */
+struct task_shared {
+	uint32_t refs;
+
+	// Threads that haven't exited yet. The files are closed once this hits 0.
+	uint32_t live;
+
+	// PID of the process, which is the one of its initial thread
+	uint32_t pid;
+
+	// All threads of the process, linked through thread_next
+	struct task* threads;
+
+	struct vm_ctx vmem;
+	void* sbrk;
+	vfs_file_t files[CONFIG_VFS_MAX_OPENFILES];
+	char cwd[VFS_PATH_MAX];
+
+	// Signals are 1-indexed, so we need one additional array entry
+	struct sigaction signal_handlers[NSIG + 1];
+};
+
 typedef struct task {
 	uint32_t pid;
 	uint16_t uid;
@@ -37,16 +64,50 @@ typedef struct task {
 
 	char name[VFS_NAME_MAX];
 	struct task* parent;
+
+	/* Children of this task, linked through their sibling pointers. Tasks are
+	 * added to their parent and the PID hash table in scheduler_add and
+	 * removed once the scheduler drops them.
+	 */
+	struct task* children;
+	struct task* sibling_next;
+	struct task* sibling_prev;
+
+	// Next task in the same PID hash bucket
+	struct task* pid_next;
+
 	struct scheduler_qentry* qentry;
-	struct vm_ctx vmem;
+
+	struct task_shared* shared;
+	struct task* thread_next;
+
+	// Point into shared, so threads of a process see the same
+	struct vm_ctx* vmem;
+	vfs_file_t* files;
+	char* cwd;
+	struct sigaction* signal_handlers;
+
 	isf_t* state;
 	void* entry;
-	void* sbrk;
+
+	// Size of the initial stack. 0 for threads, which use stacks from userland.
 	size_t stack_size;
 
 	// Kernel stack used for interrupts. This will be loaded into the TSS.
 	void* kernel_stack;
 
+	// Task side mappings of state and kernel_stack, freed when a thread exits
+	vm_alloc_t kernel_allocs[2];
+
+	// Kernel side mappings of state and kernel_stack, released in task_free
+	vm_alloc_t kernel_maps[2];
+
+	// Base of the %gs segment, used by userland for thread-local storage
+	void* tls;
+
+	// Cleared and woken as futex when the thread exits, used by pthread_join
+	uint32_t* clear_tid;
+
 	// Controlling terminal
 	struct term* ctty;
 
@@ -100,10 +161,6 @@ typedef struct task {
 	uint32_t argc;
 	uint32_t envc;
 
-	vfs_file_t files[CONFIG_VFS_MAX_OPENFILES];
-
-	// Signals are 1-indexed, so we need one additional array entry
-	struct sigaction signal_handlers[NSIG + 1];
 	uint32_t signal_mask;
 
 	struct {
@@ -117,7 +174,6 @@ typedef struct task {
 		int* stat_loc;
 	} wait_context;
 
-	char cwd[VFS_PATH_MAX];
 	char binary_path[VFS_PATH_MAX];
 
 	/* A task-specific errno variable. After a syscall return, this will be put
@@ -138,17 +194,35 @@ typedef struct task {
 
 	uint32_t sleep_until;
 
+	// Set while the task is blocked in poll() or epoll_wait()
+	struct poll_waiter* poll_waiter;
+
+	// Set while the task is blocked in futex_wait
+	struct futex_waiter* futex_waiter;
+
 	struct task* strace_observer;
 	int strace_fd;
 
 	struct sysfs_file* sysfs_file;
+	struct sysfs_file* sysfs_maps;
 } task_t;
 
+// Whether the thread is still running from the userland point of view
+static inline bool task_alive(task_t* task) {
+	return task->task_state != TASK_STATE_TERMINATED && task->task_state != TASK_STATE_ZOMBIE
+		&& task->task_state != TASK_STATE_REAPED && task->task_state != TASK_STATE_REPLACED;
+}
+
 task_t* task_new(task_t* parent, uint32_t pid, char name[VFS_NAME_MAX],
 	char** environ, uint32_t envc, char** argv, uint32_t argc);
+task_t* task_get_leader(task_t* task);
 int task_fork(task_t* to_fork, isf_t* state);
+int task_clone(task_t* task, isf_t* state, void* stack, void* tls, uint32_t* clear_tid);
 int task_execve(task_t* task, char* path, char** argv, char** env);
 int task_exit(task_t* task, int code);
+int task_thread_exit(task_t* task, int code);
+void task_terminate(task_t* task, int exit_code);
+int task_set_tls(task_t* task, void* tls);
 int task_setid(task_t* task, int which, int id);
 void task_userland_eol(task_t* t);
 void task_cleanup(task_t* t);
@@ -23,21 +23,20 @@
 #include <time.h>
 
 int task_waitpid(task_t* task, int32_t child_pid, int* stat_loc, int options) {
+	// Children belong to the process, so any of its threads can wait for them
 	if(child_pid > 0) {
 		task_t* target_task = scheduler_find(child_pid);
-		if(!target_task || target_task->parent != task) {
+		if(!target_task || !target_task->parent ||
+			target_task->parent->shared != task->shared) {
 			sc_errno = ECHILD;
 			return -1;
 		}
 	} else {
 		// Check if task has any children to wait for.
+		task_t* leader = task_get_leader(task);
 		bool have_children = false;
-		for(struct scheduler_qentry* e = task->qentry->next; e->next != task->qentry->next; e = e->next) {
-			if(!e->task) {
-				continue;
-			}
-			task_t* i = e->task;
-			if(i->parent == task && i->task_state != TASK_STATE_REPLACED &&
+		for(task_t* i = leader ? leader->children : NULL; i; i = i->sibling_next) {
+			if(i->task_state != TASK_STATE_REPLACED &&
 				i->task_state != TASK_STATE_REAPED) {
 				have_children = true;
 				break;
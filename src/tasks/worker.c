@@ -41,6 +41,7 @@ worker_t* worker_new(char* name, void* entry) {
 	}
 
 	worker->state->ds = GDT_SEG_DATA_PL0;
+	worker->state->gs = GDT_SEG_DATA_PL0;
 	worker->state->cr3 = (uint32_t)vm_pagedir(VM_KERNEL);
 	worker->state->ebp = 0;
 	worker->state->esp = (void*)worker->stack + KERNEL_STACK_SIZE - sizeof(iret_t);
@@ -57,6 +57,8 @@ static size_t ptm_write(struct vfs_callback_ctx* ctx, void* source, size_t size)
 
 static int ptm_poll(struct vfs_callback_ctx* ctx, int events) {
 	struct term* pty = (struct term*)ctx->fp->meta;
+	poll_register(ctx, &pty->ptm_buf->waitq);
+
 //	int r = events & POLLOUT;
 	int r = 0;
 	if(events & POLLIN && buffer_size(pty->ptm_buf)) {
@@ -66,6 +68,18 @@ static int ptm_poll(struct vfs_callback_ctx* ctx, int events) {
 	return r;
 }
 
+static int ptm_fork(struct vfs_callback_ctx* ctx) {
+	struct term* pty = (struct term*)ctx->fp->meta;
+	__sync_add_and_fetch(&pty->ptm_refs, 1);
+	return 0;
+}
+
+static int ptm_close(struct vfs_callback_ctx* ctx) {
+	struct term* pty = (struct term*)ctx->fp->meta;
+	__sync_sub_and_fetch(&pty->ptm_refs, 1);
+	return 0;
+}
+
 static size_t term_write_cb(struct term* term, const void* source, size_t size) {
 	return buffer_write(term->ptm_buf, source, size);
 }
@@ -91,6 +105,8 @@ static vfs_file_t* ptmx_open(struct vfs_callback_ctx* ctx, uint32_t flags) {
 		.ioctl = term_vfs_ioctl,
 		.stat = term_vfs_stat,
 		.access = sysfs_access,
+		.fork = ptm_fork,
+		.close = ptm_close,
 	};
 
 	struct vfs_callbacks pts_cb = {
@@ -124,12 +140,13 @@ static vfs_file_t* ptmx_open(struct vfs_callback_ctx* ctx, uint32_t flags) {
 	snprintf(fd1->path, 30, "/dev/ptm%d", pty->num + 1);
 	snprintf(fd2->path, 30, "/dev/pts%d", pty->num + 1);
 
-	pty->ptm_buf = buffer_new(150);
+	pty->ptm_buf = buffer_new(16);
 	if(!pty->ptm_buf) {
 		kfree(pty);
 		return NULL;
 	}
 
+	pty->ptm_refs = 1;
 	pty->ptm_fd = fd1->num;
 	pty->pts_fd = fd2->num;
 
@@ -54,9 +54,17 @@ size_t term_write(struct term* term, const char* source, size_t size) {
 		size_t i = 0;
 		for(; i < size; i++, source++) {
 			if(*source == '\n') {
-				if(term->write_cb(term, "\r\n", 2) != 2) {
+				/* Only count the newline once both characters are out. If
+				 * just the \r fit, don't write it again on the next try.
+				 */
+				const char* nl = term->cr_written ? "\n" : "\r\n";
+				size_t len = strlen(nl);
+				size_t r = term->write_cb(term, nl, len);
+				if(r != len) {
+					term->cr_written = term->cr_written || r == 1;
 					break;
 				}
+				term->cr_written = false;
 			} else {
 				if(!term->write_cb(term, source, 1)) {
 					break;
@@ -134,7 +142,38 @@ size_t term_input(struct term* term, const void* _source, size_t size) {
 
 size_t term_vfs_write(struct vfs_callback_ctx* ctx, void* source, size_t size) {
 	struct term* term = (struct term*)ctx->fp->meta;
-	return term_write(term, (char*)source, size);
+	size_t written = 0;
+
+	/* Block until the other end of a pty has caught up. Echo in term_input
+	 * doesn't do this and instead drops output if the buffer is full, as the
+	 * task on the other end of the pty might be the one writing the input.
+	 */
+	while(1) {
+		written += term_write(term, (char*)source + written, size - written);
+		if(written == size) {
+			return written;
+		}
+
+		// Nobody left to read the output of the pty
+		if(term->ptm_buf && !term->ptm_refs) {
+			if(!written) {
+				sc_errno = EIO;
+				return -1;
+			}
+			return written;
+		}
+
+		if(ctx->fp->flags & O_NONBLOCK) {
+			if(!written) {
+				sc_errno = EAGAIN;
+				return -1;
+			}
+			return written;
+		}
+
+		int_enable();
+		scheduler_yield();
+	}
 }
 
 size_t term_vfs_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
@@ -229,7 +268,7 @@ int term_vfs_ioctl(struct vfs_callback_ctx* ctx, int request, void* _arg) {
 	}
 
 	vm_alloc_t alloc;
-	void* arg = vm_map(VM_KERNEL, &alloc, &ctx->task->vmem, _arg,
+	void* arg = vm_map(VM_KERNEL, &alloc, ctx->task->vmem, _arg,
 		arg_size, VM_MAP_USER_ONLY | VM_RW);
 
 	if(!arg) {
@@ -279,6 +318,7 @@ int term_vfs_ioctl(struct vfs_callback_ctx* ctx, int request, void* _arg) {
 int term_vfs_poll(struct vfs_callback_ctx* ctx, int events) {
 	struct term* term = (struct term*)ctx->fp->meta;
 	struct buffer* buf = term->input_buf;
+	poll_register(ctx, &buf->waitq);
 
 //	int r = events & POLLOUT;
 	int r = 0;
@@ -313,7 +353,7 @@ struct term* term_new(char* name, term_write_cb_t* write_cb) {
 
 	memcpy(&term->termios.c_cc, default_c_cc, sizeof(default_c_cc));
 
-	term->input_buf = buffer_new(150);
+	term->input_buf = buffer_new(4);
 	if(!term->input_buf) {
 		kfree(term);
 		return NULL;
@@ -204,10 +204,16 @@ struct term {
     int read_done;
     term_write_cb_t* write_cb;
 
+    // Set when only the \r of an ONLCR "\r\n" fit into the output
+    bool cr_written;
+
     // PTY specific fields, unset for /dev/console
     uint32_t num;
     struct buffer* ptm_buf;
     int ptm_fd;
+
+    // Open references to the master end, writes to the slave fail without
+    volatile int ptm_refs;
 };
 
 struct term* term_new(char* name, term_write_cb_t* write_cb);